@@ -65,14 +65,10 @@ void editor_move_cursor(int key)
 			}
 		} else {
 			/* Step back a whole glyph (1 byte for ASCII, 2-4 for
-			 * UTF-8 multi-byte) by counting continuation bytes
-			 * trailing the previous start byte. */
-			int n = 1, pos = filecol - 1;
-			while (pos > 0 && row &&
-			       utf8_is_cont((unsigned char)row->chars[pos])) {
-				n++;
-				pos--;
-			}
+			 * UTF-8 multi-byte, plus any combining marks riding on
+			 * it) so the cursor always lands on a glyph start. */
+			int n = row ? filecol - utf8_prev_glyph(row->chars,
+			                                        row->size, filecol) : 1;
 			while (n--) {
 				if (editor.cx == 0) {
 					if (editor.coloff) editor.coloff--;
@@ -85,12 +81,9 @@ void editor_move_cursor(int key)
 		break;
 	case ARROW_RIGHT:
 		if (row && filecol < row->size) {
-			/* Step forward a whole glyph: 1 + however many
-			 * continuation bytes follow the current start byte. */
-			int n = 1;
-			while (filecol + n < row->size &&
-			       utf8_is_cont((unsigned char)row->chars[filecol + n]))
-				n++;
+			/* Step forward a whole glyph: its own bytes plus any
+			 * zero-width combining marks that follow it. */
+			int n = utf8_next_glyph(row->chars, row->size, filecol) - filecol;
 			while (n--) {
 				if (editor.cx == editor.screencols - 1)
 					editor.coloff++;
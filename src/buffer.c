@@ -5,21 +5,24 @@
 /* Visual column at byte offset `chars_col` in `row`.  Tabs use kg's
  * own stop convention (advance until (vcol+1) % 8 == 0) — same as the
  * render in editor_update_row and the cursor-placement loop in
- * editor_refresh_screen, so the two metrics agree.  UTF-8 continuation
- * bytes contribute zero width.  `chars_col` past row's end maps to
- * (row's visual width) plus the virtual offset, so cursors that sit
+ * editor_refresh_screen, so the two metrics agree.  Every other glyph
+ * counts its display width: two for East Asian wide characters, zero
+ * for combining marks, one otherwise.  `chars_col` past row's end maps
+ * to (row's visual width) plus the virtual offset, so cursors that sit
  * in virtual space (rect mode) get a well-defined visual column too. */
 int editor_visual_col(erow *row, int chars_col)
 {
-	int j, vcol = 0;
+	int j = 0, n, vcol = 0;
 	int limit = chars_col < row->size ? chars_col : row->size;
 
-	for (j = 0; j < limit; j++) {
+	while (j < limit) {
 		if (row->chars[j] == TAB) {
 			vcol++;
 			while ((vcol + 1) % 8 != 0) vcol++;
-		} else if (!utf8_is_cont((unsigned char)row->chars[j])) {
-			vcol++;
+			j++;
+		} else {
+			vcol += utf8_glyph_width(row->chars + j, row->size - j, &n);
+			j += n;
 		}
 	}
 	if (chars_col > row->size)
@@ -29,29 +32,32 @@ int editor_visual_col(erow *row, int chars_col)
 
 /* Inverse of editor_visual_col(): byte offset into row->chars whose
  * visual position lands at or just before `target_vcol`.  A target
- * that falls inside a tab's expansion snaps to the tab's start byte
- * (closest representable position when cx is a byte offset).  When
- * target is past the row's visual end, returns row->size plus the
+ * that falls inside a tab's expansion or a wide glyph snaps to the
+ * glyph's start byte (closest representable position when cx is a byte
+ * offset); zero-width marks stay attached to the glyph before them.
+ * When target is past the row's visual end, returns row->size plus the
  * matching virtual offset (the cursor lives in virtual space). */
 int editor_chars_col_at_visual(erow *row, int target_vcol)
 {
-	int j = 0, vcol = 0;
+	int j = 0, n = 1, vcol = 0;
 
 	while (j < row->size) {
-		int next_vcol = vcol;
+		int next_vcol;
 		if (row->chars[j] == TAB) {
 			next_vcol = vcol + 1;
 			while ((next_vcol + 1) % 8 != 0) next_vcol++;
-		} else if (!utf8_is_cont((unsigned char)row->chars[j])) {
-			next_vcol = vcol + 1;
+			n = 1;
+		} else {
+			next_vcol = vcol + utf8_glyph_width(row->chars + j,
+			                                    row->size - j, &n);
 		}
 		if (next_vcol > target_vcol) break;
 		vcol = next_vcol;
-		j++;
+		j += n;
 	}
 	/* Past-EOL only fires when we walked the whole row without hitting
-	 * target_vcol.  Breaking early means we hit a glyph (typically a
-	 * tab) whose expansion would overshoot — round down to j. */
+	 * target_vcol.  Breaking early means we hit a glyph (a tab or a
+	 * wide character) whose width would overshoot — round down to j. */
 	if (j >= row->size && vcol < target_vcol)
 		return row->size + (target_vcol - vcol);
 	return j;
@@ -133,18 +139,57 @@ void editor_reveal_position_centered(int row, int col)
 	else if (editor.cx >= editor.screencols) editor.cx = editor.screencols - 1;
 }
 
+/* The current buffer's content changed: its search index is stale. */
+static void drop_index(void)
+{
+	if (editor.index) {
+		trigram_free(editor.index);
+		editor.index = NULL;
+	}
+}
+
+/* Rows [at, numrows - after) of the current buffer may have changed
+ * since its journal last recorded them; see journal.c. */
+static void journal_touch(int at, int after)
+{
+	struct journal *j = editor.journal;
+
+	if (!j)
+		return;
+	if (at < j->lo)
+		j->lo = at;
+	if (after < j->tail)
+		j->tail = after;
+}
+
 /* Update the rendered version and the syntax highlight of a row. */
 void editor_update_row(erow *row)
 {
+	static unsigned generation;
+
 	unsigned int tabs = 0, nonprint = 0;
 	unsigned long long allocsize;
 	int j, idx;
 
+	drop_index();
+	if (row >= editor.row && row < editor.row + editor.numrows)
+		journal_touch(row - editor.row, editor.numrows - 1 - (row - editor.row));
+
 	/* Create a version of the row we can directly print on the screen,
-	 * respecting tabs, substituting non printable characters with '?'. */
-	free(row->render);
+	 * respecting tabs, substituting non printable characters with '?'.
+	 * Without TABs that is the row itself: render aliases chars, with
+	 * rsize == size, and only a row with TABs gets a copy of its own. */
+	if (row->render != row->chars)
+		free(row->render);
 	for (j = 0; j < row->size; j++)
 		if (row->chars[j] == TAB) tabs++;
+	row->gen = ++generation;
+	if (!tabs) {
+		row->render = row->chars;
+		row->rsize  = row->size;
+		editor_update_syntax(row);
+		return;
+	}
 
 	allocsize = (unsigned long long)row->size + tabs*8 + nonprint*9 + 1;
 	if (allocsize > UINT32_MAX) {
@@ -170,6 +215,63 @@ void editor_update_row(erow *row)
 	editor_update_syntax(row);
 }
 
+/* Rows' text is carved in order out of per-buffer arena blocks, so lines
+ * cost no malloc apiece, short ones are packed together with no allocator
+ * overhead between them, and the whole buffer goes with a free() per
+ * block.  A row from the arena is marked shared; the first time it has to
+ * grow it moves to a malloc of its own (editor_row_resize).
+ *
+ * Nothing carved is given back: the text of a row that grew or was
+ * deleted stays in its block as dead space until the buffer goes.  A
+ * long editing session would pile that up, so saving repacks the live
+ * rows into fresh blocks once there is more dead text than live
+ * (editor_arena_repack). */
+#define ARENA_BLOCK 65536               /* bytes per block */
+#define ARENA_MAX   (ARENA_BLOCK / 16)  /* longer rows get their own malloc */
+
+/* Carve n bytes out of the current buffer's arena, or NULL when n is too
+ * big for it or memory is out. */
+static char *arena_alloc(size_t n)
+{
+	struct row_arena *a = editor.arena;
+	char *mem;
+
+	if (n > ARENA_MAX)
+		return NULL;
+	if (!a || a->size - a->used < n) {
+		if (!(a = malloc(sizeof(*a))))
+			return NULL;
+		if (!(a->mem = malloc(ARENA_BLOCK))) {
+			free(a);
+			return NULL;
+		}
+		a->used = 0;
+		a->size = ARENA_BLOCK;
+		a->next = editor.arena;
+		editor.arena = a;
+	}
+	mem = a->mem + a->used;
+	a->used += n;
+	return mem;
+}
+
+/* Hand text, size bytes from malloc(), to the current buffer's arena for
+ * rows to share, see editor_append_text().  It goes behind the block being
+ * carved, which is left to fill up.  Returns 0, or -1 out of memory. */
+int editor_adopt_text(char *text, size_t size)
+{
+	struct row_arena *a = malloc(sizeof(*a));
+	struct row_arena **at = editor.arena ? &editor.arena->next : &editor.arena;
+
+	if (!a)
+		return -1;
+	a->mem  = text;
+	a->used = a->size = size;
+	a->next = *at;
+	*at = a;
+	return 0;
+}
+
 /* Insert a row at the specified position, shifting the other rows on the bottom
  * if required. */
 void editor_insert_row(int at, const char *s, size_t len)
@@ -185,26 +287,162 @@ void editor_insert_row(int at, const char *s, size_t len)
 	}
 
 	editor.row[at].size = len;
-	editor.row[at].chars = malloc(len+1);
-	memcpy(editor.row[at].chars, s, len+1);
+	editor.row[at].chars = arena_alloc(len+1);
+	editor.row[at].shared = editor.row[at].chars != NULL;
+	if (!editor.row[at].shared)
+		editor.row[at].chars = malloc(len+1);
+	memcpy(editor.row[at].chars, s, len);
+	editor.row[at].chars[len] = '\0';
 	editor.row[at].hl = NULL;
 	editor.row[at].hl_oc = 0;
 	editor.row[at].render = NULL;
 	editor.row[at].rsize = 0;
 	editor.row[at].idx = at;
-	editor_update_row(editor.row+at);
 	editor.numrows++;
+	editor_update_row(editor.row+at);
 	editor.dirty++;
 }
 
+/* Append the n lines of a file's text as rows, the i-th line ending just
+ * past eol[i].  The rows share text, which must be in the arena (see
+ * editor_adopt_text), instead of each getting a copy: the newline ending a
+ * line (CR LF when crlf is set) is overwritten with its NUL, and text
+ * needs one byte to spare for the last line's.  Returns 1
+ * when the last line ended in a newline, 0 when not, -1 out of memory. */
+int editor_append_text(char *text, const size_t *eol, int n, int crlf)
+{
+	size_t from = 0, len;
+	erow *rows, *row;
+	int i, nl = 0;
+
+	if (!n)
+		return 0;
+	rows = realloc(editor.row, sizeof(erow) * (editor.numrows + n));
+	if (!rows)
+		return -1;
+	editor.row = rows;
+	for (i = 0; i < n; i++) {
+		len = eol[i] - from;
+		nl  = text[from + len - 1] == '\n';
+		if (nl)
+			len -= crlf && len > 1 && text[from + len - 2] == '\r' ? 2 : 1;
+
+		row = &editor.row[editor.numrows];
+		row->idx    = editor.numrows++;
+		row->size   = len;
+		row->chars  = text + from;
+		row->chars[len] = '\0';
+		row->shared = 1;
+		row->render = NULL;
+		row->rsize  = 0;
+		row->hl     = NULL;
+		row->hl_oc  = 0;
+		editor_update_row(row);
+		from = eol[i];
+	}
+	editor.dirty += n;
+	return nl;
+}
+
 /* Free row's heap allocated stuff. */
 void editor_free_row(erow *row)
 {
-	free(row->render);
-	free(row->chars);
+	drop_index();
+	if (row->render != row->chars)
+		free(row->render);
+	if (!row->shared)
+		free(row->chars);
 	free(row->hl);
 }
 
+/* Free all of the current buffer's rows, and the arena they share. */
+void editor_free_rows(void)
+{
+	struct row_arena *a, *next;
+	int i;
+
+	for (i = 0; i < editor.numrows; i++)
+		editor_free_row(&editor.row[i]);
+	free(editor.row);
+	for (a = editor.arena; a; a = next) {
+		next = a->next;
+		free(a->mem);
+		free(a);
+	}
+	editor.row = NULL;
+	editor.arena = NULL;
+	editor.numrows = 0;
+}
+
+/* Copy the current buffer's shared rows into fresh arena blocks and free
+ * the old ones, when more of the arena is dead than live.  Out of memory
+ * the old blocks are kept on behind the new, so rows stay valid either
+ * way.  Row text doesn't change, only where it lives. */
+void editor_arena_repack(void)
+{
+	struct row_arena *old = editor.arena, *a, *next;
+	size_t used = 0, live = 0;
+	int i;
+
+	for (a = old; a; a = a->next)
+		used += a->used;
+	for (i = 0; i < editor.numrows; i++)
+		if (editor.row[i].shared)
+			live += (size_t)editor.row[i].size + 1;
+	if (used - live <= live)
+		return;
+
+	editor.arena = NULL;
+	for (i = 0; i < editor.numrows; i++) {
+		erow *row = &editor.row[i];
+		size_t n = (size_t)row->size + 1;
+		char *chars;
+
+		if (!row->shared)
+			continue;
+		if (!(chars = arena_alloc(n)) && (chars = malloc(n)))
+			row->shared = 0;
+		if (!chars) {
+			for (a = editor.arena; a && a->next; a = a->next)
+				;
+			*(a ? &a->next : &editor.arena) = old;
+			return;
+		}
+		memcpy(chars, row->chars, n);
+		if (row->render == row->chars)
+			row->render = chars;
+		row->chars = chars;
+	}
+	for (a = old; a; a = next) {
+		next = a->next;
+		free(a->mem);
+		free(a);
+	}
+}
+
+/* Make room for size bytes in row->chars, moving a row that shares the
+ * file text into a malloc of its own first.  Like realloc(), returns the
+ * new chars, or NULL with the row untouched. */
+char *editor_row_resize(erow *row, size_t size)
+{
+	int alias = row->render == row->chars;
+	char *chars;
+
+	if (!row->shared) {
+		chars = realloc(row->chars, size);
+	} else if ((chars = malloc(size))) {
+		memcpy(chars, row->chars, (size_t)row->size + 1 < size ?
+		                          (size_t)row->size + 1 : size);
+		row->shared = 0;
+	}
+	if (!chars)
+		return NULL;
+	row->chars = chars;
+	if (alias)
+		row->render = chars;   /* until editor_update_row() */
+	return chars;
+}
+
 /* Remove the row at the specified position, shifting the remaining on the top. */
 void editor_del_row(int at)
 {
@@ -217,6 +455,51 @@ void editor_del_row(int at)
 	for (int j = at; j < editor.numrows-1; j++) editor.row[j].idx--;
 	editor.numrows--;
 	editor.dirty++;
+	journal_touch(at, editor.numrows - at);
+}
+
+/* Replace the n rows at `at` with the count rows given, in one splice of
+ * the row array however many come and go.  Of each new row only chars,
+ * size and shared need be set: the text is the buffer's from now on,
+ * shared text being in the arena already (see editor_adopt_text).
+ * Returns 0, or -1 out of memory with the buffer untouched. */
+int editor_replace_rows(int at, int n, const erow *rows, int count)
+{
+	int i, grow = count - n;
+	erow *r;
+
+	if (at < 0 || n < 0 || at + n > editor.numrows)
+		return -1;
+	if (grow > 0) {
+		r = realloc(editor.row, sizeof(erow) * (editor.numrows + grow));
+		if (!r)
+			return -1;
+		editor.row = r;
+	}
+
+	for (i = at; i < at + n; i++)
+		editor_free_row(&editor.row[i]);
+	memmove(editor.row + at + count, editor.row + at + n,
+	        sizeof(erow) * (editor.numrows - at - n));
+	if (count)
+		memcpy(editor.row + at, rows, sizeof(erow) * count);
+	editor.numrows += grow;
+	if (grow)
+		for (i = at + count; i < editor.numrows; i++)
+			editor.row[i].idx = i;
+
+	for (i = at; i < at + count; i++) {
+		r = &editor.row[i];
+		r->idx    = i;
+		r->render = NULL;
+		r->rsize  = 0;
+		r->hl     = NULL;
+		r->hl_oc  = 0;
+		editor_update_row(r);
+	}
+	journal_touch(at, editor.numrows - at - count);
+	editor.dirty++;
+	return 0;
 }
 
 /* Turn the editor rows into a single heap-allocated string.
@@ -224,6 +507,13 @@ void editor_del_row(int at)
  * integer pointed by 'buflen' with the size of the string, excluding
  * the final nulterm. */
 char *editor_rows_to_string(erow *rows, int numrows, int *buflen)
+{
+	return editor_rows_to_file(rows, numrows, 0, buflen);
+}
+
+/* Like editor_rows_to_string(), but the bytes a file of these rows holds:
+ * when crlf is set, lines end in CR LF.  Returns NULL out of memory. */
+char *editor_rows_to_file(erow *rows, int numrows, int crlf, int *buflen)
 {
 	char *buf = NULL, *p;
 	int totlen = 0;
@@ -236,16 +526,21 @@ char *editor_rows_to_string(erow *rows, int numrows, int *buflen)
 	for (j = 0; j < numrows; j++)
 		totlen += rows[j].size;
 	if (numrows > 1)
-		totlen += numrows - 1;
+		totlen += (numrows - 1) * (crlf ? 2 : 1);
 	*buflen = totlen;
 	totlen++; /* Also make space for nulterm */
 
 	p = buf = malloc(totlen);
+	if (!buf)
+		return NULL;
 	for (j = 0; j < numrows; j++) {
 		memcpy(p, rows[j].chars, rows[j].size);
 		p += rows[j].size;
-		if (j != numrows - 1)
+		if (j != numrows - 1) {
+			if (crlf)
+				*p++ = '\r';
 			*p++ = '\n';
+		}
 	}
 	*p = '\0';
 	return buf;
@@ -260,14 +555,14 @@ void editor_row_insert_char(erow *row, int at, int c)
 		 * current length by more than a single character. */
 		int padlen = at - row->size;
 		/* In the next line +2 means: new char and null term. */
-		row->chars = realloc(row->chars, row->size+padlen+2);
+		editor_row_resize(row, row->size+padlen+2);
 		memset(row->chars+row->size, ' ', padlen);
 		row->chars[row->size+padlen+1] = '\0';
 		row->size += padlen+1;
 	} else {
 		/* If we are in the middle of the string just make space for 1 new
 		 * char plus the (already existing) null term. */
-		row->chars = realloc(row->chars, row->size+2);
+		editor_row_resize(row, row->size+2);
 		memmove(row->chars+at+1, row->chars+at, row->size-at+1);
 		row->size++;
 	}
@@ -277,9 +572,9 @@ void editor_row_insert_char(erow *row, int at, int c)
 }
 
 /* Append the string 's' at the end of a row */
-void editor_row_append_string(erow *row, char *s, size_t len)
+void editor_row_append_string(erow *row, const char *s, size_t len)
 {
-	row->chars = realloc(row->chars, row->size+len+1);
+	editor_row_resize(row, row->size+len+1);
 	memcpy(row->chars+row->size, s, len);
 	row->size += len;
 	row->chars[row->size] = '\0';
@@ -287,6 +582,25 @@ void editor_row_append_string(erow *row, char *s, size_t len)
 	editor.dirty++;
 }
 
+/* Replace the whole content of a row with s[0..len), re-rendering it once. */
+void editor_row_set_chars(erow *row, const char *s, size_t len)
+{
+	char *chars = malloc(len + 1);
+
+	if (!chars) return;
+	memcpy(chars, s, len);
+	chars[len] = '\0';
+	if (row->render == row->chars)
+		row->render = chars;   /* until editor_update_row() */
+	if (!row->shared)
+		free(row->chars);
+	row->chars  = chars;
+	row->shared = 0;
+	row->size   = len;
+	editor_update_row(row);
+	editor.dirty++;
+}
+
 /* Delete the character at offset 'at' from the specified row. */
 void editor_row_del_char(erow *row, int at)
 {
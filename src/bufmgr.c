@@ -1,6 +1,7 @@
 /* ========================= Buffer management ============================== */
 
 #include "def.h"
+#include <pthread.h>
 
 /* Synthetic syntax records for special modes. */
 static struct editor_syntax ibuffer_syntax = {
@@ -17,7 +18,8 @@ static struct editor_syntax text_syntax = {
 #define IBUF_NAME "*Buffer List*"
 #define HELP_NAME "*help*"
 
-struct editor_buffer buflist[MAX_BUFFERS];
+struct editor_buffer *buflist;
+int buf_slots   = 0;
 int buf_current = 0;
 int buf_count   = 0;
 
@@ -25,6 +27,268 @@ int buf_count   = 0;
 
 static void silent_revert_current(void);
 
+/* ---- Buffer lookup index ----
+ *
+ * A file is found among the buffers three ways: by canonical path, so
+ * "./foo" and "/home/u/foo" are the same buffer; by inode, so is a hard
+ * link to it; and by basename, for the picker and uniquified names.
+ * Each key is hashed into one chained table, the chains threaded through
+ * the buffer slots themselves (ix_next), so a lookup costs the same with
+ * five buffers or five hundred.
+ *
+ * A slot is indexed when its state is saved, and again whenever the file
+ * name or inode it was indexed under has changed since: a save-as, or a
+ * save that renamed a new file into place. */
+enum { KEY_PATH, KEY_INODE, KEY_BASE };
+
+static int *bucket;             /* first key in chain: slot * BUF_KEYS + kind */
+static unsigned nbuckets;       /* power of two, or 0 */
+
+static uint32_t buf_hash_bytes(uint32_t h, const void *p, size_t len)
+{
+	const unsigned char *s = p;
+
+	while (len--)
+		h = (h ^ *s++) * 16777619u;     /* FNV-1a */
+	return h;
+}
+
+static uint32_t buf_hash_str(const char *s)
+{
+	return buf_hash_bytes(2166136261u, s, strlen(s));
+}
+
+static uint32_t buf_hash_inode(dev_t dev, ino_t ino)
+{
+	return buf_hash_bytes(buf_hash_bytes(2166136261u, &dev, sizeof(dev)),
+	                      &ino, sizeof(ino));
+}
+
+static void buf_key_add(int slot, int kind, uint32_t h)
+{
+	int *head = &bucket[h & (nbuckets - 1)];
+
+	buflist[slot].ix_hash[kind] = h;
+	buflist[slot].ix_next[kind] = *head;
+	*head = slot * BUF_KEYS + kind;
+}
+
+static void buf_key_del(int slot, int kind)
+{
+	int key = slot * BUF_KEYS + kind;
+	int *p = &bucket[buflist[slot].ix_hash[kind] & (nbuckets - 1)];
+
+	while (*p >= 0 && *p != key)
+		p = &buflist[*p / BUF_KEYS].ix_next[*p % BUF_KEYS];
+	if (*p == key)
+		*p = buflist[slot].ix_next[kind];
+}
+
+/* Hash slot's keys into the table, as recorded in its ix_ fields. */
+static void buf_keys_add(int slot)
+{
+	struct editor_buffer *b = &buflist[slot];
+
+	if (!b->ix_name)
+		return;
+	buf_key_add(slot, KEY_PATH, buf_hash_str(b->ix_canon));
+	buf_key_add(slot, KEY_BASE, buf_hash_str(buf_basename(b->ix_name)));
+	if (b->ix_ino)
+		buf_key_add(slot, KEY_INODE, buf_hash_inode(b->ix_dev, b->ix_ino));
+}
+
+/* Take slot out of the index. */
+static void buf_unindex(int slot)
+{
+	struct editor_buffer *b = &buflist[slot];
+
+	if (!b->ix_name)
+		return;
+	buf_key_del(slot, KEY_PATH);
+	buf_key_del(slot, KEY_BASE);
+	if (b->ix_ino)
+		buf_key_del(slot, KEY_INODE);
+	free(b->ix_name);
+	free(b->ix_canon);
+	b->ix_name = b->ix_canon = NULL;
+	b->ix_ino = 0;
+}
+
+/* Canonical form of a file name: the real path of an existing file, or
+ * of its directory for a file not written yet.  Special buffers' names
+ * are their own canonical form.  *dev and *ino get the file's inode, or
+ * 0 when there's no such file. */
+static char *buf_canonical(const char *name, dev_t *dev, ino_t *ino)
+{
+	char real[PATH_MAX], dir[PATH_MAX], *slash;
+	struct stat st;
+
+	*dev = 0;
+	*ino = 0;
+	if (is_special_buffer(name))
+		return strdup(name);
+	if (stat(name, &st) == 0) {
+		*dev = st.st_dev;
+		*ino = st.st_ino;
+	}
+	if (realpath(name, real))
+		return strdup(real);
+
+	slash = strrchr(name, '/');
+	if (!slash)
+		snprintf(dir, sizeof(dir), ".");
+	else if (slash == name)
+		snprintf(dir, sizeof(dir), "/");
+	else
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - name), name);
+	if (realpath(dir, real) &&
+	    strlen(real) + strlen(buf_basename(name)) + 2 <= sizeof(real)) {
+		if (strcmp(real, "/"))
+			strcat(real, "/");
+		strcat(real, buf_basename(name));
+		return strdup(real);
+	}
+	return strdup(name);
+}
+
+/* (Re-)index slot under file name, whose inode was last seen as ino,
+ * unless it already is. */
+static void buf_index(int slot, const char *name, ino_t ino)
+{
+	struct editor_buffer *b = &buflist[slot];
+
+	if (b->ix_name && name && !strcmp(b->ix_name, name) &&
+	    (is_special_buffer(name) || b->ix_ino == ino))
+		return;
+	if (!b->ix_name && !name)
+		return;
+	buf_unindex(slot);
+	if (!name || !(b->ix_name = strdup(name)))
+		return;
+	if (!(b->ix_canon = buf_canonical(name, &b->ix_dev, &b->ix_ino))) {
+		free(b->ix_name);
+		b->ix_name = NULL;
+		return;
+	}
+	buf_keys_add(slot);
+}
+
+/* The current buffer's slot lags its live state; catch its index up
+ * before a lookup. */
+static void buf_index_sync(void)
+{
+	if (buf_current < buf_slots && buflist[buf_current].active)
+		buf_index(buf_current, editor.filename, editor.disk_ino);
+}
+
+/* Make room for at least want buffer slots.  Returns 0, or -1 when out
+ * of memory. */
+static int buf_grow(int want)
+{
+	struct editor_buffer *nb;
+	unsigned nbk = nbuckets ? nbuckets : 16;
+	int *bk, n = buf_slots ? buf_slots : 8, i;
+
+	if (want <= buf_slots)
+		return 0;
+	while (n < want)
+		n *= 2;
+	while (nbk < (unsigned)n * 2)
+		nbk *= 2;
+	if (!(nb = realloc(buflist, n * sizeof(*nb))))
+		return -1;
+	buflist = nb;
+	memset(buflist + buf_slots, 0, (n - buf_slots) * sizeof(*nb));
+	if (nbk != nbuckets) {
+		if (!(bk = malloc(nbk * sizeof(*bk))))
+			return -1;
+		free(bucket);
+		bucket = bk;
+		nbuckets = nbk;
+		for (i = 0; i < (int)nbk; i++)
+			bucket[i] = -1;
+		for (i = 0; i < buf_slots; i++)
+			buf_keys_add(i);
+	}
+	buf_slots = n;
+	return 0;
+}
+
+/* An unused buffer slot, growing the table when all are taken.  Returns
+ * -1 when out of memory. */
+static int buf_free_slot(void)
+{
+	int i;
+
+	for (i = 0; i < buf_slots; i++)
+		if (!buflist[i].active)
+			return i;
+	return buf_grow(buf_slots + 1) < 0 ? -1 : i;
+}
+
+/* A slot other than skip holding a key of kind that hashes to h and
+ * satisfies match(slot, arg), or -1 when there's none. */
+static int buf_lookup(int kind, uint32_t h, int (*match)(int, const void *),
+                      const void *arg, int skip)
+{
+	int key;
+
+	if (!nbuckets)
+		return -1;
+	for (key = bucket[h & (nbuckets - 1)]; key >= 0;
+	     key = buflist[key / BUF_KEYS].ix_next[key % BUF_KEYS]) {
+		int slot = key / BUF_KEYS;
+
+		if (key % BUF_KEYS == kind && slot != skip &&
+		    buflist[slot].ix_hash[kind] == h && match(slot, arg))
+			return slot;
+	}
+	return -1;
+}
+
+static int match_canon(int slot, const void *canon)
+{
+	return !strcmp(buflist[slot].ix_canon, canon);
+}
+
+static int match_base(int slot, const void *base)
+{
+	return !strcmp(buf_basename(buflist[slot].ix_name), base);
+}
+
+static int match_inode(int slot, const void *st)
+{
+	const struct stat *s = st;
+
+	return buflist[slot].ix_dev == s->st_dev &&
+	       buflist[slot].ix_ino == s->st_ino;
+}
+
+/* Slot of the buffer visiting path, under whatever name it was opened,
+ * or -1 when there's none. */
+int buf_find_file(const char *path)
+{
+	struct stat st;
+	char *canon;
+	int slot;
+
+	buf_index_sync();
+	if (!(canon = buf_canonical(path, &st.st_dev, &st.st_ino)))
+		return -1;
+	slot = buf_lookup(KEY_PATH, buf_hash_str(canon), match_canon, canon, -1);
+	if (slot < 0 && st.st_ino)
+		slot = buf_lookup(KEY_INODE, buf_hash_inode(st.st_dev, st.st_ino),
+		                  match_inode, &st, -1);
+	free(canon);
+	return slot;
+}
+
+/* Whether the current buffer reloads itself when its file changes. */
+static int autorevert_wanted(void)
+{
+	return editor.auto_revert || editor.follow || global_auto_revert;
+}
+
 /* Save live editor state (and global undostack) into buflist[idx]. */
 static void buf_save_to_slot(int idx)
 {
@@ -34,6 +298,8 @@ static void buf_save_to_slot(int idx)
 	b->rowoff = editor.rowoff;   b->coloff = editor.coloff;
 	b->numrows = editor.numrows;
 	b->row = editor.row;
+	b->arena = editor.arena;
+	b->crlf = editor.crlf;
 	b->dirty = editor.dirty;
 	b->filename = editor.filename;
 	b->syntax = editor.syntax;
@@ -46,11 +312,17 @@ static void buf_save_to_slot(int idx)
 	b->readonly = editor.readonly;
 	b->disk_mtime = editor.disk_mtime;
 	b->disk_size = editor.disk_size;
+	b->disk_ino = editor.disk_ino;
+	b->disk_tail = editor.disk_tail;
 	b->disk_changed = editor.disk_changed;
 	b->auto_revert = editor.auto_revert;
+	b->follow = editor.follow;
 	b->backed_up = editor.backed_up;
 	b->fill_column = editor.fill_column;
+	b->index = editor.index;
+	b->journal = editor.journal;
 	b->active = 1;
+	buf_index(idx, editor.filename, editor.disk_ino);
 }
 
 /* Restore buflist[idx] into live editor state (and global undostack). */
@@ -62,6 +334,8 @@ static void buf_restore_from_slot(int idx)
 	editor.rowoff = b->rowoff;   editor.coloff = b->coloff;
 	editor.numrows = b->numrows;
 	editor.row = b->row;
+	editor.arena = b->arena;
+	editor.crlf = b->crlf;
 	editor.dirty = b->dirty;
 	editor.filename = b->filename;
 	editor.syntax = b->syntax;
@@ -74,10 +348,15 @@ static void buf_restore_from_slot(int idx)
 	editor.readonly = b->readonly;
 	editor.disk_mtime = b->disk_mtime;
 	editor.disk_size = b->disk_size;
+	editor.disk_ino = b->disk_ino;
+	editor.disk_tail = b->disk_tail;
 	editor.disk_changed = b->disk_changed;
 	editor.auto_revert = b->auto_revert;
+	editor.follow = b->follow;
 	editor.backed_up = b->backed_up;
 	editor.fill_column = b->fill_column;
+	editor.index = b->index;
+	editor.journal = b->journal;
 	buf_current = idx;
 	/* Keep the active window pointing at the newly-restored buffer. */
 	if (win_count > 0)
@@ -86,8 +365,7 @@ static void buf_restore_from_slot(int idx)
 	/* If this buffer was flagged stale while it sat in its slot, reload
 	 * it now — but only when the user has opted in and there are no
 	 * unsaved edits to lose. */
-	if (editor.disk_changed && !editor.dirty &&
-	    (editor.auto_revert || global_auto_revert))
+	if (editor.disk_changed && !editor.dirty && autorevert_wanted())
 		silent_revert_current();
 }
 
@@ -144,13 +422,8 @@ static void clamp_cursor_to_buffer(void)
 void buf_reload_from_disk(void)
 {
 	char *fname;
-	int i;
 
-	for (i = 0; i < editor.numrows; i++)
-		editor_free_row(&editor.row[i]);
-	free(editor.row);
-	editor.row = NULL;
-	editor.numrows = 0;
+	editor_free_rows();
 	editor.mark_set = 0;
 	editor.mark_highlight = 0;
 	editor.shift_select = 0;
@@ -173,7 +446,8 @@ void buf_reload_from_disk(void)
 
 /* Auto-revert path: reload the buffer from disk and try to keep the user's
  * viewport intact (rather than recentering on the cursor as an explicit
- * M-x revert-buffer would).  Never called against a dirty buffer. */
+ * M-x revert-buffer would).  A followed file that only grew just gets the
+ * new lines added.  Never called against a dirty buffer. */
 static void silent_revert_current(void)
 {
 	int saved_cx = editor.cx;
@@ -181,6 +455,11 @@ static void silent_revert_current(void)
 	int saved_rowoff = editor.rowoff;
 	int saved_coloff = editor.coloff;
 
+	if (editor_follow_disk() == 0) {
+		clamp_cursor_to_buffer();
+		buf_save_to_slot(buf_current);
+		return;
+	}
 	buf_reload_from_disk();
 
 	editor.cx = saved_cx;
@@ -194,10 +473,83 @@ static void silent_revert_current(void)
 	                          buf_basename(editor.filename));
 }
 
-/* Walk every active buffer, stat its underlying file, and update the
- * disk_changed flag when the mtime or size disagrees with our last seen
- * snapshot.  Cheap on a local FS; we still rate-limit to keep network
- * stat() latency from compounding across keystrokes.
+/* File name behind buffer slot i, or NULL for an unused slot or one
+ * with no file on disk to compare against. */
+static const char *autorevert_file(int i)
+{
+	const char *fname;
+
+	if (!buflist[i].active) return NULL;
+	fname = (i == buf_current) ? editor.filename : buflist[i].filename;
+	if (is_special_buffer(fname)) return NULL;
+	return fname;
+}
+
+/* Stat buffer slot i's file and update its disk_changed flag when the
+ * mtime or size disagrees with our last seen snapshot, silently reverting
+ * the current buffer when the user has opted in.  Returns 1 when that
+ * changed anything visible. */
+static int autorevert_check(int i)
+{
+	struct editor_buffer *b = &buflist[i];
+	const char *fname = autorevert_file(i);
+	int *flag;
+	time_t snap_mtime;
+	off_t snap_size;
+	int new_changed, refresh_needed = 0;
+
+	if (!fname) return 0;
+	if (save_pending(fname)) return 0;  /* our own write; see save_poll() */
+
+	if (i == buf_current) {
+		flag       = &editor.disk_changed;
+		snap_mtime = editor.disk_mtime;
+		snap_size  = editor.disk_size;
+	} else {
+		flag       = &b->disk_changed;
+		snap_mtime = b->disk_mtime;
+		snap_size  = b->disk_size;
+	}
+
+	new_changed = file_state_differs(fname, snap_mtime, snap_size);
+	if (new_changed != *flag) {
+		*flag = new_changed;
+		refresh_needed = 1;
+	}
+	if (i == buf_current && new_changed && !editor.dirty &&
+	    autorevert_wanted()) {
+		silent_revert_current();
+		refresh_needed = 1;
+	}
+	return refresh_needed;
+}
+
+/* Keep a change watch on every buffer's file.  Returns 1 when all of
+ * them are covered, so nothing needs polling; 0 when some file (or the
+ * whole platform) has to fall back to the timed stat() scan. */
+static int autorevert_watch(void)
+{
+	int i, covered = 1;
+
+	for (i = 0; i < buf_slots; i++)
+		if (watch_set(i, autorevert_file(i)) < 0)
+			covered = 0;
+	return covered;
+}
+
+/* Descriptor that becomes readable when a buffer's file changes on disk,
+ * for the idle read to wait on along with the terminal.  -1 when some
+ * file isn't watched and autorevert_poll() must run on a timer instead. */
+int autorevert_fd(void)
+{
+	return autorevert_watch() ? watch_fd() : -1;
+}
+
+/* Notice buffers whose file changed on disk.  With every file watched
+ * this only looks at the ones a notification named, so an idle editor
+ * costs nothing; otherwise walk every buffer and stat its file, rate-
+ * limited to keep network stat() latency from compounding across
+ * keystrokes.
  *
  * Returns 1 if anything visible changed (a flag transitioned, or a buffer
  * was silently reverted) and the screen wants a redraw.  Returns 0 when
@@ -205,48 +557,52 @@ static void silent_revert_current(void)
 int autorevert_poll(void)
 {
 	static time_t last_poll;
-	time_t now = time(NULL);
+	static char *changed;
+	static int nchanged;
 	int refresh_needed = 0;
+	time_t now;
 	int i;
 
-	if (now - last_poll < AUTOREVERT_POLL_INTERVAL_SEC) return 0;
-	last_poll = now;
-
-	for (i = 0; i < MAX_BUFFERS; i++) {
-		struct editor_buffer *b = &buflist[i];
-		const char *fname;
-		int *flag;
-		time_t snap_mtime;
-		off_t snap_size;
-		int new_changed;
+	if (nchanged < buf_slots) {
+		char *p = realloc(changed, buf_slots);
 
-		if (!b->active) continue;
-
-		fname = (i == buf_current) ? editor.filename : b->filename;
-		if (is_special_buffer(fname)) continue;
+		if (!p) return 0;
+		changed  = p;
+		nchanged = buf_slots;
+	}
+	if (autorevert_watch()) {
+		if (!watch_read(changed, buf_slots)) return 0;
+		for (i = 0; i < buf_slots; i++)
+			if (changed[i] && autorevert_check(i))
+				refresh_needed = 1;
+		return refresh_needed;
+	}
 
-		if (i == buf_current) {
-			flag       = &editor.disk_changed;
-			snap_mtime = editor.disk_mtime;
-			snap_size  = editor.disk_size;
-		} else {
-			flag       = &b->disk_changed;
-			snap_mtime = b->disk_mtime;
-			snap_size  = b->disk_size;
-		}
+	now = time(NULL);
+	if (now - last_poll < AUTOREVERT_POLL_INTERVAL_SEC) return 0;
+	last_poll = now;
 
-		new_changed = file_state_differs(fname, snap_mtime, snap_size);
-		if (new_changed != *flag) {
-			*flag = new_changed;
+	for (i = 0; i < buf_slots; i++)
+		if (autorevert_check(i))
 			refresh_needed = 1;
-		}
-		if (i == buf_current && new_changed && !editor.dirty &&
-		    (editor.auto_revert || global_auto_revert)) {
+	return refresh_needed;
+}
+
+/* Toggle auto-revert-tail on the current buffer: like auto-revert, but a
+ * file that only grows (a log) gets just its new lines read in, and point
+ * on the last line follows them.  Turning it on catches up right away. */
+void buf_follow_mode(void)
+{
+	editor.follow = !editor.follow;
+	if (editor.follow) {
+		if (editor.disk_changed && !editor.dirty)
 			silent_revert_current();
-			refresh_needed = 1;
-		}
+		else if (!editor.disk_changed)
+			editor_snapshot_disk();
 	}
-	return refresh_needed;
+	editor_set_status_message("Auto-revert-tail for %s is %s",
+	                          buf_basename(editor.filename),
+	                          editor.follow ? "on" : "off");
 }
 
 /* Reset editor to a clean empty state and initialise a fresh undo stack.
@@ -257,6 +613,8 @@ static void buf_reset(void)
 	editor.rowoff = editor.coloff = 0;
 	editor.numrows = 0;
 	editor.row = NULL;
+	editor.arena = NULL;
+	editor.crlf = 0;
 	editor.dirty = 0;
 	editor.filename = NULL;
 	editor.syntax = NULL;
@@ -272,10 +630,15 @@ static void buf_reset(void)
 	editor.readonly = 0;
 	editor.disk_mtime = 0;
 	editor.disk_size = 0;
+	editor.disk_ino = 0;
+	editor.disk_tail = 0;
 	editor.disk_changed = 0;
 	editor.auto_revert = 0;
+	editor.follow = 0;
 	editor.backed_up = 0;
 	editor.fill_column = DEFAULT_FILL_COLUMN;
+	editor.index = NULL;
+	editor.journal = NULL;
 	undo_init();
 }
 
@@ -305,17 +668,12 @@ void buf_display_name(int idx, char *out, size_t outsize)
 	const char *path = b->filename;
 	const char *base = buf_basename(path);
 	const char *parent_end, *parent_start;
-	int parent_len, i, dup = 0;
+	int parent_len, dup = 0;
 
 	if (path) {
-		for (i = 0; i < MAX_BUFFERS; i++) {
-			if (i == idx || !buflist[i].active || !buflist[i].filename)
-				continue;
-			if (strcmp(buf_basename(buflist[i].filename), base) == 0) {
-				dup = 1;
-				break;
-			}
-		}
+		buf_index_sync();
+		dup = buf_lookup(KEY_BASE, buf_hash_str(base), match_base, base,
+		                 idx) >= 0;
 	}
 
 	if (!dup) {
@@ -490,14 +848,8 @@ void editor_msg_appendf(char *msg, int size, int *off, const char *fmt, ...)
  * Emacs identifies "the same file" across distinct prompt paths. */
 static int file_open_in_buflist(const char *name)
 {
-	int i;
-
-	for (i = 0; i < MAX_BUFFERS; i++) {
-		if (buflist[i].active && buflist[i].filename &&
-		    strcmp(buf_basename(buflist[i].filename), name) == 0)
-			return 1;
-	}
-	return 0;
+	buf_index_sync();
+	return buf_lookup(KEY_BASE, buf_hash_str(name), match_base, name, -1) >= 0;
 }
 
 /* Stable-partition entries[0..n) so files already open in a buffer
@@ -726,45 +1078,250 @@ int editor_read_line_path(int fd, const char *prompt, char *buf, int bufsize)
 	}
 }
 
+/* ---- Loading the command-line files ----
+ *
+ * The files named on the command line are read and split into lines by
+ * the worker pool, all at once, so a handful of files on a slow disk
+ * take as long as the largest rather than the sum.  Only turning them
+ * into buffers happens on the UI thread: the first is waited for, so kg
+ * starts on it, and the rest are added from the idle loop as they come
+ * in, in command-line order.
+ *
+ * Only regular files go to the pool.  A FIFO or a device can take
+ * forever to read, and the pool would stay busy all that time, leaving
+ * grep-project and friends without it; those are read one after another
+ * on a thread of their own instead. */
+
+struct load_file {
+	char *name;
+	int line, col;              /* from a +LINE:COL before it, or 0 */
+	struct file_text text;
+	int special;                /* not a regular file */
+	int async;                  /* read by a thread, not load_ready() */
+	int done;                   /* read, under load->lock */
+};
+
+static struct load_job {
+	pthread_mutex_t lock;
+	pthread_cond_t  ready;      /* some file is done */
+	struct load_file *file;
+	int nfiles;
+	int next;                   /* first file not made a buffer yet */
+	int readonly;
+	int *task;                  /* file of each pool task */
+	pthread_t reader;           /* reads the special files */
+	int reading;                /* reader was started */
+} *load;
+
+static void load_read(struct load_job *job, struct load_file *f)
+{
+	file_text_read(f->name, &f->text);
+	pthread_mutex_lock(&job->lock);
+	f->done = 1;
+	pthread_cond_broadcast(&job->ready);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void load_task(void *arg, int task, int worker)
+{
+	struct load_job *job = arg;
+
+	(void)worker;
+	load_read(job, &job->file[job->task[task]]);
+}
+
+static void *load_reader(void *arg)
+{
+	struct load_job *job = arg;
+	int i;
+
+	for (i = 0; i < job->nfiles; i++) {
+		if (job->file[i].special && job->file[i].async)
+			load_read(job, &job->file[i]);
+	}
+	return NULL;
+}
+
+/* Hand the files to the pool and the reader thread, where there is
+ * more than one; whatever they can't take is read by load_ready(). */
+static void load_start(void)
+{
+	sigset_t all, old;
+	struct stat st;
+	int i, ntasks = 0, nspecial = 0;
+
+	if (load->nfiles < 2 || !(load->task = malloc(load->nfiles *
+	                                             sizeof(*load->task))))
+		return;
+	for (i = 0; i < load->nfiles; i++) {
+		struct load_file *f = &load->file[i];
+
+		if (stat(f->name, &st) == 0 && !S_ISREG(st.st_mode))
+			f->special = 1, nspecial++;
+		else
+			load->task[ntasks++] = i;
+	}
+
+	if (nspecial) {
+		/* Like the pool's workers, leave signals to the UI thread */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		for (i = 0; i < load->nfiles; i++)
+			load->file[i].async = load->file[i].special;
+		if (pthread_create(&load->reader, NULL, load_reader, load) == 0)
+			load->reading = 1;
+		else
+			for (i = 0; i < load->nfiles; i++)
+				load->file[i].async = 0;
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+	if (ntasks) {
+		for (i = 0; i < ntasks; i++)
+			load->file[load->task[i]].async = 1;
+		if (pool_start(load_task, load, ntasks) < 0)
+			for (i = 0; i < ntasks; i++)
+				load->file[load->task[i]].async = 0;
+	}
+}
+
+/* Whether file i has been read; with wait set, wait until it is. */
+static int load_ready(int i, int wait)
+{
+	struct load_file *f = &load->file[i];
+	int done;
+
+	if (!f->async) {
+		if (!f->done)
+			file_text_read(f->name, &f->text);
+		return f->done = 1;
+	}
+	pthread_mutex_lock(&load->lock);
+	while (wait && !f->done)
+		pthread_cond_wait(&load->ready, &load->lock);
+	done = f->done;
+	pthread_mutex_unlock(&load->lock);
+	return done;
+}
+
+/* Make loaded file f a buffer, leaving the current one current; the
+ * first buffer becomes current itself.  A file already open, named
+ * twice or visited meanwhile, keeps its buffer.  Returns -1 when the
+ * file can't be read, with errno set. */
+static int load_install(struct load_file *f)
+{
+	int slot, prev = buf_count ? buf_current : -1;
+
+	if (prev >= 0 && buf_find_file(f->name) >= 0)
+		return 0;
+	if (f->text.err && f->text.err != ENOENT) {
+		errno = f->text.err;
+		return -1;
+	}
+	if ((slot = buf_free_slot()) < 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (prev >= 0)
+		buf_save_current_state();
+	buf_reset();
+	editor.readonly = load->readonly;
+	editor_select_syntax_highlight(f->name);
+	editor_open_text(f->name, &f->text);
+	file_text_free(&f->text);
+	if (f->line > 0)
+		editor_goto_line_direct(f->line, f->col);
+	buf_save_to_slot(slot);
+	buf_count++;
+	buf_restore_from_slot(prev >= 0 ? prev : slot);
+	return 0;
+}
+
+/* Add the files read since last time as buffers, in command-line order,
+ * and free the job once they all are.  Called from the idle loop.
+ * Returns 1 when the screen wants a redraw. */
+int buf_load_poll(void)
+{
+	int refresh = 0;
+
+	if (!load)
+		return 0;
+	while (load->next < load->nfiles && load_ready(load->next, 0)) {
+		struct load_file *f = &load->file[load->next++];
+
+		if (load_install(f) < 0) {
+			editor_set_status_message("Can't open %s: %s", f->name,
+			                          strerror(errno));
+			file_text_free(&f->text);
+		}
+		refresh = 1;
+	}
+	if (load->next == load->nfiles) {
+		if (load->reading)
+			pthread_join(load->reader, NULL);
+		pthread_mutex_destroy(&load->lock);
+		pthread_cond_destroy(&load->ready);
+		free(load->file);
+		free(load->task);
+		free(load);
+		load = NULL;
+	}
+	return refresh;
+}
+
+/* Whether command-line files are still being read, for the idle loop
+ * to keep polling. */
+int buf_loading(void)
+{
+	return load != NULL;
+}
+
 /* Load all command-line files into the buffer list, then start in buffer 0.
  * Called once from main() after init_editor().
  * Arguments of the form +LINE or +LINE:COL position the next file. */
 void buf_load_args(int nfiles, char **filenames, int readonly)
 {
-	int i, slot = 0;
+	int i, n = 0;
 	int pending_line = 0, pending_col = 1;
 
-	memset(buflist, 0, sizeof(buflist));
 	buf_current = 0;
 	buf_count = 0;
-
-	if (nfiles == 0) {
-		/* No files given: open an empty *scratch* buffer. */
-		buf_new_scratch(0);
-		return;
+	if (buf_grow(nfiles > 0 ? nfiles : 1) < 0 ||
+	    !(load = calloc(1, sizeof(*load))) ||
+	    (nfiles && !(load->file = calloc(nfiles, sizeof(*load->file))))) {
+		fprintf(stderr, "kg: out of memory\n");
+		exit(1);
 	}
 
-	for (i = 0; i < nfiles && slot < MAX_BUFFERS; i++) {
+	for (i = 0; i < nfiles; i++) {
 		if (filenames[i][0] == '+') {
 			/* Position specifier: +LINE or +LINE:COL */
 			pending_line = 0; pending_col = 1;
 			sscanf(filenames[i] + 1, "%d:%d", &pending_line, &pending_col);
 			continue;
 		}
-		buf_reset();
-		editor.readonly = readonly;
-		editor_select_syntax_highlight(filenames[i]);
-		editor_open(filenames[i]);
-		if (pending_line > 0) {
-			editor_goto_line_direct(pending_line, pending_col);
-			pending_line = 0; pending_col = 1;
+		load->file[n].name = filenames[i];
+		load->file[n].line = pending_line;
+		load->file[n].col  = pending_col;
+		pending_line = 0; pending_col = 1;
+		n++;
+	}
+	load->nfiles   = n;
+	load->readonly = readonly;
+	pthread_mutex_init(&load->lock, NULL);
+	pthread_cond_init(&load->ready, NULL);
+	load_start();
+
+	/* Start on the first file, taking along whatever else is ready;
+	 * without the pool that is all of them. */
+	for (i = 0; load->next < n && load_ready(load->next, i == 0); i++) {
+		if (load_install(&load->file[load->next++]) < 0) {
+			perror("Opening file");
+			exit(1);
 		}
-		buf_save_to_slot(slot);
-		buflist[slot].active = 1;
-		buf_count++;
-		slot++;
 	}
-	buf_restore_from_slot(0);
+	buf_load_poll();
+	if (n == 0)
+		buf_new_scratch(0);     /* no files given */
 }
 
 /* Interactive buffer selector shown in the echo area (C-x b).
@@ -776,172 +1333,187 @@ void buf_select_interactive(int fd)
 {
 	const char prompt[] = "Buffer: ";
 	const int  plen     = sizeof(prompt) - 1;
-	int order[MAX_BUFFERS], n = 0;
+	int *order, *match_idx, n = 0;
+	char (*namebuf)[128];
+	const char **names;
 	char query[64];
-	int qlen = 0, sel = 0;
+	int qlen = 0, sel = 0, done = 0;
 	int i, c;
 	char msg[512];
 	int off;
 
 	query[0] = '\0';
 
+	order     = malloc(buf_count * sizeof(*order));
+	match_idx = malloc(buf_count * sizeof(*match_idx));
+	namebuf   = malloc(buf_count * sizeof(*namebuf));
+	names     = malloc(buf_count * sizeof(*names));
+	if (!order || !match_idx || !namebuf || !names) {
+		editor_set_status_message("Out of memory");
+		done = 1;
+	}
+
 	/* Build ring starting from the buffer after current (most natural default). */
-	for (i = 1; i <= MAX_BUFFERS; i++) {
-		int idx = (buf_current + i) % MAX_BUFFERS;
+	for (i = 1; !done && i <= buf_slots; i++) {
+		int idx = (buf_current + i) % buf_slots;
 		if (buflist[idx].active) order[n++] = idx;
 	}
-	if (n == 0) {
+	if (!done && n == 0) {
 		editor_set_status_message("No other buffers.");
-		return;
+		done = 1;
 	}
 
-	{
-		static char namebuf[MAX_BUFFERS][128];
-		const char *names[MAX_BUFFERS];
-		int match_idx[MAX_BUFFERS];
+	while (!done) {
+		int matches = 0;
 
-		while (1) {
-			int matches = 0;
-
-			/* Cache every candidate's display name once per redraw,
-			 * then build the filtered view as prefix matches followed
-			 * by mid-name matches. */
-			for (i = 0; i < n; i++)
-				buf_display_name(order[i], namebuf[i], sizeof(namebuf[i]));
+		/* Cache every candidate's display name once per redraw,
+		 * then build the filtered view as prefix matches followed
+		 * by mid-name matches. */
+		for (i = 0; i < n; i++)
+			buf_display_name(order[i], namebuf[i], sizeof(namebuf[i]));
 
+		for (i = 0; i < n; i++) {
+			if (editor_picker_match_rank(namebuf[i], query) != 0)
+				continue;
+			names[matches]     = namebuf[i];
+			match_idx[matches] = order[i];
+			matches++;
+		}
+		if (qlen > 0) {
 			for (i = 0; i < n; i++) {
-				if (editor_picker_match_rank(namebuf[i], query) != 0)
+				if (editor_picker_match_rank(namebuf[i], query) != 1)
 					continue;
 				names[matches]     = namebuf[i];
 				match_idx[matches] = order[i];
 				matches++;
 			}
-			if (qlen > 0) {
-				for (i = 0; i < n; i++) {
-					if (editor_picker_match_rank(namebuf[i], query) != 1)
-						continue;
-					names[matches]     = namebuf[i];
-					match_idx[matches] = order[i];
-					matches++;
-				}
-			}
-			if (sel >= matches) sel = matches > 0 ? matches - 1 : 0;
+		}
+		if (sel >= matches) sel = matches > 0 ? matches - 1 : 0;
 
-			off = 0;
-			editor_msg_appendf(msg, sizeof(msg), &off, "%s%s ", prompt, query);
-			editor_picker_render(msg, sizeof(msg), &off, names, matches, matches, sel);
-			editor_set_status_message("%s", msg);
-			editor.echo_cursor_col = plen + qlen + 1;
-			editor_refresh_screen();
+		off = 0;
+		editor_msg_appendf(msg, sizeof(msg), &off, "%s%s ", prompt, query);
+		editor_picker_render(msg, sizeof(msg), &off, names, matches, matches, sel);
+		editor_set_status_message("%s", msg);
+		editor.echo_cursor_col = plen + qlen + 1;
+		editor_refresh_screen();
 
-			c = editor_read_key(fd);
-			if (c == DEL_KEY || c == CTRL_H || c == BACKSPACE) {
-				if (qlen > 0) query[--qlen] = '\0';
-				sel = 0;
-			} else if (c == ARROW_RIGHT || c == CTRL_F) {
-				if (matches > 0) sel = (sel + 1) % matches;
-			} else if (c == ARROW_LEFT || c == CTRL_B) {
-				if (matches > 0) sel = (sel - 1 + matches) % matches;
-			} else if (c == ENTER) {
-				editor.echo_cursor_col = 0;
-				editor_set_status_message("");
-				if (matches > 0) {
-					buf_save_current_state();
-					buf_restore_from_slot(match_idx[sel]);
-				}
-				return;
-			} else if (c == ESC || c == CTRL_G) {
-				editor.echo_cursor_col = 0;
-				editor_set_status_message("");
-				return;
-			} else if (isprint(c) && qlen < (int)sizeof(query) - 1) {
-				query[qlen++] = c;
-				query[qlen]   = '\0';
-				sel = 0;
+		c = editor_read_key(fd);
+		if (c == DEL_KEY || c == CTRL_H || c == BACKSPACE) {
+			if (qlen > 0) query[--qlen] = '\0';
+			sel = 0;
+		} else if (c == ARROW_RIGHT || c == CTRL_F) {
+			if (matches > 0) sel = (sel + 1) % matches;
+		} else if (c == ARROW_LEFT || c == CTRL_B) {
+			if (matches > 0) sel = (sel - 1 + matches) % matches;
+		} else if (c == ENTER) {
+			editor.echo_cursor_col = 0;
+			editor_set_status_message("");
+			if (matches > 0) {
+				buf_save_current_state();
+				buf_restore_from_slot(match_idx[sel]);
 			}
+			done = 1;
+		} else if (c == ESC || c == CTRL_G) {
+			editor.echo_cursor_col = 0;
+			editor_set_status_message("");
+			done = 1;
+		} else if (isprint(c) && qlen < (int)sizeof(query) - 1) {
+			query[qlen++] = c;
+			query[qlen]   = '\0';
+			sel = 0;
 		}
 	}
+	free(order);
+	free(match_idx);
+	free(namebuf);
+	free(names);
 }
 
-/* Open a file in a new buffer, prompting for the filename.  If the file is
- * already open in an existing buffer, switch to it instead.
- * readonly: if 1, mark the buffer read-only after loading. */
-static void buf_open_file_ro(int fd, int readonly)
+/* Make the file at path the current buffer: switch to it if it is
+ * already open, under this name or another, otherwise load it into a new
+ * buffer, read-only if readonly is set.  Returns 0, or -1 when out of
+ * memory. */
+int buf_visit_file(char *path, int readonly)
 {
-	char query[256];
-	int i, slot;
-	const char *prompt = readonly ? "Open file read-only: " : "Open file: ";
-
-	editor_prompt_prefill_dir(query, sizeof(query));
-	if (editor_read_line_path(fd, prompt, query, sizeof(query)) < 0 || query[0] == '\0')
-		return;
+	int slot = buf_find_file(path);
 
 	/* Switch to existing buffer if the file is already open. */
-	for (i = 0; i < MAX_BUFFERS; i++) {
-		if (buflist[i].active && buflist[i].filename &&
-		    strcmp(buflist[i].filename, query) == 0) {
-			buf_save_current_state();
-			buf_restore_from_slot(i);
-			editor_set_status_message("%s", editor.filename);
-			return;
-		}
-	}
-
-	if (buf_count >= MAX_BUFFERS) {
-		editor_set_status_message("Too many open buffers (%d max).", MAX_BUFFERS);
-		return;
+	if (slot >= 0) {
+		buf_save_current_state();
+		buf_restore_from_slot(slot);
+		editor_set_status_message("%s", editor.filename);
+		return 0;
 	}
 
-	/* Find a free slot. */
-	slot = -1;
-	for (i = 0; i < MAX_BUFFERS; i++) {
-		if (!buflist[i].active) { slot = i; break; }
+	if ((slot = buf_free_slot()) < 0) {
+		editor_set_status_message("Out of memory");
+		return -1;
 	}
-	if (slot < 0) return; /* should not happen given buf_count check above */
 
 	buf_save_current_state();
 	buf_reset();
 	editor.readonly = readonly;
-	editor_select_syntax_highlight(query);
-	editor_open(query);
+	editor_select_syntax_highlight(path);
+	editor_open(path);
 	buf_save_to_slot(slot);
 	buf_restore_from_slot(slot);
 	buf_count++;
 	editor_set_status_message("%s%s", editor.filename ? editor.filename : "[new]",
 		editor.readonly ? " [read-only]" : "");
+	return 0;
+}
+
+/* Open a file in a new buffer, prompting for the filename.  If the file is
+ * already open in an existing buffer, switch to it instead.
+ * readonly: if 1, mark the buffer read-only after loading. */
+static void buf_open_file_ro(int fd, int readonly)
+{
+	char query[256];
+	const char *prompt = readonly ? "Open file read-only: " : "Open file: ";
+
+	editor_prompt_prefill_dir(query, sizeof(query));
+	if (editor_read_line_path(fd, prompt, query, sizeof(query)) < 0 || query[0] == '\0')
+		return;
+	buf_visit_file(query, readonly);
 }
 
 void buf_open_file(int fd)     { buf_open_file_ro(fd, 0); }
 void buf_open_file_read_only(int fd) { buf_open_file_ro(fd, 1); }
 
 /* Save a buffer slot to its file without switching to it, through the same
- * atomic write and backup as editor_save so that C-x s and C-x C-s keep a
- * file equally safe.  require-final-newline is applied to the bytes here:
- * the slot's rows aren't the live buffer, so they can't be re-highlighted.
- * Returns 0 on success, 1 on error. */
-static int write_slot(struct editor_buffer *b)
+ * background writer and backup as editor_save so that C-x s and C-x C-s
+ * keep a file equally safe.  require-final-newline is applied to the bytes
+ * here: the slot's rows aren't the live buffer, so they can't be
+ * re-highlighted.  Returns 0 once queued, 1 on error. */
+static int write_slot(int i)
 {
+	struct editor_buffer *b = &buflist[i];
 	char *buf, *nl;
 	int len;
 
-	buf = editor_rows_to_string(b->row, b->numrows, &len);
+	buf = editor_rows_to_file(b->row, b->numrows, b->crlf, &len);
+	if (!buf) return 1;
 	if (require_final_newline && len > 0 && buf[len-1] != '\n') {
-		nl = realloc(buf, len + 1);
+		nl = realloc(buf, len + 2);
 		if (!nl) { free(buf); return 1; }
 		buf = nl;
+		if (b->crlf)
+			buf[len++] = '\r';
 		buf[len++] = '\n';
 	}
-	if (write_file_atomic(b->filename, buf, len,
-	                      make_backup_files && !b->backed_up) == -1) {
-		free(buf);
+	if (save_start(i, b->filename, buf, len,
+	               make_backup_files && !b->backed_up,
+	               &b->undostack, b->dirty) == -1)
 		return 1;
-	}
-	free(buf);
 	b->backed_up = 1;
+	if (i == buf_current)
+		editor.backed_up = 1;
+	journal_saved(i);
 	return 0;
 }
 
 /* Save all modified non-special buffers, prompting for each (C-x s).
+ * The writes finish in the background, see save_poll().
  * Returns 1 if the user aborted the pass with C-g, else 0. */
 int buf_save_all(int fd)
 {
@@ -949,12 +1521,13 @@ int buf_save_all(int fd)
 
 	buf_save_to_slot(buf_current); /* flush current edits into slot */
 
-	for (i = 0; i < MAX_BUFFERS; i++) {
+	for (i = 0; i < buf_slots; i++) {
 		struct editor_buffer *b = &buflist[i];
 		int answer;
 
 		if (!b->active || !b->dirty) continue;
 		if (is_special_buffer(b->filename)) continue;
+		if (save_covers(i, &b->undostack, b->dirty)) continue;
 
 		editor_set_status_message("Save %s? (y/n) ", b->filename);
 		editor_refresh_screen();
@@ -965,19 +1538,10 @@ int buf_save_all(int fd)
 		}
 		if (answer != 'y' && answer != 'Y') continue;
 
-		if (write_slot(b) == 0) {
-			b->dirty = 0;
-			if (i == buf_current) {
-				editor.dirty = 0;
-				editor.backed_up = b->backed_up;
-				editor_snapshot_disk();
-				undo_mark_clean();
-			}
-			editor_set_status_message("Wrote %s", b->filename);
-		} else {
-			editor_set_status_message("Error writing %s: %s",
-				b->filename, strerror(errno));
-		}
+		if (write_slot(i) == 0)
+			editor_set_status_message("Saving %s...", b->filename);
+		else
+			editor_set_status_message("Out of memory");
 	}
 	return 0;
 }
@@ -987,6 +1551,8 @@ void buf_kill(int fd)
 {
 	int i;
 
+	if (editor.dirty && save_pending(editor.filename))
+		save_wait();        /* it may be clean once that lands */
 	if (editor.dirty) {
 		int answer;
 		editor_set_status_message("Buffer modified, really kill? (y/n) ");
@@ -999,15 +1565,17 @@ void buf_kill(int fd)
 	}
 
 	/* Free current buffer's memory. */
-	for (i = 0; i < editor.numrows; i++)
-		editor_free_row(&editor.row[i]);
-	free(editor.row);
+	editor_free_rows();
 	free(editor.filename);
 	undo_free();
+	journal_free(editor.journal);
+	editor.journal = NULL;
 
+	buf_unindex(buf_current);
 	buflist[buf_current].active = 0;
 	buflist[buf_current].row = NULL;
 	buflist[buf_current].filename = NULL;
+	buflist[buf_current].journal = NULL;
 	buf_count--;
 
 	if (buf_count == 0) {
@@ -1019,7 +1587,7 @@ void buf_kill(int fd)
 	}
 
 	/* Switch to the nearest remaining buffer. */
-	for (i = 0; i < MAX_BUFFERS; i++) {
+	for (i = 0; i < buf_slots; i++) {
 		if (buflist[i].active) { buf_restore_from_slot(i); break; }
 	}
 	editor_set_status_message("%s", editor.filename ? editor.filename : "[new]");
@@ -1028,23 +1596,14 @@ void buf_kill(int fd)
 /* Set up the special buffer named `name`: save the outgoing state,
  * find or allocate its slot, clear any prior content, run `populate`
  * to fill rows, then mark the buffer read-only, attach `syn`, and
- * post `status`.  Shared by buf_open_list and buf_open_help. */
-static void buf_open_special(const char *name, struct editor_syntax *syn,
+ * post `status`.  Shared by buf_open_list, buf_open_help and occur. */
+void buf_open_special(const char *name, struct editor_syntax *syn,
                              void (*populate)(void), const char *status)
 {
-	int i, slot = -1, existing = -1;
+	int slot = -1, existing;
 
 	buf_save_current_state();
-
-	for (i = 0; i < MAX_BUFFERS; i++) {
-		if (!buflist[i].active) {
-			if (slot < 0) slot = i;
-			continue;
-		}
-		if (buflist[i].filename &&
-		    strcmp(buflist[i].filename, name) == 0)
-			existing = i;
-	}
+	existing = buf_find_file(name);
 
 	if (existing >= 0) {
 		buf_restore_from_slot(existing);
@@ -1054,19 +1613,16 @@ static void buf_open_special(const char *name, struct editor_syntax *syn,
 		 * attached below. */
 		editor.syntax = NULL;
 	} else {
-		if (buf_count >= MAX_BUFFERS) {
-			editor_set_status_message("Too many open buffers (%d max).", MAX_BUFFERS);
+		if ((slot = buf_free_slot()) < 0) {
+			editor_set_status_message("Out of memory");
 			return;
 		}
-		if (slot < 0) return;
 		buf_reset();
 		editor.filename = strdup(name);
 	}
 
-	for (i = 0; i < editor.numrows; i++) editor_free_row(&editor.row[i]);
-	free(editor.row);
-	editor.row = NULL;
-	editor.numrows = 0;
+	editor_free_rows();
+	editor.crlf = 0;
 
 	populate();
 
@@ -1100,7 +1656,7 @@ static void buf_list_populate(void)
 		"------", "------", "----", "----");
 	editor_insert_row(editor.numrows, line, len);
 
-	for (i = 0; i < MAX_BUFFERS; i++) {
+	for (i = 0; i < buf_slots; i++) {
 		struct editor_buffer *b = &buflist[i];
 		if (!b->active) continue;
 
@@ -1145,6 +1701,15 @@ void buf_open_help(void)
 	                 "Press q to exit help.");
 }
 
+/* Make buflist[idx] the current buffer in the active window. */
+void buf_switch_to(int idx)
+{
+	if (idx < 0 || idx >= buf_slots || !buflist[idx].active)
+		return;
+	buf_save_current_state();
+	buf_restore_from_slot(idx);
+}
+
 /* Open the buffer named on the current IBuffer line.
  * Line format: " M  <24-char name>  <6-char size>  <14-char mode>  <filename>"
  * The full filename starts at byte offset 54. */
@@ -1162,14 +1727,10 @@ void buf_ibuffer_select(void)
 	if (!filename[0]) return;
 	if (strcmp(filename, IBUF_NAME) == 0) return; /* don't recurse */
 
-	for (i = 0; i < MAX_BUFFERS; i++) {
-		if (!buflist[i].active || !buflist[i].filename) continue;
-		if (strcmp(buflist[i].filename, filename) == 0) {
-			buf_save_current_state();
-			buf_restore_from_slot(i);
-			editor_set_status_message("%s", editor.filename ? editor.filename : "[new]");
-			return;
-		}
+	if ((i = buf_find_file(filename)) >= 0) {
+		buf_switch_to(i);
+		editor_set_status_message("%s", editor.filename ? editor.filename : "[new]");
+		return;
 	}
 	editor_set_status_message("Buffer not found: %s", filename);
 }
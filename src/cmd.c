@@ -109,6 +109,12 @@ static void cmd_revert_buffer(int fd)
 	editor_set_status_message("Reverted %s", editor.filename);
 }
 
+/* Bring back the edits in the current file's recovery journal. */
+static void cmd_recover_file(int fd)
+{
+	editor_recover_file(fd);
+}
+
 /* Join the current line with the previous one (M-^). */
 static void cmd_join_line(int fd)
 {
@@ -124,9 +130,11 @@ static void cmd_capitalize_word(int fd){ (void)fd; editor_capitalize_word(); }
 /* Set the current buffer's fill column, prompting for the value (C-x f). */
 static void cmd_set_fill_column(int fd)         { editor_set_fill_column(fd);          }
 
-/* Shell command (M-!) and shell-command-on-region (M-|). */
+/* Shell command (M-!), shell-command-on-region (M-|) and
+ * async-shell-command (M-&). */
 static void cmd_shell_command(int fd)           { editor_shell_command(fd);            }
 static void cmd_shell_command_on_region(int fd) { editor_shell_command_on_region(fd);  }
+static void cmd_async_shell_command(int fd)     { editor_async_shell_command(fd);      }
 
 /* Toggle auto-revert on the current buffer.  When on (or when the global
  * setting below is on), a clean buffer whose underlying file has changed on
@@ -140,6 +148,13 @@ static void cmd_auto_revert_mode(int fd)
 	                          editor.auto_revert ? "on" : "off");
 }
 
+/* Toggle auto-revert-tail, following a growing file, on the current buffer. */
+static void cmd_auto_revert_tail_mode(int fd)
+{
+	(void)fd;
+	buf_follow_mode();
+}
+
 /* Toggle auto-revert for every buffer at once. */
 static void cmd_global_auto_revert_mode(int fd)
 {
@@ -167,6 +182,26 @@ static void cmd_require_final_newline(int fd)
 	                          require_final_newline ? "on" : "off");
 }
 
+/* Toggle the line-number gutter in every window. */
+static void cmd_display_line_numbers_mode(int fd)
+{
+	(void)fd;
+	display_line_numbers = display_line_numbers == LINE_NUMBERS_ABSOLUTE
+		? LINE_NUMBERS_OFF : LINE_NUMBERS_ABSOLUTE;
+	editor_set_status_message("Line numbers are %s",
+	                          display_line_numbers ? "on" : "off");
+}
+
+/* Toggle line numbers counted from the cursor's line. */
+static void cmd_relative_line_numbers_mode(int fd)
+{
+	(void)fd;
+	display_line_numbers = display_line_numbers == LINE_NUMBERS_RELATIVE
+		? LINE_NUMBERS_OFF : LINE_NUMBERS_RELATIVE;
+	editor_set_status_message("Relative line numbers are %s",
+	                          display_line_numbers ? "on" : "off");
+}
+
 /* Remove trailing whitespace from every line in the buffer. */
 static void cmd_whitespace_cleanup(int fd)
 {
@@ -221,6 +256,15 @@ static void cmd_delete_horizontal_space(int fd) { (void)fd; editor_delete_horizo
 static void cmd_just_one_space(int fd)          { (void)fd; editor_just_one_space(); }
 static void cmd_zap_to_char(int fd)             { editor_zap_to_char(fd); }
 
+/* Regexp variants of C-s, C-r and M-%.  C-M-% has no terminal encoding,
+ * so query-replace-regexp is only reachable through M-x. */
+static void cmd_isearch_forward_regexp(int fd)  { editor_find(fd, 1, 1); }
+static void cmd_isearch_backward_regexp(int fd) { editor_find(fd, -1, 1); }
+static void cmd_query_replace_regexp(int fd)    { editor_query_replace(fd, 1); }
+static void cmd_occur(int fd)                   { editor_occur(fd); }
+static void cmd_grep_project(int fd)            { editor_grep_project(fd); }
+static void cmd_find_file_in_project(int fd)    { editor_find_file_in_project(fd); }
+
 /* ---- Command table ---- */
 
 typedef void (*cmdfn)(int fd);
@@ -237,22 +281,33 @@ struct named_cmd {
 };
 
 static const struct named_cmd cmdtable[] = {
+	{ "async-shell-command",      cmd_async_shell_command,     CMD_NONE },
 	{ "auto-revert-mode",         cmd_auto_revert_mode,        CMD_NONE },
+	{ "auto-revert-tail-mode",    cmd_auto_revert_tail_mode,   CMD_NONE },
 	{ "balance-windows",          cmd_balance_windows,         CMD_NONE },
 	{ "capitalize-word",          cmd_capitalize_word,         CMD_EDITS_BUFFER },
 	{ "delete-horizontal-space",  cmd_delete_horizontal_space, CMD_EDITS_BUFFER },
 	{ "delete-trailing-space",    cmd_delete_trailing_space,   CMD_EDITS_BUFFER },
+	{ "display-line-numbers-mode", cmd_display_line_numbers_mode, CMD_NONE },
 	{ "downcase-word",            cmd_downcase_word,           CMD_EDITS_BUFFER },
 	{ "enlarge-window",           cmd_enlarge_window,          CMD_NONE },
 	{ "enlarge-window-horizontally", cmd_enlarge_window_h,     CMD_NONE },
+	{ "find-file-in-project",     cmd_find_file_in_project,    CMD_NONE },
 	{ "global-auto-revert-mode",  cmd_global_auto_revert_mode, CMD_NONE },
 	{ "goto-line",                cmd_goto_line,               CMD_NONE },
+	{ "grep-project",             cmd_grep_project,            CMD_NONE },
+	{ "isearch-backward-regexp",  cmd_isearch_backward_regexp, CMD_NONE },
+	{ "isearch-forward-regexp",   cmd_isearch_forward_regexp,  CMD_NONE },
 	{ "join-line",                cmd_join_line,               CMD_EDITS_BUFFER },
 	{ "just-one-space",           cmd_just_one_space,          CMD_EDITS_BUFFER },
 	{ "make-backup-files",        cmd_make_backup_files,       CMD_NONE },
 	{ "mark-paragraph",           cmd_mark_paragraph,          CMD_NONE },
 	{ "not-modified",             cmd_not_modified,            CMD_NONE },
+	{ "occur",                    cmd_occur,                   CMD_NONE },
+	{ "query-replace-regexp",     cmd_query_replace_regexp,    CMD_EDITS_BUFFER },
 	{ "read-only-mode",           cmd_toggle_read_only,        CMD_NONE },
+	{ "recover-file",             cmd_recover_file,            CMD_NONE },
+	{ "relative-line-numbers-mode", cmd_relative_line_numbers_mode, CMD_NONE },
 	{ "require-final-newline",    cmd_require_final_newline,   CMD_NONE },
 	{ "revert-buffer",            cmd_revert_buffer,           CMD_NONE },
 	{ "save-buffer",              cmd_save_buffer,             CMD_NONE },
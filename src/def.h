@@ -99,6 +99,7 @@ enum KEY_ACTION {
 	CTRL_G = 7,         /* Ctrl-g */
 	CTRL_H = 8,         /* Ctrl-h */
 	TAB = 9,            /* Tab */
+	CTRL_J = 10,        /* Ctrl-j */
 	CTRL_K = 11,        /* Ctrl-k */
 	CTRL_L = 12,        /* Ctrl+l */
 	ENTER = 13,         /* Enter */
@@ -169,6 +170,8 @@ enum KEY_ACTION {
 	ALT_Q,
 	ALT_BACKSPACE,
 	ALT_PCT,       /* M-% query-replace */
+	ALT_CTRL_S,    /* C-M-s isearch-forward-regexp */
+	ALT_CTRL_R,    /* C-M-r isearch-backward-regexp */
 	ALT_SEMICOLON, /* M-; comment-dwim */
 	ALT_X,         /* M-x named command */
 	ALT_CARET,     /* M-^ join-line */
@@ -177,6 +180,7 @@ enum KEY_ACTION {
 	ALT_C,         /* M-c capitalize-word */
 	ALT_BANG,      /* M-! shell-command */
 	ALT_PIPE,      /* M-| shell-command-on-region */
+	ALT_AMP,       /* M-& async-shell-command */
 	ALT_LT,        /* M-< beginning-of-buffer */
 	ALT_GT,        /* M-> end-of-buffer */
 	ALT_LBRACE,    /* M-{ backward paragraph */
@@ -226,11 +230,48 @@ typedef struct erow {
 	int rsize;          /* Size of the rendered row. */
 	char *chars;        /* Row content. */
 	char *render;       /* Row content "rendered" for screen (for TABs). */
-	unsigned char *hl;  /* Syntax highlight type for each character in render.*/
+	unsigned char *hl;  /* Syntax highlight type for each character in render,
+	                       NULL when the buffer has no syntax (all normal). */
 	int hl_oc;          /* Row had open comment at end in last syntax highlight
 	                       check. */
+	unsigned gen;       /* Bumped, unique across rows, whenever render is
+	                       rebuilt; keys caches derived from the content. */
+	int shared;         /* chars is carved from the buffer's row arena, not
+	                       a malloc of its own; see buffer.c. */
 } erow;
 
+/* A block of a buffer's row arena, see buffer.c. */
+struct row_arena {
+	struct row_arena *next;
+	char *mem;
+	size_t used, size;
+};
+
+/* A buffer's crash-recovery journal, see journal.c.  Rows before lo and
+ * the last tail rows are as the journal last recorded them. */
+struct journal {
+	char *path;          /* #file# beside the file */
+	int lo, tail;        /* both INT_MAX when nothing changed since */
+	int base;            /* numrows when last recorded, -1 when unknown */
+	int created;         /* the file was started this visit */
+	int trunc;           /* next write starts it afresh */
+	int failed;          /* a write failed: stop until unmodified again */
+	int held;            /* #file# is a crash's: keep records in memory */
+	char *pend;          /* records not yet handed to the writer */
+	size_t len, cap;
+	size_t last;         /* offset in pend of the last record, or -1 */
+	int last_lo, last_old, last_new;
+	time_t written;      /* when pend was last handed over */
+};
+
+/* What a write queued with save_journal() does to the journal file. */
+enum journal_op {
+	JOURNAL_NONE,        /* not a journal write: a save */
+	JOURNAL_CREATE,
+	JOURNAL_APPEND,
+	JOURNAL_REMOVE,
+};
+
 /* Highlight color */
 typedef struct hl_color {
 	int r, g, b;
@@ -247,6 +288,8 @@ typedef struct hl_color {
 #define KG_SHOW_TILDE 1
 #endif
 
+struct trigram_index;
+
 /* Editor configuration state */
 struct editor_config {
 	int cx, cy;         /* Cursor x and y position in characters */
@@ -257,6 +300,8 @@ struct editor_config {
 	int numrows;        /* Number of rows */
 	int rawmode;        /* Is terminal raw mode enabled? */
 	erow *row;          /* Rows */
+	struct row_arena *arena; /* Where rows' text is carved from. */
+	int crlf;           /* Lines end in CR LF on disk, and are saved so. */
 	int dirty;          /* File modified but not saved. */
 	char *filename;     /* Currently open filename */
 	char statusmsg[512];
@@ -284,10 +329,15 @@ struct editor_config {
 	int window_line_state; /* Cycle state for M-r: 0=top, 1=middle, 2=bottom. */
 	time_t disk_mtime;  /* mtime of `filename` when we last read/wrote it. */
 	off_t disk_size;    /* size of `filename` when we last read/wrote it. */
+	ino_t disk_ino;     /* inode of `filename` then, to tell a new file apart. */
+	uint32_t disk_tail; /* checksum of the bytes before disk_size; see fileio.c */
 	int disk_changed;   /* Set by the auto-revert poll when disk differs. */
 	int auto_revert;    /* Per-buffer auto-revert toggle. */
+	int follow;         /* auto-revert-tail: read only what was appended. */
 	int backed_up;      /* 1 once a foo~ backup was made this visit. */
 	int fill_column;    /* Column M-q reflows to; set with C-x f. */
+	struct trigram_index *index; /* Search index, or NULL; see trigram.c */
+	struct journal *journal; /* Recovery journal, or NULL; see journal.c */
 };
 
 /* Append buffer for efficient screen rendering */
@@ -313,7 +363,8 @@ enum undo_type {
 	UNDO_KILL_TEXT,   /* Kill line or region */
 	UNDO_YANK_TEXT,   /* Yank (paste) */
 	UNDO_REFLOW_PARA, /* M-q paragraph reflow */
-	UNDO_RECT_OVERWRITE  /* Rectangle kill/delete/clear/yank: restore rows */
+	UNDO_RECT_OVERWRITE, /* Rectangle kill/delete/clear/yank: restore rows */
+	UNDO_REPLACE_ROWS    /* M-| filter: swap the original rows back in */
 };
 
 /* Single undo operation */
@@ -333,6 +384,24 @@ struct undo_stack {
 	int size;
 	int max_size;
 	int clean_size;  /* Stack size at last save (-1 if never saved clean) */
+	unsigned long seq; /* Changes with every push and undo, never repeats */
+};
+
+/* A compiled substring-search pattern, see match.c. */
+struct needle {
+	unsigned char *pat;  /* Pattern, case-folded when fold is set */
+	int len;
+	int fold;            /* ASCII case-insensitive */
+	int rare;            /* Index of the memchr() prefilter byte, or -1 */
+	int fwd[256];        /* Horspool shifts, left-to-right scan */
+	int bwd[256];        /* Horspool shifts, right-to-left scan */
+};
+
+/* Line-number gutter modes (display_line_numbers). */
+enum {
+	LINE_NUMBERS_OFF = 0,
+	LINE_NUMBERS_ABSOLUTE,
+	LINE_NUMBERS_RELATIVE,
 };
 
 /* Per-window viewport state. */
@@ -347,13 +416,17 @@ struct editor_window {
 	int active;         /* 1 if this slot is in use */
 };
 
-/* Per-buffer state saved when switching away from a buffer. */
-#define MAX_BUFFERS 20
+/* Per-buffer state saved when switching away from a buffer.  The table of
+ * these grows as buffers are opened: buf_slots entries, of which buf_count
+ * are active. */
+#define BUF_KEYS 3          /* ways a buffer is looked up, see bufmgr.c */
 struct editor_buffer {
 	int cx, cy;
 	int rowoff, coloff;
 	int numrows;
 	erow *row;
+	struct row_arena *arena;
+	int crlf;
 	int dirty;
 	char *filename;
 	struct editor_syntax *syntax;
@@ -367,10 +440,23 @@ struct editor_buffer {
 	int readonly;               /* 1 if buffer is read-only */
 	time_t disk_mtime;
 	off_t disk_size;
+	ino_t disk_ino;
+	uint32_t disk_tail;
 	int disk_changed;
 	int auto_revert;
+	int follow;
 	int backed_up;
 	int fill_column;
+	struct trigram_index *index;
+	struct journal *journal;
+
+	/* Owned by the buffer lookup index in bufmgr.c. */
+	char *ix_name;              /* file name as indexed */
+	char *ix_canon;             /* its canonical path */
+	dev_t ix_dev;
+	ino_t ix_ino;               /* 0 when there's no file on disk */
+	uint32_t ix_hash[BUF_KEYS];
+	int ix_next[BUF_KEYS];      /* next key in the hash chain, -1 ends it */
 };
 
 /* Global editor state */
@@ -379,12 +465,14 @@ extern int running;
 extern int suppress_undo;
 extern struct kill_ring killring;
 extern struct undo_stack undostack;
-extern struct editor_buffer buflist[MAX_BUFFERS];
+extern struct editor_buffer *buflist;
+extern int buf_slots;   /* size of buflist[] */
 extern int buf_current; /* index into buflist[] of the active buffer */
 extern int buf_count;   /* number of active buffers */
 extern int global_auto_revert; /* Default auto-revert flag for all buffers. */
 extern int make_backup_files;  /* Write a foo~ backup on first save of a visit. */
 extern int require_final_newline; /* Ensure the file ends with a newline on save. */
+extern int display_line_numbers;  /* LINE_NUMBERS_* gutter mode, all windows. */
 
 extern struct editor_window winlist[MAX_WINDOWS];
 extern int win_current;     /* index into winlist[] of the active window */
@@ -404,6 +492,8 @@ void editor_picker_render(char *msg, int msg_size, int *off,
 void editor_msg_appendf(char *msg, int size, int *off, const char *fmt, ...)
 	__attribute__((format(printf, 4, 5)));
 int  autorevert_poll(void);
+int  autorevert_fd(void);
+void buf_follow_mode(void);
 void buf_reload_from_disk(void);
 
 /* path.c */
@@ -417,7 +507,11 @@ int  editor_path_complete_entries(const char *dir, const char *prefix,
                                   struct path_entry *entries, int max,
                                   char *lcp, int lcp_size);
 int  editor_picker_match_rank(const char *haystack, const char *needle);
+int  editor_path_walk(const char *dir, const char *const *skip,
+                      int (*fn)(const char *path, void *arg), void *arg);
 void buf_load_args(int nfiles, char **filenames, int readonly);
+int  buf_load_poll(void);
+int  buf_loading(void);
 void buf_select_interactive(int fd);
 void buf_open_file(int fd);
 void buf_open_file_read_only(int fd);
@@ -426,6 +520,11 @@ int buf_save_all(int fd);
 void buf_open_list(void);
 void buf_open_help(void);
 void buf_ibuffer_select(void);
+void buf_open_special(const char *name, struct editor_syntax *syn,
+                      void (*populate)(void), const char *status);
+void buf_switch_to(int idx);
+int  buf_visit_file(char *path, int readonly);
+int  buf_find_file(const char *path);
 void buf_display_name(int idx, char *out, size_t outsize);
 
 /* winmgr.c */
@@ -466,11 +565,19 @@ int  chars_to_render_col(erow *row, int chars_col);
 /* buffer.c */
 void editor_update_row(erow *row);
 void editor_insert_row(int at, const char *s, size_t len);
+int  editor_adopt_text(char *text, size_t size);
+int  editor_append_text(char *text, const size_t *eol, int n, int crlf);
 void editor_free_row(erow *row);
+void editor_free_rows(void);
+void editor_arena_repack(void);
+char *editor_row_resize(erow *row, size_t size);
 void editor_del_row(int at);
+int  editor_replace_rows(int at, int n, const erow *rows, int count);
 char *editor_rows_to_string(erow *rows, int numrows, int *buflen);
+char *editor_rows_to_file(erow *rows, int numrows, int crlf, int *buflen);
 void editor_row_insert_char(erow *row, int at, int c);
-void editor_row_append_string(erow *row, char *s, size_t len);
+void editor_row_append_string(erow *row, const char *s, size_t len);
+void editor_row_set_chars(erow *row, const char *s, size_t len);
 void editor_row_del_char(erow *row, int at);
 int  editor_readonly_blocked(void);
 void editor_insert_char(int c);
@@ -488,6 +595,14 @@ static inline int is_special_buffer(const char *filename)
 	return !filename || filename[0] == '*';
 }
 
+/* Returns 1 for the name of a recovery journal, #file#; see journal.c. */
+static inline int is_journal_name(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 2 && name[0] == '#' && name[len - 1] == '#';
+}
+
 /* True for UTF-8 continuation bytes (0x80–0xBF).  Useful when iterating
  * a raw byte stream and needing to skip past or land on glyph boundaries. */
 static inline int utf8_is_cont(unsigned char b)
@@ -495,6 +610,25 @@ static inline int utf8_is_cont(unsigned char b)
 	return (b & 0xC0) == 0x80;
 }
 
+/* utf8.c */
+int utf8_cp_width(int cp);
+int utf8_decode(const char *s, int len, int *cp);
+int utf8_glyph_width_mb(const char *s, int len, int *bytes);
+int utf8_next_glyph(const char *s, int len, int pos);
+int utf8_prev_glyph(const char *s, int len, int pos);
+
+/* Display columns taken by the glyph at s (len > 0 bytes available);
+ * its byte length goes to *bytes.  ASCII stays on this inline path and
+ * never touches the width table.  Tabs are the caller's business. */
+static inline int utf8_glyph_width(const char *s, int len, int *bytes)
+{
+	if ((unsigned char)s[0] < 0x80) {
+		*bytes = 1;
+		return 1;
+	}
+	return utf8_glyph_width_mb(s, len, bytes);
+}
+
 /* Return the basename of a filename (part after last '/'), or the whole
  * string if no '/' is present.  Falls back to "[new]" for NULL. */
 static inline const char *buf_basename(const char *filename)
@@ -511,18 +645,54 @@ extern const char *kg_help_lines[];   /* NULL-terminated, loaded into *help* */
 /* display.c */
 void ab_append(struct abuf *ab, const char *s, int len);
 void ab_free(struct abuf *ab);
+int  display_gutter_width(int numrows);
 void editor_refresh_screen(void);
 void editor_set_status_message(const char *fmt, ...);
 
 /* fileio.c */
+/* A file read into memory and split into lines, by file_text_read(),
+ * which touches no editor state and so can run on a worker thread. */
+struct file_text {
+	char *buf;          /* the file's bytes */
+	size_t len;
+	size_t *eol;        /* end of each line in buf, past its newline */
+	int nlines;
+	int err;            /* errno when it couldn't be read, else 0 */
+};
+int  file_text_read(const char *path, struct file_text *ft);
+void file_text_free(struct file_text *ft);
+int  editor_open_text(char *filename, struct file_text *ft);
 int editor_open(char *filename);
 int editor_save(int fd);
 int write_file_atomic(const char *path, const char *buf, int len, int backup);
+int save_start(int slot, const char *path, char *buf, int len, int backup,
+               const struct undo_stack *u, int dirty);
+int save_pending(const char *path);
+int save_covers(int slot, const struct undo_stack *u, int dirty);
+int save_poll(void);
+void save_wait(void);
+int save_journal(int slot, const char *path, char *buf, int len,
+                 enum journal_op op);
 void editor_write_file(int fd);
 void editor_insert_file(int fd);
 void editor_snapshot_disk(void);
+int  editor_follow_disk(void);
+void editor_append_output(const char *s, size_t len);
 int  file_state_differs(const char *path, time_t mtime, off_t size);
 
+/* journal.c */
+int  journal_sync(void);
+void journal_poll(void);
+int  journal_pending(void);
+void journal_flush(void);
+void journal_saved(int slot);
+void journal_written(int slot);
+void journal_lost(int slot);
+void journal_failed(int slot, const char *path, int err);
+void journal_free(struct journal *j);
+int  journal_replay(const char *text, size_t len);
+void editor_recover_file(int fd);
+
 /* kbd.c */
 void editor_process_keypress(int fd);
 
@@ -531,6 +701,7 @@ void editor_named_command(int fd);
 
 /* macro.c */
 int  macro_is_recording(void);
+int  macro_is_replaying(void);
 void macro_reset(void);
 void macro_on_key(int key);
 int  macro_next_key(void);
@@ -538,14 +709,70 @@ void macro_start(void);
 void macro_stop(int trim);
 void macro_replay(int fd);
 
+/* match.c */
+int  needle_init(struct needle *n, const char *pat, int len, int fold);
+void needle_free(struct needle *n);
+int  needle_find(const struct needle *n, const char *hay, int hlen);
+int  needle_rfind(const struct needle *n, const char *hay, int hlen);
+
+/* pool.c */
+int  pool_size(void);
+int  pool_start(void (*fn)(void *arg, int task, int worker), void *arg,
+                int ntasks);
+int  pool_wait(int timeout_ms);
+
+/* regex.c */
+struct regex;
+struct regex *regex_compile(const char *pat, int len, int fold, const char **err);
+void regex_free(struct regex *re);
+int  regex_search(struct regex *re, const char *s, int len, int from,
+                  int *start, int *end);
+int  regex_rsearch(struct regex *re, const char *s, int len, int limit,
+                   int *start, int *end);
+int  regex_multiline(const struct regex *re);
+
+/* watch.c */
+int  watch_fd(void);
+int  watch_set(int i, const char *path);
+int  watch_read(char *changed, int n);
+
+/* project.c */
+struct project_index;
+struct project_index *project_index_new(const char *root);
+void project_index_free(struct project_index *ix);
+int  project_index_count(struct project_index *ix, int *done);
+const char *project_index_path(struct project_index *ix, int i);
+int  project_rank(struct project_index *ix, const char *q, int qlen,
+                  int *out, int max);
+void editor_find_file_in_project(int fd);
+
+/* grep.c */
+void editor_grep_project(int fd);
+int  editor_grep_goto(void);
+int  grep_poll(void);
+int  grep_running(void);
+
 /* search.c */
-void editor_find(int fd, int direction);
-void editor_query_replace(int fd);
+void editor_find(int fd, int direction, int regex);
+void editor_query_replace(int fd, int regex);
+void editor_occur(int fd);
+int  editor_occur_goto(void);
+int  search_index_idle(int fd);
+int  query_has_upper(const char *q, int qlen, int regex);
+int  search_lazy_spans(erow *row, const int **span);
+int  search_lazy_current(int fr, erow *row, int *lo, int *hi);
 
 /* shell.c */
 void editor_shell_command(int fd);
 void editor_shell_command_on_region(int fd);
 char *shell_run(const char *cmd, const char *in, int inlen, int *out_len);
+void editor_async_shell_command(int fd);
+int  shell_async_poll(void);
+int  shell_async_fd(void);
+int  shell_async_waiting(void);
+int  shell_async_running(void);
+int  shell_async_interrupt(void);
+void shell_async_stop(void);
 
 /* syntax.c */
 int is_separator(int c);
@@ -561,6 +788,7 @@ int enable_raw_mode(int fd);
 void editor_suspend(void);
 int editor_read_key(int fd);
 int editor_read_key_idle(int fd);
+int editor_key_pending(int fd);
 int editor_read_raw_byte(int fd);
 int get_cursor_position(int ifd, int ofd, int *rows, int *cols);
 int get_window_size(int ifd, int ofd, int *rows, int *cols);
@@ -618,10 +846,24 @@ char *editor_get_region_text(int *out_len);
 void editor_sort_lines(void);
 void editor_yank(void);
 
+/* trigram.c */
+#define TRIGRAM_QUERY_MAX 64
+struct trigram_query {
+	int n;
+	unsigned bit[TRIGRAM_QUERY_MAX];
+};
+struct trigram_index *trigram_new(const erow *rows, int numrows);
+void trigram_free(struct trigram_index *ix);
+int  trigram_build_step(struct trigram_index *ix, const erow *rows, int fd);
+int  trigram_query_init(struct trigram_query *q, const char *s, int len);
+int  trigram_skip(const struct trigram_index *ix, const struct trigram_query *q,
+                  int row, int direction);
+
 /* undo.c */
 void undo_init(void);
 void undo_free(void);
 void undo_push(enum undo_type type, int row, int col, int c, char *text, int len);
+void undo_push_text(enum undo_type type, int row, int col, int c, char *text, int len);
 void editor_undo(void);
 void undo_mark_clean(void);
 
@@ -60,6 +60,95 @@ static void ab_fill(struct abuf *ab, char c, int n)
 
 static void ab_append_spaces(struct abuf *ab, int n) { ab_fill(ab, ' ', n); }
 
+/* Two ASCII digits for every value 0..99, so the line-number gutter
+ * formats a number with one table lookup per digit pair instead of an
+ * snprintf() per row per frame. */
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+/* Width of the line-number gutter for a buffer of numrows lines: the
+ * digits of the largest line number plus one column of separation, or
+ * 0 when line numbers are off.  The digit count only changes when
+ * numrows crosses a power of ten, so it is cached against the range of
+ * line counts it is good for. */
+int display_gutter_width(int numrows)
+{
+	static int lo = 1, hi = 10, digits = 1;
+
+	if (!display_line_numbers)
+		return 0;
+	if (numrows < 1) numrows = 1;
+	if (numrows < lo || numrows >= hi) {
+		lo = 1;
+		hi = 10;
+		digits = 1;
+		while (numrows >= hi && hi <= INT_MAX / 10) {
+			lo = hi;
+			hi *= 10;
+			digits++;
+		}
+	}
+	return digits < 2 ? 3 : digits + 1;
+}
+
+/* Write n right-aligned into buf[0..width-2] and a space into the last
+ * column.  n is never wider than width - 1 (see display_gutter_width). */
+static void gutter_format(char *buf, int width, unsigned n)
+{
+	int pos = width - 1;
+
+	buf[pos] = ' ';
+	while (n >= 100) {
+		unsigned q = n / 100;
+		const char *d = digit_pairs + 2 * (n - q * 100);
+		buf[--pos] = d[1];
+		buf[--pos] = d[0];
+		n = q;
+	}
+	if (n >= 10) {
+		buf[--pos] = digit_pairs[2 * n + 1];
+		buf[--pos] = digit_pairs[2 * n];
+	} else {
+		buf[--pos] = '0' + n;
+	}
+	while (pos > 0)
+		buf[--pos] = ' ';
+}
+
+/* Emit the gutter for file row fr: blank past the end of the buffer,
+ * dimmed except on the cursor's line.  In relative mode the cursor's
+ * line keeps its absolute number and every other line shows its
+ * distance from it, like Emacs' display-line-numbers 'relative. */
+static void draw_gutter(struct abuf *ab, int gutter, int fr, int numrows,
+                        int cur_row)
+{
+	char buf[16];
+
+	if (fr >= numrows) {
+		ab_append_spaces(ab, gutter);
+		return;
+	}
+	if (display_line_numbers == LINE_NUMBERS_RELATIVE && fr != cur_row)
+		gutter_format(buf, gutter, fr > cur_row ? fr - cur_row : cur_row - fr);
+	else
+		gutter_format(buf, gutter, fr + 1);
+	if (fr != cur_row) ab_append(ab, "\x1b[2m", 4);
+	ab_append(ab, buf, gutter);
+	if (fr != cur_row) ab_append(ab, "\x1b[22m", 5);
+}
+
+/* Gutter width for window w showing numrows lines.  A window too
+ * narrow to keep most of its width for text goes without. */
+static int win_gutter_width(const struct editor_window *w, int numrows)
+{
+	int gutter = display_gutter_width(numrows);
+
+	return gutter * 2 > w->w ? 0 : gutter;
+}
+
 /* Convert a `chars`-column index to its rendered (post-tab-expansion)
  * column on the same row, matching editor_update_row's expansion rule
  * (each TAB widens to the next 8-column stop). */
@@ -68,6 +157,8 @@ int chars_to_render_col(erow *row, int chars_col)
 	int j, idx = 0;
 
 	if (chars_col > row->size) chars_col = row->size;
+	if (row->render == row->chars)
+		return chars_col;   /* no TABs: the row renders as itself */
 	for (j = 0; j < chars_col; j++) {
 		if (row->chars[j] == TAB) {
 			idx++;
@@ -82,6 +173,8 @@ int chars_to_render_col(erow *row, int chars_col)
 /* Render the text rows of one window into ab.
  * win_y, win_x, win_h, win_w describe the window's position/size.
  * rowoff/coloff/numrows/rows describe the buffer viewport.
+ * gutter: columns taken by line numbers at the window's left edge, out
+ * of win_w; cur_row is the window's cursor line, for relative numbers.
  * is_active: the window currently has the user's focus; only this one
  * shows the visual-mark region overlay.
  * is_full_width: if true we can use \x1b[0K (erase to EOL) to clear the
@@ -90,7 +183,7 @@ int chars_to_render_col(erow *row, int chars_col)
 static void draw_window_rows(struct abuf *ab,
 	int win_y, int win_x, int win_h, int win_w,
 	int rowoff, int coloff, int numrows, erow *rows,
-	int is_active, int is_full_width)
+	int gutter, int cur_row, int is_active, int is_full_width)
 {
 	int y, j;
 	int region_active = 0;
@@ -127,6 +220,7 @@ static void draw_window_rows(struct abuf *ab,
 		                 region_s_col != region_e_col);
 	}
 
+	win_w -= gutter;
 	for (y = 0; y < win_h; y++) {
 		int fr = rowoff + y;
 		int current_color = -1;
@@ -135,6 +229,8 @@ static void draw_window_rows(struct abuf *ab,
 		int len, vcol_used = 0;
 
 		ab_move_to(ab, win_y + y, win_x);
+		if (gutter)
+			draw_gutter(ab, gutter, fr, numrows, cur_row);
 
 		if (fr >= numrows) {
 			int filled = 0;
@@ -164,12 +260,11 @@ static void draw_window_rows(struct abuf *ab,
 					budget = win_w - filled;
 					if (budget < 0) budget = 0;
 					while (str[k]) {
-						unsigned char b = (unsigned char)str[k];
-						if (!utf8_is_cont(b)) {
-							if (vcols >= budget) break;
-							vcols++;
-						}
-						k++;
+						int n, gw = utf8_glyph_width(str + k,
+							(int)strlen(str + k), &n);
+						if (vcols + gw > budget) break;
+						vcols += gw;
+						k += n;
 					}
 					ab_append(ab, str, k);
 					filled += vcols;
@@ -190,26 +285,35 @@ static void draw_window_rows(struct abuf *ab,
 			erow *r = &rows[fr];
 			char *c;
 			unsigned char *hl;
-
-			/* Walk render bytes from coloff to compute len bounded by
-			 * win_w VISIBLE columns, keeping UTF-8 glyphs whole.
-			 * Counting non-continuation bytes as one column each lets
-			 * a 79-visual-col line (200+ bytes of box drawing) render
-			 * correctly on an 80-col terminal. */
+			const int *span = NULL;
+			int nspan = 0, k = 0;
+			int cur_lo = -1, cur_hi = -1;
+
+			/* Walk render glyphs from coloff to compute len bounded
+			 * by win_w VISIBLE columns, keeping UTF-8 glyphs whole.
+			 * Counting each glyph at its display width lets a
+			 * 79-visual-col line (200+ bytes of box drawing) render
+			 * correctly on an 80-col terminal, and stops a CJK glyph
+			 * that would straddle the right edge from spilling into
+			 * the next pane.  Combining marks cost nothing. */
 			len = 0;
-			if (coloff < r->rsize) {
-				while (coloff + len < r->rsize) {
-					unsigned char b = (unsigned char)r->render[coloff + len];
-					if (!utf8_is_cont(b)) {
-						if (vcol_used >= win_w) break;
-						vcol_used++;
-					}
-					len++;
-				}
+			while (coloff + len < r->rsize) {
+				int n, gw = utf8_glyph_width(r->render + coloff + len,
+				                             r->rsize - coloff - len, &n);
+				if (vcol_used + gw > win_w) break;
+				vcol_used += gw;
+				len += n;
 			}
 
 			c  = r->render + coloff;
-			hl = r->hl    + coloff;
+			hl = r->hl ? r->hl + coloff : NULL;
+
+			/* Search matches are an overlay on the live buffer's
+			 * rows; the current one also goes reverse video. */
+			if (rows == editor.row) {
+				nspan = search_lazy_spans(r, &span);
+				search_lazy_current(fr, r, &cur_lo, &cur_hi);
+			}
 
 			if (region_active && fr >= region_s_row && fr <= region_e_row) {
 				if (editor.rect_mode) {
@@ -229,7 +333,14 @@ static void draw_window_rows(struct abuf *ab,
 
 			for (j = 0; j < len; j++) {
 				int render_col = coloff + j;
-				int want_rev = (render_col >= hi_lo && render_col < hi_hi);
+				int want_rev = (render_col >= hi_lo && render_col < hi_hi) ||
+				               (render_col >= cur_lo && render_col < cur_hi);
+				int h = hl ? hl[j] : HL_NORMAL;
+
+				while (k < nspan && span[2 * k + 1] <= render_col)
+					k++;
+				if (k < nspan && span[2 * k] <= render_col && h != HL_NONPRINT)
+					h = HL_MATCH;
 				/* Defer the reverse-video toggle on UTF-8 continuation
 				 * bytes so an escape can never split a multi-byte
 				 * glyph; the next start byte will catch up. */
@@ -238,7 +349,7 @@ static void draw_window_rows(struct abuf *ab,
 					else          ab_append(ab, "\x1b[27m", 5);
 					current_reverse = want_rev;
 				}
-				if (hl[j] == HL_NONPRINT) {
+				if (h == HL_NONPRINT) {
 					unsigned char uc = c[j];
 					char sym;
 					ab_append(ab, "\x1b[7m", 4);
@@ -250,14 +361,14 @@ static void draw_window_rows(struct abuf *ab,
 					 * reverse state it actually wants. */
 					current_color = -1;
 					current_reverse = 0;
-				} else if (hl[j] == HL_NORMAL) {
+				} else if (h == HL_NORMAL) {
 					if (current_color != -1) {
 						ab_append(ab, "\x1b[39m", 5);
 						current_color = -1;
 					}
 					ab_append(ab, c+j, 1);
 				} else {
-					int color = editor_syntax_to_color(hl[j]);
+					int color = editor_syntax_to_color(h);
 					if (color != current_color) {
 						char cbuf[16];
 						int clen = snprintf(cbuf, sizeof(cbuf), "\x1b[%dm", color);
@@ -325,6 +436,7 @@ static void draw_mode_line(struct abuf *ab, int ml_row, int win_x, int win_w,
 	int is_current = (is_active || bufidx == buf_current);
 	int dirty = is_current ? editor.dirty : b->dirty;
 	int readonly = is_current ? editor.readonly : b->readonly;
+	int crlf = is_current ? editor.crlf : b->crlf;
 	const char *flags;
 	char pos[8];
 
@@ -355,9 +467,9 @@ static void draw_mode_line(struct abuf *ab, int ml_row, int win_x, int win_w,
 	else
 		flags = dirty ? "-**-" : "----";
 
-	len = snprintf(status, sizeof(status), "%s  %s%s  %s (%d,%d)  (%s)",
+	len = snprintf(status, sizeof(status), "%s  %s%s  %s (%d,%d)  (%s%s)",
 		flags, bname, changed,
-		pos, cur_row, cur_col, modename);
+		pos, cur_row, cur_col, modename, crlf ? " DOS" : "");
 
 	if (len > win_w) len = win_w;
 	ab_append(ab, status, len);
@@ -381,7 +493,7 @@ void editor_refresh_screen(void)
 		erow *rows;
 		int is_active = (i == win_current);
 		int is_full_width = (w->w == win_total_cols);
-		int ml_row;
+		int ml_row, gutter, cur_row;
 		struct editor_buffer *b;
 
 		if (!w->active) continue;
@@ -394,6 +506,7 @@ void editor_refresh_screen(void)
 			rows    = editor.row;
 			rowoff  = editor.rowoff;
 			coloff  = editor.coloff;
+			cur_row = editor.rowoff + editor.cy;
 		} else {
 			/* Row data: if this window shares the active buffer, use the
 			 * live editor arrays — b->row may be a stale pointer after realloc. */
@@ -403,10 +516,25 @@ void editor_refresh_screen(void)
 			 * slot's (which tracks the last-active window's scroll). */
 			rowoff  = w->rowoff;
 			coloff  = w->coloff;
+			cur_row = w->rowoff + w->cy;
+		}
+
+		gutter = win_gutter_width(w, numrows);
+		if (is_active && editor.screencols != w->w - gutter) {
+			/* The gutter grew, shrank or was toggled: narrow the
+			 * text area movement code sees and keep the cursor on
+			 * the same file column by scrolling if it fell off. */
+			editor.screencols = w->w - gutter;
+			if (editor.cx >= editor.screencols) {
+				editor.coloff += editor.cx - (editor.screencols - 1);
+				editor.cx = editor.screencols - 1;
+			}
+			coloff = editor.coloff;
 		}
 
 		draw_window_rows(&ab, w->y, w->x, w->h, w->w,
-			rowoff, coloff, numrows, rows, is_active, is_full_width);
+			rowoff, coloff, numrows, rows, gutter, cur_row,
+			is_active, is_full_width);
 
 		ml_row = w->y + w->h;
 		{
@@ -477,18 +605,25 @@ void editor_refresh_screen(void)
 		if (row) {
 			/* editor.cx is a byte offset into row->chars, but the cursor
 			 * must be placed at the visible column.  Tabs widen to the
-			 * next 8-stop; UTF-8 continuation bytes carry no width. */
+			 * next 8-stop; other glyphs take their display width. */
 			int target = editor.cx + editor.coloff;
+			int n;
 
-			for (j = editor.coloff; j < target && j < row->size; j++) {
-				if (row->chars[j] == TAB) cx += 7 - ((cx) % 8);
-				if (!utf8_is_cont((unsigned char)row->chars[j])) cx++;
+			for (j = editor.coloff; j < target && j < row->size; j += n) {
+				if (row->chars[j] == TAB) {
+					cx += 8 - (cx % 8);
+					n = 1;
+				} else {
+					cx += utf8_glyph_width(row->chars + j,
+					                       row->size - j, &n);
+				}
 			}
 			/* Past EOL — rect mode allows the cursor to live in virtual
 			 * space; each virtual byte renders as one extra column. */
 			if (target > row->size) cx += target - row->size;
 		}
-		ab_move_to(&ab, w->y + editor.cy, w->x + cx - 1);
+		ab_move_to(&ab, w->y + editor.cy,
+		           w->x + win_gutter_width(w, editor.numrows) + cx - 1);
 	}
 
 	ab_append(&ab, "\x1b[?25h", 6); /* Show cursor. */
@@ -1,25 +1,154 @@
 /* =============================== File I/O ================================= */
 
 #include "def.h"
+#include <pthread.h>
+
+/* Bytes before the end of a followed file that are checksummed, so a
+ * later look can tell whether the file only grew since. */
+#define FOLLOW_TAIL_BYTES 4096
+/* How much of the appended part is read at a time. */
+#define FOLLOW_CHUNK      65536
+
+/* FNV-1a checksum of the FOLLOW_TAIL_BYTES of fd that end at `size`.
+ * Returns 0 and sets *sum, or -1 when they can't all be read. */
+static int file_tail_sum(int fd, off_t size, uint32_t *sum)
+{
+	char buf[FOLLOW_TAIL_BYTES];
+	off_t from = size > FOLLOW_TAIL_BYTES ? size - FOLLOW_TAIL_BYTES : 0;
+	uint32_t h = 2166136261u;
+	ssize_t n, i;
+
+	n = pread(fd, buf, size - from, from);
+	if (n != size - from)
+		return -1;
+	for (i = 0; i < n; i++)
+		h = (h ^ (unsigned char)buf[i]) * 16777619u;
+	*sum = h;
+	return 0;
+}
 
 /* Refresh the on-disk metadata snapshot for the active buffer.  Called after
  * a successful open or save so the auto-revert poll has a baseline to
  * compare against.  If the file is not present (e.g. a freshly created
- * buffer that has never been saved) the snapshot is zeroed. */
+ * buffer that has never been saved) the snapshot is zeroed.  A followed
+ * buffer also records the checksum editor_follow_disk() compares. */
 void editor_snapshot_disk(void)
 {
 	struct stat st;
+	int fd;
 
 	editor.disk_changed = 0;
+	editor.disk_tail = 0;
 	if (editor.filename && stat(editor.filename, &st) == 0) {
 		editor.disk_mtime = st.st_mtime;
 		editor.disk_size  = st.st_size;
+		editor.disk_ino   = st.st_ino;
 	} else {
 		editor.disk_mtime = 0;
 		editor.disk_size  = 0;
+		editor.disk_ino   = 0;
+		return;
+	}
+	if (editor.follow && (fd = open(editor.filename, O_RDONLY)) != -1) {
+		if (file_tail_sum(fd, editor.disk_size, &editor.disk_tail))
+			editor.disk_ino = 0;    /* no baseline: reload next time */
+		close(fd);
+	}
+}
+
+/* A DOS file's CR ends up on its row when it comes in at the end of one
+ * read and the LF at the start of the next; take it off. */
+static void follow_strip_cr(erow *row)
+{
+	if (row->size && row->chars[row->size - 1] == '\r') {
+		row->chars[--row->size] = '\0';
+		editor_update_row(row);
 	}
 }
 
+/* Add text to the end of the buffer, as read from a followed file or a
+ * command's output: the part up to the first newline continues the last
+ * row, each newline starts a new one -- the same rows editor_open() would
+ * make of the whole file. */
+void editor_append_output(const char *s, size_t len)
+{
+	const char *nl;
+
+	while (len) {
+		size_t seg;
+
+		if (editor.numrows == 0)
+			editor_insert_row(0, "", 0);
+		nl  = memchr(s, '\n', len);
+		seg = nl ? (size_t)(nl - s) : len;
+		if (seg)
+			editor_row_append_string(&editor.row[editor.numrows - 1],
+			                         s, seg);
+		if (!nl)
+			break;
+		if (editor.crlf)
+			follow_strip_cr(&editor.row[editor.numrows - 1]);
+		editor_insert_row(editor.numrows, "", 0);
+		s   += seg + 1;
+		len -= seg + 1;
+	}
+}
+
+/* auto-revert-tail: when the file behind the (clean) current buffer has
+ * only grown since the snapshot -- same inode, larger, and the bytes
+ * before the old end unchanged -- read just the new part into new rows
+ * instead of reloading it all.  Point on the last row stays on the last
+ * row, so the view follows the file like tail -f.  Returns 0 when done,
+ * -1 when the file was rewritten some other way and needs a full reload. */
+int editor_follow_disk(void)
+{
+	char buf[FOLLOW_CHUNK];
+	struct stat st;
+	off_t at, end;
+	uint32_t sum;
+	int fd, pinned, rc = -1;
+
+	if (!editor.follow || !editor.disk_ino || editor.numrows == 0)
+		return -1;
+	if ((fd = open(editor.filename, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) || st.st_ino != editor.disk_ino ||
+	    st.st_size <= editor.disk_size ||
+	    file_tail_sum(fd, editor.disk_size, &sum) || sum != editor.disk_tail)
+		goto done;
+
+	pinned = editor.rowoff + editor.cy >= editor.numrows - 1;
+	suppress_undo = 1;
+	for (at = editor.disk_size, end = st.st_size; at < end; ) {
+		ssize_t n = pread(fd, buf, end - at < FOLLOW_CHUNK ?
+		                  (size_t)(end - at) : sizeof(buf), at);
+
+		if (n <= 0)
+			break;
+		editor_append_output(buf, n);
+		at += n;
+	}
+	suppress_undo = 0;
+	undo_free();
+	undo_init();
+	undo_mark_clean();
+	editor.dirty = 0;
+
+	if (pinned) {
+		editor.cy = editor.numrows - 1 - editor.rowoff;
+		editor.cx = editor.row[editor.numrows - 1].size - editor.coloff;
+	}
+	editor.disk_mtime   = st.st_mtime;
+	editor.disk_size    = at;
+	editor.disk_changed = 0;
+	if (file_tail_sum(fd, at, &editor.disk_tail))
+		editor.disk_ino = 0;
+	rc = 0;
+done:
+	close(fd);
+	return rc;
+}
+
 /* Return 1 if the file at `path` exists and its mtime or size disagrees
  * with the supplied snapshot.  Used both by editor_save (where the snapshot
  * comes from the buffer's own last-seen state) and by autorevert_poll. */
@@ -31,16 +160,116 @@ int file_state_differs(const char *path, time_t mtime, off_t size)
 	return st.st_mtime != mtime || st.st_size != size;
 }
 
-/* Load the specified program in the editor memory and returns 0 on success
- * or 1 on error. */
-int editor_open(char *filename)
+/* Read the file at path into ft and find its line ends.  Returns 0, or
+ * -1 with ft->err set when the file can't be read. */
+int file_text_read(const char *path, struct file_text *ft)
+{
+	size_t cap = 65536, ecap = 0;
+	struct stat st;
+	ssize_t n;
+	char *p;
+	int fd;
+
+	memset(ft, 0, sizeof(*ft));
+	if ((fd = open(path, O_RDONLY)) == -1)
+		goto fail;
+	/* The size is a hint: the file may grow, or be a pipe. */
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		cap = st.st_size + 1;
+	if (!(ft->buf = malloc(cap))) {
+		errno = ENOMEM;
+		goto fail_close;
+	}
+	for (;;) {
+		if (ft->len == cap) {
+			cap *= 2;
+			if (!(p = realloc(ft->buf, cap))) {
+				errno = ENOMEM;
+				goto fail_close;
+			}
+			ft->buf = p;
+		}
+		n = read(fd, ft->buf + ft->len, cap - ft->len);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail_close;
+		}
+		ft->len += n;
+	}
+	close(fd);
+	/* A byte to spare for the NUL editor_append_text() ends rows with. */
+	if (ft->len == cap) {
+		if (!(p = realloc(ft->buf, cap + 1))) {
+			errno = ENOMEM;
+			goto fail;
+		}
+		ft->buf = p;
+	}
+
+	for (p = ft->buf; p && p < ft->buf + ft->len; p++) {
+		char *nl = memchr(p, '\n', ft->buf + ft->len - p);
+
+		if (ft->nlines == (int)ecap) {
+			size_t *e;
+
+			ecap = ecap ? ecap * 2 : 1024;
+			if (!(e = realloc(ft->eol, ecap * sizeof(*e)))) {
+				errno = ENOMEM;
+				goto fail;
+			}
+			ft->eol = e;
+		}
+		p = nl ? nl : ft->buf + ft->len - 1;
+		ft->eol[ft->nlines++] = p + 1 - ft->buf;
+	}
+	return 0;
+
+fail_close:
+	close(fd);
+fail:
+	ft->err = errno;
+	file_text_free(ft);
+	return -1;
+}
+
+void file_text_free(struct file_text *ft)
+{
+	free(ft->buf);
+	free(ft->eol);
+	ft->buf = NULL;
+	ft->eol = NULL;
+	ft->len = 0;
+	ft->nlines = 0;
+}
+
+/* Whether every line of ft that ends in a newline ends in CR LF, and at
+ * least one does: a DOS file, whose line ends are kept as they were. */
+static int file_text_crlf(const struct file_text *ft)
+{
+	int i, n = 0;
+
+	for (i = 0; i < ft->nlines; i++) {
+		size_t e = ft->eol[i];
+
+		if (ft->buf[e - 1] != '\n')
+			continue;
+		if (e < 2 || ft->buf[e - 2] != '\r')
+			return 0;
+		n++;
+	}
+	return n > 0;
+}
+
+/* Load filename, already read into ft, into the editor.  Returns 0 on
+ * success, 1 for a file that doesn't exist yet (an empty buffer to save
+ * it from), or -1 with errno set when it couldn't be read. */
+int editor_open_text(char *filename, struct file_text *ft)
 {
-	ssize_t linelen;
-	size_t linecap = 0;
 	size_t fnlen = strlen(filename) + 1;
-	char *line = NULL;
-	FILE *fp;
-	int ended_with_newline = 0;
+	int ended_with_newline;
 
 	editor.dirty = 0;
 	editor.backed_up = 0;
@@ -48,30 +277,32 @@ int editor_open(char *filename)
 	editor.filename = malloc(fnlen);
 	memcpy(editor.filename, filename, fnlen);
 
-	fp = fopen(filename, "r");
-	if (!fp) {
-		if (errno != ENOENT) {
-			perror("Opening file");
-			exit(1);
+	if (ft->err) {
+		if (ft->err != ENOENT) {
+			errno = ft->err;
+			return -1;
 		}
 		editor_snapshot_disk();
 		return 1;
 	}
 
-	while ((linelen = getline(&line, &linecap, fp)) != -1) {
-		ended_with_newline = 0;
-		if (linelen && (line[linelen-1] == '\n' || line[linelen-1] == '\r')) {
-			line[--linelen] = '\0';
-			ended_with_newline = 1;
-		}
-		editor_insert_row(editor.numrows, line, linelen);
+	/* The rows keep the text read, so ft no longer owns it. */
+	if (editor_adopt_text(ft->buf, ft->len + 1) < 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	editor.crlf = file_text_crlf(ft);
+	ended_with_newline = editor_append_text(ft->buf, ft->eol, ft->nlines,
+	                                        editor.crlf);
+	ft->buf = NULL;
+	if (ended_with_newline < 0) {
+		errno = ENOMEM;
+		return -1;
 	}
 	/* A file ending in a newline has a trailing empty line, like GNU
 	 * Emacs; represent it as an empty row so the newline round-trips. */
 	if (ended_with_newline)
 		editor_insert_row(editor.numrows, "", 0);
-	free(line);
-	fclose(fp);
 	/* A file we can't write opens read-only, like GNU Emacs, so the mode
 	 * line shows %%.  Only ever adds read-only; an explicit -R stays. */
 	if (access(filename, W_OK) != 0)
@@ -82,6 +313,44 @@ int editor_open(char *filename)
 	return 0;
 }
 
+/* Load the specified program in the editor memory and returns 0 on success
+ * or 1 on error. */
+int editor_open(char *filename)
+{
+	struct file_text ft;
+	int rc;
+
+	file_text_read(filename, &ft);
+	rc = editor_open_text(filename, &ft);
+	file_text_free(&ft);
+	if (rc < 0) {
+		perror("Opening file");
+		exit(1);
+	}
+	return rc;
+}
+
+/* Write all len bytes of buf to fd.  Returns 0, or -1 with errno set. */
+static int write_all(int fd, const char *buf, int len)
+{
+	int off;
+
+	for (off = 0; off < len; ) {
+		ssize_t n = write(fd, buf + off, len - off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		off += n;
+	}
+	return 0;
+}
+
 /* Write `buf` (len bytes) to `path` atomically: create a temp file in
  * the target's directory, copy the target's permissions and owner onto
  * it, flush it to disk, then rename it over the target -- so a reader
@@ -106,7 +375,6 @@ int write_file_atomic(const char *path, const char *buf, int len, int backup)
 	int do_backup;
 	int tmpfd;
 	char *slash;
-	int off;
 
 	/* Resolve a symlink so we replace its target, not the link itself;
 	 * lstat has already captured a non-symlink's own metadata. */
@@ -153,20 +421,8 @@ int write_file_atomic(const char *path, const char *buf, int len, int backup)
 			goto fail;
 	}
 
-	for (off = 0; off < len; ) {
-		ssize_t n = write(tmpfd, buf + off, len - off);
-		if (n < 0) {
-			if (errno == EINTR)
-				continue;
-			goto fail;
-		}
-		if (n == 0) {
-			errno = EIO;
-			goto fail;
-		}
-		off += n;
-	}
-
+	if (write_all(tmpfd, buf, len) == -1)
+		goto fail;
 	if (fsync(tmpfd) == -1)
 		goto fail;
 	if (close(tmpfd) == -1) {
@@ -204,7 +460,300 @@ fail:
 	return -1;
 }
 
-/* Save the current file on disk. Return 0 on success, 1 on error.
+/* A save handed to the writer thread.  The text is flattened on the UI
+ * thread, so later edits can't reach it; what the buffer looked like then
+ * (its undo seq and dirty count) says whether it's still that text when
+ * the write lands.  Records for a recovery journal ride the same queue,
+ * so they reach the disk in order with the saves that make them moot. */
+struct save_job {
+	struct save_job *next;
+	int slot;            /* buffer the text came from */
+	enum journal_op journal; /* JOURNAL_NONE for a save */
+	char *path;
+	char *buf;
+	int len;
+	int backup;          /* make path~ first, see write_file_atomic() */
+	unsigned long seq;   /* the buffer's undostack.seq at the snapshot */
+	int undo_size;       /* and its undostack.size */
+	int dirty;           /* and its dirty count */
+	int done;            /* written, or failed, by the writer */
+	int err;             /* errno when it failed, else 0 */
+	struct stat st;      /* the file as written */
+};
+
+/* Saves queue up for one writer thread, so the write, fsync and rename
+ * (seconds, on slow flash) never hold up a key.  Jobs are written in the
+ * order given, so two saves of one file land newest last, and leave the
+ * queue in that order too. */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;     /* a job was queued */
+	pthread_cond_t done;     /* a job was written */
+	struct save_job *head, *tail;
+	int started;             /* 1 once the thread runs, -1 if it can't */
+} writer = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, NULL, NULL, 0
+};
+
+/* Start, append to or remove a journal file.  No fsync: the records
+ * have to outlive kg, not the machine. */
+static int save_write_journal(struct save_job *j)
+{
+	int fd, flags = O_WRONLY | O_CREAT | O_APPEND;
+
+	if (j->journal == JOURNAL_REMOVE)
+		return unlink(j->path) == -1 && errno != ENOENT ? -1 : 0;
+	if (j->journal == JOURNAL_CREATE)
+		flags |= O_TRUNC;
+	if ((fd = open(j->path, flags, 0600)) == -1)
+		return -1;
+	if (write_all(fd, j->buf, j->len) == -1) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+	return close(fd);
+}
+
+static void save_write(struct save_job *j)
+{
+	if (j->journal != JOURNAL_NONE) {
+		if (save_write_journal(j) == -1)
+			j->err = errno;
+		return;
+	}
+	if (write_file_atomic(j->path, j->buf, j->len, j->backup) == -1 ||
+	    stat(j->path, &j->st) == -1)
+		j->err = errno;
+}
+
+static void *save_thread(void *arg)
+{
+	struct save_job *j;
+
+	(void)arg;
+	pthread_mutex_lock(&writer.lock);
+	for (;;) {
+		for (j = writer.head; j && j->done; j = j->next)
+			;
+		if (!j) {
+			pthread_cond_wait(&writer.work, &writer.lock);
+			continue;
+		}
+		pthread_mutex_unlock(&writer.lock);
+		save_write(j);
+		pthread_mutex_lock(&writer.lock);
+		j->done = 1;
+		pthread_cond_broadcast(&writer.done);
+	}
+	return NULL;
+}
+
+/* Hand j to the writer thread, starting that the first time. */
+static void save_queue(struct save_job *j)
+{
+	sigset_t all, old;
+	pthread_t tid;
+
+	if (!writer.started) {
+		/* Like the pool workers: keep the UI thread's signals off it. */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		writer.started = pthread_create(&tid, NULL, save_thread, NULL) == 0 ? 1 : -1;
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		if (writer.started == 1)
+			pthread_detach(tid);
+	}
+	if (writer.started < 0) {
+		save_write(j);       /* no thread: write it right here */
+		j->done = 1;
+	}
+
+	pthread_mutex_lock(&writer.lock);
+	if (writer.tail)
+		writer.tail->next = j;
+	else
+		writer.head = j;
+	writer.tail = j;
+	pthread_cond_signal(&writer.work);
+	pthread_mutex_unlock(&writer.lock);
+}
+
+/* Queue buf, len bytes of buffer `slot` as it stands in undo stack u with
+ * dirty count `dirty`, to be written to path.  Takes over buf.
+ * Returns 0, or -1 when out of memory. */
+int save_start(int slot, const char *path, char *buf, int len, int backup,
+               const struct undo_stack *u, int dirty)
+{
+	struct save_job *j = calloc(1, sizeof(*j));
+
+	if (!j || !(j->path = strdup(path))) {
+		free(j);
+		free(buf);
+		return -1;
+	}
+	j->slot = slot;
+	j->buf = buf;
+	j->len = len;
+	j->backup = backup;
+	j->seq = u->seq;
+	j->undo_size = u->size;
+	j->dirty = dirty;
+	save_queue(j);
+	return 0;
+}
+
+/* Queue op on the journal file path of buffer slot, writing buf, len
+ * bytes, for a create or append.  Takes over buf.
+ * Returns 0, or -1 when out of memory. */
+int save_journal(int slot, const char *path, char *buf, int len,
+                 enum journal_op op)
+{
+	struct save_job *j = calloc(1, sizeof(*j));
+
+	if (!j || !(j->path = strdup(path))) {
+		free(j);
+		free(buf);
+		return -1;
+	}
+	j->slot = slot;
+	j->journal = op;
+	j->buf = buf;
+	j->len = len;
+	save_queue(j);
+	return 0;
+}
+
+/* Number of saves of path (of anything, when path is NULL) that are
+ * queued or written but not yet picked up by save_poll(). */
+int save_pending(const char *path)
+{
+	struct save_job *j;
+	int n = 0;
+
+	pthread_mutex_lock(&writer.lock);
+	for (j = writer.head; j; j = j->next)
+		if (!path || !strcmp(j->path, path))
+			n++;
+	pthread_mutex_unlock(&writer.lock);
+	return n;
+}
+
+/* Whether a save of buffer `slot` taken with it in state u, dirty, is
+ * still on its way, so that saving it again would write the same text. */
+int save_covers(int slot, const struct undo_stack *u, int dirty)
+{
+	struct save_job *j;
+	int found = 0;
+
+	pthread_mutex_lock(&writer.lock);
+	for (j = writer.head; j; j = j->next)
+		if (j->slot == slot && j->journal == JOURNAL_NONE)
+			found = j->seq == u->seq && j->dirty == dirty &&
+			        !(j->done && j->err);
+	pthread_mutex_unlock(&writer.lock);
+	return found;
+}
+
+/* Settle a written job with its buffer, if that still shows the file.
+ * The buffer is clean only when nothing was edited since the snapshot;
+ * otherwise undoing back to it will make it so. */
+static void save_finish(struct save_job *j)
+{
+	struct editor_buffer *b = j->slot < buf_slots ? &buflist[j->slot] : NULL;
+	int cur = j->slot == buf_current;
+	const char *name = cur ? editor.filename : b && b->active ? b->filename : NULL;
+	struct undo_stack *u = cur ? &undostack : b ? &b->undostack : NULL;
+	int *dirty = cur ? &editor.dirty : b ? &b->dirty : NULL;
+
+	if (j->journal != JOURNAL_NONE) {
+		if (j->err && (cur || (b && b->active)))
+			journal_failed(j->slot, j->path, j->err);
+		return;
+	}
+	if (!name || strcmp(name, j->path))
+		name = NULL;        /* killed, or renamed with C-x C-w */
+
+	if (j->err) {
+		if (name && j->backup)
+			*(cur ? &editor.backed_up : &b->backed_up) = 0;
+		if (name)
+			journal_lost(j->slot);
+		editor_set_status_message("Error writing %s: %s",
+		                          j->path, strerror(j->err));
+		return;
+	}
+	if (name) {
+		journal_written(j->slot);
+		u->clean_size = j->undo_size;
+		if (u->seq == j->seq && *dirty == j->dirty)
+			*dirty = 0;
+		if (cur) {
+			editor_snapshot_disk();
+		} else {
+			b->disk_mtime = j->st.st_mtime;
+			b->disk_size = j->st.st_size;
+			b->disk_ino = j->st.st_ino;
+			b->disk_tail = 0;
+			b->disk_changed = 0;
+		}
+	}
+	editor_set_status_message("Wrote %s (%d bytes)", j->path, j->len);
+}
+
+/* Pick up saves the writer has finished, from the idle loop.  Returns 1
+ * when any were, so the screen shows the outcome. */
+int save_poll(void)
+{
+	struct save_job *j;
+	int any = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&writer.lock);
+		j = writer.head;
+		if (j && j->done) {
+			writer.head = j->next;
+			if (!writer.head)
+				writer.tail = NULL;
+		} else {
+			j = NULL;
+		}
+		pthread_mutex_unlock(&writer.lock);
+		if (!j)
+			return any;
+		save_finish(j);
+		free(j->path);
+		free(j->buf);
+		free(j);
+		any = 1;
+	}
+}
+
+/* Block until every queued save is on disk, e.g. before exiting. */
+void save_wait(void)
+{
+	struct save_job *j;
+
+	pthread_mutex_lock(&writer.lock);
+	if (writer.head) {
+		editor_set_status_message("Saving...");
+		editor_refresh_screen();
+	}
+	for (;;) {
+		for (j = writer.head; j && j->done; j = j->next)
+			;
+		if (!j)
+			break;
+		pthread_cond_wait(&writer.done, &writer.lock);
+	}
+	pthread_mutex_unlock(&writer.lock);
+	save_poll();
+}
+
+/* Save the current file on disk, in the background.  Return 0 once the
+ * write is queued, 1 on error.
  * Special buffers (filename is NULL or starts with '*') prompt for a name. */
 int editor_save(int fd)
 {
@@ -243,7 +792,8 @@ int editor_save(int fd)
 		free(editor.filename);
 		editor.filename = newfilename;
 		editor_select_syntax_highlight(editor.filename);
-	} else if (file_state_differs(editor.filename,
+	} else if (!save_pending(editor.filename) &&
+	           file_state_differs(editor.filename,
 	                              editor.disk_mtime, editor.disk_size)) {
 		editor_set_status_message("File %s changed on disk.  Save anyway? (y/n) ",
 		                          editor.filename);
@@ -261,21 +811,18 @@ int editor_save(int fd)
 	    editor.row[editor.numrows - 1].size > 0)
 		editor_insert_row(editor.numrows, "", 0);
 
-	buf = editor_rows_to_string(editor.row, editor.numrows, &len);
-	if (write_file_atomic(editor.filename, buf, len,
-	                      make_backup_files && !editor.backed_up) == -1) {
-		free(buf);
-		editor_set_status_message("Error writing %s: %s",
-		                          editor.filename, strerror(errno));
+	/* The writer thread does the rest; save_poll() reports back. */
+	buf = editor_rows_to_file(editor.row, editor.numrows, editor.crlf, &len);
+	if (!buf || save_start(buf_current, editor.filename, buf, len,
+	                       make_backup_files && !editor.backed_up,
+	                       &undostack, editor.dirty) == -1) {
+		editor_set_status_message("Out of memory");
 		return 1;
 	}
-
-	free(buf);
-	editor.dirty = 0;
 	editor.backed_up = 1;
-	undo_mark_clean();  /* Mark this state as clean for undo tracking */
-	editor_snapshot_disk();
-	editor_set_status_message("Wrote %s (%d bytes)", editor.filename, len);
+	editor_arena_repack();  /* the writer has its own copy of the text */
+	journal_saved(buf_current);
+	editor_set_status_message("Saving %s...", editor.filename);
 	return 0;
 }
 
@@ -0,0 +1,426 @@
+/* ============================ Project grep ================================ */
+
+#include "def.h"
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* M-x grep-project: search every file under a directory for a regexp and
+ * list the matching lines as "file:line: text" in a *grep* buffer, where
+ * RET opens the file at that line.  The files are mapped into memory and
+ * searched on the worker pool (pool.c) while the editor carries on; the
+ * idle loop appends each file's results, in walk order, as they come in,
+ * whenever the *grep* buffer is the current one. */
+
+#define GREP_NAME        "*grep*"
+#define GREP_MAX_FILES   100000
+#define GREP_MAX_LINE    300        /* bytes of a matching line shown */
+#define GREP_BINARY_PEEK 8192       /* a NUL in here means binary: skip */
+#define GREP_SETTLE_MS   200        /* wait this long for a small tree */
+
+static struct editor_syntax grep_syntax = {
+	"Grep", NULL, NULL, "", "", "", 0
+};
+
+struct grep_file {
+	char *path;
+	char *out;                  /* "file:line: text\n" lines, or NULL */
+	int outlen, nmatch;
+	int done;                   /* under the job's lock */
+};
+
+struct grep_job {
+	char query[256];
+	char root[PATH_MAX];
+	int rel;                    /* length of "root/" in each path */
+	int fold;
+	struct grep_file *files;
+	int nfiles, cap, truncated;
+	int emitted;                /* files already in the buffer */
+	int nmatch;                 /* matches in those */
+	struct regex **re;          /* per worker: the DFA cache isn't shared */
+	int nworkers;
+	int pooled;                 /* running on the pool */
+	pthread_mutex_t lock;
+	int cancel;                 /* under lock */
+};
+
+static struct grep_job *grep;   /* the job behind the *grep* buffer */
+
+static int grep_cancelled(struct grep_job *job)
+{
+	int cancel;
+
+	pthread_mutex_lock(&job->lock);
+	cancel = job->cancel;
+	pthread_mutex_unlock(&job->lock);
+	return cancel;
+}
+
+static void grep_emit(struct abuf *out, const struct grep_job *job,
+		      const char *path, int line, const char *text, int len)
+{
+	char head[64];
+	int n;
+
+	if (len > 0 && text[len - 1] == '\r')
+		len--;
+	if (len > GREP_MAX_LINE)
+		len = GREP_MAX_LINE;
+	ab_append(out, path + job->rel, strlen(path + job->rel));
+	n = snprintf(head, sizeof(head), ":%d: ", line);
+	ab_append(out, head, n);
+	ab_append(out, text, len);
+	ab_append(out, "\n", 1);
+}
+
+/* Search one file, appending its matching lines to out.  Returns the
+ * number of matches. */
+static int grep_one(struct grep_job *job, const char *path, struct regex *re,
+		    struct abuf *out)
+{
+	struct stat st;
+	const char *map, *nl;
+	int fd, len, pos = 0, line = 1, counted = 0, n = 0;
+	int b, e;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+	    st.st_size > INT_MAX) {
+		close(fd);
+		return 0;
+	}
+	len = st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+
+	if (memchr(map, '\0', len < GREP_BINARY_PEEK ? len : GREP_BINARY_PEEK))
+		goto done;
+
+	/* Every line starts before len: an empty match at len, as "^$"
+	 * finds, would be on the line after the final newline, which
+	 * isn't there. */
+	while (pos < len && regex_search(re, map, len, pos, &b, &e)) {
+		int ls = b, le;
+
+		if (b == len && map[len - 1] == '\n')
+			break;
+
+		while ((nl = memchr(map + counted, '\n', b - counted))) {
+			line++;
+			counted = nl - map + 1;
+		}
+		counted = b;
+		while (ls > 0 && map[ls - 1] != '\n')
+			ls--;
+		nl = memchr(map + b, '\n', len - b);
+		le = nl ? nl - map : len;
+
+		grep_emit(out, job, path, line, map + ls, le - ls);
+		n++;
+		pos = le + 1;
+		if (n % 64 == 0 && grep_cancelled(job))
+			break;
+	}
+done:
+	munmap((void *)map, len);
+	return n;
+}
+
+static void grep_task(void *arg, int task, int worker)
+{
+	struct grep_job *job = arg;
+	struct grep_file *f = &job->files[task];
+	struct abuf out = { NULL, 0 };
+	int n = 0;
+
+	if (!grep_cancelled(job)) {
+		if (!job->re[worker]) {
+			const char *err;
+
+			job->re[worker] = regex_compile(job->query,
+			    strlen(job->query), job->fold, &err);
+		}
+		if (job->re[worker])
+			n = grep_one(job, f->path, job->re[worker], &out);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	f->out    = out.b;
+	f->outlen = out.len;
+	f->nmatch = n;
+	f->done   = 1;
+	pthread_mutex_unlock(&job->lock);
+}
+
+static int grep_add_file(const char *path, void *arg)
+{
+	struct grep_job *job = arg;
+
+	if (job->nfiles == GREP_MAX_FILES) {
+		job->truncated = 1;
+		return 1;
+	}
+	if (job->nfiles == job->cap) {
+		int ncap = job->cap ? job->cap * 2 : 256;
+		struct grep_file *nf = realloc(job->files, ncap * sizeof(*nf));
+
+		if (!nf)
+			return 1;
+		job->files = nf;
+		job->cap   = ncap;
+	}
+	memset(&job->files[job->nfiles], 0, sizeof(job->files[0]));
+	job->files[job->nfiles].path = strdup(path);
+	if (!job->files[job->nfiles].path)
+		return 1;
+	job->nfiles++;
+	return 0;
+}
+
+/* Stop the job, wait for the workers to let go of it, and free it. */
+static void grep_drop(void)
+{
+	int i;
+
+	if (!grep)
+		return;
+	pthread_mutex_lock(&grep->lock);
+	grep->cancel = 1;
+	pthread_mutex_unlock(&grep->lock);
+	if (grep->pooled)
+		while (!pool_wait(50))
+			;
+
+	for (i = 0; i < grep->nfiles; i++) {
+		free(grep->files[i].path);
+		free(grep->files[i].out);
+	}
+	for (i = 0; i < grep->nworkers; i++)
+		if (grep->re[i])
+			regex_free(grep->re[i]);
+	free(grep->re);
+	free(grep->files);
+	pthread_mutex_destroy(&grep->lock);
+	free(grep);
+	grep = NULL;
+}
+
+static void grep_populate(void)
+{
+	editor_insert_row(0, "", 0);
+}
+
+static void grep_header(void)
+{
+	char line[PATH_MAX + 400];
+	int len;
+
+	if (grep->emitted < grep->nfiles)
+		len = snprintf(line, sizeof(line),
+		    "Searching for \"%s\" in %s: %d match%s in %d of %d files",
+		    grep->query, grep->root, grep->nmatch,
+		    grep->nmatch == 1 ? "" : "es", grep->emitted, grep->nfiles);
+	else
+		len = snprintf(line, sizeof(line),
+		    "%d match%s for \"%s\" in %s, %d file%s searched%s",
+		    grep->nmatch, grep->nmatch == 1 ? "" : "es", grep->query,
+		    grep->root, grep->nfiles, grep->nfiles == 1 ? "" : "s",
+		    grep->truncated ? " (stopped at the file limit)" : "");
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+	editor_row_set_chars(&editor.row[0], line, len);
+}
+
+/* From the idle loop: append the results that have come in since last
+ * time, when the *grep* buffer is current.  Returns 1 when the screen
+ * needs a redraw. */
+int grep_poll(void)
+{
+	int i, first, last;
+
+	if (!grep || grep->emitted == grep->nfiles)
+		return 0;
+
+	if (editor.syntax != &grep_syntax) {
+		/* Killed: nobody will read the rest. */
+		for (i = 0; i < buf_slots; i++)
+			if (buflist[i].active && buflist[i].syntax == &grep_syntax)
+				return 0;
+		grep_drop();
+		return 0;
+	}
+
+	first = grep->emitted;
+	pthread_mutex_lock(&grep->lock);
+	for (last = first; last < grep->nfiles && grep->files[last].done; last++)
+		;
+	pthread_mutex_unlock(&grep->lock);
+	if (last == first)
+		return 0;
+
+	for (i = first; i < last; i++) {
+		struct grep_file *f = &grep->files[i];
+		char *p = f->out, *end = f->out + f->outlen;
+
+		while (p < end) {
+			char *nl = memchr(p, '\n', end - p);
+
+			editor_insert_row(editor.numrows, p, nl - p);
+			p = nl + 1;
+		}
+		grep->nmatch += f->nmatch;
+		free(f->out);
+		f->out = NULL;
+	}
+	grep->emitted = last;
+	grep_header();
+	editor.dirty = 0;
+	if (last == grep->nfiles)
+		editor_set_status_message("Grep finished: %d match%s",
+		                          grep->nmatch, grep->nmatch == 1 ? "" : "es");
+	return 1;
+}
+
+/* Whether grep_poll() has results to wait for: a search is still running
+ * and the *grep* buffer is up to show them.  The idle read keeps ticking
+ * while it does. */
+int grep_running(void)
+{
+	return grep && grep->emitted < grep->nfiles &&
+	       editor.syntax == &grep_syntax;
+}
+
+void editor_grep_project(int fd)
+{
+	char query[256], dir[PATH_MAX], def[PATH_MAX], prompt[PATH_MAX + 32];
+	struct grep_job *job;
+	struct regex *re;
+	const char *err;
+	int qlen, len, i;
+
+	if (editor_read_line(fd, "Grep project for regexp: ", query,
+			     sizeof(query)) < 0 || !query[0])
+		return;
+	/* The path picker completes to an entry on RET, so the directory
+	 * is a plain prompt defaulting to the current file's. */
+	editor_prompt_prefill_dir(def, sizeof(def));
+	if (!def[0])
+		strcpy(def, "./");
+	snprintf(prompt, sizeof(prompt), "In directory (default %s): ", def);
+	if (editor_read_line(fd, prompt, dir, sizeof(dir)) < 0)
+		return;
+	if (!dir[0])
+		memcpy(dir, def, sizeof(dir));
+
+	qlen = strlen(query);
+	re = regex_compile(query, qlen, 0, &err);
+	if (!re) {
+		editor_set_status_message("Invalid regexp: %s", err);
+		return;
+	}
+	regex_free(re);
+
+	grep_drop();
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return;
+	memcpy(job->query, query, qlen + 1);
+	editor_path_expand_tilde(dir, sizeof(dir));
+	len = strlen(dir);
+	while (len > 1 && dir[len - 1] == '/')
+		dir[--len] = '\0';
+	snprintf(job->root, sizeof(job->root), "%s", len ? dir : ".");
+	job->rel  = strcmp(job->root, "/") ? strlen(job->root) + 1 : 1;
+	job->fold = !query_has_upper(query, qlen, 1);
+	pthread_mutex_init(&job->lock, NULL);
+
+	if (editor_path_walk(job->root, NULL, grep_add_file, job) < 0) {
+		editor_set_status_message("Can't open directory %s", job->root);
+		grep = job;
+		grep_drop();
+		return;
+	}
+
+	job->nworkers = pool_size() ? pool_size() : 1;
+	job->re = calloc(job->nworkers, sizeof(*job->re));
+	grep = job;
+	if (!job->re) {
+		grep_drop();
+		return;
+	}
+
+	buf_open_special(GREP_NAME, &grep_syntax, grep_populate, "");
+	if (editor.syntax != &grep_syntax) {
+		grep_drop();
+		return;
+	}
+
+	if (job->nfiles && pool_start(grep_task, job, job->nfiles) == 0) {
+		/* A small tree is done in a blink: list it at once rather
+		 * than at the next idle tick, unless the user types on. */
+		job->pooled = 1;
+		for (i = 0; i < GREP_SETTLE_MS / 10 && !editor_key_pending(fd); i++)
+			if (pool_wait(10))
+				break;
+	} else {
+		for (i = 0; i < job->nfiles; i++)
+			grep_task(job, i, 0);
+	}
+	grep_header();
+	editor.dirty = 0;
+	grep_poll();
+}
+
+/* RET in the *grep* buffer: open the file of the entry at point, on the
+ * line and at the first match.  Returns 0 when point isn't in a *grep*
+ * buffer, so the key can mean something else. */
+int editor_grep_goto(void)
+{
+	char path[PATH_MAX];
+	int filerow = editor.rowoff + editor.cy;
+	const char *s, *colon;
+	struct regex *re;
+	const char *err;
+	int line = 0, ms = 0, me;
+
+	if (editor.syntax != &grep_syntax)
+		return 0;
+	if (!grep || filerow < 1 || filerow >= editor.numrows)
+		return 1;
+
+	/* The first ":digits:" ends the file name. */
+	s = editor.row[filerow].chars;
+	for (colon = strchr(s, ':'); colon; colon = strchr(colon + 1, ':')) {
+		const char *d = colon + 1;
+
+		while (isdigit((unsigned char)*d))
+			d++;
+		if (d > colon + 1 && *d == ':') {
+			line = atoi(colon + 1);
+			break;
+		}
+	}
+	if (!colon)
+		return 1;
+
+	snprintf(path, sizeof(path), "%.*s/%.*s", grep->rel - 1, grep->root,
+	         (int)(colon - s), s);
+
+	if (buf_visit_file(path, 0) < 0)
+		return 1;
+	if (line >= 1 && line <= editor.numrows) {
+		erow *row = &editor.row[line - 1];
+
+		re = regex_compile(grep->query, strlen(grep->query), grep->fold, &err);
+		if (re) {
+			regex_search(re, row->chars, row->size, 0, &ms, &me);
+			regex_free(re);
+		}
+	}
+	editor_goto_line_direct(line, ms + 1);
+	return 1;
+}
@@ -42,9 +42,10 @@ const char *kg_help_lines[] = {
 	"│ C-y/S-Ins  paste        │ C-x (/F3 begin macro    │ M-%      query replace  │",
 	"│ DEL        del region   │ C-x )/F4 end macro      │ C-l      recenter       │",
 	"│ M-!/M-|    shell cmd ±  │ C-x e/F4 exec macro     │ C-g      cancel         │",
-	"│                         │                         │ C-h/F1   help           │",
+	"│ M-&        async shell  │                         │ C-h/F1   help           │",
 	"│                         │                         │ C-z      suspend        │",
 	"│                         │                         │ C-u      numeric arg    │",
+	"│                         │                         │ C-M-s/r  regexp search  │",
 	"└─────────────────────────┴─────────────────────────┴─────────────────────────┘",
 	"           M- = Esc/Meta/Alt      C- = Ctrl       S- = Shift",
 	NULL
@@ -0,0 +1,485 @@
+/* journal.c - Crash-recovery journal of unsaved edits
+ *
+ * While a file's buffer is modified, its changes are appended to #file#
+ * beside it, the Emacs auto-save name, so M-x recover-file can bring
+ * them back after kg is killed.  Instead of writing out the whole buffer
+ * every so often, the journal records only the rows changed since its
+ * last record: the row primitives in buffer.c narrow a span of rows that
+ * may differ, and at the end of each command that span becomes a record
+ *
+ *	@lo old new
+ *	<new lines, each ending in a newline>
+ *
+ * saying rows [lo, lo+old) were replaced by the new lines; an old of -1
+ * stands for all the rows from lo on.  After a "kg journal" line, the
+ * records replay in order onto the file as it is on disk.
+ *
+ * Records collect in memory, and go to the writer thread in fileio.c at
+ * most every JOURNAL_DELAY seconds, or once JOURNAL_BATCH bytes wait, as
+ * plain appends.  Typing along one line rewrites the last record waiting
+ * instead of adding one per key.  Saving the buffer, or undoing back to
+ * what is on disk, removes the journal.
+ *
+ * A journal found on visiting the file is left by a kg that died, and is
+ * what M-x recover-file is for.  It is held: records for the buffer stay
+ * in memory instead of starting the file afresh, until the user recovers
+ * it or the buffer is saved. */
+
+#include "def.h"
+
+#define JOURNAL_DELAY 2         /* seconds between writes */
+#define JOURNAL_BATCH 65536     /* bytes waiting that are written at once */
+#define JOURNAL_MERGE 4096      /* largest last record that's rewritten */
+
+static const char journal_magic[] = "kg journal\n";
+
+/* The journal of filename: #name# in the same directory. */
+static char *journal_path(const char *filename)
+{
+	const char *base = buf_basename(filename);
+	char *path = malloc(strlen(filename) + 3);
+
+	if (path)
+		sprintf(path, "%.*s#%s#", (int)(base - filename), filename, base);
+	return path;
+}
+
+/* Drop what's recorded: the buffer's numrows rows are the journal's. */
+static void journal_forget(struct journal *j, int numrows)
+{
+	j->lo = j->tail = INT_MAX;
+	j->base = numrows;
+	free(j->pend);
+	j->pend = NULL;
+	j->len = j->cap = 0;
+	j->last = (size_t)-1;
+}
+
+/* Start over from the file on disk, removing the journal file. */
+static void journal_restart(int slot, struct journal *j, int numrows)
+{
+	if (j->created)
+		save_journal(slot, j->path, NULL, 0, JOURNAL_REMOVE);
+	j->created = j->failed = 0;
+	journal_forget(j, numrows);
+}
+
+void journal_free(struct journal *j)
+{
+	if (!j)
+		return;
+	free(j->pend);
+	free(j->path);
+	free(j);
+}
+
+static int journal_put(struct journal *j, const char *s, size_t len)
+{
+	if (j->len + len > j->cap) {
+		size_t cap = j->cap ? j->cap : 256;
+		char *p;
+
+		while (cap < j->len + len)
+			cap *= 2;
+		if (!(p = realloc(j->pend, cap)))
+			return -1;
+		j->pend = p;
+		j->cap = cap;
+	}
+	memcpy(j->pend + j->len, s, len);
+	j->len += len;
+	return 0;
+}
+
+/* Record rows [lo, lo+n) as replacing old rows at lo. */
+static int journal_record(struct journal *j, const erow *rows,
+                          int lo, int old, int n)
+{
+	char head[48];
+	int i;
+
+	if (!j->created) {
+		if (journal_put(j, journal_magic, sizeof(journal_magic) - 1))
+			return -1;
+		j->created = j->trunc = 1;
+	}
+	j->last = j->len;
+	j->last_lo = lo;
+	j->last_old = old;
+	j->last_new = n;
+	snprintf(head, sizeof(head), "@%d %d %d\n", lo, old, n);
+	if (journal_put(j, head, strlen(head)))
+		return -1;
+	for (i = lo; i < lo + n; i++)
+		if (journal_put(j, rows[i].chars, rows[i].size) ||
+		    journal_put(j, "\n", 1))
+			return -1;
+	return 0;
+}
+
+/* Record what changed in a buffer since the last record, numrows rows;
+ * or start over once it's unmodified. */
+static void journal_update(int slot, struct journal *j, const erow *rows,
+                           int numrows, int dirty)
+{
+	int lo = j->lo, old, n;
+
+	if (!dirty) {
+		journal_restart(slot, j, numrows);
+		return;
+	}
+	if (lo == INT_MAX || j->failed) {
+		j->lo = j->tail = INT_MAX;
+		j->base = numrows;
+		return;
+	}
+
+	old = j->base - lo - j->tail;
+	n = numrows - lo - j->tail;
+	if (j->base < 0 || old < 0 || n < 0) {
+		lo = 0;
+		old = -1;
+		n = numrows;
+	}
+	j->lo = j->tail = INT_MAX;
+	j->base = numrows;
+	if (!old && !n)
+		return;
+
+	/* Within the rows the last record wrote: write that one again. */
+	if (j->last != (size_t)-1 && j->len - j->last <= JOURNAL_MERGE &&
+	    lo >= j->last_lo && lo + old <= j->last_lo + j->last_new) {
+		n   = j->last_new + n - old;
+		old = j->last_old;
+		lo  = j->last_lo;
+		j->len = j->last;
+	}
+	if (journal_record(j, rows, lo, old, n))
+		j->failed = 1;
+}
+
+/* Hand a buffer's waiting records to the writer thread, unless the
+ * journal file is held. */
+static void journal_write(int slot, struct journal *j)
+{
+	if (j->held)
+		return;
+	save_journal(slot, j->path, j->pend, (int)j->len,
+	             j->trunc ? JOURNAL_CREATE : JOURNAL_APPEND);
+	j->pend = NULL;
+	j->len = j->cap = 0;
+	j->last = (size_t)-1;
+	j->trunc = 0;
+	j->written = time(NULL);
+}
+
+/* Let the user know when the file they just visited has a journal left
+ * over, and not one older than the file.  Returns 1 when it has. */
+static int journal_hint(const struct journal *j, const char *filename)
+{
+	struct stat js, fs;
+
+	if (stat(j->path, &js) != 0 ||
+	    (stat(filename, &fs) == 0 && js.st_mtime < fs.st_mtime))
+		return 0;
+	editor_set_status_message("%s has a recovery journal, "
+	                          "M-x recover-file to restore it",
+	                          buf_basename(filename));
+	return 1;
+}
+
+/* Between commands: record what the last one changed in the current
+ * buffer, giving a file's buffer its journal the first time round.
+ * Returns 1 when that has a message to show. */
+int journal_sync(void)
+{
+	struct journal *j = editor.journal;
+
+	if (!j) {
+		if (is_special_buffer(editor.filename))
+			return 0;
+		if (!(j = calloc(1, sizeof(*j))) ||
+		    !(j->path = journal_path(editor.filename))) {
+			free(j);
+			return 0;
+		}
+		journal_forget(j, editor.numrows);
+		editor.journal = j;
+		j->held = journal_hint(j, editor.filename);
+		return j->held;
+	}
+	journal_update(buf_current, j, editor.row, editor.numrows, editor.dirty);
+	if (j->len >= JOURNAL_BATCH)
+		journal_write(buf_current, j);
+	return 0;
+}
+
+/* The journal of buffer slot, with its rows and dirty count. */
+static struct journal *journal_of(int slot, const erow **rows, int *numrows,
+                                  int *dirty)
+{
+	struct editor_buffer *b = &buflist[slot];
+
+	if (slot == buf_current) {
+		*rows = editor.row;
+		*numrows = editor.numrows;
+		*dirty = editor.dirty;
+		return editor.journal;
+	}
+	*rows = b->row;
+	*numrows = b->numrows;
+	*dirty = b->dirty;
+	return b->active ? b->journal : NULL;
+}
+
+/* From the idle loop: write out records that have waited long enough. */
+void journal_poll(void)
+{
+	time_t now = time(NULL);
+	const erow *rows;
+	int i, numrows, dirty;
+
+	for (i = 0; i < buf_slots; i++) {
+		struct journal *j = journal_of(i, &rows, &numrows, &dirty);
+
+		if (!j)
+			continue;
+		journal_update(i, j, rows, numrows, dirty);
+		if (j->len && now - j->written >= JOURNAL_DELAY)
+			journal_write(i, j);
+	}
+}
+
+/* Whether records are waiting for journal_poll(). */
+int journal_pending(void)
+{
+	const erow *rows;
+	int i, numrows, dirty;
+
+	for (i = 0; i < buf_slots; i++) {
+		struct journal *j = journal_of(i, &rows, &numrows, &dirty);
+
+		if (j && j->len && !j->held)
+			return 1;
+	}
+	return 0;
+}
+
+/* Write out every record now, e.g. before exiting. */
+void journal_flush(void)
+{
+	const erow *rows;
+	int i, numrows, dirty;
+
+	for (i = 0; i < buf_slots; i++) {
+		struct journal *j = journal_of(i, &rows, &numrows, &dirty);
+
+		if (!j)
+			continue;
+		journal_update(i, j, rows, numrows, dirty);
+		if (j->len)
+			journal_write(i, j);
+	}
+}
+
+/* Buffer slot was just queued to be saved, maybe under a new name: its
+ * journal starts over from what will be on disk. */
+void journal_saved(int slot)
+{
+	const erow *rows;
+	int numrows, dirty;
+	struct journal *j = journal_of(slot, &rows, &numrows, &dirty);
+	const char *name = slot == buf_current ? editor.filename
+	                                       : buflist[slot].filename;
+	char *path;
+
+	if (!j)
+		return;
+	journal_restart(slot, j, numrows);
+	if ((path = journal_path(name))) {
+		free(j->path);
+		j->path = path;
+	}
+}
+
+/* Buffer slot was saved: a journal held for recovery is out of date
+ * now, and the buffer's own may replace it. */
+void journal_written(int slot)
+{
+	const erow *rows;
+	int numrows, dirty;
+	struct journal *j = journal_of(slot, &rows, &numrows, &dirty);
+
+	if (j)
+		j->held = 0;
+}
+
+/* Saving buffer slot failed after its journal started over: record the
+ * whole buffer again, as the file on disk is still the old one. */
+void journal_lost(int slot)
+{
+	const erow *rows;
+	int numrows, dirty;
+	struct journal *j = journal_of(slot, &rows, &numrows, &dirty);
+
+	if (!j)
+		return;
+	journal_forget(j, -1);
+	j->lo = j->tail = 0;
+	j->created = j->failed = 0;
+}
+
+/* A write to journal path of buffer slot failed: give up on it until the
+ * buffer is unmodified again. */
+void journal_failed(int slot, const char *path, int err)
+{
+	const erow *rows;
+	int numrows, dirty;
+	struct journal *j = journal_of(slot, &rows, &numrows, &dirty);
+
+	if (!j || strcmp(j->path, path) || j->failed)
+		return;
+	journal_forget(j, numrows);
+	j->failed = 1;
+	editor_set_status_message("Error writing %s: %s", path, strerror(err));
+}
+
+/* Parse a record's "@lo old new" line.  Returns where its lines start,
+ * or NULL when p doesn't hold a whole one. */
+static const char *journal_head(const char *p, const char *end,
+                                int *lo, int *old, int *n)
+{
+	const char *nl = memchr(p, '\n', end - p);
+	char line[48];
+
+	if (!nl || *p != '@' || nl - p >= (int)sizeof(line))
+		return NULL;
+	memcpy(line, p, nl - p);
+	line[nl - p] = '\0';
+	if (sscanf(line, "@%d %d %d", lo, old, n) != 3)
+		return NULL;
+	return nl + 1;
+}
+
+/* Replay a journal, len bytes of text, onto the current buffer.  A
+ * record that's cut short or doesn't fit ends the replay, as when kg
+ * died while writing it.  Returns 0 when all of it was replayed, 1 when
+ * only some records were, and -1 when none were. */
+int journal_replay(const char *text, size_t len)
+{
+	const char *end = text + len, *start, *stop, *p, *q;
+	size_t mlen = sizeof(journal_magic) - 1;
+	int lo, old, n, i, rows;
+
+	if (len < mlen || memcmp(text, journal_magic, mlen))
+		return -1;
+
+	/* Find how far it replays before touching any row. */
+	start = text + mlen;
+	rows = editor.numrows;
+	for (stop = start; stop < end; stop = p) {
+		if (!(p = journal_head(stop, end, &lo, &old, &n)))
+			break;
+		if (old < 0)
+			old = rows - lo;
+		if (lo < 0 || lo > rows || old < 0 || old > rows - lo || n < 0)
+			break;
+		for (i = 0; i < n && (q = memchr(p, '\n', end - p)); i++)
+			p = q + 1;
+		if (i < n)
+			break;
+		rows += n - old;
+	}
+	if (stop == start && stop < end)
+		return -1;
+
+	for (p = start; p < stop; ) {
+		p = journal_head(p, end, &lo, &old, &n);
+		if (old < 0)
+			old = editor.numrows - lo;
+		for (i = 0; i < n; i++) {
+			q = memchr(p, '\n', end - p);
+			if (i < old)
+				editor_row_set_chars(&editor.row[lo + i], p, q - p);
+			else
+				editor_insert_row(lo + i, p, q - p);
+			p = q + 1;
+		}
+		for (i = n; i < old; i++)
+			editor_del_row(lo + n);
+	}
+	return stop < end;
+}
+
+/* Replace the current buffer with its file plus the edits in the file's
+ * journal (M-x recover-file). */
+void editor_recover_file(int fd)
+{
+	struct file_text ft;
+	struct stat js, fs;
+	char *path;
+	int answer, rc;
+
+	if (is_special_buffer(editor.filename)) {
+		editor_set_status_message("Buffer is not visiting a file");
+		return;
+	}
+	if (!(path = journal_path(editor.filename))) {
+		editor_set_status_message("Out of memory");
+		return;
+	}
+	if (stat(path, &js) != 0) {
+		editor_set_status_message("No recovery journal for %s",
+		                          editor.filename);
+		goto done;
+	}
+	if (stat(editor.filename, &fs) == 0 && fs.st_mtime > js.st_mtime) {
+		editor_set_status_message("%s is newer than its journal",
+		                          editor.filename);
+		goto done;
+	}
+	editor_set_status_message("Recover %s from %s? (y/n) ",
+	                          editor.filename, path);
+	editor_refresh_screen();
+	answer = editor_read_key(fd);
+	if (answer != 'y' && answer != 'Y') {
+		editor_set_status_message("");
+		goto done;
+	}
+
+	/* Our own records may still be on their way there, unless the
+	 * journal is held. */
+	journal_flush();
+	save_wait();
+	if (file_text_read(path, &ft)) {
+		editor_set_status_message("Cannot read %s: %s", path,
+		                          strerror(ft.err));
+		goto done;
+	}
+
+	editor.cx = editor.cy = editor.rowoff = editor.coloff = 0;
+	buf_reload_from_disk();
+	suppress_undo = 1;
+	rc = journal_replay(ft.buf, ft.len);
+	suppress_undo = 0;
+	file_text_free(&ft);
+	if (rc < 0) {
+		editor_set_status_message("%s does not fit %s", path,
+		                          editor.filename);
+		goto done;
+	}
+
+	/* The buffer is what the journal says now, so it goes on from here;
+	 * no undo takes it back to what's on disk. */
+	editor.dirty++;
+	undostack.clean_size = -1;
+	if (editor.journal) {
+		journal_forget(editor.journal, editor.numrows);
+		editor.journal->created = 1;
+		editor.journal->held = 0;
+	}
+	editor_set_status_message(rc ? "Recovered %s, the last edits were cut short"
+	                             : "Recovered %s", editor.filename);
+done:
+	free(path);
+}
@@ -100,11 +100,14 @@ static void editor_quit(int fd)
 	 * save prompt cancels the quit. */
 	if (buf_save_all(fd))
 		return;
+	save_wait();
 
 	/* Count what the user left unsaved.  buf_save_all flushed the current
-	 * buffer into its slot, so every slot's dirty flag is authoritative. */
-	for (i = 0; i < MAX_BUFFERS; i++) {
-		if (!buflist[i].active || !buflist[i].dirty) continue;
+	 * buffer into its slot, but the saves landing since settled it live. */
+	for (i = 0; i < buf_slots; i++) {
+		int dirty = i == buf_current ? editor.dirty : buflist[i].dirty;
+
+		if (!buflist[i].active || !dirty) continue;
 		if (is_special_buffer(buflist[i].filename)) continue;
 		ndirty++;
 	}
@@ -121,6 +124,22 @@ static void editor_quit(int fd)
 			return;
 		}
 	}
+
+	if (shell_async_running()) {
+		int answer;
+		editor_set_status_message("A shell command is running, kill it and exit? (y/n) ");
+		editor_refresh_screen();
+		answer = editor_read_key(fd);
+		if (answer != 'y' && answer != 'Y') {
+			editor_set_status_message("");
+			return;
+		}
+		shell_async_stop();
+	}
+
+	/* What's left unsaved stays in its journal. */
+	journal_flush();
+	save_wait();
 	running = 0;
 }
 
@@ -292,7 +311,8 @@ void editor_process_keypress(int fd)
 	 * at point.  Editing itself is refused by the mutation commands, which
 	 * bail via editor_readonly_blocked(). */
 	if (editor.readonly && c == ENTER) {
-		buf_ibuffer_select();
+		if (!editor_occur_goto() && !editor_grep_goto())
+			buf_ibuffer_select();
 		return;
 	}
 
@@ -344,6 +364,8 @@ void editor_process_keypress(int fd)
 		editor.rect_mode = 0;
 		editor_snap_cx_to_row();
 		editor_set_status_message("");
+		if (shell_async_interrupt())
+			editor_set_status_message("Killing shell command");
 		break;
 	case CTRL_K:        /* Kill line */
 		if (n > 1) {
@@ -389,10 +411,16 @@ void editor_process_keypress(int fd)
 		while (n--) editor_move_cursor(ARROW_UP);
 		break;
 	case CTRL_S:        /* Incremental search forward */
-		editor_find(fd, 1);
+		editor_find(fd, 1, 0);
 		break;
 	case CTRL_R:        /* Incremental search backward */
-		editor_find(fd, -1);
+		editor_find(fd, -1, 0);
+		break;
+	case ALT_CTRL_S:    /* Regexp search forward */
+		editor_find(fd, 1, 1);
+		break;
+	case ALT_CTRL_R:    /* Regexp search backward */
+		editor_find(fd, -1, 1);
 		break;
 	case CTRL_Q: {
 		int key;
@@ -592,7 +620,7 @@ void editor_process_keypress(int fd)
 		editor_reflow_paragraph();
 		break;
 	case ALT_PCT:       /* Query replace */
-		editor_query_replace(fd);
+		editor_query_replace(fd, 0);
 		break;
 	case ALT_SEMICOLON: /* Toggle line comment */
 		editor_comment_dwim();
@@ -618,6 +646,9 @@ void editor_process_keypress(int fd)
 	case ALT_PIPE:      /* Shell command on region */
 		editor_shell_command_on_region(fd);
 		break;
+	case ALT_AMP:       /* Async shell command */
+		editor_async_shell_command(fd);
+		break;
 	case KEY_F1:        /* F1: Help */
 		buf_open_help();
 		break;
@@ -11,6 +11,7 @@ static int macro_recording = 0;
 static int macro_replaying = 0;
 
 int macro_is_recording(void) { return macro_recording; }
+int macro_is_replaying(void) { return macro_replaying; }
 
 /* Forget any recorded macro and recording/replay state.  Used by the
  * fuzz harness to give every input a clean slate. */
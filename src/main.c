@@ -39,6 +39,7 @@ int suppress_undo = 0;
 int global_auto_revert = 0;
 int make_backup_files = 1;
 int require_final_newline = 0;
+int display_line_numbers = LINE_NUMBERS_OFF;
 
 void init_editor(void)
 {
@@ -67,6 +68,7 @@ void init_editor(void)
 	editor.disk_size = 0;
 	editor.disk_changed = 0;
 	editor.auto_revert = 0;
+	editor.follow = 0;
 	editor.backed_up = 0;
 	editor.prefix_pending = 0;
 	editor.prefix_arg = 0;
@@ -81,7 +83,7 @@ void init_editor(void)
 
 	/* SA_RESTART so a resize doesn't interrupt a blocked read into the
 	 * quit-on-error path; the handler only raises a flag, and the main
-	 * loop and the idle read drain it within a read timeout. */
+	 * loop and the idle wait (whose poll() it does interrupt) drain it. */
 	{
 		struct sigaction sa;
 		memset(&sa, 0, sizeof(sa));
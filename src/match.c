@@ -0,0 +1,164 @@
+/* ============================ Substring search ============================ */
+
+#include "def.h"
+
+/* Shared by isearch, query replace and the lazy highlight.  A needle is
+ * compiled once per query: the pattern is case-folded up front when the
+ * search folds, Horspool shift tables are built for both directions, and
+ * the byte least likely to occur in text is picked for a memchr()
+ * prefilter -- libc's memchr is vectorised, so a search for something
+ * rare runs at close to memory bandwidth.  Folding is ASCII-only, as
+ * tolower() was in the C locale kg runs in. */
+
+static unsigned char fold_tab[256];
+
+/* Bytes in rough order of decreasing frequency in source code and logs.
+ * Anything not listed is considered rare. */
+static const char common_bytes[] =
+	" etaoinsrhldcumfpgwybvkxjqz"
+	"0123456789ETAOINSRHLDCUMFPGWYBVKXJQZ"
+	"\t,.-_/()=;:\"'{}[]<>*+#";
+
+static void fold_init(void)
+{
+	int c;
+
+	if (fold_tab['A'] == 'a')
+		return;
+	for (c = 0; c < 256; c++)
+		fold_tab[c] = (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+}
+
+/* Higher means more common, so a worse prefilter byte. */
+static int byte_rank(unsigned char c)
+{
+	const char *p = c ? strchr(common_bytes, c) : NULL;
+
+	return p ? (int)(sizeof(common_bytes) - (p - common_bytes)) : 0;
+}
+
+static int is_alpha(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* Compile pat[0..len) into n.  Returns 0, or -1 when out of memory. */
+int needle_init(struct needle *n, const char *pat, int len, int fold)
+{
+	int i, best = -1;
+
+	fold_init();
+	memset(n, 0, sizeof(*n));
+	n->pat = malloc(len + 1);
+	if (!n->pat)
+		return -1;
+	for (i = 0; i < len; i++)
+		n->pat[i] = fold ? fold_tab[(unsigned char)pat[i]] : pat[i];
+	n->pat[len] = '\0';
+	n->len  = len;
+	n->fold = fold;
+
+	for (i = 0; i < 256; i++)
+		n->fwd[i] = n->bwd[i] = len;
+	for (i = 0; i < len - 1; i++)
+		n->fwd[n->pat[i]] = len - 1 - i;
+	for (i = len - 1; i > 0; i--)
+		n->bwd[n->pat[i]] = i;
+
+	/* A letter can't be the prefilter byte when folding: memchr()
+	 * would miss the other case. */
+	n->rare = -1;
+	for (i = 0; i < len; i++) {
+		if (fold && is_alpha(n->pat[i]))
+			continue;
+		if (best < 0 || byte_rank(n->pat[i]) < best) {
+			best = byte_rank(n->pat[i]);
+			n->rare = i;
+		}
+	}
+	return 0;
+}
+
+void needle_free(struct needle *n)
+{
+	free(n->pat);
+	n->pat = NULL;
+	n->len = 0;
+}
+
+static int needle_eq(const struct needle *n, const unsigned char *h, int len)
+{
+	int i;
+
+	if (!n->fold)
+		return memcmp(h, n->pat, len) == 0;
+	for (i = 0; i < len; i++)
+		if (fold_tab[h[i]] != n->pat[i])
+			return 0;
+	return 1;
+}
+
+/* Offset of the first match in hay[0..hlen), or -1. */
+int needle_find(const struct needle *n, const char *hay, int hlen)
+{
+	const unsigned char *h = (const unsigned char *)hay;
+	int m = n->len, pos = 0;
+
+	if (m == 0)
+		return 0;
+	if (m > hlen)
+		return -1;
+
+	if (n->rare >= 0) {
+		int r = n->rare, misses = 0;
+
+		/* Jump between occurrences of the rare byte and verify.
+		 * When it keeps turning up without a match -- the "rare"
+		 * byte is common in this text -- hand over to Horspool. */
+		while (pos <= hlen - m) {
+			const unsigned char *p = memchr(h + pos + r, n->pat[r],
+			                                hlen - m - pos + 1);
+			if (!p)
+				return -1;
+			pos = p - h - r;
+			if (needle_eq(n, h + pos, m))
+				return pos;
+			pos++;
+			if (++misses > 8 && misses * 32 > pos)
+				break;
+		}
+	}
+
+	while (pos <= hlen - m) {
+		unsigned char last = h[pos + m - 1];
+
+		if (n->fold)
+			last = fold_tab[last];
+		if (last == n->pat[m - 1] && needle_eq(n, h + pos, m - 1))
+			return pos;
+		pos += n->fwd[last];
+	}
+	return -1;
+}
+
+/* Offset of the rightmost match lying wholly inside hay[0..hlen), or -1.
+ * Scans right to left, so the cost depends on the distance back to the
+ * match rather than on the length of hay. */
+int needle_rfind(const struct needle *n, const char *hay, int hlen)
+{
+	const unsigned char *h = (const unsigned char *)hay;
+	int m = n->len, pos;
+
+	if (m == 0)
+		return hlen;
+	for (pos = hlen - m; pos >= 0; ) {
+		unsigned char first = h[pos];
+
+		if (n->fold)
+			first = fold_tab[first];
+		if (first == n->pat[0] && needle_eq(n, h + pos, m))
+			return pos;
+		pos -= n->bwd[first];
+	}
+	return -1;
+}
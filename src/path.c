@@ -23,24 +23,6 @@ int editor_picker_match_rank(const char *haystack, const char *needle)
 	return -1;
 }
 
-/* qsort comparator state: the typed needle that ranked these entries.
- * Set just before qsort, cleared after, so the comparator can keep
- * prefix matches above mid-name matches without an extra rank field
- * in the struct exposed by def.h. */
-static const char *path_cmp_needle;
-
-static int path_entry_cmp(const void *a, const void *b)
-{
-	const struct path_entry *pa = a, *pb = b;
-
-	if (path_cmp_needle && *path_cmp_needle) {
-		int ra = editor_picker_match_rank(pa->name, path_cmp_needle);
-		int rb = editor_picker_match_rank(pb->name, path_cmp_needle);
-		if (ra != rb) return ra - rb;
-	}
-	return strcmp(pa->name, pb->name);
-}
-
 /* Expand a leading "~" or "~/" in `buf` to $HOME, in place.  No-op for
  * "~user/" forms or when $HOME isn't set or the result wouldn't fit. */
 void editor_path_expand_tilde(char *buf, int bufsize)
@@ -81,6 +63,182 @@ void editor_path_split(const char *path, char *dir, int dsize, char *file, int f
 	snprintf(file, fsize, "%s", buf_basename(path));
 }
 
+/* Directory listings for the C-x C-f picker, cached so a keystroke in
+ * the prompt doesn't re-read a 50k-entry directory (or one on NFS) from
+ * scratch.  A listing is read and sorted once, then reused as long as a
+ * stat() of the directory shows it unchanged.  The matches of the last
+ * query are kept too: a query that extends it can only match a subset of
+ * them, so typing narrows an ever shorter list instead of the whole
+ * directory. */
+#define PATH_CACHE_DIRS 4
+
+#ifdef __APPLE__
+#define PATH_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define PATH_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
+struct path_dir {
+	char   *path;               /* directory as given, NULL when unused */
+	time_t  mtime;              /* what stat() said when it was read */
+	long    mtime_ns;
+	off_t   size;
+	ino_t   ino;
+	char   *names;              /* entry names, NUL separated */
+	int    *name;               /* sorted by name: offsets into names */
+	signed char *is_dir;        /* per entry: 1, 0, or -1 until stat()ed */
+	int     n;
+	int    *match;              /* entries matching query, still sorted */
+	int     nmatch;
+	char    query[PATH_ENTRY_NAME_MAX];
+	unsigned used;              /* for evicting the least recently used */
+};
+
+static struct path_dir path_cache[PATH_CACHE_DIRS];
+static unsigned path_clock;
+
+static void path_dir_free(struct path_dir *d)
+{
+	free(d->path);
+	free(d->names);
+	free(d->name);
+	free(d->is_dir);
+	free(d->match);
+	memset(d, 0, sizeof(*d));
+}
+
+static const char *path_sort_names;
+
+static int path_name_cmp(const void *a, const void *b)
+{
+	return strcmp(path_sort_names + *(const int *)a,
+	              path_sort_names + *(const int *)b);
+}
+
+/* Read directory dir, as described by st, into d.  Each name is stored
+ * after a byte holding its d_type, which goes into is_dir once the names
+ * are sorted.  ".." is kept, for a query starting with '.' to offer. */
+static int path_dir_read(struct path_dir *d, const char *dir,
+                         const struct stat *st)
+{
+	struct dirent *de;
+	size_t len = 0, cap = 4096;
+	int i, n = 0, ncap = 256;
+	DIR *dp;
+
+	dp = opendir(dir[0] ? dir : ".");
+	if (!dp) return -1;
+
+	d->path  = strdup(dir);
+	d->names = malloc(cap);
+	d->name  = malloc(ncap * sizeof(*d->name));
+	if (!d->path || !d->names || !d->name)
+		goto fail;
+	while ((de = readdir(dp)) != NULL) {
+		size_t nlen = strlen(de->d_name);
+
+		if (!strcmp(de->d_name, "."))
+			continue;
+		if (nlen >= PATH_ENTRY_NAME_MAX)
+			nlen = PATH_ENTRY_NAME_MAX - 1;
+		while (len + nlen + 2 > cap) {
+			char *p = realloc(d->names, cap * 2);
+
+			if (!p) goto fail;
+			d->names = p;
+			cap *= 2;
+		}
+		if (n == ncap) {
+			int *p = realloc(d->name, 2 * ncap * sizeof(*p));
+
+			if (!p) goto fail;
+			d->name = p;
+			ncap *= 2;
+		}
+		d->names[len++] = (char)de->d_type;
+		memcpy(d->names + len, de->d_name, nlen);
+		d->names[len + nlen] = '\0';
+		d->name[n++] = (int)len;
+		len += nlen + 1;
+	}
+	closedir(dp);
+	dp = NULL;
+
+	d->n      = n;
+	d->is_dir = malloc(n ? n : 1);
+	d->match  = malloc((n ? n : 1) * sizeof(*d->match));
+	if (!d->is_dir || !d->match)
+		goto fail;
+	path_sort_names = d->names;
+	qsort(d->name, n, sizeof(*d->name), path_name_cmp);
+	path_sort_names = NULL;
+	for (i = 0; i < n; i++) {
+		unsigned char type = d->names[d->name[i] - 1];
+
+		d->is_dir[i] = type == DT_DIR ? 1 : type == DT_UNKNOWN ? -1 : 0;
+	}
+
+	d->mtime    = st->st_mtime;
+	d->mtime_ns = PATH_MTIME_NSEC(*st);
+	d->size     = st->st_size;
+	d->ino      = st->st_ino;
+	d->nmatch   = -1;           /* no query yet */
+	return 0;
+fail:
+	if (dp) closedir(dp);
+	path_dir_free(d);
+	return -1;
+}
+
+/* The cached listing of dir, read afresh when it is new or has changed
+ * since.  NULL when the directory can't be read. */
+static struct path_dir *path_dir_get(const char *dir)
+{
+	struct path_dir *d, *lru = &path_cache[0];
+	struct stat st;
+	int i;
+
+	if (stat(dir[0] ? dir : ".", &st) != 0)
+		return NULL;
+	for (i = 0; i < PATH_CACHE_DIRS; i++) {
+		d = &path_cache[i];
+		if (d->path && !strcmp(d->path, dir)) {
+			if (d->mtime == st.st_mtime &&
+			    d->mtime_ns == PATH_MTIME_NSEC(st) &&
+			    d->size == st.st_size && d->ino == st.st_ino) {
+				d->used = ++path_clock;
+				return d;
+			}
+			lru = d;
+			break;
+		}
+		if (lru->path && (!d->path || d->used < lru->used))
+			lru = d;
+	}
+	path_dir_free(lru);
+	if (path_dir_read(lru, dir, &st))
+		return NULL;
+	lru->used = ++path_clock;
+	return lru;
+}
+
+/* Whether cached entry i of d is a directory, stat()ing it the first time
+ * when readdir couldn't tell. */
+static int path_dir_is_dir(struct path_dir *d, int i)
+{
+	if (d->is_dir[i] < 0) {
+		char full[PATH_MAX];
+		struct stat st;
+		int n = snprintf(full, sizeof(full), "%s%s",
+		                 d->path[0] ? d->path : "./",
+		                 d->names + d->name[i]);
+
+		d->is_dir[i] = n < (int)sizeof(full) && stat(full, &st) == 0 &&
+		               S_ISDIR(st.st_mode);
+	}
+	return d->is_dir[i];
+}
+
 /* Scan `dir` for entries that match `prefix` as either a leading or a
  * mid-name substring.  Returns the total number of matches (or -1 on
  * opendir failure); writes the first `max` of them into `entries[]`,
@@ -88,74 +246,157 @@ void editor_path_split(const char *path, char *dir, int dsize, char *file, int f
  * within each group.  Computes the longest common prefix into `lcp`
  * when non-NULL, considering only the prefix-matched group (mid-name
  * matches share no leading text worth Tab-extending to).  Dotfiles
- * are hidden unless `prefix` itself starts with '.'. */
+ * (and "..") are hidden unless `prefix` itself starts with '.', and
+ * recovery journals unless it starts with '#'. */
 int editor_path_complete_entries(const char *dir, const char *prefix,
                                  struct path_entry *entries, int max,
                                  char *lcp, int lcp_size)
 {
-	struct dirent *de;
-	DIR *dp;
-	int matches = 0;
-	int prefix_matches = 0;
-	int filled = 0;
-	int lcp_len = 0;
-	int i;
+	struct path_dir *d = path_dir_get(dir);
+	size_t qlen = strlen(prefix), prev;
+	int i, pass, filled = 0, nmatch = 0;
+	int first = -1, last = -1;      /* prefix matches, alphabetically */
 
 	if (lcp) lcp[0] = '\0';
+	if (!d) return -1;
 
-	dp = opendir(dir[0] ? dir : ".");
-	if (!dp) return -1;
+	/* Narrow the last query's matches when this one extends it and
+	 * agrees on dotfiles; otherwise start over from every entry. */
+	prev = d->nmatch < 0 ? 0 : strlen(d->query);
+	if (d->nmatch >= 0 && qlen >= prev && qlen < sizeof(d->query) &&
+	    !strncmp(prefix, d->query, prev) &&
+	    (prev > 0 || (prefix[0] != '.' && prefix[0] != '#'))) {
+		for (i = 0; i < d->nmatch; i++) {
+			int e = d->match[i];
 
-	while ((de = readdir(dp)) != NULL) {
-		const char *name = de->d_name;
-		int rank;
+			if (editor_picker_match_rank(d->names + d->name[e], prefix) >= 0)
+				d->match[nmatch++] = e;
+		}
+	} else {
+		for (i = 0; i < d->n; i++) {
+			const char *name = d->names + d->name[i];
 
-		if (name[0] == '.' && (name[1] == '\0' || prefix[0] != '.'))
-			continue;
-		rank = editor_picker_match_rank(name, prefix);
-		if (rank < 0) continue;
-
-		matches++;
-
-		if (rank == 0 && lcp) {
-			prefix_matches++;
-			if (prefix_matches == 1) {
-				snprintf(lcp, lcp_size, "%s", name);
-				lcp_len = (int)strlen(lcp);
-			} else {
-				for (i = 0; i < lcp_len && name[i] && lcp[i] == name[i]; i++)
-					;
-				lcp_len = i;
-				lcp[lcp_len] = '\0';
+			if (name[0] == '.' && prefix[0] != '.')
+				continue;
+			if (is_journal_name(name) && prefix[0] != '#')
+				continue;
+			if (editor_picker_match_rank(name, prefix) >= 0)
+				d->match[nmatch++] = i;
+		}
+	}
+	d->nmatch = nmatch;
+	if (qlen < sizeof(d->query))
+		memcpy(d->query, prefix, qlen + 1);
+	else
+		d->nmatch = -1;     /* too long to remember: start over next time */
+
+	/* Prefix matches first, then mid-name ones, each already sorted. */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < nmatch; i++) {
+			int e = d->match[i];
+			const char *name = d->names + d->name[e];
+			struct path_entry *pe;
+
+			if (editor_picker_match_rank(name, prefix) != pass)
+				continue;
+			if (pass == 0) {
+				if (first < 0) first = e;
+				last = e;
 			}
+			if (!entries || filled >= max)
+				continue;
+			pe = &entries[filled++];
+			snprintf(pe->name, sizeof(pe->name), "%s", name);
+			pe->is_dir = path_dir_is_dir(d, e);
 		}
+	}
 
-		if (entries && filled < max) {
-			struct path_entry *e = &entries[filled++];
-			size_t nlen = strlen(name);
-			if (nlen >= sizeof(e->name)) nlen = sizeof(e->name) - 1;
-			memcpy(e->name, name, nlen);
-			e->name[nlen] = '\0';
-			e->is_dir = (de->d_type == DT_DIR);
-			/* DT_UNKNOWN: fall back to stat(). */
-			if (de->d_type == DT_UNKNOWN) {
-				char full[PATH_MAX];
-				struct stat st;
-				int n = snprintf(full, sizeof(full), "%s%s",
-				                 dir[0] ? dir : "./", name);
-				if (n < (int)sizeof(full) && stat(full, &st) == 0 &&
-				    S_ISDIR(st.st_mode))
-					e->is_dir = 1;
+	/* The longest prefix all prefix matches share is the one the first
+	 * and the last of them, alphabetically, have in common. */
+	if (lcp && first >= 0) {
+		const char *a = d->names + d->name[first];
+		const char *b = d->names + d->name[last];
+
+		for (i = 0; a[i] && a[i] == b[i]; i++)
+			;
+		snprintf(lcp, lcp_size, "%.*s", i, a);
+	}
+	return nmatch;
+}
+
+#define PATH_WALK_MAX_DEPTH 64
+
+/* Whether directory name is on the caller's NULL-terminated skip list. */
+static int path_walk_skip(const char *name, const char *const *skip)
+{
+	for (; skip && *skip; skip++)
+		if (!strcmp(name, *skip))
+			return 1;
+	return 0;
+}
+
+static int path_walk(char *path, int len, int depth, const char *const *skip,
+                     int (*fn)(const char *path, void *arg), void *arg)
+{
+	struct dirent *de;
+	DIR *dp;
+	int stop = 0;
+
+	if (depth > PATH_WALK_MAX_DEPTH)
+		return 0;
+	dp = opendir(path);
+	if (!dp)
+		return depth ? 0 : -1;
+
+	while (!stop && (de = readdir(dp)) != NULL) {
+		const char *name = de->d_name;
+		int n, is_dir = de->d_type == DT_DIR;
+		int is_file = de->d_type == DT_REG;
+		struct stat st;
+
+		if (name[0] == '.' || is_journal_name(name))
+			continue;
+		n = snprintf(path + len, PATH_MAX - len, "%s%s",
+		             len && path[len - 1] != '/' ? "/" : "", name);
+		if (n >= PATH_MAX - len)
+			continue;
+
+		/* DT_UNKNOWN: fall back to lstat().  A link to a file is
+		 * searched, a link to a directory is not followed, so a
+		 * cycle of links can't send the walk round forever. */
+		if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK) {
+			is_dir = is_file = 0;
+			if (lstat(path, &st) == 0 && !S_ISLNK(st.st_mode)) {
+				is_dir  = S_ISDIR(st.st_mode);
+				is_file = S_ISREG(st.st_mode);
+			} else if (stat(path, &st) == 0) {
+				is_file = S_ISREG(st.st_mode);
 			}
 		}
+
+		if (is_dir && !path_walk_skip(name, skip))
+			stop = path_walk(path, len + n, depth + 1, skip, fn, arg);
+		else if (is_file)
+			stop = fn(path, arg);
 	}
+	path[len] = '\0';
 	closedir(dp);
+	return stop;
+}
 
-	if (entries && filled > 0) {
-		path_cmp_needle = prefix;
-		qsort(entries, filled, sizeof(*entries), path_entry_cmp);
-		path_cmp_needle = NULL;
-	}
+/* Call fn(path, arg) for every regular file under dir, recursively, in
+ * directory order.  Dotfiles and dot directories (.git and friends) are
+ * skipped, and so are recovery journals, links to directories and the
+ * directories named in skip, a NULL-terminated list or NULL for none.
+ * fn returns nonzero to stop the walk.
+ * Returns 0, 1 when fn stopped it, or -1 when dir can't be opened. */
+int editor_path_walk(const char *dir, const char *const *skip,
+                     int (*fn)(const char *path, void *arg), void *arg)
+{
+	char path[PATH_MAX];
+	int len = snprintf(path, sizeof(path), "%s", dir[0] ? dir : ".");
 
-	return matches;
+	if (len >= (int)sizeof(path))
+		return -1;
+	return path_walk(path, len, 0, skip, fn, arg);
 }
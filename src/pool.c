@@ -0,0 +1,141 @@
+/* ============================ Worker pool ================================= */
+
+#include "def.h"
+#include <pthread.h>
+
+/* A fixed set of worker threads, one per online CPU, started the first
+ * time something asks for them.  Work comes in batches: pool_start()
+ * hands out tasks 0..n-1 of a function to whichever worker is free and
+ * returns at once, so the UI thread can keep an eye on the keyboard in
+ * pool_wait() while the workers run.  One batch at a time: while one is
+ * running, pool_start() refuses another and the caller works inline.
+ *
+ * Stopping early is up to the task function: it should check whatever
+ * cancel flag its batch carries and return quickly, and the remaining
+ * tasks then drain in no time. */
+
+#define POOL_MAX_THREADS 64
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  work;       /* a batch has tasks to hand out */
+	pthread_cond_t  done;       /* the last task of a batch finished */
+	pthread_t threads[POOL_MAX_THREADS];
+	int nthreads;
+	int failed;                 /* couldn't start: run everything inline */
+	void (*fn)(void *arg, int task, int worker);
+	void *arg;
+	int ntasks, next, pending;
+} pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, { 0 }, 0, 0, NULL, NULL, 0, 0, 0
+};
+
+static void *pool_worker(void *p)
+{
+	int worker = (int)(intptr_t)p;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		void (*fn)(void *, int, int);
+		void *arg;
+		int task;
+
+		while (pool.next >= pool.ntasks)
+			pthread_cond_wait(&pool.work, &pool.lock);
+		task = pool.next++;
+		fn   = pool.fn;
+		arg  = pool.arg;
+		pthread_mutex_unlock(&pool.lock);
+
+		fn(arg, task, worker);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.pending == 0)
+			pthread_cond_broadcast(&pool.done);
+	}
+	return NULL;
+}
+
+/* Number of workers, starting them on first use.  0 when threads are
+ * unavailable, in which case callers should just do the work inline. */
+int pool_size(void)
+{
+	sigset_t all, old;
+	long ncpu;
+	int i;
+
+	if (pool.nthreads || pool.failed)
+		return pool.nthreads;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1) ncpu = 1;
+	if (ncpu > POOL_MAX_THREADS) ncpu = POOL_MAX_THREADS;
+
+	/* Workers must not take SIGWINCH, SIGCONT and friends: the
+	 * handlers assume they run on the UI thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < ncpu; i++) {
+		if (pthread_create(&pool.threads[i], NULL, pool_worker,
+		                   (void *)(intptr_t)i))
+			break;
+		pthread_detach(pool.threads[i]);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	pool.nthreads = i;
+	if (i == 0)
+		pool.failed = 1;
+	return pool.nthreads;
+}
+
+/* Run fn(arg, task, worker) for every task in [0, ntasks) on the pool and
+ * return without waiting.  worker is in [0, pool_size()), so fn can keep
+ * per-worker state in an array.  Returns 0, or -1 when there is no pool
+ * or it is busy with another batch; the caller then does the work itself. */
+int pool_start(void (*fn)(void *arg, int task, int worker), void *arg, int ntasks)
+{
+	if (pool_size() == 0)
+		return -1;
+
+	pthread_mutex_lock(&pool.lock);
+	if (pool.pending > 0) {
+		pthread_mutex_unlock(&pool.lock);
+		return -1;
+	}
+	pool.fn      = fn;
+	pool.arg     = arg;
+	pool.next    = 0;
+	pool.ntasks  = ntasks;
+	pool.pending = ntasks;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+	return 0;
+}
+
+/* Wait up to timeout_ms for the batch to finish.  Returns 1 once every
+ * task has returned, 0 on timeout. */
+int pool_wait(int timeout_ms)
+{
+	struct timespec until;
+	int finished;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec  += timeout_ms / 1000;
+	until.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.pending > 0 &&
+	       pthread_cond_timedwait(&pool.done, &pool.lock, &until) == 0)
+		;
+	finished = pool.pending == 0;
+	if (finished)
+		pool.ntasks = pool.next = 0;
+	pthread_mutex_unlock(&pool.lock);
+	return finished;
+}
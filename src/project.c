@@ -0,0 +1,576 @@
+/* ========================== Find file in project ========================== */
+
+#include "def.h"
+#include <pthread.h>
+#include <poll.h>
+
+/* M-x find-file-in-project: open any file below the project root by typing
+ * a few letters of its path.  The tree is crawled on a thread of its own
+ * into a compact index -- the relative paths packed into large chunks,
+ * plus per file a 64-bit mask of the characters in it -- and the picker
+ * ranks whatever has been found so far while the crawl goes on.
+ *
+ * Ranking is a fuzzy subsequence match.  The masks go first: a path that
+ * lacks any character of the query can't match, and that test is a tight
+ * loop over a flat array the compiler can vectorise, so only the paths
+ * that survive it are scored.  A query that extends the previous one
+ * re-scores just the previous matches.
+ *
+ * The picker sleeps in poll() on the terminal and on a pipe the crawl
+ * writes to every PROJECT_POLL_MS or so while it finds files, so it
+ * redraws as they come in and costs nothing while the user thinks.
+ * Build output (build, node_modules, ...) is not indexed: nobody means
+ * to open those, though grep-project still searches them. */
+
+#define PROJECT_BLOCK      4096        /* files per index block */
+#define PROJECT_MAX_BLOCKS 256         /* so at most ~1M files */
+#define PROJECT_CHUNK      (1 << 20)   /* bytes per chunk of path text */
+#define PROJECT_MAX_CHUNKS 1024
+#define PROJECT_MAX_RANK   PICKER_MAX_ENTRIES
+#define PROJECT_STALE_SEC  30          /* crawl again after this long */
+#define PROJECT_POLL_MS    100         /* picker refresh while crawling */
+
+/* Directories full of generated files nobody means to open. */
+static const char *const project_skip[] = {
+	"build", "_build", "node_modules", "__pycache__", NULL
+};
+
+/* Score weights, see project_fuzzy(). */
+#define SCORE_MATCH        16
+#define BONUS_CONSECUTIVE  16
+#define BONUS_COMPONENT    16          /* first character of a path component */
+#define BONUS_WORD         12          /* after _ - . or at a camelCase hump */
+#define BONUS_BASENAME     48          /* the whole query is in the file name */
+
+struct project_block {
+	uint64_t mask[PROJECT_BLOCK];       /* characters present, see project_bit() */
+	const char *path[PROJECT_BLOCK];    /* relative to the root */
+	unsigned short len[PROJECT_BLOCK];
+	unsigned short base[PROJECT_BLOCK]; /* offset of the file name in path */
+};
+
+struct project_index {
+	char root[PATH_MAX];
+	int rootlen;
+	pthread_t thread;
+	int started;                /* thread to join */
+	int wake[2];                /* crawl -> picker: more files, or done */
+	struct timespec woke;       /* crawl thread's last write to wake */
+	time_t when;                /* crawl started */
+	pthread_mutex_t lock;
+	int count;                  /* files published to the picker, under lock */
+	int done;                   /* crawl over, under lock */
+	int cancel;                 /* under lock */
+	int nfiles;                 /* crawl thread's own count */
+	int truncated;
+	struct project_block *block[PROJECT_MAX_BLOCKS];
+	char *chunk[PROJECT_MAX_CHUNKS];
+	int nchunks;
+	size_t chunk_used;
+
+	/* Ranking state, picker side: the last query and the files among
+	 * the first `scanned` that matched it. */
+	char query[256];
+	int qlen, fold;
+	int *match;
+	int nmatch, matchcap, scanned;
+};
+
+static struct project_index *project;   /* kept between invocations */
+
+static int project_bit(unsigned char c)
+{
+	if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+	if (c >= 'a' && c <= 'z') return c - 'a';
+	if (c >= '0' && c <= '9') return 26 + c - '0';
+	return 36 + c % 28;
+}
+
+static uint64_t project_mask(const char *s, int len)
+{
+	uint64_t m = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		m |= (uint64_t)1 << project_bit((unsigned char)s[i]);
+	return m;
+}
+
+/* On the crawl thread: tell a waiting picker there is news, at most once
+ * per PROJECT_POLL_MS unless the crawl is over. */
+static void project_wake(struct project_index *ix, int done)
+{
+	struct timespec now;
+	char c = 0;
+
+	if (ix->wake[1] < 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!done && (now.tv_sec - ix->woke.tv_sec) * 1000 +
+	             (now.tv_nsec - ix->woke.tv_nsec) / 1000000 < PROJECT_POLL_MS)
+		return;
+	/* A full pipe is fine: the picker has yet to drain it anyway. */
+	if (write(ix->wake[1], &c, 1) == 1)
+		ix->woke = now;
+}
+
+/* Walk callback, on the crawl thread: add path to the index and publish
+ * it.  Returns 1 to stop the walk when cancelled or full. */
+static int project_add(const char *path, void *arg)
+{
+	struct project_index *ix = arg;
+	const char *rel = path + ix->rootlen;
+	struct project_block *b;
+	size_t len;
+	char *p;
+	int n = ix->nfiles, cancel;
+
+	while (*rel == '/')
+		rel++;
+	len = strlen(rel);
+	if (len == 0 || len > USHRT_MAX)
+		return 0;
+	if (n == PROJECT_BLOCK * PROJECT_MAX_BLOCKS) {
+		ix->truncated = 1;
+		return 1;
+	}
+
+	if (!ix->nchunks || ix->chunk_used + len + 1 > PROJECT_CHUNK) {
+		if (ix->nchunks == PROJECT_MAX_CHUNKS ||
+		    !(ix->chunk[ix->nchunks] = malloc(PROJECT_CHUNK))) {
+			ix->truncated = 1;
+			return 1;
+		}
+		ix->nchunks++;
+		ix->chunk_used = 0;
+	}
+	if (n % PROJECT_BLOCK == 0 &&
+	    !(ix->block[n / PROJECT_BLOCK] = malloc(sizeof(*b)))) {
+		ix->truncated = 1;
+		return 1;
+	}
+
+	p = ix->chunk[ix->nchunks - 1] + ix->chunk_used;
+	memcpy(p, rel, len + 1);
+	ix->chunk_used += len + 1;
+
+	b = ix->block[n / PROJECT_BLOCK];
+	b->path[n % PROJECT_BLOCK] = p;
+	b->len[n % PROJECT_BLOCK]  = (unsigned short)len;
+	b->base[n % PROJECT_BLOCK] = (unsigned short)(buf_basename(p) - p);
+	b->mask[n % PROJECT_BLOCK] = project_mask(p, len);
+	ix->nfiles = n + 1;
+
+	pthread_mutex_lock(&ix->lock);
+	ix->count = n + 1;
+	cancel = ix->cancel;
+	pthread_mutex_unlock(&ix->lock);
+	project_wake(ix, 0);
+	return cancel;
+}
+
+static void *project_crawl(void *arg)
+{
+	struct project_index *ix = arg;
+
+	editor_path_walk(ix->root, project_skip, project_add, ix);
+	pthread_mutex_lock(&ix->lock);
+	ix->done = 1;
+	pthread_mutex_unlock(&ix->lock);
+	project_wake(ix, 1);
+	return NULL;
+}
+
+/* Start indexing every file below root on a thread of its own.  Returns
+ * the index, filling in as the crawl goes on, or NULL. */
+struct project_index *project_index_new(const char *root)
+{
+	struct project_index *ix = calloc(1, sizeof(*ix));
+	sigset_t all, old;
+
+	if (!ix)
+		return NULL;
+	ix->rootlen = snprintf(ix->root, sizeof(ix->root), "%s", root);
+	if (ix->rootlen >= (int)sizeof(ix->root)) {
+		free(ix);
+		return NULL;
+	}
+	pthread_mutex_init(&ix->lock, NULL);
+	ix->when = time(NULL);
+	if (pipe(ix->wake) < 0) {
+		ix->wake[0] = ix->wake[1] = -1;
+	} else {
+		fcntl(ix->wake[0], F_SETFL, O_NONBLOCK);
+		fcntl(ix->wake[1], F_SETFL, O_NONBLOCK);
+		fcntl(ix->wake[0], F_SETFD, FD_CLOEXEC);
+		fcntl(ix->wake[1], F_SETFD, FD_CLOEXEC);
+	}
+
+	/* Like the pool workers: keep the UI thread's signals off it. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	ix->started = pthread_create(&ix->thread, NULL, project_crawl, ix) == 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (!ix->started)
+		project_crawl(ix);  /* no thread: crawl right here */
+	return ix;
+}
+
+/* Stop the crawl, if still going, and free the index. */
+void project_index_free(struct project_index *ix)
+{
+	int i;
+
+	if (!ix)
+		return;
+	pthread_mutex_lock(&ix->lock);
+	ix->cancel = 1;
+	pthread_mutex_unlock(&ix->lock);
+	if (ix->started)
+		pthread_join(ix->thread, NULL);
+	for (i = 0; i < PROJECT_MAX_BLOCKS && ix->block[i]; i++)
+		free(ix->block[i]);
+	for (i = 0; i < ix->nchunks; i++)
+		free(ix->chunk[i]);
+	free(ix->match);
+	if (ix->wake[0] >= 0) {
+		close(ix->wake[0]);
+		close(ix->wake[1]);
+	}
+	pthread_mutex_destroy(&ix->lock);
+	free(ix);
+}
+
+/* Number of files indexed so far; *done is set once the crawl is over. */
+int project_index_count(struct project_index *ix, int *done)
+{
+	int n;
+
+	pthread_mutex_lock(&ix->lock);
+	n = ix->count;
+	if (done)
+		*done = ix->done;
+	pthread_mutex_unlock(&ix->lock);
+	return n;
+}
+
+/* Path of file i, relative to the root. */
+const char *project_index_path(struct project_index *ix, int i)
+{
+	return ix->block[i / PROJECT_BLOCK]->path[i % PROJECT_BLOCK];
+}
+
+/* Score of q as a subsequence of s[0..len), or -1 when it isn't one.
+ * Each s[i] is or:ed with fold[j] before comparing with q[j], which folds
+ * case where q[j] is a lower-case letter and fold[j] is 0x20.  Every
+ * character matched scores, and more at the start of a path component or
+ * a word, or right after the previous match.  Greedy: the leftmost match
+ * is the one scored. */
+static int project_fuzzy(const char *s, int len, const unsigned char *q,
+                         const unsigned char *fold, int qlen)
+{
+	int i = 0, j, last = -2, score = 0;
+
+	for (j = 0; j < qlen; j++, i++) {
+		unsigned char prev;
+
+		while (i < len && ((unsigned char)s[i] | fold[j]) != q[j])
+			i++;
+		if (i == len)
+			return -1;
+		prev = i ? s[i - 1] : '/';
+		score += SCORE_MATCH;
+		if (i == last + 1)
+			score += BONUS_CONSECUTIVE;
+		if (prev == '/')
+			score += BONUS_COMPONENT;
+		else if (prev == '_' || prev == '-' || prev == '.' || prev == ' ' ||
+		         (isupper((unsigned char)s[i]) && islower(prev)))
+			score += BONUS_WORD;
+		last = i;
+	}
+	return score;
+}
+
+/* Rank path (len bytes, file name at base) against q: -1 for no match,
+ * otherwise higher is better.  A match within the file name beats one
+ * spread over the directories, and between equal matches the shorter
+ * path wins. */
+static int project_score(const char *path, int len, int base,
+                         const unsigned char *q, const unsigned char *fold,
+                         int qlen)
+{
+	int score = project_fuzzy(path + base, len - base, q, fold, qlen);
+
+	if (score >= 0)
+		score += BONUS_BASENAME;
+	else if ((score = project_fuzzy(path, len, q, fold, qlen)) < 0)
+		return -1;
+	return (score << 16) + (USHRT_MAX - len);
+}
+
+struct project_hit {
+	int score, file;
+};
+
+/* Keep hit among the best n of max, best first; ties keep file order. */
+static int project_keep(struct project_hit *best, int n, int max,
+                        int score, int file)
+{
+	int i;
+
+	if (n == max && score <= best[n - 1].score)
+		return n;
+	if (n < max)
+		n++;
+	for (i = n - 1; i > 0 && best[i - 1].score < score; i--)
+		best[i] = best[i - 1];
+	best[i].score = score;
+	best[i].file  = file;
+	return n;
+}
+
+static int project_match_push(struct project_index *ix, int file)
+{
+	if (ix->nmatch == ix->matchcap) {
+		int cap = ix->matchcap ? ix->matchcap * 2 : 1024;
+		int *m = realloc(ix->match, cap * sizeof(*m));
+
+		if (!m)
+			return -1;
+		ix->match = m;
+		ix->matchcap = cap;
+	}
+	ix->match[ix->nmatch++] = file;
+	return 0;
+}
+
+/* Rank the files indexed so far against query q, smart case: folded
+ * unless q has an upper-case letter.  The best max (up to
+ * PICKER_MAX_ENTRIES) go to out[], best first; returns how many match. */
+int project_rank(struct project_index *ix, const char *q, int qlen,
+                 int *out, int max)
+{
+	struct project_hit best[PROJECT_MAX_RANK];
+	unsigned char hit[PROJECT_BLOCK];
+	unsigned char fq[sizeof(ix->query)], or[sizeof(ix->query)];
+	uint64_t qmask;
+	int i, k, n, nbest = 0, fold = 1, old;
+
+	if (max > PROJECT_MAX_RANK)
+		max = PROJECT_MAX_RANK;
+	if (qlen >= (int)sizeof(fq))
+		qlen = sizeof(fq) - 1;
+	for (i = 0; i < qlen; i++)
+		if (isupper((unsigned char)q[i]))
+			fold = 0;
+	for (i = 0; i < qlen; i++) {
+		fq[i] = fold ? tolower((unsigned char)q[i]) : q[i];
+		or[i] = fold && islower(fq[i]) ? 0x20 : 0;
+	}
+	fq[qlen] = '\0';
+	qmask = project_mask((char *)fq, qlen);
+	n = project_index_count(ix, NULL);
+
+	/* The files the last query matched, when this one extends it;
+	 * otherwise everything is new. */
+	if (!(fold == ix->fold && qlen >= ix->qlen &&
+	      !memcmp(fq, ix->query, ix->qlen))) {
+		ix->nmatch  = 0;
+		ix->scanned = 0;
+	}
+	old = ix->nmatch;
+	ix->nmatch = 0;
+	for (i = 0; i < old; i++) {
+		int f = ix->match[i], score;
+		struct project_block *b = ix->block[f / PROJECT_BLOCK];
+
+		k = f % PROJECT_BLOCK;
+		if ((b->mask[k] & qmask) != qmask)
+			continue;
+		score = project_score(b->path[k], b->len[k], b->base[k],
+		                      fq, or, qlen);
+		if (score < 0)
+			continue;
+		ix->match[ix->nmatch++] = f;
+		nbest = project_keep(best, nbest, max, score, f);
+	}
+
+	/* Then the files found since, a block at a time: masks first. */
+	for (i = ix->scanned; i < n; ) {
+		struct project_block *b = ix->block[i / PROJECT_BLOCK];
+		int from = i % PROJECT_BLOCK;
+		int to = n - i + from < PROJECT_BLOCK ? n - i + from : PROJECT_BLOCK;
+
+		for (k = from; k < to; k++)
+			hit[k] = (b->mask[k] & qmask) == qmask;
+		for (k = from; k < to; k++) {
+			int score;
+
+			if (!hit[k])
+				continue;
+			score = project_score(b->path[k], b->len[k], b->base[k],
+			                      fq, or, qlen);
+			if (score < 0 || project_match_push(ix, i + k - from) < 0)
+				continue;
+			nbest = project_keep(best, nbest, max, score, i + k - from);
+		}
+		i += to - from;
+	}
+	ix->scanned = n;
+	memcpy(ix->query, fq, qlen + 1);
+	ix->qlen = qlen;
+	ix->fold = fold;
+
+	for (i = 0; i < nbest; i++)
+		out[i] = best[i].file;
+	return ix->nmatch;
+}
+
+/* The project the current buffer belongs to: the nearest directory at or
+ * above its file's (or the working directory, for a buffer without one)
+ * that holds a .git, or that starting directory when none does. */
+static int project_find_root(char *root, int size)
+{
+	char start[PATH_MAX], probe[PATH_MAX + 8];
+	struct stat st;
+	int len;
+
+	if (!realpath(is_special_buffer(editor.filename) ? "." : editor.filename,
+	              start) && !realpath(".", start))
+		return -1;
+	if (!is_special_buffer(editor.filename) && stat(start, &st) == 0 &&
+	    !S_ISDIR(st.st_mode))
+		*strrchr(start, '/') = '\0';
+	if (!start[0])
+		strcpy(start, "/");
+
+	/* len 0 is the filesystem root, probed last as "/.git". */
+	for (len = (int)strlen(start); ; ) {
+		snprintf(probe, sizeof(probe), "%.*s/.git", len, start);
+		if (stat(probe, &st) == 0) {
+			snprintf(root, size, "%.*s", len ? len : 1, start);
+			return 0;
+		}
+		if (len == 0)
+			break;
+		while (len > 0 && start[len - 1] != '/')
+			len--;
+		if (len > 0)
+			len--;          /* drop the slash */
+	}
+	snprintf(root, size, "%s", start);
+	return 0;
+}
+
+/* Wait for a key, for the crawl to find more files while it goes on, or
+ * for a terminal resize.  Returns 1 when a key is ready to read, 0 when
+ * the picker wants redrawing first. */
+static int project_wait(struct project_index *ix, int fd, int done)
+{
+	struct pollfd p[2];
+	char drain[64];
+
+	if (macro_is_replaying())
+		return 1;
+	p[0].fd      = fd;
+	p[0].events  = POLLIN;
+	p[0].revents = 0;
+	p[1].fd      = done ? -1 : ix->wake[0];
+	p[1].events  = POLLIN;
+	p[1].revents = 0;
+
+	/* Without the pipe, look at the count on a clock instead. */
+	if (poll(p, 2, !done && ix->wake[0] < 0 ? PROJECT_POLL_MS : -1) < 0) {
+		if (errno != EINTR)
+			return 1;
+		editor_process_pending_resize();
+		return 0;
+	}
+	if (p[1].revents & POLLIN)
+		while (read(ix->wake[0], drain, sizeof(drain)) > 0)
+			;
+	return p[0].revents != 0;
+}
+
+void editor_find_file_in_project(int fd)
+{
+	char root[PATH_MAX], query[256], prompt[128], msg[1024];
+	char path[PATH_MAX * 2];
+	const char *names[PICKER_MAX_ENTRIES];
+	int idx[PICKER_MAX_ENTRIES];
+	int qlen = 0, sel = 0, c, i;
+
+	if (project_find_root(root, sizeof(root)) < 0) {
+		editor_set_status_message("Can't tell where the project is");
+		return;
+	}
+	if (project && (strcmp(project->root, root) ||
+	                time(NULL) - project->when > PROJECT_STALE_SEC)) {
+		project_index_free(project);
+		project = NULL;
+	}
+	if (!project && !(project = project_index_new(root))) {
+		editor_set_status_message("Out of memory");
+		return;
+	}
+	/* A fresh index: the previous query's matches mean nothing. */
+	project->qlen = 0;
+	project->nmatch = project->scanned = 0;
+
+	query[0] = '\0';
+	while (1) {
+		int total, shown, count, done, plen, off = 0;
+
+		total = project_rank(project, query, qlen, idx, PICKER_MAX_ENTRIES);
+		shown = total < PICKER_MAX_ENTRIES ? total : PICKER_MAX_ENTRIES;
+		for (i = 0; i < shown; i++)
+			names[i] = project_index_path(project, idx[i]);
+		if (sel >= shown) sel = shown > 0 ? shown - 1 : 0;
+
+		count = project_index_count(project, &done);
+		if (done)
+			plen = snprintf(prompt, sizeof(prompt), "Find file in %s/: ",
+			                buf_basename(root));
+		else
+			plen = snprintf(prompt, sizeof(prompt),
+			                "Find file in %s/ (%d...): ",
+			                buf_basename(root), count);
+		editor_msg_appendf(msg, sizeof(msg), &off, "%s%s ", prompt, query);
+		editor_picker_render(msg, sizeof(msg), &off, names, shown, total, sel);
+		editor_set_status_message("%s", msg);
+		editor.echo_cursor_col = plen + qlen + 1;
+		editor_refresh_screen();
+
+		/* While the crawl goes on, show what it finds as it comes. */
+		if (!project_wait(project, fd, done))
+			continue;
+
+		c = editor_read_key(fd);
+		if (c == DEL_KEY || c == CTRL_H || c == BACKSPACE) {
+			if (qlen > 0) query[--qlen] = '\0';
+			sel = 0;
+		} else if (c == ARROW_RIGHT || c == CTRL_F) {
+			if (shown > 0) sel = (sel + 1) % shown;
+		} else if (c == ARROW_LEFT || c == CTRL_B) {
+			if (shown > 0) sel = (sel - 1 + shown) % shown;
+		} else if (c == ENTER) {
+			editor.echo_cursor_col = 0;
+			editor_set_status_message("");
+			if (shown > 0) {
+				snprintf(path, sizeof(path), "%s%s%s", root,
+				         strcmp(root, "/") ? "/" : "", names[sel]);
+				buf_visit_file(path, 0);
+			}
+			return;
+		} else if (c == ESC || c == CTRL_G) {
+			editor.echo_cursor_col = 0;
+			editor_set_status_message("");
+			return;
+		} else if (isprint(c) && qlen < (int)sizeof(query) - 1) {
+			query[qlen++] = c;
+			query[qlen]   = '\0';
+			sel = 0;
+		}
+	}
+}
@@ -0,0 +1,1182 @@
+/* ============================ Regular expressions ========================= */
+
+#include "def.h"
+
+/* egrep-style regular expressions for the regexp variants of isearch and
+ * query replace.  There is no backtracking: a pattern is parsed to a small
+ * syntax tree, compiled to a Thompson NFA program (once as written, once
+ * reversed), and matched by DFAs built lazily from those programs -- a
+ * state is only constructed the first time the scan needs it, and the
+ * cache is simply flushed if it grows too large.  Matching is linear in
+ * the text, whatever the pattern.
+ *
+ * A forward search runs the forward DFA with leftmost-first priorities
+ * (what a backtracking matcher such as Emacs' would pick) to find where
+ * the leftmost match ends, then the reverse DFA anchored at that end to
+ * find where it starts.  A backward search runs the reverse DFA from the
+ * limit to find the rightmost match start, then the forward DFA anchored
+ * there to find its end.
+ *
+ * When every match must begin with some literal text, the forward scan
+ * uses a needle (match.c) to jump straight to the next place it occurs
+ * whenever no partial match is in flight.
+ *
+ * Supported: literals (UTF-8 aware), . [...] [^...] [:class:] \w \W \d
+ * \D \s \S \n \t, ( ) (?: ) |, * + ? {m} {m,} {m,n} and their lazy ?
+ * forms, ^ and $ at line boundaries.  There are no capture groups. */
+
+#define RE_MAX_INST    20000   /* program size limit, after {m,n} expansion */
+#define RE_MAX_REPEAT  255
+#define RE_MAX_DEPTH   200     /* parenthesis nesting */
+#define DFA_MAX_STATES 2048    /* cached states before the cache is flushed */
+#define DFA_UNKNOWN    -1      /* transition not computed yet */
+#define DFA_DEAD       -2      /* no thread left and none will start */
+
+enum { OP_SET, OP_SPLIT, OP_JMP, OP_BOL, OP_EOL, OP_MATCH };
+
+struct re_inst {
+	unsigned char op;
+	int x, y;               /* SET: set index; SPLIT: x preferred; JMP: x */
+};
+
+enum { N_EMPTY, N_SET, N_CAT, N_ALT, N_REP, N_BOL, N_EOL };
+
+struct re_node {
+	int type;
+	int set;                /* N_SET: index into sets */
+	int min, max;           /* N_REP: max -1 is unbounded */
+	int greedy;
+	int a, b;               /* children, node indices */
+};
+
+struct dfa_state {
+	int *pcs;               /* thread list, in priority order */
+	int n;
+	unsigned char flag;     /* last byte consumed was '\n', or a boundary */
+	unsigned char inject;   /* still starting a new thread at each byte */
+	unsigned char accept[2];/* a match ends here, by lookahead boundary */
+	int next[256];
+};
+
+struct dfa {
+	const struct re_inst *prog;
+	const unsigned char (*sets)[32];
+	int ninst;
+	int reverse;            /* program runs right to left */
+	int first;              /* leftmost-first: cut threads below a match */
+	struct dfa_state *states;
+	int nstates;
+	int *htab;              /* open addressing, state index + 1 */
+	int hsize;
+	unsigned *mark;         /* closure dedupe, by generation */
+	unsigned gen;
+	int *stack, *buf, *buf2;
+};
+
+struct regex {
+	struct re_inst *fprog, *rprog;
+	int nfprog, nrprog;
+	unsigned char (*sets)[32];
+	int nsets;
+	struct dfa fwd, rev;
+	struct needle prefix;
+	int has_prefix;
+	int fold;
+};
+
+/* ---- Parser ---- */
+
+struct re_parse {
+	const unsigned char *p, *end;
+	int fold;
+	struct re_node *nodes;
+	int nnodes, capnodes;
+	unsigned char (*sets)[32];
+	int nsets, capsets;
+	int depth;
+	const char *err;
+};
+
+static int new_node(struct re_parse *ps, int type)
+{
+	struct re_node *n;
+
+	if (ps->nnodes == ps->capnodes) {
+		int cap = ps->capnodes ? ps->capnodes * 2 : 64;
+		struct re_node *nn = realloc(ps->nodes, cap * sizeof(*nn));
+
+		if (!nn) {
+			ps->err = "Out of memory";
+			return -1;
+		}
+		ps->nodes = nn;
+		ps->capnodes = cap;
+	}
+	n = &ps->nodes[ps->nnodes];
+	memset(n, 0, sizeof(*n));
+	n->type = type;
+	n->a = n->b = -1;
+	return ps->nnodes++;
+}
+
+static int new_set(struct re_parse *ps, const unsigned char *bits)
+{
+	int nd;
+
+	if (ps->nsets == ps->capsets) {
+		int cap = ps->capsets ? ps->capsets * 2 : 16;
+		unsigned char (*ns)[32] = realloc(ps->sets, cap * sizeof(*ns));
+
+		if (!ns) {
+			ps->err = "Out of memory";
+			return -1;
+		}
+		ps->sets = ns;
+		ps->capsets = cap;
+	}
+	memcpy(ps->sets[ps->nsets], bits, 32);
+	nd = new_node(ps, N_SET);
+	if (nd < 0) return -1;
+	ps->nodes[nd].set = ps->nsets++;
+	return nd;
+}
+
+static void bit_set(unsigned char *bits, int c)
+{
+	bits[c >> 3] |= 1 << (c & 7);
+}
+
+static int bit_get(const unsigned char *bits, int c)
+{
+	return bits[c >> 3] & (1 << (c & 7));
+}
+
+static void bit_range(unsigned char *bits, int lo, int hi)
+{
+	for (; lo <= hi; lo++)
+		bit_set(bits, lo);
+}
+
+/* Add the other case of every ASCII letter already in bits. */
+static void bit_fold(unsigned char *bits)
+{
+	int c;
+
+	for (c = 'a'; c <= 'z'; c++) {
+		if (bit_get(bits, c) || bit_get(bits, c - 'a' + 'A')) {
+			bit_set(bits, c);
+			bit_set(bits, c - 'a' + 'A');
+		}
+	}
+}
+
+static int binary(struct re_parse *ps, int type, int a, int b)
+{
+	int nd;
+
+	if (a < 0 || b < 0) return -1;
+	nd = new_node(ps, type);
+	if (nd < 0) return -1;
+	ps->nodes[nd].a = a;
+	ps->nodes[nd].b = b;
+	return nd;
+}
+
+static int byte_node(struct re_parse *ps, int c)
+{
+	unsigned char bits[32] = { 0 };
+
+	bit_set(bits, c);
+	if (ps->fold) bit_fold(bits);
+	return new_set(ps, bits);
+}
+
+static int range_node(struct re_parse *ps, int lo, int hi)
+{
+	unsigned char bits[32] = { 0 };
+
+	bit_range(bits, lo, hi);
+	return new_set(ps, bits);
+}
+
+/* Any complete multi-byte UTF-8 character. */
+static int utf8_multibyte(struct re_parse *ps)
+{
+	int two   = binary(ps, N_CAT, range_node(ps, 0xC2, 0xDF),
+	                   range_node(ps, 0x80, 0xBF));
+	int three = binary(ps, N_CAT, range_node(ps, 0xE0, 0xEF),
+	                   binary(ps, N_CAT, range_node(ps, 0x80, 0xBF),
+	                          range_node(ps, 0x80, 0xBF)));
+	int four  = binary(ps, N_CAT, range_node(ps, 0xF0, 0xF4),
+	                   binary(ps, N_CAT, range_node(ps, 0x80, 0xBF),
+	                          binary(ps, N_CAT, range_node(ps, 0x80, 0xBF),
+	                                 range_node(ps, 0x80, 0xBF))));
+
+	return binary(ps, N_ALT, two, binary(ps, N_ALT, three, four));
+}
+
+/* One character from the ASCII set bits, or, with multibyte set, any
+ * non-ASCII character.  A stray byte >= 0x80 is the last resort, so
+ * damaged text still matches but whole characters are preferred. */
+static int char_class(struct re_parse *ps, const unsigned char *bits, int multibyte)
+{
+	int nd = new_set(ps, bits);
+
+	if (multibyte)
+		nd = binary(ps, N_ALT, nd,
+		            binary(ps, N_ALT, utf8_multibyte(ps),
+		                   range_node(ps, 0x80, 0xFF)));
+	return nd;
+}
+
+/* Bits for the \w \d \s family; returns 0 for anything else. */
+static int class_escape(int c, unsigned char *bits, int *negate)
+{
+	memset(bits, 0, 32);
+	*negate = (c == 'W' || c == 'D' || c == 'S');
+	switch (c) {
+	case 'w': case 'W':
+		bit_range(bits, 'a', 'z');
+		bit_range(bits, 'A', 'Z');
+		bit_range(bits, '0', '9');
+		bit_set(bits, '_');
+		return 1;
+	case 'd': case 'D':
+		bit_range(bits, '0', '9');
+		return 1;
+	case 's': case 'S':
+		bit_set(bits, ' ');
+		bit_range(bits, '\t', '\r');
+		return 1;
+	}
+	return 0;
+}
+
+static int ascii_escape(int c)
+{
+	switch (c) {
+	case 'n': return '\n';
+	case 't': return '\t';
+	case 'r': return '\r';
+	case 'f': return '\f';
+	case 'v': return '\v';
+	}
+	return -1;
+}
+
+static void negate_ascii(unsigned char *bits)
+{
+	int c;
+
+	for (c = 0; c < 0x80; c++) {
+		if (bit_get(bits, c)) bits[c >> 3] &= ~(1 << (c & 7));
+		else bit_set(bits, c);
+	}
+	for (c = 0x80; c < 0x100; c++)
+		bits[c >> 3] &= ~(1 << (c & 7));
+}
+
+static const struct {
+	const char *name;
+	const char *members;    /* pairs of range endpoints */
+} posix_classes[] = {
+	{ "alpha",  "azAZ" },
+	{ "digit",  "09" },
+	{ "alnum",  "azAZ09" },
+	{ "upper",  "AZ" },
+	{ "lower",  "az" },
+	{ "space",  "  \t\r" },
+	{ "xdigit", "09afAF" },
+	{ "punct",  "!/:@[`{~" },
+	{ "word",   "azAZ09__" },
+};
+
+/* Parse a bracket expression; ps->p is just past the '['. */
+static int parse_bracket(struct re_parse *ps)
+{
+	unsigned char bits[32] = { 0 };
+	int negate = 0, first = 1, alt = -1, multi = 0;
+
+	if (ps->p < ps->end && *ps->p == '^') {
+		negate = 1;
+		ps->p++;
+	}
+	while (ps->p < ps->end && (first || *ps->p != ']')) {
+		int lo = *ps->p, hi;
+
+		first = 0;
+		if (lo == '[' && ps->p + 1 < ps->end && ps->p[1] == ':') {
+			const unsigned char *close = ps->p + 2;
+			size_t k;
+
+			while (close + 1 < ps->end && !(close[0] == ':' && close[1] == ']'))
+				close++;
+			if (close + 1 >= ps->end) {
+				ps->err = "Unmatched [ or [^";
+				return -1;
+			}
+			for (k = 0; k < sizeof(posix_classes) / sizeof(posix_classes[0]); k++) {
+				const char *name = posix_classes[k].name;
+				const char *m;
+
+				if (strlen(name) != (size_t)(close - ps->p - 2) ||
+				    memcmp(name, ps->p + 2, close - ps->p - 2))
+					continue;
+				for (m = posix_classes[k].members; *m; m += 2)
+					bit_range(bits, (unsigned char)m[0], (unsigned char)m[1]);
+				if (!strcmp(name, "space")) bit_range(bits, '\t', '\r');
+				if (!strcmp(name, "alpha") || !strcmp(name, "alnum") ||
+				    !strcmp(name, "word"))
+					multi = 1;
+				break;
+			}
+			if (k == sizeof(posix_classes) / sizeof(posix_classes[0])) {
+				ps->err = "Invalid character class name";
+				return -1;
+			}
+			ps->p = close + 2;
+			continue;
+		}
+		if (lo == '\\' && ps->p + 1 < ps->end) {
+			unsigned char cbits[32];
+			int neg, k;
+
+			if (class_escape(ps->p[1], cbits, &neg) && !neg) {
+				for (k = 0; k < 32; k++) bits[k] |= cbits[k];
+				if (ps->p[1] == 'w') multi = 1;
+				ps->p += 2;
+				continue;
+			}
+			lo = ascii_escape(ps->p[1]);
+			if (lo < 0) lo = ps->p[1];
+			ps->p++;
+		}
+		if (lo >= 0x80) {
+			/* A whole non-ASCII character, as its own branch. */
+			int cp, n = utf8_decode((const char *)ps->p, ps->end - ps->p, &cp);
+			int seq = -1, k;
+
+			if (negate) {
+				ps->err = "Non-ASCII characters in [^...] are not supported";
+				return -1;
+			}
+			if (ps->p + n < ps->end - 1 && ps->p[n] == '-' && ps->p[n + 1] != ']') {
+				ps->err = "Ranges of non-ASCII characters are not supported";
+				return -1;
+			}
+			for (k = 0; k < n; k++) {
+				int b = byte_node(ps, ps->p[k]);
+				seq = seq < 0 ? b : binary(ps, N_CAT, seq, b);
+			}
+			alt = alt < 0 ? seq : binary(ps, N_ALT, alt, seq);
+			if (alt < 0) return -1;
+			ps->p += n;
+			continue;
+		}
+		ps->p++;
+		hi = lo;
+		if (ps->p + 1 < ps->end && *ps->p == '-' && ps->p[1] != ']') {
+			hi = ps->p[1];
+			if (hi == '\\' && ps->p + 2 < ps->end) {
+				hi = ascii_escape(ps->p[2]);
+				if (hi < 0) hi = ps->p[2];
+				ps->p++;
+			}
+			if (hi >= 0x80) {
+				ps->err = "Ranges of non-ASCII characters are not supported";
+				return -1;
+			}
+			if (hi < lo) {
+				ps->err = "Invalid range end";
+				return -1;
+			}
+			ps->p += 2;
+		}
+		bit_range(bits, lo, hi);
+	}
+	if (ps->p >= ps->end) {
+		ps->err = "Unmatched [ or [^";
+		return -1;
+	}
+	ps->p++;        /* ']' */
+
+	if (ps->fold) bit_fold(bits);
+	if (negate) {
+		negate_ascii(bits);
+		return char_class(ps, bits, 1);
+	}
+	{
+		int nd = char_class(ps, bits, multi);
+		return alt < 0 ? nd : binary(ps, N_ALT, nd, alt);
+	}
+}
+
+static int parse_alt(struct re_parse *ps);
+
+static int parse_atom(struct re_parse *ps)
+{
+	int c = *ps->p;
+
+	switch (c) {
+	case '(': {
+		int nd;
+
+		ps->p++;
+		if (ps->end - ps->p >= 2 && ps->p[0] == '?' && ps->p[1] == ':')
+			ps->p += 2;
+		if (++ps->depth > RE_MAX_DEPTH) {
+			ps->err = "Regular expression too big";
+			return -1;
+		}
+		nd = parse_alt(ps);
+		ps->depth--;
+		if (nd < 0) return -1;
+		if (ps->p >= ps->end || *ps->p != ')') {
+			ps->err = "Unmatched ( or \\(";
+			return -1;
+		}
+		ps->p++;
+		return nd;
+	}
+	case '[':
+		ps->p++;
+		return parse_bracket(ps);
+	case '.': {
+		unsigned char bits[32] = { 0 };
+
+		ps->p++;
+		bit_range(bits, 0, 0x7F);
+		bits['\n' >> 3] &= ~(1 << ('\n' & 7));
+		return char_class(ps, bits, 1);
+	}
+	case '^':
+		ps->p++;
+		return new_node(ps, N_BOL);
+	case '$':
+		ps->p++;
+		return new_node(ps, N_EOL);
+	case '\\': {
+		unsigned char bits[32];
+		int neg, e;
+
+		if (ps->p + 1 >= ps->end) {
+			ps->err = "Trailing backslash";
+			return -1;
+		}
+		e = ps->p[1];
+		ps->p += 2;
+		if (class_escape(e, bits, &neg)) {
+			if (neg) {
+				negate_ascii(bits);
+				return new_set(ps, bits);
+			}
+			return char_class(ps, bits, e == 'w');
+		}
+		if (ascii_escape(e) >= 0)
+			return byte_node(ps, ascii_escape(e));
+		if (isalnum(e) || e == '<' || e == '>') {
+			ps->err = "Unsupported backslash escape";
+			return -1;
+		}
+		return byte_node(ps, e);
+	}
+	case '*': case '+': case '?':
+		ps->err = "Nothing to repeat";
+		return -1;
+	}
+
+	if (c >= 0x80) {
+		int cp, n = utf8_decode((const char *)ps->p, ps->end - ps->p, &cp);
+		int seq = -1, k;
+
+		for (k = 0; k < n; k++) {
+			int b = byte_node(ps, ps->p[k]);
+			seq = seq < 0 ? b : binary(ps, N_CAT, seq, b);
+		}
+		ps->p += n;
+		return seq;
+	}
+	ps->p++;
+	return byte_node(ps, c);
+}
+
+static int parse_number(struct re_parse *ps)
+{
+	int v = 0, any = 0;
+
+	while (ps->p < ps->end && isdigit(*ps->p)) {
+		v = v * 10 + (*ps->p++ - '0');
+		if (v > RE_MAX_REPEAT) {
+			ps->err = "Repetition count too large";
+			return -2;
+		}
+		any = 1;
+	}
+	return any ? v : -1;
+}
+
+static int parse_repeat(struct re_parse *ps)
+{
+	int nd = parse_atom(ps);
+
+	while (nd >= 0 && ps->p < ps->end) {
+		int c = *ps->p, min, max, rep;
+
+		if (c == '*') {
+			min = 0; max = -1;
+			ps->p++;
+		} else if (c == '+') {
+			min = 1; max = -1;
+			ps->p++;
+		} else if (c == '?') {
+			min = 0; max = 1;
+			ps->p++;
+		} else if (c == '{') {
+			const unsigned char *save = ps->p;
+
+			ps->p++;
+			min = parse_number(ps);
+			if (min == -2) return -1;
+			max = min;
+			if (ps->p < ps->end && *ps->p == ',') {
+				ps->p++;
+				max = parse_number(ps);
+				if (max == -2) return -1;
+			}
+			if (min < 0 || ps->p >= ps->end || *ps->p != '}') {
+				/* Not a bound after all: a literal '{'. */
+				ps->p = save;
+				break;
+			}
+			ps->p++;
+			if (max >= 0 && max < min) {
+				ps->err = "Invalid content of \\{\\}";
+				return -1;
+			}
+		} else {
+			break;
+		}
+		rep = new_node(ps, N_REP);
+		if (rep < 0) return -1;
+		ps->nodes[rep].a = nd;
+		ps->nodes[rep].min = min;
+		ps->nodes[rep].max = max;
+		ps->nodes[rep].greedy = 1;
+		if (ps->p < ps->end && *ps->p == '?') {
+			ps->nodes[rep].greedy = 0;
+			ps->p++;
+		}
+		nd = rep;
+	}
+	return nd;
+}
+
+static int parse_cat(struct re_parse *ps)
+{
+	int nd = -1;
+
+	while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+		int next = parse_repeat(ps);
+
+		if (next < 0) return -1;
+		nd = nd < 0 ? next : binary(ps, N_CAT, nd, next);
+		if (nd < 0) return -1;
+	}
+	return nd < 0 ? new_node(ps, N_EMPTY) : nd;
+}
+
+static int parse_alt(struct re_parse *ps)
+{
+	int nd = parse_cat(ps);
+
+	while (nd >= 0 && ps->p < ps->end && *ps->p == '|') {
+		ps->p++;
+		nd = binary(ps, N_ALT, nd, parse_cat(ps));
+	}
+	return nd;
+}
+
+/* ---- Compiler ---- */
+
+struct re_emit {
+	const struct re_node *nodes;
+	struct re_inst *prog;
+	int n, cap;
+	int reverse;
+	int overflow;
+};
+
+static int emit(struct re_emit *e, int op, int x, int y)
+{
+	if (e->n == e->cap) {
+		int cap = e->cap ? e->cap * 2 : 64;
+		struct re_inst *np;
+
+		if (cap > RE_MAX_INST) cap = RE_MAX_INST;
+		if (e->n == cap) {
+			e->overflow = 1;
+			return e->n - 1;
+		}
+		np = realloc(e->prog, cap * sizeof(*np));
+		if (!np) {
+			e->overflow = 1;
+			return e->n - 1;
+		}
+		e->prog = np;
+		e->cap  = cap;
+	}
+	e->prog[e->n].op = op;
+	e->prog[e->n].x  = x;
+	e->prog[e->n].y  = y;
+	return e->n++;
+}
+
+/* Point the split at pc into a loop or optional body and past it, the
+ * body first when greedy. */
+static void patch_split(struct re_emit *e, int pc, int body, int skip, int greedy)
+{
+	if (e->overflow) return;
+	e->prog[pc].x = greedy ? body : skip;
+	e->prog[pc].y = greedy ? skip : body;
+}
+
+static void compile_node(struct re_emit *e, int nd)
+{
+	const struct re_node *n = &e->nodes[nd];
+	int i;
+
+	if (e->overflow) return;
+	switch (n->type) {
+	case N_EMPTY:
+		break;
+	case N_SET:
+		emit(e, OP_SET, n->set, 0);
+		break;
+	case N_BOL:
+		emit(e, OP_BOL, 0, 0);
+		break;
+	case N_EOL:
+		emit(e, OP_EOL, 0, 0);
+		break;
+	case N_CAT:
+		compile_node(e, e->reverse ? n->b : n->a);
+		compile_node(e, e->reverse ? n->a : n->b);
+		break;
+	case N_ALT: {
+		int split = emit(e, OP_SPLIT, -1, -1), jmp;
+
+		if (!e->overflow) e->prog[split].x = e->n;
+		compile_node(e, n->a);
+		jmp = emit(e, OP_JMP, -1, 0);
+		if (!e->overflow) e->prog[split].y = e->n;
+		compile_node(e, n->b);
+		if (!e->overflow) e->prog[jmp].x = e->n;
+		break;
+	}
+	case N_REP:
+		for (i = 0; i < n->min; i++)
+			compile_node(e, n->a);
+		if (n->max < 0) {
+			int split = emit(e, OP_SPLIT, -1, -1);
+			int body = e->n;
+
+			compile_node(e, n->a);
+			emit(e, OP_JMP, split, 0);
+			patch_split(e, split, body, e->n, n->greedy);
+		} else {
+			/* x{0,k}: k nested optional copies; every split
+			 * skips to the common end. */
+			int splits[RE_MAX_REPEAT];
+			int k = n->max - n->min;
+
+			for (i = 0; i < k; i++) {
+				splits[i] = emit(e, OP_SPLIT, -1, -1);
+				compile_node(e, n->a);
+			}
+			for (i = 0; i < k; i++)
+				patch_split(e, splits[i], splits[i] + 1, e->n, n->greedy);
+		}
+		break;
+	}
+}
+
+static struct re_inst *compile_prog(const struct re_node *nodes, int root,
+                                    int reverse, int *len)
+{
+	struct re_emit e;
+
+	memset(&e, 0, sizeof(e));
+	e.nodes   = nodes;
+	e.reverse = reverse;
+	compile_node(&e, root);
+	emit(&e, OP_MATCH, 0, 0);
+	if (e.overflow) {
+		free(e.prog);
+		return NULL;
+	}
+	*len = e.n;
+	return e.prog;
+}
+
+/* Literal text every match must start with, for the prefilter.  Returns
+ * 1 if all of node was literal, so the caller may carry on past it. */
+static int literal_prefix(const struct re_parse *ps, int nd, char *buf, int *n, int max)
+{
+	const struct re_node *node = &ps->nodes[nd];
+	const unsigned char *bits;
+	int c, count = 0, lit = -1;
+
+	switch (node->type) {
+	case N_BOL:
+	case N_EOL:
+		return 1;
+	case N_CAT:
+		return literal_prefix(ps, node->a, buf, n, max) &&
+		       literal_prefix(ps, node->b, buf, n, max);
+	case N_REP:
+		if (node->min > 0)
+			literal_prefix(ps, node->a, buf, n, max);
+		return 0;
+	case N_SET:
+		break;
+	default:
+		return 0;
+	}
+
+	/* One byte, or one letter in both cases when folding. */
+	bits = ps->sets[node->set];
+	for (c = 0; c < 256; c++) {
+		if (!bit_get(bits, c)) continue;
+		if (ps->fold && c >= 'A' && c <= 'Z' && bit_get(bits, c + 'a' - 'A'))
+			continue;
+		count++;
+		lit = c;
+	}
+	if (count != 1 || *n >= max)
+		return 0;
+	buf[(*n)++] = lit;
+	return 1;
+}
+
+/* ---- Lazy DFA ---- */
+
+static int dfa_init(struct dfa *d, const struct re_inst *prog, int ninst,
+                    const unsigned char (*sets)[32], int reverse, int first)
+{
+	memset(d, 0, sizeof(*d));
+	d->prog    = prog;
+	d->ninst   = ninst;
+	d->sets    = sets;
+	d->reverse = reverse;
+	d->first   = first;
+	d->hsize   = 4 * DFA_MAX_STATES;
+	d->htab    = calloc(d->hsize, sizeof(int));
+	d->states  = malloc(DFA_MAX_STATES * sizeof(*d->states));
+	d->mark    = calloc(ninst, sizeof(unsigned));
+	d->stack   = malloc((2 * ninst + 2) * sizeof(int));
+	d->buf     = malloc((ninst + 1) * sizeof(int));
+	d->buf2    = malloc((ninst + 1) * sizeof(int));
+	if (!d->htab || !d->states || !d->mark || !d->stack || !d->buf || !d->buf2)
+		return -1;
+	return 0;
+}
+
+static void dfa_flush(struct dfa *d)
+{
+	int i;
+
+	for (i = 0; i < d->nstates; i++)
+		free(d->states[i].pcs);
+	d->nstates = 0;
+	memset(d->htab, 0, d->hsize * sizeof(int));
+}
+
+static void dfa_free(struct dfa *d)
+{
+	if (d->states) dfa_flush(d);
+	free(d->states);
+	free(d->htab);
+	free(d->mark);
+	free(d->stack);
+	free(d->buf);
+	free(d->buf2);
+}
+
+/* Follow pc through jumps and splits in priority order, appending the
+ * threads it reaches to out.  Assertions are kept as threads to resolve
+ * later, or with resolve set are taken or dropped on the spot. */
+static void closure(struct dfa *d, int pc, int resolve, int bol, int eol,
+                    int *out, int *nout)
+{
+	int sp = 0;
+
+	d->stack[sp++] = pc;
+	while (sp) {
+		const struct re_inst *in;
+
+		pc = d->stack[--sp];
+		if (d->mark[pc] == d->gen) continue;
+		d->mark[pc] = d->gen;
+		in = &d->prog[pc];
+		switch (in->op) {
+		case OP_JMP:
+			d->stack[sp++] = in->x;
+			break;
+		case OP_SPLIT:
+			d->stack[sp++] = in->y;
+			d->stack[sp++] = in->x;
+			break;
+		case OP_BOL:
+		case OP_EOL:
+			if (!resolve)
+				out[(*nout)++] = pc;
+			else if (in->op == OP_BOL ? bol : eol)
+				d->stack[sp++] = pc + 1;
+			break;
+		default:
+			out[(*nout)++] = pc;
+		}
+	}
+}
+
+static void next_gen(struct dfa *d)
+{
+	if (++d->gen == 0) {
+		memset(d->mark, 0, d->ninst * sizeof(unsigned));
+		d->gen = 1;
+	}
+}
+
+/* Threads of state s at a position whose line-boundary context is known,
+ * with assertions resolved, into d->buf.  Returns the count; *match gets
+ * the index of the first MATCH thread or -1. */
+static int dfa_resolve(struct dfa *d, const int *pcs, int n, int inject,
+                       int bol, int eol, int *match)
+{
+	int i, nr = 0;
+
+	next_gen(d);
+	for (i = 0; i < n; i++)
+		closure(d, pcs[i], 1, bol, eol, d->buf, &nr);
+	if (inject)
+		closure(d, 0, 1, bol, eol, d->buf, &nr);
+	*match = -1;
+	for (i = 0; i < nr; i++) {
+		if (d->prog[d->buf[i]].op == OP_MATCH) {
+			*match = i;
+			break;
+		}
+	}
+	return nr;
+}
+
+static unsigned dfa_hash(const int *pcs, int n, int flag, int inject)
+{
+	unsigned h = 2166136261u ^ (unsigned)(flag | inject << 1);
+	int i;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ (unsigned)pcs[i]) * 16777619u;
+	return h;
+}
+
+/* Find or add the state (pcs, flag, inject).  Returns its index, or -1
+ * when out of memory. */
+static int dfa_intern(struct dfa *d, const int *pcs, int n, int flag, int inject)
+{
+	unsigned h = dfa_hash(pcs, n, flag, inject);
+	int slot = h & (d->hsize - 1);
+	struct dfa_state *s;
+	int i, la;
+
+	while (d->htab[slot]) {
+		s = &d->states[d->htab[slot] - 1];
+		if (s->n == n && s->flag == flag && s->inject == inject &&
+		    !memcmp(s->pcs, pcs, n * sizeof(int)))
+			return d->htab[slot] - 1;
+		slot = (slot + 1) & (d->hsize - 1);
+	}
+	if (d->nstates == DFA_MAX_STATES)
+		return -1;
+
+	s = &d->states[d->nstates];
+	s->pcs = malloc((n ? n : 1) * sizeof(int));
+	if (!s->pcs)
+		return -1;
+	memcpy(s->pcs, pcs, n * sizeof(int));
+	s->n      = n;
+	s->flag   = flag;
+	s->inject = inject;
+	for (i = 0; i < 256; i++)
+		s->next[i] = DFA_UNKNOWN;
+	for (la = 0; la < 2; la++) {
+		int match;
+
+		dfa_resolve(d, pcs, n, inject,
+		            d->reverse ? la : flag, d->reverse ? flag : la, &match);
+		s->accept[la] = match >= 0;
+	}
+	d->htab[slot] = d->nstates + 1;
+	return d->nstates++;
+}
+
+/* The state a scan starts in: nothing in flight and a thread started at
+ * every position, or, anchored, just the thread started here. */
+static int dfa_start(struct dfa *d, int flag, int anchored)
+{
+	int n = 0, st;
+
+	if (anchored) {
+		next_gen(d);
+		closure(d, 0, 0, 0, 0, d->buf2, &n);
+	}
+	st = dfa_intern(d, d->buf2, n, flag, !anchored);
+	if (st < 0) {
+		dfa_flush(d);
+		st = dfa_intern(d, d->buf2, n, flag, !anchored);
+	}
+	return st;
+}
+
+/* Compute the transition of state si on byte c. */
+static int dfa_step(struct dfa *d, int si, int c)
+{
+	struct dfa_state *s = &d->states[si];
+	int la = (c == '\n');
+	int match, nr, nn = 0, i, inject = s->inject, next;
+
+	nr = dfa_resolve(d, s->pcs, s->n, s->inject,
+	                 d->reverse ? la : s->flag, d->reverse ? s->flag : la,
+	                 &match);
+	if (d->first && match >= 0) {
+		/* Leftmost-first: threads below the match can't win, and
+		 * neither can anything starting later. */
+		nr = match;
+		inject = 0;
+	}
+	next_gen(d);
+	for (i = 0; i < nr; i++) {
+		const struct re_inst *in = &d->prog[d->buf[i]];
+
+		if (in->op == OP_SET && bit_get(d->sets[in->x], c))
+			closure(d, d->buf[i] + 1, 0, 0, 0, d->buf2, &nn);
+	}
+	if (nn == 0 && !inject)
+		return DFA_DEAD;
+
+	next = dfa_intern(d, d->buf2, nn, la, inject);
+	if (next < 0) {
+		/* Cache full: start over, keeping only where we're going.
+		 * The caller's index si is stale after this, but it only
+		 * needs the returned one. */
+		dfa_flush(d);
+		return dfa_intern(d, d->buf2, nn, la, inject);
+	}
+	d->states[si].next[c] = next;
+	return next;
+}
+
+static int dfa_next(struct dfa *d, int si, int c)
+{
+	int next = d->states[si].next[c];
+
+	return next == DFA_UNKNOWN ? dfa_step(d, si, c) : next;
+}
+
+static int is_boundary(const char *s, int len, int pos)
+{
+	return pos <= 0 || pos >= len || s[pos] == '\n';
+}
+
+/* Scan s[from..to) forward; returns where the leftmost-first match ends,
+ * or -1.  Anchored, the match must start at from.  pre, when given, is a
+ * literal every match starts with, used to skip text while no partial
+ * match is in flight. */
+static int dfa_fwd(struct dfa *d, const char *s, int len, int from, int to,
+                   int anchored, const struct needle *pre)
+{
+	int pos = from, last = -1;
+	int st = dfa_start(d, from == 0 || s[from - 1] == '\n', anchored);
+
+	if (st < 0) return -1;
+	for (; pos < to; pos++) {
+		unsigned char c = s[pos];
+		struct dfa_state *cur = &d->states[st];
+
+		if (pre && cur->n == 0 && cur->inject && !cur->flag) {
+			int skip = needle_find(pre, s + pos, to - pos);
+
+			if (skip < 0) return last;
+			if (skip > 0) {
+				pos += skip;
+				c = s[pos];
+				if (s[pos - 1] == '\n')
+					st = dfa_start(d, 1, 0);
+				if (st < 0) return last;
+				cur = &d->states[st];
+			}
+		}
+		if (cur->accept[c == '\n'])
+			last = pos;
+		st = dfa_next(d, st, c);
+		if (st < 0) return last;
+	}
+	if (d->states[st].accept[is_boundary(s, len, to) ? 1 : 0])
+		last = to;
+	return last;
+}
+
+/* Scan s[to..from) backward from `from`.  Anchored, returns the smallest
+ * position where a match ending at from can start; unanchored, returns
+ * the largest position where a match ending at or before from starts.
+ * -1 when there is none. */
+static int dfa_rev(struct dfa *d, const char *s, int len, int from, int to,
+                   int anchored)
+{
+	int pos, best = -1;
+	int st = dfa_start(d, is_boundary(s, len, from), anchored);
+
+	if (st < 0) return -1;
+	for (pos = from; pos > to; pos--) {
+		unsigned char c = s[pos - 1];
+
+		if (d->states[st].accept[c == '\n']) {
+			best = pos;
+			if (!anchored) return best;
+		}
+		st = dfa_next(d, st, c);
+		if (st < 0) return best;
+	}
+	if (d->states[st].accept[to == 0 || s[to - 1] == '\n'])
+		best = to;
+	return best;
+}
+
+/* ---- Interface ---- */
+
+void regex_free(struct regex *re)
+{
+	if (!re) return;
+	dfa_free(&re->fwd);
+	dfa_free(&re->rev);
+	if (re->has_prefix) needle_free(&re->prefix);
+	free(re->fprog);
+	free(re->rprog);
+	free(re->sets);
+	free(re);
+}
+
+/* Compile pat[0..len).  fold matches ASCII letters in either case.  On a
+ * syntax error returns NULL with *err set to a message. */
+struct regex *regex_compile(const char *pat, int len, int fold, const char **err)
+{
+	struct re_parse ps;
+	struct regex *re;
+	char prefix[64];
+	int root, plen = 0;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p    = (const unsigned char *)pat;
+	ps.end  = ps.p + len;
+	ps.fold = fold;
+	root = parse_alt(&ps);
+	if (root >= 0 && ps.p < ps.end) {
+		ps.err = "Unmatched ) or \\)";
+		root = -1;
+	}
+	if (root < 0) {
+		*err = ps.err ? ps.err : "Invalid regexp";
+		free(ps.nodes);
+		free(ps.sets);
+		return NULL;
+	}
+
+	re = calloc(1, sizeof(*re));
+	if (!re) {
+		*err = "Out of memory";
+		free(ps.nodes);
+		free(ps.sets);
+		return NULL;
+	}
+	re->fold  = fold;
+	re->sets  = ps.sets;
+	re->nsets = ps.nsets;
+	re->fprog = compile_prog(ps.nodes, root, 0, &re->nfprog);
+	re->rprog = compile_prog(ps.nodes, root, 1, &re->nrprog);
+	literal_prefix(&ps, root, prefix, &plen, sizeof(prefix));
+	free(ps.nodes);
+
+	if (!re->fprog || !re->rprog) {
+		*err = "Regular expression too big";
+		regex_free(re);
+		return NULL;
+	}
+	if (dfa_init(&re->fwd, re->fprog, re->nfprog,
+	             (const unsigned char (*)[32])re->sets, 0, 1) < 0 ||
+	    dfa_init(&re->rev, re->rprog, re->nrprog,
+	             (const unsigned char (*)[32])re->sets, 1, 0) < 0) {
+		*err = "Out of memory";
+		regex_free(re);
+		return NULL;
+	}
+	if (plen > 0 && needle_init(&re->prefix, prefix, plen, fold) == 0)
+		re->has_prefix = 1;
+	return re;
+}
+
+/* Leftmost match in s[0..len) starting at or after from.  Returns 1 and
+ * sets [*start, *end), or 0.  s may hold newlines: ^ and $ match next to
+ * them as well as at the ends of s. */
+int regex_search(struct regex *re, const char *s, int len, int from,
+                 int *start, int *end)
+{
+	int e, b;
+
+	if (from < 0 || from > len)
+		return 0;
+	e = dfa_fwd(&re->fwd, s, len, from, len, 0,
+	            re->has_prefix ? &re->prefix : NULL);
+	if (e < 0)
+		return 0;
+	b = dfa_rev(&re->rev, s, len, e, from, 1);
+	if (b < 0)
+		return 0;
+	*start = b;
+	*end   = e;
+	return 1;
+}
+
+/* Match starting rightmost in s[0..len) among those ending at or before
+ * limit, as a backward search wants.  Returns 1 and sets [*start, *end),
+ * or 0. */
+int regex_rsearch(struct regex *re, const char *s, int len, int limit,
+                  int *start, int *end)
+{
+	int b, e;
+
+	if (limit < 0 || limit > len)
+		return 0;
+	b = dfa_rev(&re->rev, s, len, limit, 0, 0);
+	if (b < 0)
+		return 0;
+	e = dfa_fwd(&re->fwd, s, len, b, limit, 1, NULL);
+	if (e < 0)
+		return 0;
+	*start = b;
+	*end   = e;
+	return 1;
+}
+
+/* Whether a match of re can hold a newline, so a search has to look at
+ * more than one line at a time: some character it consumes may be '\n'.
+ * ^ and $ only look. */
+int regex_multiline(const struct regex *re)
+{
+	int i;
+
+	for (i = 0; i < re->nfprog; i++)
+		if (re->fprog[i].op == OP_SET &&
+		    bit_get(re->sets[re->fprog[i].x], '\n'))
+			return 1;
+	return 0;
+}
@@ -1,110 +1,672 @@
 /* ============================ Find / Replace =============================== */
 
 #include "def.h"
+#include <pthread.h>
 
 #define KILO_QUERY_LEN 256
+#define SEARCH_SPAN_ROWS 64     /* line breaks a regexp match may cross */
 
-#define RESTORE_HL do { \
-	if (saved_hl) { \
-		memcpy(editor.row[saved_hl_line].hl, saved_hl, editor.row[saved_hl_line].rsize); \
-		free(saved_hl); \
-		saved_hl = NULL; \
-	} \
-} while (0)
+/* Lazy highlighting: every match of the active query in the rows being
+ * drawn is shown as an overlay by draw_window_rows(), without touching
+ * row->hl.  Matches are found only for rows actually on screen and are
+ * cached by (query generation, row generation): editing a row gives it a
+ * new generation and changing the query bumps lazy.gen, so stale entries
+ * simply stop matching and nothing needs explicit invalidation. */
+#define LAZY_CACHE_SIZE 256
+
+struct lazy_entry {
+	unsigned row_gen, query_gen;
+	int n, cap;
+	int *span;          /* n [start, end) pairs, render columns */
+};
+
+/* A compiled query: a literal string through a needle (match.c), or a
+ * regular expression (regex.c).  The source is kept so a search thread
+ * can compile a regexp of its own: the DFA cache isn't shared.  span is
+ * how many line breaks a match can cross: the newlines in a literal, up
+ * to SEARCH_SPAN_ROWS for a regexp that can match one, else 0. */
+struct matcher {
+	int regex;
+	struct needle needle;
+	struct regex *re;
+	const char *query;
+	int qlen, fold;
+	int span;
+};
+
+/* Where a match starts and ends, as chars offsets in rows. */
+struct search_hit {
+	int row, col;
+	int erow, ecol;
+};
+
+static struct {
+	char query[KILO_QUERY_LEN + 1];
+	int qlen, fold, regex;
+	struct matcher match;
+	int active;
+	unsigned gen;
+	struct search_hit cur;      /* cur.row < 0: none */
+} lazy;
+
+static struct lazy_entry lazy_cache[LAZY_CACHE_SIZE];
 
 /* Smart case: an all-lowercase query folds case, a query with any uppercase
- * letter searches case-sensitively, like GNU Emacs. */
-static int query_has_upper(const char *q, int qlen)
+ * letter searches case-sensitively, like GNU Emacs.  In a regexp the
+ * letter after a backslash is syntax (\W, \S), not text, and doesn't count. */
+int query_has_upper(const char *q, int qlen, int regex)
 {
 	int i;
 
-	for (i = 0; i < qlen; i++)
+	for (i = 0; i < qlen; i++) {
+		if (regex && q[i] == '\\') {
+			i++;
+			continue;
+		}
 		if (isupper((unsigned char)q[i]))
 			return 1;
+	}
 	return 0;
 }
 
-/* strstr, optionally folding case. */
-static char *case_strstr(const char *hay, const char *needle, int fold)
+/* Compile query into m.  Returns 0, or -1 with *err set when a regexp
+ * doesn't parse -- often just incomplete while it is being typed. */
+static int matcher_init(struct matcher *m, const char *query, int qlen,
+			int fold, int regex, const char **err)
 {
-	if (!fold)
-		return strstr(hay, needle);
-	if (!*needle)
-		return (char *)hay;
+	int i;
 
-	for (; *hay; hay++) {
-		const char *h = hay, *n = needle;
+	m->regex = regex;
+	m->re    = NULL;
+	m->query = query;
+	m->qlen  = qlen;
+	m->fold  = fold;
+	m->span  = 0;
+	*err     = "Out of memory";
+	if (regex) {
+		m->re = regex_compile(query, qlen, fold, err);
+		if (m->re && regex_multiline(m->re))
+			m->span = SEARCH_SPAN_ROWS;
+		return m->re ? 0 : -1;
+	}
+	for (i = 0; i < qlen; i++)
+		m->span += query[i] == '\n';
+	return needle_init(&m->needle, query, qlen, fold);
+}
 
-		while (*h && *n &&
-		       tolower((unsigned char)*h) == tolower((unsigned char)*n)) {
-			h++;
-			n++;
+static void matcher_free(struct matcher *m)
+{
+	if (m->regex)
+		regex_free(m->re);
+	else
+		needle_free(&m->needle);
+	m->re = NULL;
+}
+
+/* First match in s[0..len) starting at or after from: returns 1 and sets
+ * [*start, *end), or 0.  A regexp sees all of s, so ^ only matches at 0. */
+static int matcher_find(const struct matcher *m, const char *s, int len,
+			int from, int *start, int *end)
+{
+	int hit;
+
+	if (m->regex)
+		return regex_search(m->re, s, len, from, start, end);
+	if (from > len)
+		return 0;
+	hit = needle_find(&m->needle, s + from, len - from);
+	if (hit < 0)
+		return 0;
+	*start = from + hit;
+	*end   = *start + m->needle.len;
+	return 1;
+}
+
+/* Rightmost-starting match lying wholly in s[0..limit). */
+static int matcher_rfind(const struct matcher *m, const char *s, int len,
+			 int limit, int *start, int *end)
+{
+	int hit;
+
+	if (m->regex)
+		return regex_rsearch(m->re, s, len, limit, start, end);
+	hit = needle_rfind(&m->needle, s, limit);
+	if (hit < 0)
+		return 0;
+	*start = hit;
+	*end   = hit + m->needle.len;
+	return 1;
+}
+
+/* Search one row from col: forward for a match at or after it, backward
+ * for one ending at or before it.  A negative col searches nothing. */
+static int row_find(const struct matcher *m, const erow *row, int col,
+		    int direction, int *b, int *e)
+{
+	if (col < 0)
+		return 0;
+	if (col > row->size)
+		col = row->size;
+	if (direction > 0)
+		return matcher_find(m, row->chars, row->size, col, b, e);
+	return matcher_rfind(m, row->chars, row->size, col, b, e);
+}
+
+/* Row k steps from start in direction, wrapping around the buffer. */
+static int scan_row(int start, int direction, int k)
+{
+	int r = (start + direction * k) % editor.numrows;
+
+	return r < 0 ? r + editor.numrows : r;
+}
+
+/* A query that can match a newline -- a literal typed with C-j, or a
+ * regexp such as a\nb or [^x]+ -- is searched in the rows as one stream
+ * of text joined by newlines.  The stream is never built whole: a window
+ * of consecutive rows is joined into a reused buffer and searched, and
+ * the next window overlaps it by the span of the query, so a match
+ * across the seam is found whole in the one or the other. */
+#define SEARCH_WINDOW_BYTES 65536
+#define SEARCH_POLL_WINDOWS 16      /* windows between keyboard checks */
+
+static struct {
+	char *b;
+	int len, cap;
+	int first, last;            /* rows [first, last) are in b */
+	int *off;                   /* where each of them starts */
+	int offcap;
+} win;
+
+static int win_append(const char *s, int len)
+{
+	if (win.len + len > win.cap) {
+		int cap = win.cap ? win.cap : SEARCH_WINDOW_BYTES;
+		char *b;
+
+		while (cap < win.len + len)
+			cap *= 2;
+		b = realloc(win.b, cap);
+		if (!b)
+			return -1;
+		win.b   = b;
+		win.cap = cap;
+	}
+	memcpy(win.b + win.len, s, len);
+	win.len += len;
+	return 0;
+}
+
+/* Join the rows from first into the window: span rows past it at least,
+ * more until it holds SEARCH_WINDOW_BYTES, and none from row end on.
+ * Rows that don't end the buffer keep their newline.  Returns -1 when
+ * out of memory. */
+static int win_fill(int first, int span, int end)
+{
+	int r;
+
+	win.len   = 0;
+	win.first = first;
+	for (r = first; r < end; r++) {
+		const erow *row = &editor.row[r];
+		int n = r - first;
+
+		if (n > span && win.len >= SEARCH_WINDOW_BYTES)
+			break;
+		if (n == win.offcap) {
+			int cap = win.offcap ? win.offcap * 2 : 256;
+			int *off = realloc(win.off, cap * sizeof(*off));
+
+			if (!off)
+				return -1;
+			win.off    = off;
+			win.offcap = cap;
 		}
-		if (!*n)
-			return (char *)hay;
+		win.off[n] = win.len;
+		if (win_append(row->chars, row->size) < 0 ||
+		    (r + 1 < editor.numrows && win_append("\n", 1) < 0))
+			return -1;
+	}
+	win.last = r;
+	return 0;
+}
+
+/* The row and column of window offset pos. */
+static void win_pos(int pos, int *row, int *col)
+{
+	int lo = 0, hi = win.last - win.first - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+
+		if (win.off[mid] <= pos)
+			lo = mid;
+		else
+			hi = mid - 1;
 	}
-	return NULL;
+	*row = win.first + lo;
+	*col = pos - win.off[lo];
 }
 
-/* Rightmost occurrence of needle whose end falls at or before `limit`, so a
- * reverse search lands on the match before point (not one straddling it) and
- * repeats step backward, like GNU Emacs. */
-static char *isearch_find_last_before(const char *s, const char *needle,
-				      int limit, int qlen, int fold)
+/* First match starting at or after (row, col) and no later than row
+ * last, in windows from there on.  Returns 1 and fills hit, 0 when there
+ * is none, -1 when a keypress on fd interrupted the search. */
+static int stream_find(int fd, const struct matcher *m,
+		       const struct trigram_query *tq, int row, int col,
+		       int last, struct search_hit *hit)
 {
-	char *best = NULL;
-	char *match = (char *)s;
+	int n, b, e;
+
+	for (n = 1; row <= last && row < editor.numrows; n++) {
+		int skip = trigram_skip(editor.index, tq, row, 1);
+		int accept;
 
-	while ((match = case_strstr(match, needle, fold)) != NULL) {
-		if (match - s + qlen > limit)
+		if (skip) {
+			row += skip;
+			col  = 0;
+			continue;
+		}
+		if (col > editor.row[row].size) {
+			row++;
+			col = 0;
+			continue;
+		}
+		if (win_fill(row, m->span, editor.numrows) < 0)
+			return 0;
+		/* A match starting in the last span rows may run on past
+		 * the window: those rows start the next one. */
+		accept = win.last == editor.numrows ? win.last : win.last - m->span;
+		if (matcher_find(m, win.b, win.len, win.off[0] + col, &b, &e)) {
+			win_pos(b, &hit->row, &hit->col);
+			if (hit->row < accept) {
+				win_pos(e, &hit->erow, &hit->ecol);
+				return hit->row <= last;
+			}
+		}
+		if (win.last == editor.numrows)
 			break;
-		best = match;
-		match++;
+		row = accept;
+		col = 0;
+		if (n % SEARCH_POLL_WINDOWS == 0 && editor_key_pending(fd))
+			return -1;
 	}
-	return best;
+	return 0;
+}
+
+/* Match starting rightmost before (row, col) and lying wholly before it,
+ * starting no earlier than row first, in windows going back from there.
+ * Returns like stream_find(). */
+static int stream_rfind(int fd, const struct matcher *m, int row, int col,
+			int first, struct search_hit *hit)
+{
+	int n, b, e;
+
+	for (n = 1; row >= first; n++) {
+		long bytes = editor.row[row].size;
+		int start = row, limit;
+
+		while (start > first &&
+		       (row - start < m->span || bytes < SEARCH_WINDOW_BYTES))
+			bytes += editor.row[--start].size + 1;
+		if (win_fill(start, row - start, row + 1) < 0)
+			return 0;
+		if (col > editor.row[row].size)
+			col = editor.row[row].size;
+		limit = win.off[row - start] + col;
+		if (limit >= 0 && matcher_rfind(m, win.b, win.len, limit, &b, &e)) {
+			win_pos(b, &hit->row, &hit->col);
+			win_pos(e, &hit->erow, &hit->ecol);
+			return 1;
+		}
+		if (start <= first)
+			break;
+		/* A match starting further back ends within span rows of
+		 * this window's first one. */
+		row = start - 1 + m->span;
+		col = editor.row[row].size;
+		if (n % SEARCH_POLL_WINDOWS == 0 && editor_key_pending(fd))
+			return -1;
+	}
+	return 0;
+}
+
+/* Very large buffers are searched on the worker pool (pool.c) so a miss
+ * doesn't freeze the editor for seconds.  The rows, in scan order, are
+ * cut into chunks handed out in order; each worker stops at the first hit
+ * in its chunk, and the hit earliest in scan order wins, so the result is
+ * the one a serial scan would find.  Chunks past a known hit give up
+ * early.  Meanwhile the UI thread watches the keyboard, and a keypress
+ * cancels the search -- worth having even with a single CPU. */
+#define PSEARCH_MIN_ROWS   50000
+#define PSEARCH_MIN_CHUNK  1024
+#define PSEARCH_POLL_MS    20
+
+struct psearch {
+	const struct matcher *m;
+	const struct trigram_query *tq;
+	struct matcher *own;       /* per worker, for a regexp */
+	signed char *own_ok;       /* 0 not compiled yet, 1 ok, -1 failed */
+	int start_row, start_col, direction, chunk;
+
+	pthread_mutex_t lock;      /* guards the rest */
+	int cancel;
+	int failed;                /* a worker couldn't compile the regexp */
+	int best;                  /* scan index of the earliest hit so far */
+	int col, len;
+};
+
+/* Whether a worker at scan index k can stop: cancelled, or beaten. */
+static int psearch_stop(struct psearch *ps, int k)
+{
+	int stop;
+
+	pthread_mutex_lock(&ps->lock);
+	stop = ps->cancel || ps->best < k;
+	pthread_mutex_unlock(&ps->lock);
+	return stop;
+}
+
+static void psearch_task(void *arg, int task, int worker)
+{
+	struct psearch *ps = arg;
+	const struct matcher *m = ps->m;
+	int k = task * ps->chunk;
+	int end = k + ps->chunk;
+	int i;
+
+	if (end > editor.numrows)
+		end = editor.numrows;
+	if (m->regex) {
+		if (!ps->own_ok[worker]) {
+			const char *err;
+
+			ps->own_ok[worker] = matcher_init(&ps->own[worker],
+			    m->query, m->qlen, m->fold, 1, &err) ? -1 : 1;
+		}
+		if (ps->own_ok[worker] < 0) {
+			/* Out of memory: stop everyone, and let the
+			 * caller scan by itself. */
+			pthread_mutex_lock(&ps->lock);
+			ps->cancel = ps->failed = 1;
+			pthread_mutex_unlock(&ps->lock);
+			return;
+		}
+		m = &ps->own[worker];
+	}
+
+	for (i = 0; k < end; k++, i++) {
+		int r = scan_row(ps->start_row, ps->direction, k);
+		erow *row = &editor.row[r];
+		int col = k ? (ps->direction > 0 ? 0 : row->size) : ps->start_col;
+		int skip, b, e;
+
+		if ((i & 255) == 0 && psearch_stop(ps, k))
+			return;
+		skip = trigram_skip(editor.index, ps->tq, r, ps->direction);
+		if (skip) {
+			k += skip - 1;
+			continue;
+		}
+		if (!row_find(m, row, col, ps->direction, &b, &e))
+			continue;
+		pthread_mutex_lock(&ps->lock);
+		if (k < ps->best) {
+			ps->best = k;
+			ps->col  = b;
+			ps->len  = e - b;
+		}
+		pthread_mutex_unlock(&ps->lock);
+		return;
+	}
+}
+
+/* Run the search on the pool.  Returns 1 and fills the match, 0 when
+ * there is none, -1 when a keypress on fd cancelled it, and -2 when the
+ * pool can't be used, so the caller should scan by itself. */
+static int psearch_run(int fd, int start_row, int start_col, int direction,
+		       const struct matcher *m, const struct trigram_query *tq,
+		       struct search_hit *hit)
+{
+	struct psearch ps;
+	int workers = pool_size();
+	int ntasks, result, i;
+
+	if (workers == 0)
+		return -2;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.m         = m;
+	ps.tq        = tq;
+	ps.start_row = start_row;
+	ps.start_col = start_col;
+	ps.direction = direction;
+	ps.best      = editor.numrows;
+	ps.chunk     = editor.numrows / (workers * 8);
+	if (ps.chunk < PSEARCH_MIN_CHUNK)
+		ps.chunk = PSEARCH_MIN_CHUNK;
+	ntasks = (editor.numrows + ps.chunk - 1) / ps.chunk;
+
+	if (m->regex) {
+		ps.own    = calloc(workers, sizeof(*ps.own));
+		ps.own_ok = calloc(workers, sizeof(*ps.own_ok));
+		if (!ps.own || !ps.own_ok) {
+			free(ps.own);
+			free(ps.own_ok);
+			return -2;
+		}
+	}
+	pthread_mutex_init(&ps.lock, NULL);
+
+	if (pool_start(psearch_task, &ps, ntasks) < 0) {
+		result = -2;
+		goto out;
+	}
+	while (!pool_wait(PSEARCH_POLL_MS)) {
+		if (!editor_key_pending(fd))
+			continue;
+		pthread_mutex_lock(&ps.lock);
+		ps.cancel = 1;
+		pthread_mutex_unlock(&ps.lock);
+	}
+
+	/* A cancelled batch may have skipped rows before its best hit. */
+	result = ps.failed ? -2 : ps.cancel ? -1 : 0;
+	if (!result && ps.best < editor.numrows) {
+		hit->row  = hit->erow = scan_row(start_row, direction, ps.best);
+		hit->col  = ps.col;
+		hit->ecol = ps.col + ps.len;
+		result    = 1;
+	}
+out:
+	for (i = 0; ps.own_ok && i < workers; i++)
+		if (ps.own_ok[i] > 0)
+			matcher_free(&ps.own[i]);
+	free(ps.own);
+	free(ps.own_ok);
+	pthread_mutex_destroy(&ps.lock);
+	return result;
 }
 
 /* Scan the rows from (start_row, start_col) in `direction`, wrapping once
- * through the buffer, for `query`.  On a hit fills *match_row/_col/_len and
- * returns 1; returns 0 when nothing matches.  Columns index row->render. */
-static int isearch_find_match(int start_row, int start_col, int direction,
-			      const char *query, int qlen, int fold,
-			      int *match_row, int *match_col, int *match_len)
+ * through the buffer, for m.  On a hit fills *hit and returns 1; returns
+ * 0 when nothing matches, and -1 when a keypress on fd interrupted a long
+ * search.  Columns index row->chars.
+ * Going backward, only matches ending at or before start_col count on the
+ * first row, so a reverse search lands on the match before point (not one
+ * straddling it) and repeats step backward, like GNU Emacs.  A negative
+ * start_col leaves nothing to search on the first row. */
+static int isearch_find_match(int fd, int start_row, int start_col,
+			      int direction, const struct matcher *m,
+			      struct search_hit *hit)
 {
-	int current, i;
+	struct trigram_query tq;
+	int k;
 
-	if (editor.numrows == 0 || qlen == 0) return 0;
+	if (editor.numrows == 0) return 0;
 	if (start_row < 0) start_row = 0;
 	else if (start_row >= editor.numrows) start_row = editor.numrows - 1;
 
-	current = start_row;
-	for (i = 0; i < editor.numrows; i++) {
-		erow *row = &editor.row[current];
-		int col = (i == 0) ? start_col : (direction > 0 ? 0 : row->rsize);
-		char *match;
+	/* A built index lets a literal query skip blocks of rows that
+	 * can't hold it; a regexp has no trigrams to look up.  The text up
+	 * to a literal's first newline is all on the row a match starts. */
+	tq.n = 0;
+	if (!m->regex && editor.index) {
+		const char *nl = memchr(m->query, '\n', m->qlen);
 
-		if (col < 0) col = 0;
-		else if (col > row->rsize) col = row->rsize;
+		trigram_query_init(&tq, m->query, nl ? nl - m->query : m->qlen);
+	}
 
-		if (direction > 0)
-			match = case_strstr(row->render + col, query, fold);
-		else
-			match = isearch_find_last_before(row->render, query, col, qlen, fold);
+	if (m->span) {
+		int found;
 
-		if (match) {
-			*match_row = current;
-			*match_col = match - row->render;
-			*match_len = qlen;
-			return 1;
+		if (direction > 0) {
+			found = stream_find(fd, m, &tq, start_row, start_col,
+					    editor.numrows - 1, hit);
+			if (found == 0)
+				found = stream_find(fd, m, &tq, 0, 0, start_row, hit);
+		} else {
+			found = stream_rfind(fd, m, start_row, start_col, 0, hit);
+			if (found == 0)
+				found = stream_rfind(fd, m, editor.numrows - 1,
+				    editor.row[editor.numrows - 1].size,
+				    start_row, hit);
 		}
+		return found;
+	}
+
+	if (editor.numrows >= PSEARCH_MIN_ROWS) {
+		int found = psearch_run(fd, start_row, start_col, direction, m,
+					&tq, hit);
+		if (found != -2)
+			return found;
+	}
+
+	for (k = 0; k < editor.numrows; k++) {
+		int current = scan_row(start_row, direction, k);
+		erow *row = &editor.row[current];
+		int col = k ? (direction > 0 ? 0 : row->size) : start_col;
+		int skip = trigram_skip(editor.index, &tq, current, direction);
+		int b, e;
 
-		current += direction;
-		if (current < 0) current = editor.numrows - 1;
-		else if (current == editor.numrows) current = 0;
+		if (skip) {
+			k += skip - 1;
+			continue;
+		}
+		if (row_find(m, row, col, direction, &b, &e)) {
+			hit->row  = hit->erow = current;
+			hit->col  = b;
+			hit->ecol = e;
+			return 1;
+		}
 	}
 	return 0;
 }
 
+/* Spare time between keys: index the current buffer for search when it
+ * is read-only and big enough for a scan to take a while.  Returns 1 as
+ * long as there is indexing left to do. */
+int search_index_idle(int fd)
+{
+	if (!editor.readonly || editor.numrows < PSEARCH_MIN_ROWS)
+		return 0;
+	if (!editor.index &&
+	    !(editor.index = trigram_new(editor.row, editor.numrows)))
+		return 0;
+	return !trigram_build_step(editor.index, editor.row, fd);
+}
+
+/* Make query the one lazily highlighted in every window on this buffer.
+ * A regexp that doesn't parse yet highlights nothing. */
+static void lazy_set_query(const char *query, int qlen, int fold, int regex)
+{
+	const char *err;
+
+	if (lazy.active && lazy.qlen == qlen && lazy.fold == fold &&
+	    lazy.regex == regex && memcmp(lazy.query, query, qlen) == 0)
+		return;
+	memcpy(lazy.query, query, qlen);
+	lazy.query[qlen] = '\0';
+	lazy.qlen   = qlen;
+	lazy.fold   = fold;
+	lazy.regex  = regex;
+	matcher_free(&lazy.match);
+	lazy.active = qlen > 0 &&
+	              matcher_init(&lazy.match, query, qlen, fold, regex, &err) == 0;
+	lazy.gen++;
+	lazy.cur.row = -1;
+}
+
+/* Mark the match point sits on, drawn apart from the other matches;
+ * NULL for none. */
+static void lazy_set_current(const struct search_hit *hit)
+{
+	if (hit)
+		lazy.cur = *hit;
+	else
+		lazy.cur.row = -1;
+}
+
+static void lazy_clear(void)
+{
+	lazy.active  = 0;
+	lazy.cur.row = -1;
+}
+
+/* Matches of the lazy-highlight query in row, as *span[0..2n) pairs of
+ * half-open render columns.  Returns n, 0 when no search is active.
+ * Each row is searched on its own, so a match across a line break is
+ * only shown as the current one. */
+int search_lazy_spans(erow *row, const int **span)
+{
+	struct lazy_entry *e;
+	int col, b, end;
+
+	if (!lazy.active || !row->render)
+		return 0;
+
+	e = &lazy_cache[row->gen % LAZY_CACHE_SIZE];
+	if (e->row_gen != row->gen || e->query_gen != lazy.gen) {
+		e->row_gen   = row->gen;
+		e->query_gen = lazy.gen;
+		e->n = 0;
+		col = 0;
+		while (matcher_find(&lazy.match, row->chars, row->size, col,
+		                    &b, &end)) {
+			if (end == b) {
+				/* Nothing to show for an empty match. */
+				col = b + 1;
+				continue;
+			}
+			if (e->n * 2 + 2 > e->cap) {
+				int cap = e->cap ? e->cap * 2 : 16;
+				int *span = realloc(e->span, cap * sizeof(int));
+
+				if (!span) break;
+				e->span = span;
+				e->cap  = cap;
+			}
+			e->span[e->n * 2]     = chars_to_render_col(row, b);
+			e->span[e->n * 2 + 1] = chars_to_render_col(row, end);
+			e->n++;
+			col = end;
+		}
+	}
+	*span = e->span;
+	return e->n;
+}
+
+/* The part of row fr that the current match covers, for
+ * draw_window_rows(): returns 1 and fills [*lo, *hi) in render columns
+ * while a search shows a match on that row, else 0. */
+int search_lazy_current(int fr, erow *row, int *lo, int *hi)
+{
+	if (!lazy.active || lazy.cur.row < 0 ||
+	    fr < lazy.cur.row || fr > lazy.cur.erow)
+		return 0;
+	*lo = fr == lazy.cur.row  ? chars_to_render_col(row, lazy.cur.col)  : 0;
+	*hi = fr == lazy.cur.erow ? chars_to_render_col(row, lazy.cur.ecol) : row->rsize;
+	return 1;
+}
+
 /* A motion or set-mark command typed during incremental search ends the
  * search and runs from the match, the way Emacs hands off to the command
  * instead of beeping.  Returns 1 if c was such a key, 0 otherwise.  These
@@ -180,202 +742,646 @@ static int isearch_handoff_key(int c)
 	return 1;
 }
 
-void editor_find(int fd, int direction)
+/* One entry per I-search input: the query length after it, the direction
+ * and origin of its scan, and where it matched.  Extending the query
+ * searches on from the top entry's hit -- any match of the longer query is
+ * a match of the shorter one, so nothing before that hit can match -- and
+ * Backspace pops an entry, returning to an earlier state without scanning
+ * at all.  A regexp has no such property ("a" then "a|b"), so regexp
+ * input always rescans from the origin. */
+struct isearch_step {
+	int qlen;
+	int direction;
+	int orow, ocol;      /* where the scan this step refines started */
+	int found;
+	struct search_hit hit;
+	const char *err;     /* why a regexp doesn't parse, "interrupted"
+	                      * when a key cut the scan short, or NULL */
+};
+
+/* Push the step for an input whose search started at (row, col), or,
+ * with scan == 0, for one known to fail without looking.  Returns the new
+ * top, or NULL if the stack couldn't grow. */
+static struct isearch_step *isearch_push(int fd, struct isearch_step **stack,
+					 int *depth, int *cap, int qlen,
+					 int direction, int scan, int row, int col,
+					 const char *query, int fold, int regex)
+{
+	struct isearch_step *st;
+	struct matcher m;
+	const char *err;
+
+	if (*depth == *cap) {
+		int ncap = *cap ? *cap * 2 : 32;
+		struct isearch_step *ns = realloc(*stack, ncap * sizeof(*ns));
+
+		if (!ns) return NULL;
+		*stack = ns;
+		*cap   = ncap;
+	}
+	st = &(*stack)[(*depth)++];
+	st->qlen      = qlen;
+	st->direction = direction;
+	st->orow      = row;
+	st->ocol      = col;
+	st->found     = 0;
+	memset(&st->hit, 0, sizeof(st->hit));
+	st->err       = NULL;
+	if (!scan)
+		return st;
+	if (matcher_init(&m, query, qlen, fold, regex, &err) < 0) {
+		st->err = err;
+		return st;
+	}
+	st->found = isearch_find_match(fd, row, col, direction, &m, &st->hit);
+	if (st->found < 0) {
+		st->found = 0;
+		st->err   = "interrupted";
+	}
+	matcher_free(&m);
+	return st;
+}
+
+/* The query as the prompt shows it, control characters such as a
+ * newline typed with C-j as ^J. */
+static const char *isearch_shown(const char *query, int qlen)
+{
+	static char buf[KILO_QUERY_LEN * 2 + 1];
+	int i, n = 0;
+
+	for (i = 0; i < qlen; i++) {
+		unsigned char c = query[i];
+
+		if (c < ' ' || c == 127) {
+			buf[n++] = '^';
+			buf[n++] = c == 127 ? '?' : c + '@';
+		} else {
+			buf[n++] = c;
+		}
+	}
+	buf[n] = '\0';
+	return buf;
+}
+
+/* Incremental search, for a literal string or, with regex set, for a
+ * regular expression (C-M-s, C-M-r).  TAB and C-j go into the query as
+ * themselves, and C-q quotes any other key, so a search can match across
+ * line breaks. */
+void editor_find(int fd, int direction, int regex)
 {
 	char query[KILO_QUERY_LEN+1] = {0};
 	int saved_cx = editor.cx, saved_cy = editor.cy;
 	int saved_coloff = editor.coloff, saved_rowoff = editor.rowoff;
 	int start_row = editor.rowoff + editor.cy;
 	int start_col = 0;
-	int last_match_row = -1, last_match_col = -1;
-	int saved_hl_line = -1;  /* No saved HL */
-	int find_next = 0; /* if 1 search next, if -1 search prev. */
-	char *saved_hl = NULL;
+	struct isearch_step *stack = NULL, *top = NULL;
+	int depth = 0, cap = 0;
 	int qlen = 0;
 
 	/* Anchor the search at point so a fresh query, and reverse search in
-	 * particular, starts where the cursor is rather than at the top.  The
-	 * scan indexes row->render, so anchor in render columns too. */
+	 * particular, starts where the cursor is rather than at the top. */
 	if (start_row >= 0 && start_row < editor.numrows)
-		start_col = chars_to_render_col(&editor.row[start_row],
-						editor.coloff + editor.cx);
+		start_col = editor.coloff + editor.cx;
 
 	while (1) {
+		int fold = !query_has_upper(query, qlen, regex);
+		int moved = 0;
 		int c;
 
-		editor_set_status_message("I-search: %s", query);
+		if (top && qlen && top->err)
+			editor_set_status_message("I-search%s: %s [%s]",
+			    regex ? " regexp" : "", isearch_shown(query, qlen),
+			    top->err);
+		else
+			editor_set_status_message("%sI-search%s: %s",
+			    top && qlen && !top->found ? "Failing " : "",
+			    regex ? " regexp" : "", isearch_shown(query, qlen));
 		editor_refresh_screen();
 
 		c = editor_read_key(fd);
 		if (c == DEL_KEY || c == CTRL_H || c == BACKSPACE) {
-			if (qlen != 0) query[--qlen] = '\0';
-			last_match_row = last_match_col = -1;
-			find_next = direction;
+			if (depth == 0) continue;
+			depth--;
+			top = depth ? &stack[depth - 1] : NULL;
+			qlen = top ? top->qlen : 0;
+			query[qlen] = '\0';
+			if (top) direction = top->direction;
+			moved = 1;
 		} else if (c == ESC || c == ENTER || c == CTRL_G) {
 			if (c == ESC) {
 				editor.cx = saved_cx; editor.cy = saved_cy;
 				editor.coloff = saved_coloff; editor.rowoff = saved_rowoff;
 			}
-			RESTORE_HL;
 			editor_set_status_message("");
-			return;
-		} else if (c == ARROW_RIGHT || c == ARROW_DOWN || c == CTRL_S) {
-			direction = find_next = 1;
-		} else if (c == ARROW_LEFT || c == ARROW_UP || c == CTRL_R) {
-			direction = find_next = -1;
-		} else if (isprint(c)) {
-			if (qlen < KILO_QUERY_LEN) {
-				query[qlen++] = c;
-				query[qlen] = '\0';
-				last_match_row = last_match_col = -1;
-				find_next = direction;
+			break;
+		} else if (c == ARROW_RIGHT || c == ARROW_DOWN || c == CTRL_S ||
+		           c == ARROW_LEFT || c == ARROW_UP || c == CTRL_R ||
+		           c == ALT_CTRL_S || c == ALT_CTRL_R) {
+			int dir = (c == ARROW_RIGHT || c == ARROW_DOWN ||
+			           c == CTRL_S || c == ALT_CTRL_S) ? 1 : -1;
+			struct isearch_step prev;
+			int row, col, empty;
+
+			if (!top || qlen == 0) {
+				direction = dir;
+				continue;
+			}
+			/* Repeat from just past the current hit; a failing
+			 * search has no hit, and since the scan wraps through
+			 * the whole buffer it would only fail again.  One cut
+			 * short by a key is simply run again.  A regexp
+			 * repeats from the end of its match, and steps over an
+			 * empty one so it can't find the same spot again. */
+			prev = *top;
+			empty = prev.hit.erow == prev.hit.row &&
+			        prev.hit.ecol == prev.hit.col;
+			row  = prev.found ? prev.hit.row : prev.orow;
+			col  = prev.found ? prev.hit.col : prev.ocol;
+			if (prev.found && dir > 0 && regex && !empty) {
+				row = prev.hit.erow;
+				col = prev.hit.ecol;
+			} else if (prev.found && dir > 0) {
+				col++;
+			} else if (prev.found && regex && empty) {
+				col--;
 			}
+			top = isearch_push(fd, &stack, &depth, &cap, qlen, dir,
+			                   prev.found || prev.err, row, col,
+			                   query, fold, regex);
+			if (!top) break;
+			direction = dir;
+			moved = 1;
+		} else if (isprint(c) || c == TAB || c == CTRL_J || c == CTRL_Q) {
+			struct isearch_step prev = { 0 };
+			int row = start_row, col = start_col, scan = 1;
+
+			if (c == CTRL_Q)
+				c = editor_read_raw_byte(fd);
+			if (qlen == KILO_QUERY_LEN || c == 0) continue;
+			query[qlen++] = c;
+			query[qlen] = '\0';
+			fold = !query_has_upper(query, qlen, regex);
+			if (top) {
+				prev = *top;
+				if (regex || prev.err) {
+					row = prev.orow;
+					col = prev.ocol;
+				} else if (!prev.found && prev.qlen > 0) {
+					scan = 0;
+				} else if (prev.found && direction < 0 &&
+				           memchr(query, '\n', qlen)) {
+					/* Going back, a longer match across
+					 * lines may end rows past the hit. */
+					row = prev.orow;
+					col = prev.ocol;
+				} else if (prev.found) {
+					/* Re-verify at the hit.  Going back, the
+					 * longer match may end past it, but not past
+					 * where the scan started (no straddling). */
+					row = prev.hit.row;
+					col = prev.hit.col + (direction > 0 ? 0 : qlen);
+					if (direction < 0 && row == prev.orow &&
+					    col > prev.ocol)
+						col = prev.ocol;
+				}
+			}
+			top = isearch_push(fd, &stack, &depth, &cap, qlen, direction,
+			                   scan, row, col, query, fold, regex);
+			if (!top) break;
+			if (depth > 1 && (prev.found || prev.err || regex)) {
+				/* A refinement keeps the bound of the scan
+				 * it refines. */
+				top->orow = prev.orow;
+				top->ocol = prev.ocol;
+			}
+			moved = 1;
 		} else if (isearch_handoff_key(c)) {
-			RESTORE_HL;
-			return;
+			break;
 		}
 
-		/* Search occurrence. */
-		if (find_next) {
-			int current = start_row, col = start_col;
-			int match_row, match_col, match_len;
-			int fold = !query_has_upper(query, qlen);
-
-			/* Repeat from just past the last hit; a fresh query
-			 * (last_match_row == -1) restarts from point. */
-			if (last_match_row != -1) {
-				current = last_match_row;
-				col = last_match_col + (direction > 0 ? 1 : 0);
-			}
-			find_next = 0;
-
-			/* Highlight */
-			RESTORE_HL;
-
-			if (isearch_find_match(current, col, direction, query, qlen, fold,
-					       &match_row, &match_col, &match_len)) {
-				erow *row = &editor.row[match_row];
-
-				last_match_row = match_row;
-				last_match_col = match_col;
-				if (row->hl) {
-					saved_hl_line = match_row;
-					saved_hl = malloc(row->rsize);
-					memcpy(saved_hl, row->hl, row->rsize);
-					memset(row->hl + match_col, HL_MATCH, match_len);
-				}
-				/* Land point at the far end of the match in the
-				 * search direction: end when going forward, start
-				 * when going back, like Emacs isearch. */
-				editor_reveal_position_centered(match_row,
-				    match_col + (direction > 0 ? match_len : 0));
+		if (!moved) continue;
+		lazy_set_query(query, qlen, fold, regex);
+		if (top && top->found) {
+			lazy_set_current(&top->hit);
+			/* Land point at the far end of the match in the
+			 * search direction: end when going forward, start
+			 * when going back, like Emacs isearch. */
+			if (top->direction > 0)
+				editor_reveal_position_centered(top->hit.erow,
+				                                top->hit.ecol);
+			else
+				editor_reveal_position_centered(top->hit.row,
+				                                top->hit.col);
+		} else {
+			lazy_set_current(NULL);
+			if (!top) {
+				editor.cx = saved_cx; editor.cy = saved_cy;
+				editor.coloff = saved_coloff; editor.rowoff = saved_rowoff;
 			}
 		}
 	}
+
+	free(stack);
+	lazy_clear();
+}
+
+/* Growable byte buffer for building replacement text and rows; err is
+ * set once an allocation fails. */
+struct strbuf {
+	char *b;
+	int len, cap, err;
+};
+
+static void sb_append(struct strbuf *sb, const char *s, int len)
+{
+	if (sb->err || len <= 0)
+		return;
+	if (sb->len + len > sb->cap) {
+		int cap = sb->cap ? sb->cap : 64;
+		char *b;
+
+		while (cap < sb->len + len)
+			cap *= 2;
+		b = realloc(sb->b, cap);
+		if (!b) {
+			sb->err = 1;
+			return;
+		}
+		sb->b   = b;
+		sb->cap = cap;
+	}
+	memcpy(sb->b + sb->len, s, len);
+	sb->len += len;
+}
+
+/* Append the text replacing match[0..mlen) to out: rep with, for a
+ * regexp, \& or \0 standing for the whole match and \\ for a backslash. */
+static void expand_replacement(struct strbuf *out, const char *rep, int rlen,
+			       int regex, const char *match, int mlen)
+{
+	int i, lit = 0;
+
+	if (!regex) {
+		sb_append(out, rep, rlen);
+		return;
+	}
+	for (i = 0; i < rlen; i++) {
+		if (rep[i] != '\\' || i + 1 == rlen)
+			continue;
+		sb_append(out, rep + lit, i - lit);
+		i++;
+		if (rep[i] == '&' || rep[i] == '0')
+			sb_append(out, match, mlen);
+		else if (rep[i] == '\\')
+			sb_append(out, "\\", 1);
+		else
+			sb_append(out, rep + i - 1, 2);
+		lit = i + 1;
+	}
+	sb_append(out, rep + lit, rlen - lit);
 }
 
-void editor_query_replace(int fd)
+/* Replace every match from (filerow, col) to the end of the buffer without
+ * asking, for the `!' answer.  Each row with matches is rebuilt once from
+ * its list of matches, rather than a character at a time, and the rows
+ * from the first changed to the last are saved as one undo record, so
+ * C-_ puts the whole lot back in one step.  Returns the number of
+ * replacements; *end_row/_col get the end of the last one. */
+static int replace_remaining(const struct matcher *m, int filerow, int col,
+			     const char *rep, int rlen, int regex,
+			     int *end_row, int *end_col)
+{
+	struct strbuf line = { 0 }, orig = { 0 };
+	int first = -1, last = -1, count = 0, r;
+
+	for (; filerow < editor.numrows; filerow++, col = 0) {
+		erow *row = &editor.row[filerow];
+		int ms, me, copied = 0, n = 0, end = 0;
+
+		line.len = 0;
+		while (col <= row->size &&
+		       matcher_find(m, row->chars, row->size, col, &ms, &me)) {
+			sb_append(&line, row->chars + copied, ms - copied);
+			expand_replacement(&line, rep, rlen, regex,
+			                   row->chars + ms, me - ms);
+			end    = line.len;
+			copied = me;
+			/* Step over an empty match, or it matches again. */
+			col = me + (me == ms);
+			n++;
+		}
+		if (n == 0)
+			continue;
+		sb_append(&line, row->chars + copied, row->size - copied);
+		if (line.err)
+			break;
+
+		/* Save the original of this row and any unchanged ones since
+		 * the last changed row, before touching it. */
+		for (r = first < 0 ? filerow : last + 1; r <= filerow; r++) {
+			if (r > first && first >= 0)
+				sb_append(&orig, "\n", 1);
+			sb_append(&orig, editor.row[r].chars, editor.row[r].size);
+		}
+		if (orig.err)
+			break;
+		if (first < 0)
+			first = filerow;
+		last = filerow;
+
+		editor_row_set_chars(row, line.b ? line.b : "", line.len);
+		count  += n;
+		*end_row = filerow;
+		*end_col = end;
+	}
+
+	/* undo_push() keeps no payload for zero bytes, which
+	 * UNDO_RECT_OVERWRITE would read as no rows at all; the lone empty
+	 * row that can give that is put back by deleting what went in. */
+	if (count && orig.len > 0)
+		undo_push(UNDO_RECT_OVERWRITE, first, 0, editor.numrows, orig.b, orig.len);
+	else if (count)
+		undo_push(UNDO_YANK_TEXT, first, 0, 0, editor.row[first].chars,
+		          editor.row[first].size);
+
+	free(line.b);
+	free(orig.b);
+	return count;
+}
+
+/* Query replace (M-%), or with regex set query-replace-regexp. */
+void editor_query_replace(int fd, int regex)
 {
 	char search[KILO_QUERY_LEN+1] = {0};
 	char replace[KILO_QUERY_LEN+1] = {0};
-	char *saved_hl = NULL;
-	int saved_hl_line = -1;
 	int slen, rlen, fold;
 	int filerow, match_col;
-	int count = 0, replace_all = 0;
+	struct matcher m;
+	const char *err;
+	int count = 0;
 
 	if (editor_readonly_blocked())
 		return;
 
-	if (editor_read_line(fd, "Query replace: ", search, sizeof(search)) < 0 || !search[0])
+	if (editor_read_line(fd, regex ? "Query replace regexp: " : "Query replace: ",
+			     search, sizeof(search)) < 0 || !search[0])
 		return;
 	if (editor_read_line(fd, "Replace with: ", replace, sizeof(replace)) < 0)
 		return;
 
 	slen = strlen(search);
 	rlen = strlen(replace);
-	fold = !query_has_upper(search, slen);
+	fold = !query_has_upper(search, slen, regex);
 	filerow   = editor.rowoff + editor.cy;
 	match_col = editor.coloff + editor.cx;
+	if (matcher_init(&m, search, slen, fold, regex, &err) < 0) {
+		if (regex)
+			editor_set_status_message("Invalid regexp: %s", err);
+		return;
+	}
 
 	while (filerow < editor.numrows) {
-		char *match = case_strstr(editor.row[filerow].chars + match_col, search, fold);
+		erow *r = &editor.row[filerow];
+		struct search_hit hit;
+		int ms, me;
 		int c;
 
-		if (!match) {
+		if (match_col > r->size ||
+		    !matcher_find(&m, r->chars, r->size, match_col, &ms, &me)) {
 			filerow++;
 			match_col = 0;
 			continue;
 		}
-		match_col = match - editor.row[filerow].chars;
+		match_col = ms;
 
 		editor_goto_line_direct(filerow + 1, match_col + 1);
 
-		/* Highlight the match.  Convert the chars offset to a render
-		 * offset so the highlight lands correctly even when tabs precede
-		 * the match on the line. */
-		RESTORE_HL;
-		{
-			erow *row = &editor.row[filerow];
-			if (row->hl) {
-				int i, rcol = 0;
-				for (i = 0; i < match_col; i++)
-					rcol += (row->chars[i] == '\t') ? (8 - rcol % 8) : 1;
-				saved_hl_line = filerow;
-				saved_hl = malloc(row->rsize);
-				memcpy(saved_hl, row->hl, row->rsize);
-				if (rcol + slen <= row->rsize)
-					memset(row->hl + rcol, HL_MATCH, slen);
-			}
-		}
+		/* Highlight the match. */
+		lazy_set_query(search, slen, fold, regex);
+		hit.row  = hit.erow = filerow;
+		hit.col  = ms;
+		hit.ecol = me;
+		lazy_set_current(&hit);
 
-		if (!replace_all) {
-			editor_set_status_message(
-				"Replace \"%s\" with \"%s\"? (y/n/!/q)", search, replace);
-			editor_refresh_screen();
-			c = editor_read_key(fd);
-		} else {
-			c = 'y';
-		}
+		editor_set_status_message(
+			"Replace \"%s\" with \"%s\"? (y/n/!/q)", search, replace);
+		editor_refresh_screen();
+		c = editor_read_key(fd);
 
 		if (c == ESC || c == CTRL_G || c == 'q')
 			break;
 		if (c == '!') {
-			replace_all = 1;
-			c = 'y';
+			int end_row = filerow, end_col = ms;
+
+			count += replace_remaining(&m, filerow, ms, replace, rlen,
+			                           regex, &end_row, &end_col);
+			editor_goto_line_direct(end_row + 1, end_col + 1);
+			break;
 		}
 
 		if (c == 'y' || c == ENTER) {
 			erow *row = &editor.row[filerow];
-			char matched[KILO_QUERY_LEN + 1];
-			int i;
+			struct strbuf text = { 0 };
+			int mlen = me - ms, i;
 
-			/* Record the text actually matched, not the query: under
-			 * case folding they differ, and undo must restore what was
-			 * really there. */
-			memcpy(matched, row->chars + match_col, slen);
-			matched[slen] = '\0';
+			expand_replacement(&text, replace, rlen, regex,
+			                   row->chars + ms, mlen);
+			if (text.err)
+				break;
 
 			/* Undo in two steps: YANK_TEXT (popped first) deletes the
-			 * inserted replacement, then KILL_TEXT restores the original. */
-			undo_push(UNDO_KILL_TEXT, filerow, match_col, 0, matched, slen);
-			undo_push(UNDO_YANK_TEXT, filerow, match_col, 0, replace, rlen);
+			 * inserted replacement, then KILL_TEXT restores the original.
+			 * Record the text actually matched, not the query: under
+			 * case folding or a regexp they differ, and undo must
+			 * restore what was really there. */
+			undo_push(UNDO_KILL_TEXT, filerow, ms, 0, row->chars + ms, mlen);
+			undo_push(UNDO_YANK_TEXT, filerow, ms, 0, text.b, text.len);
 
 			suppress_undo = 1;
-			for (i = 0; i < slen; i++)
-				editor_row_del_char(row, match_col);
-			for (i = 0; i < rlen; i++)
-				editor_row_insert_char(row, match_col + i, (unsigned char)replace[i]);
+			for (i = 0; i < mlen; i++)
+				editor_row_del_char(row, ms);
+			for (i = 0; i < text.len; i++)
+				editor_row_insert_char(row, ms + i, (unsigned char)text.b[i]);
 			suppress_undo = 0;
 
-			match_col += rlen;
+			/* Step over an empty match, or it matches again. */
+			match_col = ms + text.len + (mlen == 0);
+			free(text.b);
 			count++;
 		} else {
-			match_col++;
+			match_col = regex && me > ms ? me : ms + 1;
 		}
 	}
 
-	RESTORE_HL;
+	matcher_free(&m);
+	lazy_clear();
 	editor_set_status_message(count ? "Replaced %d occurrence%s." : "No replacements made.",
 				  count, count == 1 ? "" : "s");
 }
+
+/* M-x occur: every line of the buffer that matches a regexp, listed as
+ * "line:text" in an *Occur* buffer where RET visits the line.  The scan
+ * appends to the *Occur* buffer as it goes and redraws every so often,
+ * so matches in a huge file show up while the rest is still being
+ * searched; a keypress stops it there. */
+#define OCCUR_NAME     "*Occur*"
+#define OCCUR_CHUNK    4096     /* rows between clock checks */
+#define OCCUR_REDRAW_MS 100
+
+static struct editor_syntax occur_syntax = {
+	"Occur", NULL, NULL, "", "", "", 0
+};
+
+static struct {
+	char query[KILO_QUERY_LEN + 1];
+	struct matcher m;
+	int live;            /* m is compiled */
+	int src;             /* buflist[] slot searched */
+	char *src_name;      /* its filename then, to notice a reused slot */
+} occur;
+
+static long elapsed_ms(const struct timeval *since)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - since->tv_sec) * 1000L +
+	       (now.tv_usec - since->tv_usec) / 1000;
+}
+
+/* The header row; rewritten once the scan is done. */
+static void occur_populate(void)
+{
+	char line[KILO_QUERY_LEN + 64];
+	int len = snprintf(line, sizeof(line), "Searching for \"%s\"...",
+	                   occur.query);
+
+	editor_insert_row(0, line, len);
+}
+
+void editor_occur(int fd)
+{
+	struct editor_buffer *b;
+	struct strbuf line = { 0 };
+	struct timeval last;
+	char name[256], header[KILO_QUERY_LEN + 320];
+	const char *err;
+	int qlen, r, n = 0, stopped = -1, len;
+
+	if (editor.syntax == &occur_syntax) {
+		editor_set_status_message("Already in the %s buffer", OCCUR_NAME);
+		return;
+	}
+	if (editor_read_line(fd, "List lines matching regexp: ", occur.query,
+			     sizeof(occur.query)) < 0 || !occur.query[0])
+		return;
+
+	qlen = strlen(occur.query);
+	if (occur.live)
+		matcher_free(&occur.m);
+	occur.live = 0;
+	if (matcher_init(&occur.m, occur.query, qlen,
+			 !query_has_upper(occur.query, qlen, 1), 1, &err) < 0) {
+		editor_set_status_message("Invalid regexp: %s", err);
+		return;
+	}
+	occur.live = 1;
+	occur.src  = buf_current;
+	free(occur.src_name);
+	occur.src_name = editor.filename ? strdup(editor.filename) : NULL;
+	buf_display_name(occur.src, name, sizeof(name));
+
+	buf_open_special(OCCUR_NAME, &occur_syntax, occur_populate, "");
+	if (editor.syntax != &occur_syntax)
+		return;         /* no free buffer slot */
+
+	/* The source rows sit in their slot until we switch back. */
+	b = &buflist[occur.src];
+	gettimeofday(&last, NULL);
+	for (r = 0; r < b->numrows; r++) {
+		erow *row = &b->row[r];
+		int ms, me;
+
+		if (r % OCCUR_CHUNK == OCCUR_CHUNK - 1 &&
+		    elapsed_ms(&last) >= OCCUR_REDRAW_MS) {
+			if (editor_key_pending(fd)) {
+				stopped = r;
+				break;
+			}
+			editor_set_status_message("Searching... %d%%",
+			                          (int)(100.0 * r / b->numrows));
+			editor.dirty = 0;
+			editor_refresh_screen();
+			gettimeofday(&last, NULL);
+		}
+		if (!matcher_find(&occur.m, row->chars, row->size, 0, &ms, &me))
+			continue;
+
+		line.len = 0;
+		len = snprintf(header, sizeof(header), "%7d:", r + 1);
+		sb_append(&line, header, len);
+		sb_append(&line, row->chars, row->size);
+		if (line.err)
+			break;
+		editor_insert_row(editor.numrows, line.b, line.len);
+		n++;
+	}
+	free(line.b);
+
+	len = snprintf(header, sizeof(header), "%d line%s matching \"%s\" in buffer: %s",
+	               n, n == 1 ? "" : "s", occur.query, name);
+	if (stopped >= 0 && len < (int)sizeof(header))
+		len += snprintf(header + len, sizeof(header) - len,
+		                " (stopped at line %d)", stopped + 1);
+	if (len >= (int)sizeof(header))
+		len = sizeof(header) - 1;
+	editor_row_set_chars(&editor.row[0], header, len);
+	editor.dirty = 0;
+
+	if (n)
+		editor_set_status_message("RET visits a line, q or C-x k closes %s",
+		                          OCCUR_NAME);
+	else
+		editor_set_status_message("No matches for \"%s\"", occur.query);
+}
+
+/* RET in the *Occur* buffer: go to the line at point in the buffer that
+ * was searched, on the start of its first match.  Returns 0 when point
+ * isn't in an *Occur* buffer, so the key can mean something else. */
+int editor_occur_goto(void)
+{
+	int filerow = editor.rowoff + editor.cy;
+	struct editor_buffer *b;
+	erow *row;
+	char *end;
+	long line;
+	int ms = 0, me;
+
+	if (editor.syntax != &occur_syntax)
+		return 0;
+	if (filerow < 1 || filerow >= editor.numrows)
+		return 1;
+
+	row  = &editor.row[filerow];
+	line = strtol(row->chars, &end, 10);
+	if (end == row->chars || *end != ':' || line < 1)
+		return 1;
+
+	b = &buflist[occur.src];
+	if (!b->active || (b->filename && occur.src_name ?
+	    strcmp(b->filename, occur.src_name) != 0 :
+	    b->filename != occur.src_name)) {
+		editor_set_status_message("Buffer no longer exists");
+		return 1;
+	}
+
+	buf_switch_to(occur.src);
+	if (line <= editor.numrows) {
+		row = &editor.row[line - 1];
+		if (occur.live)
+			matcher_find(&occur.m, row->chars, row->size, 0, &ms, &me);
+	}
+	editor_goto_line_direct(line, ms + 1);
+	editor_set_status_message("%s", editor.filename ? editor.filename : "[new]");
+	return 1;
+}
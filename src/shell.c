@@ -2,8 +2,11 @@
  *
  * M-!  shell-command            Run a shell command, insert stdout at point.
  * M-|  shell-command-on-region  Pipe the region through a shell command and
- *                               replace it with stdout.  The original region
- *                               is left in the kill ring as a safety net.
+ *                               replace it with stdout, as one undo step.
+ *                               A failing command leaves the region be.
+ * M-&  async-shell-command      Run a shell command in the background, its
+ *                               stdout and stderr going to a buffer of their
+ *                               own as they come.  C-g there kills it.
  *
  * The child is spawned via /bin/sh -c so the user can use pipes, redirects,
  * and shell builtins.  Stdin/stdout are connected to pipes; stderr goes to
@@ -16,6 +19,61 @@
 #include <sys/wait.h>
 
 #define SHELL_INITIAL_CAP 4096
+#define FILTER_STAGE      65536         /* region bytes per write */
+#define FILTER_CHUNK      (1024 * 1024) /* output chunks grow to this */
+
+#define ASYNC_NAME        "*Async Shell Command*"
+#define ASYNC_CHUNK       16384
+#define ASYNC_SLICE       (256 * 1024)  /* read per idle pass, at most */
+#define ASYNC_MAX_PENDING (1024 * 1024) /* then let the pipe fill up */
+
+static struct editor_syntax async_syntax = {
+	"Async", NULL, NULL, "", "", "", 0
+};
+
+/* The command behind the *Async Shell Command* buffer. */
+static struct {
+	pid_t pid;                  /* -1 once reaped */
+	int fd;                     /* its stdout and stderr, -1 at EOF */
+	int signalled;              /* C-g sent SIGTERM already */
+	struct abuf pend;           /* read, not yet in the buffer */
+} async = { -1, -1, 0, { NULL, 0 } };
+
+/* Fork /bin/sh -c `cmd` with its stdin, stdout and stderr on the given
+ * fds, -1 meaning /dev/null.  With `group` the child leads a process
+ * group of its own, so it and all it starts can be signalled together.
+ * The caller's ends of any pipes must be close-on-exec.  Returns the pid,
+ * or -1 with errno set. */
+static pid_t shell_spawn(const char *cmd, int in, int out, int err, int group)
+{
+	pid_t pid = fork();
+	int devnull;
+
+	if (pid != 0) {
+		/* Both sides set the group, so a kill can't beat the child to it. */
+		if (pid > 0 && group)
+			setpgid(pid, pid);
+		return pid;
+	}
+
+	if (group)
+		setpgid(0, 0);
+	devnull = open("/dev/null", O_RDWR);
+	dup2(in  >= 0 ? in  : devnull, STDIN_FILENO);
+	dup2(out >= 0 ? out : devnull, STDOUT_FILENO);
+	dup2(err >= 0 ? err : devnull, STDERR_FILENO);
+	if (in > STDERR_FILENO)
+		close(in);
+	if (out > STDERR_FILENO && out != in)
+		close(out);
+	if (err > STDERR_FILENO && err != in && err != out)
+		close(err);
+	if (devnull > STDERR_FILENO)
+		close(devnull);
+
+	execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+	_exit(127);
+}
 
 /* Concurrently write `in` (inlen bytes) to wfd and read everything from rfd
  * into a newly-malloc'd buffer.  Either fd may be -1 to skip that side.
@@ -127,28 +185,12 @@ char *shell_run(const char *cmd, const char *in, int inlen, int *out_len)
 
 	if (pipe(in_pipe)  < 0) goto fail;
 	if (pipe(out_pipe) < 0) goto fail;
+	fcntl(in_pipe[1],  F_SETFD, FD_CLOEXEC);
+	fcntl(out_pipe[0], F_SETFD, FD_CLOEXEC);
 
-	pid = fork();
+	pid = shell_spawn(cmd, in_pipe[0], out_pipe[1], -1, 0);
 	if (pid < 0) goto fail;
 
-	if (pid == 0) {
-		int devnull = open("/dev/null", O_WRONLY);
-
-		dup2(in_pipe[0],  STDIN_FILENO);
-		dup2(out_pipe[1], STDOUT_FILENO);
-		if (devnull >= 0) {
-			dup2(devnull, STDERR_FILENO);
-			close(devnull);
-		}
-		close(in_pipe[0]);
-		close(in_pipe[1]);
-		close(out_pipe[0]);
-		close(out_pipe[1]);
-
-		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-		_exit(127);
-	}
-
 	close(in_pipe[0]);
 	close(out_pipe[1]);
 
@@ -208,12 +250,307 @@ void editor_shell_command(int fd)
 	editor_set_status_message("Inserted %d byte%s", out_len, out_len == 1 ? "" : "s");
 }
 
-/* M-| shell-command-on-region: pipe region through cmd, replace it with stdout. */
+/* M-| streams the region through the command instead of copying it out
+ * first: it is written from the rows a slice at a time, and the output
+ * read in chunks that become the text of the new rows as they are, each
+ * line ending in its NUL where the newline was.  Nothing in the buffer
+ * changes until the command has exited successfully; then the new rows
+ * replace the old ones in one go, as one undo step. */
+struct filter {
+	/* The region, and how far it has been written. */
+	int row, col, end_row, end_col;
+	char stage[FILTER_STAGE];
+	int slen, soff;
+
+	/* The output, in chunks the rows point into. */
+	char *buf;
+	size_t len, cap, line;      /* line: start of the unfinished one */
+	char **chunk;
+	size_t *chunk_size;
+	int nchunks, chunk_cap;
+	erow *rows;
+	int nrows, rows_cap;
+};
+
+/* Copy the next slice of the region into the empty stage. */
+static void filter_fill(struct filter *f)
+{
+	f->slen = f->soff = 0;
+	while (f->row <= f->end_row && f->slen < FILTER_STAGE) {
+		erow *r = &editor.row[f->row];
+		int end = f->row == f->end_row ? f->end_col : r->size;
+		int n = end - f->col;
+
+		if (n > FILTER_STAGE - f->slen)
+			n = FILTER_STAGE - f->slen;
+		memcpy(f->stage + f->slen, r->chars + f->col, n);
+		f->slen += n;
+		f->col  += n;
+		if (f->col < end || f->slen == FILTER_STAGE)
+			break;
+		if (f->row < f->end_row)
+			f->stage[f->slen++] = '\n';
+		f->row++;
+		f->col = 0;
+	}
+}
+
+static int filter_add_row(struct filter *f, char *s, size_t len)
+{
+	if (f->nrows == f->rows_cap) {
+		int cap = f->rows_cap ? f->rows_cap * 2 : 1024;
+		erow *r = realloc(f->rows, cap * sizeof(erow));
+
+		if (!r)
+			return -1;
+		f->rows = r;
+		f->rows_cap = cap;
+	}
+	s[len] = '\0';
+	f->rows[f->nrows].chars  = s;
+	f->rows[f->nrows].size   = len;
+	f->rows[f->nrows].shared = 1;
+	f->nrows++;
+	return 0;
+}
+
+/* Keep the output chunk being read into, for the rows in it. */
+static int filter_keep(struct filter *f)
+{
+	if (f->nchunks == f->chunk_cap) {
+		int n = f->chunk_cap ? f->chunk_cap * 2 : 16;
+		char **c = realloc(f->chunk, n * sizeof(*c));
+		size_t *s;
+
+		if (!c)
+			return -1;
+		f->chunk = c;
+		if (!(s = realloc(f->chunk_size, n * sizeof(*s))))
+			return -1;
+		f->chunk_size = s;
+		f->chunk_cap  = n;
+	}
+	f->chunk[f->nchunks] = f->buf;
+	f->chunk_size[f->nchunks++] = f->cap;
+	f->buf = NULL;
+	return 0;
+}
+
+/* Start a new output chunk, taking along the unfinished line.  The old
+ * one is kept for the rows in it: a chunk never moves once rows point
+ * into it.  Chunks double in size up to FILTER_CHUNK, so a short output
+ * doesn't leave the arena a block mostly empty. */
+static int filter_next_chunk(struct filter *f)
+{
+	size_t part = f->len - f->line;
+	size_t cap = !f->buf ? SHELL_INITIAL_CAP :
+	             f->cap < FILTER_CHUNK ? f->cap * 2 : f->cap;
+	char *buf;
+
+	while (cap < 2 * part + 2)
+		cap *= 2;
+	if (!(buf = malloc(cap)))
+		return -1;
+	if (f->buf)
+		memcpy(buf, f->buf + f->line, part);
+	if (f->buf && f->line) {
+		if (filter_keep(f)) {
+			free(buf);
+			return -1;
+		}
+	} else {
+		free(f->buf);   /* no row points into it */
+	}
+	f->buf  = buf;
+	f->cap  = cap;
+	f->len  = part;
+	f->line = 0;
+	return 0;
+}
+
+/* Read what the command has written into rows.  Returns as read(2), or
+ * -2 out of memory. */
+static ssize_t filter_read(struct filter *f, int fd)
+{
+	char *p, *end;
+	ssize_t n;
+
+	/* One byte to spare for the last line's NUL. */
+	if (f->cap - f->len < 2 && filter_next_chunk(f))
+		return -2;
+	n = read(fd, f->buf + f->len, f->cap - f->len - 1);
+	if (n <= 0)
+		return n;
+
+	p   = f->buf + f->len;
+	end = p + n;
+	f->len += n;
+	while ((p = memchr(p, '\n', end - p))) {
+		if (filter_add_row(f, f->buf + f->line, p - (f->buf + f->line)))
+			return -2;
+		f->line = ++p - f->buf;
+	}
+	return n;
+}
+
+static void filter_free(struct filter *f)
+{
+	int i;
+
+	for (i = 0; i < f->nrows; i++)
+		if (!f->rows[i].shared)
+			free(f->rows[i].chars);
+	for (i = 0; i < f->nchunks; i++)
+		free(f->chunk[i]);
+	free(f->chunk);
+	free(f->chunk_size);
+	free(f->buf);
+	free(f->rows);
+}
+
+/* Write the region to wfd and read the output from rfd until the command
+ * closes it.  Both fds are closed before return.  Returns 0, or -1 out of
+ * memory. */
+static int filter_pump(struct filter *f, int rfd, int wfd)
+{
+	struct pollfd pfd[2];
+	int npoll, i, rc = 0;
+	ssize_t n;
+
+	fcntl(rfd, F_SETFL, O_NONBLOCK);
+	fcntl(wfd, F_SETFL, O_NONBLOCK);
+	filter_fill(f);
+
+	while (rfd >= 0) {
+		npoll = 0;
+		pfd[npoll].fd     = rfd;
+		pfd[npoll].events = POLLIN;
+		npoll++;
+		if (wfd >= 0) {
+			pfd[npoll].fd     = wfd;
+			pfd[npoll].events = POLLOUT;
+			npoll++;
+		}
+		if (poll(pfd, npoll, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (i = 0; i < npoll; i++) {
+			if (pfd[i].fd == rfd && (pfd[i].revents & (POLLIN|POLLHUP|POLLERR))) {
+				n = filter_read(f, rfd);
+				if (n == -2)
+					rc = -1;
+				if (n == -2 || (n < 0 && errno != EAGAIN && errno != EINTR) || n == 0) {
+					close(rfd);
+					rfd = -1;
+				}
+			}
+			if (pfd[i].fd == wfd && (pfd[i].revents & (POLLOUT|POLLHUP|POLLERR))) {
+				n = write(wfd, f->stage + f->soff, f->slen - f->soff);
+				if (n > 0 && (f->soff += n) == f->slen)
+					filter_fill(f);
+				if ((n < 0 && errno != EAGAIN) || f->slen == 0) {
+					/* All written, or the command stopped reading. */
+					close(wfd);
+					wfd = -1;
+				}
+			}
+		}
+	}
+	if (wfd >= 0)
+		close(wfd);
+	if (rfd >= 0)
+		close(rfd);
+	return rc;
+}
+
+/* Give row r the text pre before and suf after what it has, in a malloc
+ * of its own. */
+static int filter_join(erow *r, const char *pre, int plen, const char *suf, int slen)
+{
+	char *chars = malloc((size_t)plen + r->size + slen + 1);
+
+	if (!chars)
+		return -1;
+	memcpy(chars, pre, plen);
+	memcpy(chars + plen, r->chars, r->size);
+	memcpy(chars + plen + r->size, suf, slen);
+	chars[plen + r->size + slen] = '\0';
+	if (!r->shared)
+		free(r->chars);
+	r->chars  = chars;
+	r->size  += plen + slen;
+	r->shared = 0;
+	return 0;
+}
+
+/* Swap the output rows in for the rows the region spans: the first gets
+ * what comes before the region on its row, the last what follows it.
+ * The old rows go on the undo stack.  Returns 0, or -1 out of memory
+ * with the buffer untouched. */
+static int filter_install(struct filter *f, int start_row, int start_col,
+                          int end_row, int end_col)
+{
+	erow *first = &editor.row[start_row], *last = &editor.row[end_row];
+	int nold = end_row - start_row + 1;
+	int nnew, out_col, orig_len, i;
+	erow *r;
+	char *orig;
+
+	/* The unfinished line is the last one, even if empty. */
+	if (!f->buf && filter_next_chunk(f))
+		return -1;
+	if (filter_add_row(f, f->buf + f->line, f->len - f->line) ||
+	    filter_keep(f))
+		return -1;
+
+	nnew = f->nrows;
+	r = &f->rows[nnew - 1];
+	out_col = r->size + (nnew == 1 ? start_col : 0);
+	if (end_col < last->size &&
+	    filter_join(r, "", 0, last->chars + end_col, last->size - end_col))
+		return -1;
+	if (start_col > 0 && filter_join(&f->rows[0], first->chars, start_col, "", 0))
+		return -1;
+
+	orig = editor_rows_to_string(first, nold, &orig_len);
+	if (!orig)
+		return -1;
+
+	/* The chunks go to the arena for the rows to share. */
+	for (i = 0; i < f->nchunks; i++)
+		if (editor_adopt_text(f->chunk[i], f->chunk_size[i]))
+			break;
+	if (i < f->nchunks ||
+	    editor_replace_rows(start_row, nold, f->rows, nnew)) {
+		/* What the arena took is its to free. */
+		memmove(f->chunk, f->chunk + i, (f->nchunks - i) * sizeof(*f->chunk));
+		f->nchunks -= i;
+		free(orig);
+		return -1;
+	}
+	f->nchunks = 0;
+	f->nrows   = 0;         /* the buffer's now */
+
+	undo_push_text(UNDO_REPLACE_ROWS, start_row, start_col, nnew, orig, orig_len);
+	editor_cursor_goto(start_row + nnew - 1, out_col);
+	return 0;
+}
+
+/* M-| shell-command-on-region: pipe the region through cmd and replace it
+ * with the output, unless the command fails. */
 void editor_shell_command_on_region(int fd)
 {
+	int cur_row = editor.rowoff + editor.cy;
+	int cur_col = editor.coloff + editor.cx;
+	int start_row, start_col, end_row, end_col;
+	void (*old_sigpipe)(int);
+	int in_pipe[2], out_pipe[2];
+	struct filter f;
 	char cmd[256];
-	char *region, *out;
-	int region_len = 0, out_len = 0;
+	int status, rc;
+	pid_t pid;
 
 	if (editor_readonly_blocked())
 		return;
@@ -222,28 +559,269 @@ void editor_shell_command_on_region(int fd)
 		return;
 	}
 
-	region = editor_get_region_text(&region_len);
-	if (!region) {
+	if (editor.mark_row < cur_row ||
+	    (editor.mark_row == cur_row && editor.mark_col < cur_col)) {
+		start_row = editor.mark_row; start_col = editor.mark_col;
+		end_row   = cur_row;         end_col   = cur_col;
+	} else {
+		start_row = cur_row;         start_col = cur_col;
+		end_row   = editor.mark_row; end_col   = editor.mark_col;
+	}
+	/* A stale mark can point past a shrunken buffer. */
+	if (end_row >= editor.numrows) {
+		end_row = editor.numrows - 1;
+		end_col = end_row >= 0 ? editor.row[end_row].size : 0;
+	}
+	if (start_row > end_row || (start_row == end_row && start_col >= end_col)) {
 		editor_set_status_message("Empty region");
 		return;
 	}
+	if (start_col > editor.row[start_row].size)
+		start_col = editor.row[start_row].size;
+	if (end_col > editor.row[end_row].size)
+		end_col = editor.row[end_row].size;
 
-	if (editor_read_line(fd, "Shell command on region: ", cmd, sizeof(cmd)) < 0 || !cmd[0]) {
-		free(region);
+	if (editor_read_line(fd, "Shell command on region: ", cmd, sizeof(cmd)) < 0 || !cmd[0])
+		return;
+
+	in_pipe[0] = in_pipe[1] = -1;
+	if (pipe(in_pipe) < 0 || pipe(out_pipe) < 0) {
+		editor_set_status_message("Shell command failed: %s", strerror(errno));
+		if (in_pipe[0] >= 0) {
+			close(in_pipe[0]);
+			close(in_pipe[1]);
+		}
+		return;
+	}
+	fcntl(in_pipe[1],  F_SETFD, FD_CLOEXEC);
+	fcntl(out_pipe[0], F_SETFD, FD_CLOEXEC);
+	pid = shell_spawn(cmd, in_pipe[0], out_pipe[1], -1, 0);
+	close(in_pipe[0]);
+	close(out_pipe[1]);
+	if (pid < 0) {
+		editor_set_status_message("Shell command failed: %s", strerror(errno));
+		close(in_pipe[1]);
+		close(out_pipe[0]);
 		return;
 	}
 
-	out = shell_run(cmd, region, region_len, &out_len);
-	free(region);
-	if (!out) {
+	memset(&f, 0, sizeof(f));
+	f.row     = start_row;
+	f.col     = start_col;
+	f.end_row = end_row;
+	f.end_col = end_col;
+
+	/* If the child exits early we don't want EPIPE to kill us. */
+	old_sigpipe = signal(SIGPIPE, SIG_IGN);
+	rc = filter_pump(&f, out_pipe[0], in_pipe[1]);
+	signal(SIGPIPE, old_sigpipe);
+	if (rc < 0)
+		kill(pid, SIGKILL);     /* it may be stuck writing to us */
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+
+	if (rc < 0)
+		editor_set_status_message("Out of memory");
+	else if (!WIFEXITED(status) || WEXITSTATUS(status))
+		editor_set_status_message("Shell command failed (%s %d), region left as is",
+		                          WIFEXITED(status) ? "exit" : "signal",
+		                          WIFEXITED(status) ? WEXITSTATUS(status)
+		                                            : WTERMSIG(status));
+	else if (filter_install(&f, start_row, start_col, end_row, end_col))
+		editor_set_status_message("Out of memory");
+	else {
+		editor.mark_highlight = 0;
+		editor.rect_mode = 0;
+		editor.shift_select = 0;
+		editor_set_status_message("Replaced region (%d line%s out)",
+		                          editor.rowoff + editor.cy - start_row + 1,
+		                          editor.rowoff + editor.cy == start_row ? "" : "s");
+	}
+	filter_free(&f);
+}
+
+/* Kill the async command, if any, and forget its output. */
+void shell_async_stop(void)
+{
+	if (async.pid > 0) {
+		kill(-async.pid, SIGKILL);
+		waitpid(async.pid, NULL, 0);
+		async.pid = -1;
+	}
+	if (async.fd >= 0) {
+		close(async.fd);
+		async.fd = -1;
+	}
+	ab_free(&async.pend);
+	async.pend.b   = NULL;
+	async.pend.len = 0;
+}
+
+static void async_populate(void)
+{
+	editor_insert_row(0, "", 0);
+}
+
+/* Read what the command has written, a slice at a time so a chatty one
+ * can't starve the keyboard, and no more than the buffer is behind by. */
+static void async_read(void)
+{
+	char buf[ASYNC_CHUNK];
+	int total = 0;
+	ssize_t n;
+
+	while (async.fd >= 0 && total < ASYNC_SLICE &&
+	       async.pend.len < ASYNC_MAX_PENDING) {
+		n = read(async.fd, buf, sizeof(buf));
+		if (n > 0) {
+			ab_append(&async.pend, buf, n);
+			total += n;
+		} else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+			break;
+		} else {
+			close(async.fd);
+			async.fd = -1;
+		}
+	}
+}
+
+static void async_report(int status)
+{
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		editor_set_status_message("Shell command finished");
+	else if (WIFEXITED(status))
+		editor_set_status_message("Shell command exited abnormally with code %d",
+		                          WEXITSTATUS(status));
+	else if (async.signalled)
+		editor_set_status_message("Shell command killed");
+	else
+		editor_set_status_message("Shell command killed by signal %d",
+		                          WTERMSIG(status));
+}
+
+/* From the idle loop: read the async command's output, reap it once it
+ * is done, and append what came in to its buffer when that is current --
+ * point on the last line stays there, following the output.  Returns 1
+ * when the screen needs a redraw. */
+int shell_async_poll(void)
+{
+	int refresh = 0, status, pinned, i;
+
+	if (async.pid < 0 && async.fd < 0 && !async.pend.len)
+		return 0;
+
+	if (editor.syntax != &async_syntax) {
+		/* Killed: nobody will read the rest. */
+		for (i = 0; i < buf_slots; i++)
+			if (buflist[i].active && buflist[i].syntax == &async_syntax)
+				break;
+		if (i == buf_slots) {
+			shell_async_stop();
+			return 0;
+		}
+	}
+
+	async_read();
+	if (async.fd < 0 && async.pid > 0 &&
+	    waitpid(async.pid, &status, WNOHANG) == async.pid) {
+		async.pid = -1;
+		async_report(status);
+		refresh = 1;
+	}
+
+	if (editor.syntax == &async_syntax && async.pend.len) {
+		pinned = editor.rowoff + editor.cy >= editor.numrows - 1;
+		suppress_undo = 1;
+		editor_append_output(async.pend.b, async.pend.len);
+		suppress_undo = 0;
+		editor.dirty = 0;
+		if (pinned) {
+			editor.cy = editor.numrows - 1 - editor.rowoff;
+			editor.cx = editor.row[editor.numrows - 1].size - editor.coloff;
+		}
+		ab_free(&async.pend);
+		async.pend.b   = NULL;
+		async.pend.len = 0;
+		refresh = 1;
+	}
+	return refresh;
+}
+
+/* Descriptor for the idle read to wait on along with the terminal: the
+ * async command's output, while there is room to take more.  -1 when
+ * there is nothing to read. */
+int shell_async_fd(void)
+{
+	return async.pend.len < ASYNC_MAX_PENDING ? async.fd : -1;
+}
+
+/* Whether the command has closed its output but not yet exited, so the
+ * idle read has to keep ticking for shell_async_poll() to reap it. */
+int shell_async_waiting(void)
+{
+	return async.pid > 0 && async.fd < 0;
+}
+
+/* Whether an async command is still running, for quitting to ask about. */
+int shell_async_running(void)
+{
+	return async.pid > 0;
+}
+
+/* C-g in the output buffer: terminate the command and everything it
+ * started; a second C-g kills them outright.  Returns 1 when there was a
+ * command to stop. */
+int shell_async_interrupt(void)
+{
+	if (async.pid < 0 || editor.syntax != &async_syntax)
+		return 0;
+	kill(-async.pid, async.signalled ? SIGKILL : SIGTERM);
+	async.signalled = 1;
+	return 1;
+}
+
+/* M-& async-shell-command: prompt, then run the command in the background
+ * with its output streaming into the *Async Shell Command* buffer. */
+void editor_async_shell_command(int fd)
+{
+	char cmd[256];
+	int out[2], c;
+	pid_t pid;
+
+	if (editor_read_line(fd, "Async shell command: ", cmd, sizeof(cmd)) < 0 || !cmd[0])
+		return;
+	if (async.pid > 0) {
+		editor_set_status_message("A command is running, kill it? (y/n) ");
+		editor_refresh_screen();
+		c = editor_read_key(fd);
+		if (c != 'y' && c != 'Y') {
+			editor_set_status_message("");
+			return;
+		}
+	}
+	shell_async_stop();
+
+	if (pipe(out) < 0) {
+		editor_set_status_message("Shell command failed: %s", strerror(errno));
+		return;
+	}
+	fcntl(out[0], F_SETFD, FD_CLOEXEC);
+	fcntl(out[0], F_SETFL, O_NONBLOCK);
+	pid = shell_spawn(cmd, -1, out[1], out[1], 1);
+	close(out[1]);
+	if (pid < 0) {
 		editor_set_status_message("Shell command failed: %s", strerror(errno));
+		close(out[0]);
 		return;
 	}
+	async.pid = pid;
+	async.fd  = out[0];
+	async.signalled = 0;
 
-	/* Delete the region (cursor lands at the start, region goes to kill ring). */
-	editor_kill_region();
-	insert_as_yank(out, out_len);
-	free(out);
-	editor_set_status_message("Replaced region (%d byte%s out)",
-	                          out_len, out_len == 1 ? "" : "s");
+	buf_open_special(ASYNC_NAME, &async_syntax, async_populate, "");
+	if (editor.syntax != &async_syntax) {
+		shell_async_stop();
+		return;
+	}
+	editor_set_status_message("Running %s", cmd);
 }
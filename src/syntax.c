@@ -801,14 +801,19 @@ void editor_update_syntax(erow *row)
 	char *p = row->render;
 	int i = 0; /* Current char offset */
 
+	/* No syntax, everything is HL_NORMAL: no hl to keep. */
+	if (editor.syntax == NULL) {
+		free(row->hl);
+		row->hl = NULL;
+		return;
+	}
+
 	row->hl = realloc(row->hl, row->rsize);
 	/* An empty row has rsize 0; realloc may hand back NULL, and
 	 * memset(NULL, ..., 0) is undefined even for a zero count. */
 	if (row->rsize)
 		memset(row->hl, HL_NORMAL, row->rsize);
 
-	if (editor.syntax == NULL) return; /* No syntax, everything is HL_NORMAL. */
-
 	if (editor.syntax->flags & SHL_MARKDOWN) {
 		markdown_syntax(row);
 		return;
@@ -1033,15 +1038,20 @@ static const char *shebang_interp_to_ext(const char *interp)
 }
 
 /* Try to select syntax by reading a hash-bang (#!) on the first line of
- * filename, falling back to extension matching via shebang_interp_to_ext(). */
+ * filename, falling back to extension matching via shebang_interp_to_ext().
+ * Only a regular file is read: a second open of a FIFO would block, or
+ * steal what the buffer is loaded from. */
 static void select_syntax_by_shebang(const char *filename)
 {
 	char line[256];
 	char *interp, *slash, *end;
 	const char *ext;
 	unsigned int j, i;
+	struct stat st;
 	FILE *fp;
 
+	if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode))
+		return;
 	fp = fopen(filename, "r");
 	if (!fp) return;
 	if (!fgets(line, sizeof(line), fp)) {
@@ -0,0 +1,219 @@
+/* ========================== Trigram index ================================= */
+
+#include "def.h"
+#include <pthread.h>
+
+/* A block-level Bloom filter over the text of a buffer's rows, so a
+ * search can skip whole blocks that cannot contain its query.  The rows
+ * are cut into blocks of roughly TRIGRAM_BLOCK_BYTES, and every three
+ * consecutive bytes of a row (ASCII case folded, not spanning rows) set
+ * one bit in the block's filter.  A literal query can only match in a
+ * block whose filter has the bits of all its trigrams set.
+ *
+ * The index is built in the editor's spare time, a slice at a time on
+ * the worker pool (pool.c), and is only used once complete.  Building
+ * stops as soon as a key is waiting, and the rows are never touched by
+ * the workers outside of a slice, so nothing can change them underneath.
+ * buffer.c drops the index when the content changes. */
+
+#define TRIGRAM_BLOCK_BYTES  32768
+#define TRIGRAM_FILTER_BITS  8192     /* ~3% of the text */
+#define TRIGRAM_FILTER_SHIFT 19       /* 32 - log2(FILTER_BITS) */
+#define TRIGRAM_TASK_BLOCKS  16
+#define TRIGRAM_SLICE_TASKS  256
+#define TRIGRAM_POLL_MS      10
+
+struct trigram_index {
+	int numrows;
+	int block_rows;             /* rows per block */
+	int nblocks;
+	int next;                   /* blocks before this one are built */
+	unsigned char *done;        /* per block */
+	unsigned char *filter;      /* nblocks * FILTER_BITS / 8 */
+};
+
+static unsigned fold(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+static unsigned trigram_bit(const unsigned char *p)
+{
+	unsigned x = fold(p[0]) | fold(p[1]) << 8 | fold(p[2]) << 16;
+
+	return (x * 2654435761u) >> TRIGRAM_FILTER_SHIFT;
+}
+
+/* An index for numrows rows, sized from the first few of them; nothing
+ * is built yet.  NULL when out of memory. */
+struct trigram_index *trigram_new(const erow *rows, int numrows)
+{
+	struct trigram_index *ix;
+	long bytes = 0;
+	int i, sample = numrows < 4096 ? numrows : 4096;
+
+	for (i = 0; i < sample; i++)
+		bytes += rows[i].size + 1;
+
+	ix = calloc(1, sizeof(*ix));
+	if (!ix)
+		return NULL;
+	ix->numrows    = numrows;
+	ix->block_rows = sample ? TRIGRAM_BLOCK_BYTES / (bytes / sample + 1) : 1;
+	if (ix->block_rows < 1)
+		ix->block_rows = 1;
+	ix->nblocks = (numrows + ix->block_rows - 1) / ix->block_rows;
+	ix->done    = calloc(ix->nblocks + 1, 1);
+	ix->filter  = calloc((size_t)ix->nblocks + 1, TRIGRAM_FILTER_BITS / 8);
+	if (!ix->done || !ix->filter) {
+		trigram_free(ix);
+		return NULL;
+	}
+	return ix;
+}
+
+void trigram_free(struct trigram_index *ix)
+{
+	if (!ix)
+		return;
+	free(ix->done);
+	free(ix->filter);
+	free(ix);
+}
+
+/* One slice of building, shared between the pool workers. */
+struct trigram_slice {
+	struct trigram_index *ix;
+	const erow *rows;
+	int first;                  /* block of task 0 */
+	pthread_mutex_t lock;
+	int cancel;                 /* under lock */
+};
+
+static void trigram_build_block(struct trigram_index *ix, const erow *rows, int blk)
+{
+	unsigned char *f = ix->filter + (size_t)blk * (TRIGRAM_FILTER_BITS / 8);
+	int r = blk * ix->block_rows;
+	int end = r + ix->block_rows;
+
+	if (end > ix->numrows)
+		end = ix->numrows;
+	for (; r < end; r++) {
+		const unsigned char *p = (const unsigned char *)rows[r].chars;
+		int i;
+
+		for (i = 0; i + 3 <= rows[r].size; i++) {
+			unsigned bit = trigram_bit(p + i);
+
+			f[bit >> 3] |= 1 << (bit & 7);
+		}
+	}
+	ix->done[blk] = 1;
+}
+
+static void trigram_task(void *arg, int task, int worker)
+{
+	struct trigram_slice *s = arg;
+	int blk = s->first + task * TRIGRAM_TASK_BLOCKS;
+	int end = blk + TRIGRAM_TASK_BLOCKS;
+	int cancel;
+
+	(void)worker;
+	pthread_mutex_lock(&s->lock);
+	cancel = s->cancel;
+	pthread_mutex_unlock(&s->lock);
+	if (cancel)
+		return;
+
+	if (end > s->ix->nblocks)
+		end = s->ix->nblocks;
+	for (; blk < end; blk++)
+		if (!s->ix->done[blk])
+			trigram_build_block(s->ix, s->rows, blk);
+}
+
+/* Build the next slice of the index over rows, stopping early once a key
+ * is waiting on fd.  Returns 1 when the index is complete. */
+int trigram_build_step(struct trigram_index *ix, const erow *rows, int fd)
+{
+	struct trigram_slice s;
+	int ntasks, left = ix->nblocks - ix->next;
+
+	if (left <= 0)
+		return 1;
+
+	s.ix     = ix;
+	s.rows   = rows;
+	s.first  = ix->next;
+	s.cancel = 0;
+	pthread_mutex_init(&s.lock, NULL);
+	ntasks = (left + TRIGRAM_TASK_BLOCKS - 1) / TRIGRAM_TASK_BLOCKS;
+	if (ntasks > TRIGRAM_SLICE_TASKS)
+		ntasks = TRIGRAM_SLICE_TASKS;
+
+	if (pool_start(trigram_task, &s, ntasks) == 0) {
+		while (!pool_wait(TRIGRAM_POLL_MS)) {
+			if (!editor_key_pending(fd))
+				continue;
+			pthread_mutex_lock(&s.lock);
+			s.cancel = 1;
+			pthread_mutex_unlock(&s.lock);
+		}
+	} else {
+		int i;
+
+		for (i = 0; i < ntasks && !editor_key_pending(fd); i++)
+			trigram_task(&s, i, 0);
+	}
+	pthread_mutex_destroy(&s.lock);
+
+	while (ix->next < ix->nblocks && ix->done[ix->next])
+		ix->next++;
+	return ix->next == ix->nblocks;
+}
+
+/* Collect the distinct trigram bits of a query.  Returns how many, 0 when
+ * the query is too short for the index to help. */
+int trigram_query_init(struct trigram_query *q, const char *s, int len)
+{
+	int i, j;
+
+	q->n = 0;
+	for (i = 0; i + 3 <= len && q->n < TRIGRAM_QUERY_MAX; i++) {
+		unsigned bit = trigram_bit((const unsigned char *)s + i);
+
+		for (j = 0; j < q->n && q->bit[j] != bit; j++)
+			;
+		if (j == q->n)
+			q->bit[q->n++] = bit;
+	}
+	return q->n;
+}
+
+/* How many rows from row on, going in direction, can be skipped because
+ * their block cannot hold the query; 0 when it might.  An index still
+ * being built, or built over different rows, never skips anything. */
+int trigram_skip(const struct trigram_index *ix, const struct trigram_query *q,
+		 int row, int direction)
+{
+	const unsigned char *f;
+	int blk, i;
+
+	if (!ix || q->n == 0 || ix->next < ix->nblocks ||
+	    ix->numrows != editor.numrows)
+		return 0;
+
+	blk = row / ix->block_rows;
+	f = ix->filter + (size_t)blk * (TRIGRAM_FILTER_BITS / 8);
+	for (i = 0; i < q->n; i++)
+		if (!(f[q->bit[i] >> 3] & (1 << (q->bit[i] & 7))))
+			break;
+	if (i == q->n)
+		return 0;
+	if (direction > 0) {
+		int end = (blk + 1) * ix->block_rows;
+
+		return (end > ix->numrows ? ix->numrows : end) - row;
+	}
+	return row - blk * ix->block_rows + 1;
+}
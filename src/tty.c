@@ -1,9 +1,13 @@
 /* tty.c - Low level terminal handling */
 
 #include "def.h"
+#include <poll.h>
 
 static struct termios orig_termios; /* In order to restore at exit.*/
 
+/* Idle wake-up period while something runs on a clock, in ms. */
+#define IDLE_TICK_MS 100
+
 void disable_raw_mode(int fd)
 {
 #ifdef KG_FUZZ
@@ -98,6 +102,8 @@ static int parse_escape(int fd)
 	if (seq[0] == 'q') return ALT_Q;
 	if (seq[0] == '\x7f' || seq[0] == '\b') return ALT_BACKSPACE;
 	if (seq[0] == '%') return ALT_PCT;
+	if (seq[0] == CTRL_S) return ALT_CTRL_S;
+	if (seq[0] == CTRL_R) return ALT_CTRL_R;
 	if (seq[0] == ';') return ALT_SEMICOLON;
 	if (seq[0] == 'x') return ALT_X;
 	if (seq[0] == '^') return ALT_CARET;
@@ -106,6 +112,7 @@ static int parse_escape(int fd)
 	if (seq[0] == 'c') return ALT_C;
 	if (seq[0] == '!') return ALT_BANG;
 	if (seq[0] == '|') return ALT_PIPE;
+	if (seq[0] == '&') return ALT_AMP;
 	if (seq[0] == '<') return ALT_LT;
 	if (seq[0] == '>') return ALT_GT;
 	if (seq[0] == '{') return ALT_LBRACE;
@@ -325,9 +332,49 @@ int editor_read_raw_byte(int fd)
 	return key;
 }
 
+/* Sleep until the terminal has input, a watched file changes, an async
+ * shell command writes, or a signal arrives.  Only while something has
+ * to be done on a clock (a grep filling in, a save or journal records
+ * being written, a command to reap, files auto-revert can't watch) do we
+ * wake every IDLE_TICK_MS; otherwise an
+ * idle editor makes no system calls at all.
+ * Returns 1 when a key is ready to read, 0 to look around and wait
+ * again, and -1 when the terminal has gone away. */
+static int editor_idle_wait(int fd)
+{
+#ifdef KG_FUZZ
+	(void)fd;
+	return 1;
+#endif
+	struct pollfd p[3];
+
+	p[0].fd      = fd;
+	p[0].events  = POLLIN;
+	p[0].revents = 0;
+	p[1].fd      = autorevert_fd();
+	p[1].events  = POLLIN;
+	p[1].revents = 0;
+	p[2].fd      = shell_async_fd();
+	p[2].events  = POLLIN;
+	p[2].revents = 0;
+
+	/* poll() skips the negative fds. */
+	if (poll(p, 3, p[1].fd >= 0 && !grep_running() && !buf_loading() &&
+	               !save_pending(NULL) && !journal_pending() &&
+	               !shell_async_waiting()
+	               ? -1 : IDLE_TICK_MS) <= 0)
+		return 0;   /* timeout, or EINTR from a resize */
+	if (p[0].revents & POLLIN)
+		return 1;
+	if (p[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+		return -1;
+	return 0;
+}
+
 /* Top-level main-loop variant of editor_read_key: while waiting for the
- * next key, run the auto-revert poll on every 100 ms read timeout so
- * external file changes are noticed without requiring a keystroke.
+ * next key, handle resizes, pick up finished saves, files changed on
+ * disk, grep results and command-line files still loading, and spend
+ * spare time on the search index.
  * Minibuffer prompts and y/n confirmations call the plain editor_read_key
  * instead so they aren't redrawn (or silently reverted) under the user. */
 int editor_read_key_idle(int fd)
@@ -336,17 +383,33 @@ int editor_read_key_idle(int fd)
 	int nread;
 	int key;
 
+	if (journal_sync())
+		editor_refresh_screen();
 	key = macro_next_key();
 	if (key >= 0)
 		return key;
 
-	while ((nread = read(fd, &c, 1)) == 0 ||
-	       (nread == -1 && errno == EINTR)) {
+	for (;;) {
 		editor_process_pending_resize();
-		if (autorevert_poll())
+		journal_poll();
+		if (save_poll() | autorevert_poll() | grep_poll() |
+		    buf_load_poll() | shell_async_poll())
 			editor_refresh_screen();
+		/* Spare time goes to the search index, a slice at a
+		 * time for as long as no key is waiting. */
+		while (search_index_idle(fd) && !editor_key_pending(fd))
+			editor_process_pending_resize();
+
+		nread = editor_idle_wait(fd);
+		if (nread < 0)
+			break;
+		if (nread == 0)
+			continue;
+		nread = read(fd, &c, 1);
+		if (nread != -1 || errno != EINTR)
+			break;
 	}
-	if (nread == -1) {
+	if (nread != 1) {
 		running = 0;
 		return 0;
 	}
@@ -356,6 +419,21 @@ int editor_read_key_idle(int fd)
 	return key;
 }
 
+/* Whether a key is waiting to be read, so long-running work can stop
+ * and let the user's next key take over.  Never while a macro replays:
+ * its keys are already queued and nothing typed belongs to it. */
+int editor_key_pending(int fd)
+{
+	struct pollfd p;
+
+	if (macro_is_replaying())
+		return 0;
+	p.fd      = fd;
+	p.events  = POLLIN;
+	p.revents = 0;
+	return poll(&p, 1, 0) > 0 && (p.revents & POLLIN);
+}
+
 /* Use the ESC [6n escape sequence to query the horizontal cursor position
  * and return it. On error -1 is returned, on success the position of the
  * cursor is stored at *rows and *cols and 0 is returned. */
@@ -502,8 +580,8 @@ void handle_sig_winch(int unused __attribute__((unused)))
 
 /* Act on a pending terminal resize outside the signal handler: adapt the
  * window layout (which clamps cursors) and redraw.  Called from the main
- * loop and while idling for input, so a resize shows within a read timeout
- * without doing async-signal-unsafe work in the handler. */
+ * loop and while idling for input, so a resize shows right away without
+ * doing async-signal-unsafe work in the handler. */
 void editor_process_pending_resize(void)
 {
 	if (!resize_pending)
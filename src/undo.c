@@ -5,7 +5,10 @@
 #define MAX_UNDO_SIZE 1000
 
 /* Global undo stack */
-struct undo_stack undostack = {NULL, 0, MAX_UNDO_SIZE, -1};
+struct undo_stack undostack = {NULL, 0, MAX_UNDO_SIZE, -1, 0};
+
+/* Last undostack.seq handed out, across all buffers. */
+static unsigned long undo_seq;
 
 /* Initialize the undo stack */
 void undo_init(void)
@@ -14,6 +17,7 @@ void undo_init(void)
 	undostack.size = 0;
 	undostack.max_size = MAX_UNDO_SIZE;
 	undostack.clean_size = -1;  /* -1 means never saved clean */
+	undostack.seq = ++undo_seq;
 }
 
 /* Free the entire undo stack */
@@ -34,14 +38,33 @@ void undo_free(void)
 /* Push an undo operation onto the stack */
 void undo_push(enum undo_type type, int row, int col, int c, char *text, int len)
 {
-	struct undo_op *op;
+	char *copy = NULL;
 
 	/* Skip if undo recording is suppressed */
 	if (suppress_undo) return;
 
-	/* Create new undo operation */
-	op = malloc(sizeof(struct undo_op));
-	if (!op) return;
+	/* Copy text if provided */
+	if (text && len > 0) {
+		copy = malloc(len + 1);
+		if (copy) {
+			memcpy(copy, text, len);
+			copy[len] = '\0';
+		}
+	}
+	undo_push_text(type, row, col, c, copy, len);
+}
+
+/* Like undo_push(), but the operation takes over text, a NUL-terminated
+ * malloc of len bytes, instead of copying it: for the rows of a large
+ * region, which would otherwise be held twice. */
+void undo_push_text(enum undo_type type, int row, int col, int c, char *text, int len)
+{
+	struct undo_op *op;
+
+	if (suppress_undo || !(op = malloc(sizeof(struct undo_op)))) {
+		free(text);
+		return;
+	}
 
 	op->type = type;
 	op->row = row;
@@ -49,21 +72,18 @@ void undo_push(enum undo_type type, int row, int col, int c, char *text, int len
 	op->c = c;
 	op->text = NULL;
 	op->len = 0;
-
-	/* Copy text if provided */
 	if (text && len > 0) {
-		op->text = malloc(len + 1);
-		if (op->text) {
-			memcpy(op->text, text, len);
-			op->text[len] = '\0';
-			op->len = len;
-		}
+		op->text = text;
+		op->len = len;
+	} else {
+		free(text);
 	}
 
 	/* Add to front of stack */
 	op->next = undostack.head;
 	undostack.head = op;
 	undostack.size++;
+	undostack.seq = ++undo_seq;
 
 	/* Trim stack if too large */
 	if (undostack.size > undostack.max_size) {
@@ -108,6 +128,7 @@ void editor_undo(void)
 	op = undostack.head;
 	undostack.head = op->next;
 	undostack.size--;
+	undostack.seq = ++undo_seq;
 
 	/* Position cursor at operation location */
 	editor_cursor_goto(op->row, op->col);
@@ -219,7 +240,9 @@ void editor_undo(void)
 		 * op->c   = numrows before the operation
 		 * op->text = original content of rows [row, row+N), '\n'-joined,
 		 *            where N = lines in op->text (0 if empty).
-		 * Replay: trim back to original numrows, then restore each row. */
+		 * Replay: trim back to original numrows, then restore each row,
+		 * in place where it still exists so a large range doesn't
+		 * shuffle the row array once per line. */
 		int orig_numrows = op->c;
 		char *p = op->text;
 		char *end = op->text ? op->text + op->len : NULL;
@@ -235,8 +258,9 @@ void editor_undo(void)
 				int target = op->row + i;
 
 				if (target < editor.numrows)
-					editor_del_row(target);
-				editor_insert_row(target, p, line_len);
+					editor_row_set_chars(&editor.row[target], p, line_len);
+				else
+					editor_insert_row(target, p, line_len);
 				if (!nl) break;
 				p = nl + 1;
 				i++;
@@ -247,6 +271,50 @@ void editor_undo(void)
 		break;
 	}
 
+	case UNDO_REPLACE_ROWS: {
+		/* op->row  = first row replaced
+		 * op->c    = rows there now, to take out
+		 * op->text = the original rows, '\n'-joined (NULL for one
+		 *            empty row).
+		 * The rows come back in one splice, sharing op->text, which the
+		 * buffer's arena takes over instead of a copy per line. */
+		char *text = op->text, *p, *nl, *end;
+		erow *rows;
+		int n = 1, i;
+
+		if (!text && (text = malloc(1)))
+			text[0] = '\0';
+		end = text ? text + op->len : NULL;
+		for (p = text; p && (p = memchr(p, '\n', end - p)); p++)
+			n++;
+		rows = text ? malloc(n * sizeof(erow)) : NULL;
+		if (!rows || editor_adopt_text(text, op->len + 1)) {
+			if (text != op->text)
+				free(text);
+			free(rows);
+			editor_set_status_message("Out of memory");
+			break;
+		}
+		op->text = NULL;        /* the arena's now */
+
+		for (i = 0, p = text; i < n; i++, p = nl + 1) {
+			nl = memchr(p, '\n', end - p);
+			if (!nl)
+				nl = end;
+			*nl = '\0';
+			rows[i].chars  = p;
+			rows[i].size   = nl - p;
+			rows[i].shared = 1;
+		}
+		suppress_undo = 1;
+		editor_replace_rows(op->row, op->c, rows, n);
+		suppress_undo = 0;
+		free(rows);
+		editor_cursor_goto(op->row, op->col);
+		editor.dirty++;
+		break;
+	}
+
 	case UNDO_REFLOW_PARA: {
 		/* op->row = paragraph start row
 		 * op->col = number of reflowed rows to delete
@@ -0,0 +1,114 @@
+/* ============================ UTF-8 glyph widths ========================== */
+
+#include "def.h"
+#include "width.h"
+
+/* Display width of code point cp: 0 for combining marks and other
+ * zero-width characters, 2 for East Asian Wide/Fullwidth, else 1.  Two
+ * table lookups, no libc wcwidth() and no dependency on the locale. */
+int utf8_cp_width(int cp)
+{
+	const unsigned char *blk;
+
+	if (cp < 0 || cp >= 0x110000)
+		return 1;
+	blk = utf8_width_stage2[utf8_width_stage1[cp >> 8]];
+	return (blk[(cp & 0xff) >> 2] >> ((cp & 3) * 2)) & 3;
+}
+
+/* Decode the UTF-8 sequence at s (at most len bytes, len > 0) into *cp
+ * and return its byte length.  Malformed or truncated input decodes one
+ * byte at a time: a stray continuation byte yields -1, any other bad
+ * lead byte yields its own value, so callers always make progress. */
+int utf8_decode(const char *s, int len, int *cp)
+{
+	const unsigned char *u = (const unsigned char *)s;
+	int n, i, c;
+
+	if (u[0] < 0x80) {
+		*cp = u[0];
+		return 1;
+	}
+	if (utf8_is_cont(u[0])) {
+		*cp = -1;
+		return 1;
+	}
+	if (u[0] >= 0xF0 && u[0] <= 0xF4) {
+		n = 4;
+		c = u[0] & 0x07;
+	} else if (u[0] >= 0xE0 && u[0] < 0xF0) {
+		n = 3;
+		c = u[0] & 0x0F;
+	} else if (u[0] >= 0xC2 && u[0] < 0xE0) {
+		n = 2;
+		c = u[0] & 0x1F;
+	} else {
+		*cp = u[0];
+		return 1;
+	}
+	if (n > len) {
+		*cp = u[0];
+		return 1;
+	}
+	for (i = 1; i < n; i++) {
+		if (!utf8_is_cont(u[i])) {
+			*cp = u[0];
+			return 1;
+		}
+		c = (c << 6) | (u[i] & 0x3F);
+	}
+	*cp = c;
+	return n;
+}
+
+/* Out-of-line half of utf8_glyph_width() for everything above ASCII.
+ * A stray continuation byte is zero columns wide, which keeps a byte
+ * walk over damaged text in step with how it was measured before. */
+int utf8_glyph_width_mb(const char *s, int len, int *bytes)
+{
+	int cp;
+
+	*bytes = utf8_decode(s, len, &cp);
+	if (cp < 0)
+		return 0;
+	if (*bytes == 1)
+		return 1;
+	return utf8_cp_width(cp);
+}
+
+/* Byte offset just past the glyph at pos in s[0..len), including any
+ * zero-width combining marks that follow it, so the cursor never lands
+ * between a base character and its accents. */
+int utf8_next_glyph(const char *s, int len, int pos)
+{
+	int n;
+
+	if (pos >= len)
+		return len;
+	utf8_glyph_width(s + pos, len - pos, &n);
+	pos += n;
+	while (pos < len && (unsigned char)s[pos] >= 0x80) {
+		if (utf8_glyph_width(s + pos, len - pos, &n) != 0)
+			break;
+		pos += n;
+	}
+	return pos;
+}
+
+/* Byte offset of the start of the glyph ending at pos: the inverse of
+ * utf8_next_glyph(), stepping back over combining marks to their base. */
+int utf8_prev_glyph(const char *s, int len, int pos)
+{
+	int start, n;
+
+	while (pos > 0) {
+		start = pos - 1;
+		while (start > 0 && utf8_is_cont((unsigned char)s[start]))
+			start--;
+		pos = start;
+		if ((unsigned char)s[start] < 0x80 ||
+		    utf8_glyph_width(s + start, len - start, &n) != 0)
+			break;
+	}
+	return pos;
+}
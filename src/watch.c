@@ -0,0 +1,226 @@
+/* ============================ File watching ============================== */
+
+#include "def.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#endif
+
+/* Change notification for the files behind buffer slots, so auto-revert
+ * hears about a write as it happens instead of stat()ing every buffer on
+ * a timer.  The directory holding each file is watched rather than the
+ * file itself: most tools save by writing a new file and renaming it over
+ * the old one, and a watch on the old inode would never fire again.
+ * That is the directory the file really lives in, symlinks resolved, so
+ * ~/.bashrc pointing into a dotfiles checkout is watched there.
+ *
+ * Only Linux has inotify.  Elsewhere, when the kernel is out of watches,
+ * or for a file on NFS and the like, where inotify only hears of writes
+ * made by this machine, watch_set() fails and the caller falls back to
+ * polling. */
+
+#ifdef __linux__
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | \
+                    IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+static struct watch_slot {
+	char *path;                 /* file as given to watch_set() */
+	char *real;                 /* where it really is */
+	const char *base;           /* its last component, inside real */
+	int wd;                     /* watch on its directory, -1 for none */
+	int remote;                 /* on a filesystem inotify can't watch */
+} *slot;
+static int nslots;
+
+static int watch_ifd = -2;      /* -2 until first use, -1 unavailable */
+
+/* The inotify descriptor, to poll() for readability along with the
+ * terminal, or -1 when change notification is unavailable. */
+int watch_fd(void)
+{
+#ifdef __linux__
+	if (watch_ifd == -2)
+		watch_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+	watch_ifd = -1;
+#endif
+	return watch_ifd;
+}
+
+/* Drop slot i's watch, removing it from the kernel unless another slot
+ * shares the directory (inotify hands out one descriptor per inode). */
+static void watch_drop(int i)
+{
+	int j, wd = slot[i].wd;
+
+	free(slot[i].path);
+	free(slot[i].real);
+	slot[i].path   = NULL;
+	slot[i].real   = NULL;
+	slot[i].wd     = -1;
+	slot[i].remote = 0;
+	if (wd < 0)
+		return;
+	for (j = 0; j < nslots; j++)
+		if (slot[j].path && slot[j].wd == wd)
+			return;
+#ifdef __linux__
+	inotify_rm_watch(watch_ifd, wd);
+#endif
+}
+
+#ifdef __linux__
+/* Real path of file name: of the file itself, symlinks and all, or of
+ * its directory for a file not written yet.  NULL when the directory
+ * can't be resolved either. */
+static char *watch_resolve(const char *name)
+{
+	char real[PATH_MAX], dir[PATH_MAX];
+	const char *base = buf_basename(name);
+	int len = (int)(base - name);
+
+	if (realpath(name, real))
+		return strdup(real);
+	if (len == 0)
+		strcpy(dir, ".");
+	else if (len < (int)sizeof(dir))
+		snprintf(dir, sizeof(dir), "%.*s", len, name);
+	else
+		return NULL;
+	if (!realpath(dir, real) ||
+	    strlen(real) + strlen(base) + 2 > sizeof(real))
+		return NULL;
+	if (strcmp(real, "/"))
+		strcat(real, "/");
+	strcat(real, base);
+	return strdup(real);
+}
+
+/* Whether dir is on a network or FUSE filesystem, where changes made by
+ * other machines or the server side never reach inotify. */
+static int watch_remote(const char *dir)
+{
+	struct statfs fs;
+
+	if (statfs(dir, &fs) != 0)
+		return 0;
+	switch ((unsigned long)fs.f_type) {
+	case 0x6969UL:              /* NFS */
+	case 0x517bUL:              /* SMB */
+	case 0xff534d42UL:          /* CIFS */
+	case 0xfe534d42UL:          /* SMB2 */
+	case 0x65735546UL:          /* FUSE */
+	case 0x01021997UL:          /* 9P */
+	case 0x00c36400UL:          /* Ceph */
+	case 0x5346414fUL:          /* AFS */
+		return 1;
+	}
+	return 0;
+}
+#endif
+
+/* Watch path for buffer slot i, or stop watching when path is NULL.
+ * Cheap to call again with the same path.  Returns 0 when changes to
+ * the file will show up in watch_read(), -1 when they won't. */
+int watch_set(int i, const char *path)
+{
+	if (i >= nslots) {
+		struct watch_slot *s;
+		int n = nslots ? nslots : 8;
+
+		if (!path)
+			return 0;
+		while (n <= i)
+			n *= 2;
+		if (!(s = realloc(slot, n * sizeof(*s))))
+			return -1;
+		memset(s + nslots, 0, (n - nslots) * sizeof(*s));
+		slot   = s;
+		nslots = n;
+	}
+	if (slot[i].path && path && !strcmp(slot[i].path, path))
+		return slot[i].wd < 0 ? -1 : 0;
+	if (slot[i].path)
+		watch_drop(i);
+	if (!path)
+		return 0;
+	if (watch_fd() < 0 || !(slot[i].path = strdup(path)))
+		return -1;
+
+	slot[i].wd = -1;
+#ifdef __linux__
+	{
+		char dir[PATH_MAX];
+		int len;
+
+		if (!(slot[i].real = watch_resolve(path)))
+			return -1;
+		slot[i].base = buf_basename(slot[i].real);
+		len = (int)(slot[i].base - slot[i].real);
+		if (len == 1)
+			strcpy(dir, "/");
+		else if (len < (int)sizeof(dir))
+			snprintf(dir, sizeof(dir), "%.*s", len - 1, slot[i].real);
+		else
+			return -1;
+		if ((slot[i].remote = watch_remote(dir)))
+			return -1;
+		slot[i].wd = inotify_add_watch(watch_ifd, dir, WATCH_MASK);
+	}
+#endif
+	return slot[i].wd < 0 ? -1 : 0;
+}
+
+/* Drain pending notifications without blocking and flag, in changed[],
+ * every slot below n whose file may have changed on disk.  Returns how
+ * many were flagged.  A lost event (queue overflow) or a watched
+ * directory going away flags the slots concerned wholesale; the caller
+ * re-checks them. */
+int watch_read(char *changed, int n)
+{
+	int i, nflagged = 0, end = n < nslots ? n : nslots;
+
+	memset(changed, 0, n);
+#ifdef __linux__
+	for (;;) {
+		union {
+			struct inotify_event ev;
+			char buf[4096];
+		} u;
+		ssize_t len = read(watch_ifd, u.buf, sizeof(u.buf));
+		char *p;
+
+		if (len <= 0)
+			break;
+		for (p = u.buf; p < u.buf + len;
+		     p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+
+			for (i = 0; i < end; i++) {
+				if (!slot[i].path)
+					continue;
+				if (ev->mask & IN_Q_OVERFLOW)
+					;
+				else if (slot[i].wd != ev->wd)
+					continue;
+				else if (ev->mask & IN_IGNORED)
+					slot[i].wd = -1;    /* directory is gone */
+				else if (!ev->len || strcmp(ev->name, slot[i].base))
+					continue;
+				nflagged += !changed[i];
+				changed[i] = 1;
+			}
+		}
+	}
+	/* A slot whose directory vanished gets watched afresh next time,
+	 * or falls back to polling if it can't be. */
+	for (i = 0; i < nslots; i++)
+		if (slot[i].path && slot[i].wd < 0 && !slot[i].remote)
+			watch_drop(i);
+#else
+	(void)i;
+	(void)end;
+#endif
+	return nflagged;
+}
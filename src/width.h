@@ -0,0 +1,1057 @@
+/* Generated by utils/mkwidth.py from Unicode 14.0.0 -- do not edit.
+ *
+ * utf8_width_stage1[cp >> 8] selects a 64-byte block in
+ * utf8_width_stage2; the width of cp is the 2-bit field
+ * (cp & 3) * 2 of byte (cp & 0xff) >> 2 in that block. */
+
+static const unsigned char utf8_width_stage1[4352] = {
+	0,0,0,1,2,3,4,5,6,7,8,9,10,11,12,13,
+	14,15,16,17,0,0,18,19,20,21,22,23,24,25,0,26,
+	27,28,0,29,30,31,32,33,0,0,0,34,35,36,37,38,
+	39,38,40,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,41,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,42,0,43,44,45,46,47,48,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,49,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,38,38,50,0,51,52,53,
+	54,55,56,57,58,59,0,60,61,62,63,64,65,66,67,68,
+	69,70,71,72,73,74,75,76,77,78,79,38,80,81,82,83,
+	0,0,0,84,85,86,38,38,38,38,38,38,38,38,38,87,
+	0,0,0,0,88,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,0,0,89,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,0,0,90,91,38,38,92,93,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,94,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,95,
+	96,97,98,99,100,101,102,103,0,0,104,38,38,38,38,105,
+	106,107,108,38,38,38,38,109,110,111,38,38,112,113,114,38,
+	115,116,38,117,118,119,120,121,122,123,124,125,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	126,127,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,38,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,128,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,128,
+};
+
+static const unsigned char utf8_width_stage2[129][64] = {
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x55,0x55,0x5a,0x55,
+		0xaa,0x55,0x95,0x59,0x55,0x55,0x55,0x55,0x65,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x15,0x00,0x50,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x56,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x95,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x95,0x56,0x02,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x10,
+		0x41,0x10,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x6a,0x55,0xa9,0xaa,0xaa,
+	},
+	{
+		0x00,0x50,0x55,0x55,0x00,0x00,0x40,0x54,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x15,0x00,0x00,0x00,0x00,0x00,0x55,0x55,0x55,0x55,0x54,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x05,0x00,0x10,0x00,0x14,0x04,0x50,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x25,0x51,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x80,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x00,0x00,0xa4,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x00,0x00,0x55,0x95,0x52,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x05,0x10,0x00,0x00,0x01,0x01,0xa0,0x55,0x55,0x55,0x95,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x01,0x9a,0x55,0x55,0x95,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x95,0xa0,0xaa,0x00,0x00,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x05,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+	},
+	{
+		0x40,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x45,0x54,
+		0x01,0x00,0x54,0x51,0x01,0x00,0x55,0x55,0x05,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x51,0x56,0x55,0x69,0x69,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x99,0x5a,0xa5,0x54,
+		0x01,0x68,0x69,0x91,0xaa,0x6a,0xaa,0x65,0x05,0x5a,0x55,0x55,0x55,0x55,0x55,0x85,
+	},
+	{
+		0x42,0x56,0x95,0x6a,0x69,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x59,0x96,0xa5,0x58,
+		0x81,0x2a,0x28,0xa0,0xa2,0xaa,0x56,0x99,0xaa,0x5a,0x55,0x55,0x50,0x91,0xaa,0xaa,
+		0x42,0x56,0x55,0x65,0x65,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x59,0x56,0xa5,0x54,
+		0x01,0x20,0x64,0xa1,0xa9,0xaa,0xaa,0xaa,0x05,0x5a,0x55,0x55,0xa5,0xaa,0x06,0x00,
+	},
+	{
+		0x52,0x56,0x55,0x69,0x69,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x59,0x56,0xa5,0x14,
+		0x01,0x68,0x69,0xa1,0xaa,0x42,0xaa,0x65,0x05,0x5a,0x55,0x55,0x55,0x55,0xaa,0xaa,
+		0x4a,0x56,0x95,0x5a,0x59,0xa5,0x96,0x59,0x6a,0xa9,0x95,0x5a,0x55,0x55,0xa5,0x5a,
+		0x94,0x5a,0x59,0xa1,0xa9,0x6a,0xaa,0xaa,0xaa,0x5a,0x55,0x55,0x55,0x55,0x95,0xaa,
+	},
+	{
+		0x54,0x54,0x55,0x59,0x59,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x55,0x55,0xa5,0x04,
+		0x54,0x09,0x08,0xa0,0xaa,0x82,0x95,0xa6,0x05,0x5a,0x55,0x55,0xaa,0x6a,0x55,0x55,
+		0x51,0x55,0x55,0x59,0x59,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x55,0x56,0xa5,0x14,
+		0x55,0x49,0x59,0xa0,0xaa,0x96,0xaa,0x96,0x05,0x5a,0x55,0x55,0x96,0xaa,0xaa,0xaa,
+	},
+	{
+		0x50,0x55,0x55,0x59,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x54,
+		0x01,0x58,0x59,0x51,0xaa,0x55,0x55,0x55,0x05,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x52,0x56,0x55,0x55,0x55,0x95,0x5a,0x55,0x55,0x55,0x55,0x55,0x65,0x55,0x55,0xa6,
+		0x55,0x95,0x8a,0x6a,0x05,0x88,0x55,0x55,0xaa,0x5a,0x55,0x55,0x5a,0xa9,0xaa,0xaa,
+	},
+	{
+		0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x51,0x00,0x80,0x6a,
+		0x55,0x15,0x00,0x40,0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x96,0x59,0x95,0x55,0x55,0x55,0x55,0x55,0x55,0x66,0x55,0x55,0x51,0x00,0x00,0xa4,
+		0x55,0x99,0x00,0xa0,0x55,0x55,0xa5,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x50,0x55,0x55,0x55,0x55,0x55,0x55,0x11,0x51,0x55,
+		0x55,0x55,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0x02,0x00,0x00,0x40,
+		0x00,0x04,0x55,0x01,0x00,0x00,0x02,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x58,
+		0x55,0x45,0x55,0x59,0x55,0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x01,0x04,0x00,0x41,0x41,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x50,0x05,0x54,0x55,0x55,0x55,0x01,0x54,0x55,0x55,
+		0x45,0x41,0x55,0x51,0x55,0x55,0x55,0x51,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x65,0xaa,0xa6,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x59,0xa5,0x55,0x95,0x59,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x59,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x59,0xa5,0x55,0x95,
+		0x59,0xa5,0x55,0x55,0x55,0x95,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x59,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x02,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,
+		0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x55,0xa5,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x05,0xa4,0xaa,0x6a,0x55,0x55,0x55,0x55,0x05,0x95,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x05,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x59,0x09,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x10,0x00,0x50,
+		0x55,0x45,0x01,0x00,0x00,0x55,0x55,0xa1,0x55,0x55,0xa5,0xaa,0x55,0x55,0xa5,0xaa,
+	},
+	{
+		0x55,0x55,0x15,0x00,0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,
+		0x55,0x41,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x91,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x40,0x15,0x54,0xaa,0x45,0x55,0x01,0xaa,
+		0xa9,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x55,0xa9,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xa5,0xaa,0x55,0x55,0x95,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x15,0x14,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x45,0x00,0x80,0x44,0x01,0x00,0x54,0x15,0x00,0x00,0x28,
+		0x55,0x55,0xa5,0xaa,0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0xa5,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x80,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x00,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x04,0x40,0x54,
+		0x45,0x55,0x55,0xa9,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x00,0x00,0x55,0x55,0x95,
+		0x50,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x50,0x10,0x50,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x45,0x50,0x11,0x50,0xaa,0xaa,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x00,0x05,0x6a,0x55,
+		0x55,0x55,0xa5,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xa9,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x56,
+		0x55,0x55,0xaa,0xaa,0x40,0x00,0x00,0x00,0x04,0x00,0x54,0x51,0x55,0x54,0x90,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0xa5,0x55,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0xa5,0x55,0xa5,0x55,0x55,0x66,0x66,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x55,
+		0x55,0x59,0x55,0x55,0x55,0x5a,0x55,0x56,0x55,0x55,0x55,0x55,0x5a,0x59,0x55,0x95,
+	},
+	{
+		0x55,0x55,0x15,0x00,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x40,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x08,0x00,0x00,0xa5,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x95,0x55,0x55,0x55,0xa9,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0xa9,0xaa,0xaa,0xaa,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xa8,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x55,0x55,0x55,0x69,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0x56,0x96,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x69,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,
+		0x55,0x55,0x55,0x55,0x95,0x55,0x55,0x55,0x59,0x55,0xa5,0x55,0x55,0x55,0x55,0x69,
+		0x55,0x5a,0x55,0x65,0x55,0x56,0x55,0x55,0x55,0x55,0x65,0x55,0xa5,0x59,0x65,0x59,
+	},
+	{
+		0x55,0x59,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x56,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x66,0x95,0x9a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0xa9,0x55,0x55,0x55,0x55,0x55,0x55,0x56,0x55,0x55,0x95,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x56,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x5a,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x65,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x50,0xaa,0x56,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x65,0xaa,0xa6,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0x6a,0xa9,0xaa,0xaa,0x2a,
+		0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0x55,0x95,0x55,0x95,0x55,0x95,0x55,0x95,
+		0x55,0x95,0x55,0x95,0x55,0x95,0x55,0x95,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x0a,0xa0,0xaa,0xaa,0xaa,0x6a,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x82,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x40,0x00,0x00,0x50,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x50,0x55,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x95,0xaa,0x65,0x56,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0x5a,0x55,0x55,0x55,
+	},
+	{
+		0x45,0x45,0x15,0x55,0x55,0x55,0x55,0x55,0x55,0x41,0x55,0xa8,0x55,0x55,0xa5,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0xa0,0xaa,0x5a,0x55,0x55,0xa5,0xaa,0x00,0x00,0x00,0x00,0x50,0x55,0x55,0x15,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x00,0x50,0x55,0x55,0x55,0x55,
+		0x55,0x15,0x00,0x00,0x50,0xaa,0xaa,0x6a,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x40,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x05,0x50,0x50,
+		0x55,0x55,0x55,0x65,0x55,0x55,0xa5,0x5a,0x55,0x51,0x55,0x55,0x55,0x55,0x55,0x95,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x01,0x40,0x41,0x81,0xaa,0xaa,
+		0x15,0x55,0x55,0xa4,0x55,0x55,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x54,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x04,0x14,0x54,0x05,
+		0x91,0xaa,0xaa,0xaa,0xaa,0xaa,0x6a,0x55,0x55,0x55,0x55,0x50,0x55,0x85,0xaa,0xaa,
+	},
+	{
+		0x56,0x95,0x56,0x95,0x56,0x95,0xaa,0xaa,0x55,0x95,0x55,0x95,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x51,0x54,0xa1,0x55,0x55,0xa5,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+	},
+	{
+		0x55,0x95,0xaa,0xaa,0x6a,0x55,0xaa,0x46,0x55,0x55,0x55,0x55,0x55,0x95,0x55,0x99,
+		0x65,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x95,0xaa,0xaa,0xaa,0x6a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xaa,0x6a,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x00,0x00,0x00,0x00,0xaa,0xaa,0xaa,0xaa,0x00,0x00,0x00,0x00,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x59,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x29,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,
+		0x5a,0x55,0x5a,0x55,0x5a,0x55,0x5a,0xa9,0xaa,0xaa,0x55,0x95,0xaa,0xaa,0x02,0xa5,
+	},
+	{
+		0x55,0x55,0x55,0x56,0x55,0x55,0x55,0x55,0x55,0x95,0x55,0x55,0x55,0x55,0x95,0x65,
+		0x55,0x55,0x55,0xa5,0x55,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,
+	},
+	{
+		0x95,0x6a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x6a,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x95,0x55,0x55,0x55,0xa9,0xa9,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa1,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0xa9,0xaa,0xaa,0xaa,0x54,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0x56,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x95,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x80,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x65,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0xaa,0x55,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0x6a,0x55,0x55,0x95,0x55,
+		0x55,0x55,0x95,0x55,0x95,0x65,0x55,0x55,0x65,0x55,0x55,0x55,0x65,0x55,0x65,0xa9,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x65,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x95,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0xa5,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x65,0xa9,0x69,
+		0x55,0x55,0x55,0x55,0x55,0x65,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0x6a,0x55,0x55,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x95,0xa5,0x6a,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x6a,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x6a,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0x55,
+		0x55,0x55,0x55,0x55,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x01,0x82,0xaa,0x00,0x55,0x56,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x80,0x2a,
+		0x55,0x55,0xa9,0xaa,0x55,0x55,0xa9,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x81,0x6a,0x55,0x55,0x95,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x56,0x55,
+		0x55,0x55,0x55,0x55,0x55,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0x55,0x55,
+		0x55,0x55,0x55,0x55,0xa5,0xaa,0x56,0xa9,0xaa,0xaa,0x56,0x55,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xa9,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0x5a,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0xaa,0xaa,0x55,0x55,0xa5,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x25,0xa4,0xa5,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x05,0x00,0x00,0x54,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,
+		0x05,0x50,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,
+	},
+	{
+		0x51,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x00,
+		0x00,0x40,0x55,0xa5,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x14,0xa4,0xaa,0x2a,
+		0x50,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x40,0x41,0x51,
+		0x85,0xaa,0xaa,0xa2,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,0x55,0x55,0xa5,0xaa,
+	},
+	{
+		0x40,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x00,0x01,0x00,0x58,0x55,0x55,
+		0x55,0x55,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x95,0xaa,0xaa,
+		0x50,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x00,0x40,
+		0x55,0x55,0x01,0x14,0x55,0x55,0x55,0x55,0x56,0x55,0x55,0x55,0x55,0xa9,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x65,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x50,0x04,0x55,0x85,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x95,0x59,0x65,0x55,0x55,0x55,0x65,0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x15,0x00,0x80,0xaa,0x55,0x55,0xa5,0xaa,
+	},
+	{
+		0x50,0x56,0x55,0x69,0x69,0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x59,0x56,0x25,0x54,
+		0x54,0x69,0x69,0xa5,0xa9,0x6a,0xaa,0x56,0x55,0x0a,0x00,0xa8,0x00,0xa8,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x00,
+		0x05,0x44,0x55,0x55,0x55,0x55,0x55,0x46,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x00,0x44,0x15,
+		0x04,0x55,0xaa,0xaa,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0xa0,0x55,0x10,
+		0x54,0x55,0x55,0x55,0x55,0x55,0x55,0xa0,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x00,0x40,0x11,
+		0x54,0xa9,0xaa,0xaa,0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0xa9,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x51,0x00,0x10,0xa5,0xaa,
+		0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x02,0x05,0x10,0x00,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x00,0x00,0x41,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0x6a,
+	},
+	{
+		0x55,0x95,0xa6,0x55,0x55,0x96,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x65,0x29,0x44,
+		0x15,0x95,0xaa,0xaa,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x5a,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x00,0x0a,0x55,0x54,0xa9,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x01,0x00,0x40,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x00,0x14,0x40,
+		0x55,0x15,0xaa,0xaa,0x01,0x40,0x01,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x05,0x00,0x00,0x40,0x50,0x55,0x95,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,
+	},
+	{
+		0x55,0x55,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x80,0x00,0x10,
+		0x55,0xa5,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x0a,0x00,0x00,0x00,0x00,0x00,0x06,0x00,0x04,0x81,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x95,0x65,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x01,0x80,0x8a,0x20,
+		0x00,0x10,0xaa,0xaa,0x55,0x55,0xa5,0xaa,0x55,0x65,0x59,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x95,0x60,0x11,0xa9,0xaa,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x15,0x54,0xa9,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xa9,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,0x6a,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x55,0xa9,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x00,0x00,0xa8,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x55,0x55,0xa5,0x5a,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,
+		0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x00,0xa4,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x40,0x55,0x55,
+		0x55,0xa5,0xaa,0xaa,0x55,0x55,0x65,0x55,0x65,0x55,0x55,0x55,0x55,0x55,0xaa,0x56,
+		0x55,0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x95,0x2a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xaa,0x2a,0x40,0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xa8,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0x55,0x55,0x55,0xa9,
+		0x55,0x55,0xa9,0xaa,0x55,0x55,0xa5,0x41,0x00,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xa0,0x00,0x00,0x00,0x00,
+		0x00,0x80,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0x56,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x15,0x50,0x55,0x15,0x00,0x00,0x00,
+		0x40,0x01,0x00,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x05,0x50,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x05,0xa4,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x59,0x9a,0x96,0x56,0x59,0x55,0x55,0x65,0x56,
+		0x55,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x65,0x95,0x56,0x55,0x59,0x55,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x65,0x95,
+		0x55,0x99,0x5a,0x55,0x59,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x40,0x15,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x54,0x55,0x51,0x55,0x55,
+		0x55,0x54,0x55,0xaa,0xaa,0xaa,0x2a,0x00,0x02,0x00,0x00,0x00,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x00,0x80,0x00,0x00,0x00,0x00,0x28,0x00,0x20,0x08,0x80,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0x00,0x40,0x55,0xa5,
+		0x55,0x55,0xa5,0x5a,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x85,0xaa,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x00,0x55,0x55,0xa5,0x6a,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x95,0x55,0x96,0x55,0x55,0x55,0x95,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x69,0x55,0x55,0x00,0x80,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x00,0x40,0xaa,0x55,0x55,0xa5,0x5a,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x56,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x96,0x69,0x56,0x55,0x95,0x55,0x66,0xaa,
+		0x9a,0x6a,0x66,0x56,0x96,0x69,0x66,0x66,0x96,0x69,0x95,0x55,0x95,0x55,0x56,0x99,
+		0x55,0x55,0x65,0x55,0x55,0x55,0x55,0xaa,0x56,0x56,0x65,0x55,0x55,0x55,0x55,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xa5,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x95,0x56,0x55,0x55,0x55,
+		0x56,0x55,0x55,0x95,0x56,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x65,0xa9,0xaa,0x6a,0x55,0x55,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x5a,0x55,0x55,0x55,0x55,0x55,0x55,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x56,0x55,0x55,0xa9,0xaa,0x9a,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xa6,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0x6a,0x95,0xaa,0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0x56,0x56,0xaa,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x6a,
+		0xa6,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x96,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x5a,
+		0x55,0x55,0x95,0x6a,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x65,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x69,0x55,0x55,0x55,0x56,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x95,0xaa,
+	},
+	{
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0x5a,0x55,0x56,0x6a,0xa9,0xaa,0xaa,0x55,0x55,0x95,0xaa,0x55,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0xaa,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0xa9,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xaa,0xaa,0x55,0x55,0xa5,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0xaa,0xaa,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,0xa5,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x6a,0xaa,
+		0xaa,0x9a,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0xaa,0xaa,0xaa,0x55,0x55,0x55,0xa5,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x95,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x95,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x55,0x55,0xa5,0xaa,
+	},
+	{
+		0xa2,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+		0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xaa,0xaa,0xaa,0xaa,
+	},
+	{
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,
+		0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0x55,0xa5,
+	},
+};
@@ -35,7 +35,7 @@ void win_save_active_view(void)
 	w->coloff = editor.coloff;
 
 	/* Keep buflist in sync so a buffer switch restores correctly. */
-	if (w->bufidx < MAX_BUFFERS && buflist[w->bufidx].active) {
+	if (w->bufidx < buf_slots && buflist[w->bufidx].active) {
 		buflist[w->bufidx].cx     = editor.cx;
 		buflist[w->bufidx].cy     = editor.cy;
 		buflist[w->bufidx].rowoff = editor.rowoff;
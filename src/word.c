@@ -596,12 +596,11 @@ void editor_join_line(void)
 	undo_push(UNDO_JOIN_LINE, prev_row_idx, join_col, 0, cur->chars, cur->size);
 
 	{
-		char *newchars = realloc(prev->chars, join_col + add_space + rest_len + 1);
+		char *newchars = editor_row_resize(prev, join_col + add_space + rest_len + 1);
 		if (!newchars) {
 			editor_set_status_message("Out of memory joining lines");
 			return;
 		}
-		prev->chars = newchars;
 	}
 	if (add_space)
 		prev->chars[join_col] = ' ';
@@ -780,7 +779,7 @@ void editor_comment_dwim(void)
 			memcpy(prefix, scs, scslen);
 			prefix[scslen] = ' ';
 
-			row->chars = realloc(row->chars, row->size + scslen + 2);
+			editor_row_resize(row, row->size + scslen + 2);
 			memmove(row->chars + scslen + 1, row->chars, row->size + 1);
 			memcpy(row->chars, scs, scslen);
 			row->chars[scslen] = ' ';
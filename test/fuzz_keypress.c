@@ -11,20 +11,13 @@ void fuzz_clear_input(void);
 
 static void free_rows(void)
 {
-	int i;
-
-	for (i = 0; i < editor.numrows; i++) {
-		editor_free_row(&editor.row[i]);
-	}
-	free(editor.row);
-	editor.row = NULL;
-	editor.numrows = 0;
+	editor_free_rows();
 }
 
 static void reset_state(void)
 {
 	memset(&editor, 0, sizeof(editor));
-	memset(buflist, 0, sizeof(buflist));
+	memset(buflist, 0, buf_slots * sizeof(*buflist));
 	memset(winlist, 0, sizeof(winlist));
 	running = 1;
 	suppress_undo = 0;
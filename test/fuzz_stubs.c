@@ -22,7 +22,9 @@ int suppress_undo = 0;
 int global_auto_revert = 0;
 int require_final_newline = 0;
 
-struct editor_buffer buflist[MAX_BUFFERS];
+static struct editor_buffer slots[4];
+struct editor_buffer *buflist = slots;
+int buf_slots = 4;
 int buf_current = 0;
 int buf_count   = 1;
 
@@ -98,6 +100,9 @@ void buf_open_list(void) { }
 void buf_ibuffer_select(void) { }
 void buf_open_help(void) { }
 int  autorevert_poll(void) { return 0; }
+int  autorevert_fd(void) { return -1; }
+int  buf_load_poll(void) { return 0; }
+int  buf_loading(void) { return 0; }
 
 /* ---- display.c ---- */
 
@@ -120,8 +125,20 @@ void win_term_resize(void) { }
 
 /* ---- search.c ---- */
 
-void editor_find(int fd, int direction) { (void)fd; (void)direction; }
-void editor_query_replace(int fd) { (void)fd; }
+void editor_find(int fd, int direction, int regex) { (void)fd; (void)direction; (void)regex; }
+void editor_query_replace(int fd, int regex) { (void)fd; (void)regex; }
+int  editor_occur_goto(void) { return 0; }
+int  search_index_idle(int fd) { (void)fd; return 0; }
+
+/* ---- grep.c ---- */
+
+int  editor_grep_goto(void) { return 0; }
+int  grep_poll(void) { return 0; }
+int  grep_running(void) { return 0; }
+
+/* ---- trigram.c ---- */
+
+void trigram_free(struct trigram_index *ix) { (void)ix; }
 
 /* ---- cmd.c ---- */
 
@@ -131,9 +148,26 @@ void editor_named_command(int fd) { (void)fd; }
 
 void editor_shell_command(int fd) { (void)fd; }
 void editor_shell_command_on_region(int fd) { (void)fd; }
+void editor_async_shell_command(int fd) { (void)fd; }
+int  shell_async_poll(void) { return 0; }
+int  shell_async_fd(void) { return -1; }
+int  shell_async_waiting(void) { return 0; }
+int  shell_async_running(void) { return 0; }
+int  shell_async_interrupt(void) { return 0; }
+void shell_async_stop(void) {}
 
 /* ---- fileio.c ---- */
 
 int  editor_save(int fd) { (void)fd; return 0; }
+int  save_pending(const char *path) { (void)path; return 0; }
+int  save_poll(void) { return 0; }
+void save_wait(void) {}
 void editor_write_file(int fd) { (void)fd; }
 void editor_insert_file(int fd) { (void)fd; }
+
+/* ---- journal.c ---- */
+
+int  journal_sync(void) { return 0; }
+void journal_poll(void) {}
+int  journal_pending(void) { return 0; }
+void journal_flush(void) {}
@@ -9,9 +9,14 @@ TESTBINS = $(TESTDIR)/test_undo $(TESTDIR)/test_buffer		\
            $(TESTDIR)/test_autocomplete $(TESTDIR)/test_word	\
            $(TESTDIR)/test_basic $(TESTDIR)/test_region		\
            $(TESTDIR)/test_shell $(TESTDIR)/test_complete	\
-           $(TESTDIR)/test_winmgr
+           $(TESTDIR)/test_winmgr $(TESTDIR)/test_match		\
+           $(TESTDIR)/test_regex $(TESTDIR)/test_pool		\
+           $(TESTDIR)/test_trigram $(TESTDIR)/test_watch		\
+           $(TESTDIR)/test_project $(TESTDIR)/test_journal		\
+           $(TESTDIR)/test_grep
 # Source objects needed by tests (subset of OBJS, no main/tty/display/etc.)
-TEST_SRCS_OBJS = $(OBJDIR)/undo.o $(OBJDIR)/buffer.o $(OBJDIR)/syntax.o
+TEST_SRCS_OBJS = $(OBJDIR)/undo.o $(OBJDIR)/buffer.o $(OBJDIR)/syntax.o \
+                 $(OBJDIR)/utf8.o $(OBJDIR)/trigram.o $(OBJDIR)/pool.o
 
 # PTY acceptance tests: drive the real binary on a pseudo-terminal and
 # compare the saved file bytes (see utils/pty_accept.py).  Needs python3
@@ -32,7 +37,7 @@ FUZZ_SRCS = $(TESTDIR)/fuzz_keypress.c $(TESTDIR)/fuzz_stubs.c \
             $(OBJDIR)/kbd.c $(OBJDIR)/buffer.c $(OBJDIR)/basic.c \
             $(OBJDIR)/word.c $(OBJDIR)/autocomplete.c $(OBJDIR)/yank.c \
             $(OBJDIR)/undo.c $(OBJDIR)/rect.c $(OBJDIR)/syntax.c \
-            $(OBJDIR)/tty.c $(OBJDIR)/macro.c
+            $(OBJDIR)/tty.c $(OBJDIR)/macro.c $(OBJDIR)/utf8.c
 
 $(TESTDIR)/fuzz_keypress: $(FUZZ_SRCS) $(HDRS)
 	$(FUZZ_CC) $(FUZZ_CFLAGS) -I$(OBJDIR) -o $@ $(FUZZ_SRCS)
@@ -75,9 +80,17 @@ EXTRA_autocomplete := $(TESTDIR)/stubs.o $(TESTDIR)/stubs_extra.o $(OBJDIR)/auto
 EXTRA_word         := $(TESTDIR)/stubs.o          $(OBJDIR)/word.o $(OBJDIR)/basic.o $(TEST_SRCS_OBJS)
 EXTRA_basic        := $(TESTDIR)/stubs.o          $(OBJDIR)/basic.o $(TEST_SRCS_OBJS)
 EXTRA_region       := $(TESTDIR)/stubs_noyank.o   $(OBJDIR)/yank.o $(OBJDIR)/rect.o $(TEST_SRCS_OBJS)
-EXTRA_shell        := $(TESTDIR)/stubs_noyank.o   $(OBJDIR)/shell.o $(OBJDIR)/yank.o $(OBJDIR)/rect.o $(OBJDIR)/buffer.o $(OBJDIR)/undo.o $(OBJDIR)/syntax.o
+EXTRA_shell        := $(TESTDIR)/stubs_noyank.o   $(OBJDIR)/shell.o $(OBJDIR)/yank.o $(OBJDIR)/rect.o $(OBJDIR)/buffer.o $(OBJDIR)/undo.o $(OBJDIR)/syntax.o $(OBJDIR)/utf8.o $(OBJDIR)/trigram.o $(OBJDIR)/pool.o
 EXTRA_complete     := $(TESTDIR)/stubs.o          $(OBJDIR)/path.o $(TEST_SRCS_OBJS)
 EXTRA_winmgr       := $(OBJDIR)/winmgr.o
+EXTRA_match        := $(TESTDIR)/stubs.o          $(OBJDIR)/match.o $(TEST_SRCS_OBJS)
+EXTRA_regex        := $(TESTDIR)/stubs.o          $(OBJDIR)/regex.o $(OBJDIR)/match.o $(TEST_SRCS_OBJS)
+EXTRA_pool         := $(TESTDIR)/stubs.o          $(TEST_SRCS_OBJS)
+EXTRA_trigram      := $(TESTDIR)/stubs.o          $(TEST_SRCS_OBJS)
+EXTRA_watch        := $(TESTDIR)/stubs.o          $(OBJDIR)/watch.o $(TEST_SRCS_OBJS)
+EXTRA_project      := $(TESTDIR)/stubs.o          $(OBJDIR)/project.o $(OBJDIR)/path.o $(TEST_SRCS_OBJS)
+EXTRA_journal      := $(TESTDIR)/stubs.o          $(OBJDIR)/journal.o $(TEST_SRCS_OBJS)
+EXTRA_grep         := $(TESTDIR)/stubs.o          $(OBJDIR)/grep.o $(OBJDIR)/regex.o $(OBJDIR)/match.o $(OBJDIR)/path.o $(TEST_SRCS_OBJS)
 
 .SECONDEXPANSION:
 $(TESTBINS): $(TESTDIR)/test_%: $(TESTDIR)/test_%.o $(TESTDIR)/test.o $$(EXTRA_$$*)
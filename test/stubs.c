@@ -9,7 +9,8 @@ int running       = 1;
 int suppress_undo = 0;
 
 /* Globals normally defined in bufmgr.c */
-struct editor_buffer buflist[MAX_BUFFERS];
+struct editor_buffer *buflist;
+int buf_slots;
 int buf_current = 0;
 int buf_count   = 0;
 int global_auto_revert = 0;
@@ -25,17 +26,25 @@ int win_total_cols = 80;
 /* Globals normally defined in yank.c */
 struct kill_ring killring;
 
+/* What editor_read_key() answers, and what editor_read_line() answers
+ * in turn (NULL-terminated), for tests going through a prompt */
+int stub_key = 0;
+const char **stub_lines;
+
 /* No-op stubs for display and kill-ring functions not under test */
 void editor_set_status_message(const char *fmt, ...) { (void)fmt; }
 void editor_set_mark_silent(void) {}
 void editor_refresh_screen(void) {}
-int  editor_read_key(int fd) { (void)fd; return 0; }
+int  editor_read_key(int fd) { (void)fd; return stub_key; }
+int  editor_key_pending(int fd) { (void)fd; return 0; }
 void kill_ring_set(char *text, int len)    { (void)text; (void)len; }
 void kill_ring_append(char *text, int len) { (void)text; (void)len; }
 char *kill_ring_get(void) { return NULL; }
 int  editor_read_line(int fd, const char *prompt, char *buf, int bufsize)
 {
-    (void)fd; (void)prompt; (void)bufsize;
+    (void)fd; (void)prompt;
     buf[0] = '\0';
+    if (stub_lines && *stub_lines)
+        snprintf(buf, bufsize, "%s", *stub_lines++);
     return 0;
 }
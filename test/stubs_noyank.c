@@ -10,7 +10,8 @@ int running       = 1;
 int suppress_undo = 0;
 
 /* Globals normally defined in bufmgr.c */
-struct editor_buffer buflist[MAX_BUFFERS];
+struct editor_buffer *buflist;
+int buf_slots;
 int buf_current = 0;
 int buf_count   = 0;
 int global_auto_revert = 0;
@@ -25,3 +26,4 @@ int win_total_cols = 80;
 
 /* No-op stub for display function not under test */
 void editor_set_status_message(const char *fmt, ...) { (void)fmt; }
+int  editor_key_pending(int fd) { (void)fd; return 0; }
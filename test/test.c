@@ -9,9 +9,5 @@ int tests_failed = 0;
 
 void free_all_rows(void)
 {
-	int i;
-
-	for (i = 0; i < editor.numrows; i++)
-		editor_free_row(&editor.row[i]);
-	free(editor.row);
+	editor_free_rows();
 }
@@ -62,6 +62,103 @@ static void test_rows_to_string_empty_row(void)
 	teardown();
 }
 
+/* Loaded lines share the file text until edited, then get their own. */
+static void test_append_text_shared(void)
+{
+	static const char file[] = "ab\ncd\r\nef";
+	size_t eol[] = { 3, 7, 9 };
+	char *text = malloc(sizeof(file));
+
+	setup();
+	memcpy(text, file, sizeof(file));
+	CHECK(editor_adopt_text(text, sizeof(file)) == 0);
+	CHECK(editor_append_text(text, eol, 3, 0) == 0);
+
+	CHECK(editor.numrows == 3);
+	CHECK(editor.row[0].shared && editor.row[0].chars == text);
+	CHECK(editor.row[1].size == 3 && !strcmp(editor.row[1].chars, "cd\r"));
+	CHECK(editor.row[2].size == 2 && !strcmp(editor.row[2].chars, "ef"));
+
+	editor_row_insert_char(&editor.row[0], 1, 'X');
+	CHECK(!editor.row[0].shared && !strcmp(editor.row[0].chars, "aXb"));
+	CHECK(editor.row[1].shared && !strcmp(editor.row[1].chars, "cd\r"));
+
+	editor_free_rows();
+	CHECK(editor.arena == NULL && editor.numrows == 0);
+}
+
+/* Short rows are carved from the arena, a long one gets its own malloc,
+ * and with no syntax there's no highlight array to keep. */
+static void test_insert_row_arena(void)
+{
+	static char big[8192];
+
+	setup();
+	memset(big, 'x', sizeof(big));
+	editor_insert_row(0, "short", 5);
+	editor_insert_row(1, big, sizeof(big));
+	editor_insert_row(2, "", 0);
+
+	CHECK(editor.row[0].shared && editor.row[2].shared);
+	CHECK(!editor.row[1].shared);
+	CHECK(editor.row[2].chars == editor.row[0].chars + 6);
+	CHECK(editor.row[0].hl == NULL && editor.row[1].hl == NULL);
+	CHECK(editor.arena && !editor.arena->next);
+	teardown();
+}
+
+/* Repacking leaves a mostly dead arena alone until dead text outweighs
+ * live, then moves the rows to one fresh block, text and all. */
+static void test_arena_repack(void)
+{
+	char line[32], *text;
+	int i;
+
+	setup();
+	for (i = 0; i < 10000; i++) {
+		int n = snprintf(line, sizeof(line), "line %d", i);
+
+		editor_insert_row(i, line, n);
+	}
+	CHECK(editor.arena && editor.arena->next);
+	editor_arena_repack();
+	CHECK(editor.row[0].chars == editor.arena->next->mem);
+
+	while (editor.numrows > 10)
+		editor_del_row(10);
+	editor_row_insert_char(&editor.row[3], 0, 'X');
+	text = editor.row[0].chars;
+	editor_arena_repack();
+	CHECK(editor.arena && !editor.arena->next);
+	CHECK(editor.row[0].chars != text && editor.row[0].shared);
+	CHECK(!strcmp(editor.row[0].chars, "line 0"));
+	CHECK(!strcmp(editor.row[3].chars, "Xline 3"));
+	CHECK(!strcmp(editor.row[9].chars, "line 9"));
+	CHECK(editor.row[9].render == editor.row[9].chars);
+	teardown();
+}
+
+/* A DOS file's CR LF line ends come off on load and back on save. */
+static void test_rows_to_file_crlf(void)
+{
+	static const char file[] = "a\r\nb\r\n";
+	size_t eol[] = { 3, 6 };
+	char *text = malloc(sizeof(file)), *s;
+	int len;
+
+	setup();
+	memcpy(text, file, sizeof(file));
+	CHECK(editor_adopt_text(text, sizeof(file)) == 0);
+	CHECK(editor_append_text(text, eol, 2, 1) == 1);
+	editor_insert_row(editor.numrows, "", 0);
+
+	CHECK(editor.row[0].size == 1 && editor.row[1].size == 1);
+	s = editor_rows_to_file(editor.row, editor.numrows, 1, &len);
+	CHECK(len == 6 && !memcmp(s, file, 6));
+	free(s);
+	editor_free_rows();
+}
+
 /* Inserting in the middle shifts chars right. */
 static void test_row_insert_char_middle(void)
 {
@@ -229,6 +326,14 @@ static void test_update_row_no_tabs(void)
 
 	CHECK(editor.row[0].rsize == 5);
 	CHECK(memcmp(editor.row[0].render, "hello", 5) == 0);
+	CHECK(editor.row[0].render == editor.row[0].chars);
+
+	/* A TAB needs a render copy of its own, dropping it shares again */
+	editor_row_insert_char(&editor.row[0], 0, '\t');
+	CHECK(editor.row[0].render != editor.row[0].chars);
+	editor_row_del_char(&editor.row[0], 0);
+	CHECK(editor.row[0].render == editor.row[0].chars);
+	CHECK(memcmp(editor.row[0].render, "hello", 5) == 0);
 	teardown();
 }
 
@@ -273,6 +378,44 @@ static void test_visual_col_utf8(void)
 	teardown();
 }
 
+/* East Asian wide glyphs take two columns, combining marks none. */
+static void test_visual_col_wide_combining(void)
+{
+	setup();
+	/* "日本" (2 x 3 bytes, 2 cols each) + "e" + U+0301 (2 bytes, 0 cols). */
+	editor_insert_row(0, "\xe6\x97\xa5\xe6\x9c\xac""e\xcc\x81""x", 10);
+
+	CHECK(editor_visual_col(&editor.row[0], 3) == 2);    /* past 日 */
+	CHECK(editor_visual_col(&editor.row[0], 6) == 4);    /* past 本 */
+	CHECK(editor_visual_col(&editor.row[0], 7) == 5);    /* past 'e' */
+	CHECK(editor_visual_col(&editor.row[0], 9) == 5);    /* accent is free */
+	CHECK(editor_visual_col(&editor.row[0], 10) == 6);
+
+	/* Mid-glyph targets snap back to the glyph start; the accent stays
+	 * with its base. */
+	CHECK(editor_chars_col_at_visual(&editor.row[0], 1) == 0);
+	CHECK(editor_chars_col_at_visual(&editor.row[0], 3) == 3);
+	CHECK(editor_chars_col_at_visual(&editor.row[0], 5) == 9);
+	teardown();
+}
+
+/* Glyph stepping treats a base character and its combining marks as one. */
+static void test_utf8_glyph_steps(void)
+{
+	const char *s = "e\xcc\x81\xe6\x97\xa5";   /* e + U+0301, 日 */
+	int n;
+
+	CHECK(utf8_next_glyph(s, 6, 0) == 3);
+	CHECK(utf8_next_glyph(s, 6, 3) == 6);
+	CHECK(utf8_prev_glyph(s, 6, 6) == 3);
+	CHECK(utf8_prev_glyph(s, 6, 3) == 0);
+	CHECK(utf8_glyph_width(s + 3, 3, &n) == 2 && n == 3);
+	CHECK(utf8_cp_width(0x41) == 1);
+	CHECK(utf8_cp_width(0xFF21) == 2);    /* fullwidth 'A' */
+	CHECK(utf8_cp_width(0x200B) == 0);    /* zero width space */
+	CHECK(utf8_glyph_width("\xe6\x97", 2, &n) == 1 && n == 1);  /* truncated */
+}
+
 /* Past end of row: byte offset becomes (row->size + virtual offset). */
 static void test_visual_col_past_eol(void)
 {
@@ -329,12 +472,56 @@ static void test_chars_col_past_eol(void)
 	teardown();
 }
 
+/* Rows are spliced in for a range in one go, growing and shrinking the
+ * buffer, with every row after the range renumbered. */
+static void test_replace_rows(void)
+{
+	char *text = malloc(8);
+	erow rows[3];
+	int i;
+
+	setup();
+	editor_insert_row(0, "a", 1);
+	editor_insert_row(1, "b", 1);
+	editor_insert_row(2, "c", 1);
+	editor_insert_row(3, "d", 1);
+
+	memcpy(text, "X\0Y\0", 4);
+	CHECK(editor_adopt_text(text, 4) == 0);
+	rows[0].chars = text;     rows[0].size = 1; rows[0].shared = 1;
+	rows[1].chars = text + 2; rows[1].size = 1; rows[1].shared = 1;
+	rows[2].chars = malloc(3);
+	memcpy(rows[2].chars, "ZZ", 3);
+	rows[2].size = 2; rows[2].shared = 0;
+
+	CHECK(editor_replace_rows(1, 2, rows, 3) == 0);
+	CHECK(editor.numrows == 5);
+	CHECK(!strcmp(editor.row[1].chars, "X"));
+	CHECK(!strcmp(editor.row[2].chars, "Y"));
+	CHECK(!strcmp(editor.row[3].chars, "ZZ"));
+	CHECK(editor.row[3].render == editor.row[3].chars);
+	CHECK(!strcmp(editor.row[4].chars, "d"));
+	for (i = 0; i < editor.numrows; i++)
+		CHECK(editor.row[i].idx == i);
+
+	CHECK(editor_replace_rows(1, 3, NULL, 0) == 0);
+	CHECK(editor.numrows == 2);
+	CHECK(!strcmp(editor.row[1].chars, "d") && editor.row[1].idx == 1);
+	CHECK(editor_replace_rows(1, 2, NULL, 0) == -1);
+	teardown();
+}
+
 /* ---- Main ---- */
 
 int main(void)
 {
 	RUN(test_rows_to_string);
 	RUN(test_rows_to_string_empty_row);
+	RUN(test_append_text_shared);
+	RUN(test_insert_row_arena);
+	RUN(test_arena_repack);
+	RUN(test_replace_rows);
+	RUN(test_rows_to_file_crlf);
 	RUN(test_row_insert_char_middle);
 	RUN(test_row_insert_char_front);
 	RUN(test_row_insert_char_end);
@@ -350,6 +537,8 @@ int main(void)
 	RUN(test_visual_col_ascii);
 	RUN(test_visual_col_tab);
 	RUN(test_visual_col_utf8);
+	RUN(test_visual_col_wide_combining);
+	RUN(test_utf8_glyph_steps);
 	RUN(test_visual_col_past_eol);
 	RUN(test_chars_col_round_trip);
 	RUN(test_chars_col_inside_tab);
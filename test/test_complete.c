@@ -2,7 +2,9 @@
  *
  * Builds a scratch directory under /tmp with a known set of entries, then
  * exercises completion against various prefixes and verifies match counts,
- * longest-common-prefix output, and the is-directory flag for sole matches. */
+ * longest-common-prefix output, and the is-directory flag for sole matches.
+ * Also covers the cached listing behind it, which must notice changes to
+ * the directory, and the recursive editor_path_walk() used by grep-project. */
 
 #define _DEFAULT_SOURCE   /* for mkdtemp under -std=c99 */
 
@@ -196,6 +198,22 @@ static void test_dot_prefix_shows_hidden(void)
 	teardown();
 }
 
+/* ".." completes to the parent directory, as it always has. */
+static void test_dot_dot(void)
+{
+	struct path_entry entries[8];
+	char lcp[256];
+	int n;
+
+	setup();
+	n = editor_path_complete_entries(scratch, "..", entries, 8, lcp, sizeof(lcp));
+	CHECK(n == 1);
+	CHECK(strcmp(entries[0].name, "..") == 0);
+	CHECK(entries[0].is_dir == 1);
+	CHECK(strcmp(lcp, "..") == 0);
+	teardown();
+}
+
 /* When matches exceed the entries cap, the returned count is still the
  * total; entries[] holds some `max`-sized alphabetically-sorted subset
  * of the matches (which subset depends on readdir order — callers that
@@ -268,6 +286,95 @@ static void test_substring_matching(void)
 	teardown();
 }
 
+/* Typing narrows the previous query's matches, and erasing widens them
+ * again; either way the answer is what a fresh scan would give. */
+static void test_narrow_and_widen(void)
+{
+	struct path_entry entries[8];
+	char lcp[256];
+	int n;
+
+	setup();
+	CHECK(editor_path_complete_entries(scratch, "f", entries, 8, lcp, sizeof(lcp)) == 3);
+	CHECK(editor_path_complete_entries(scratch, "fo", entries, 8, lcp, sizeof(lcp)) == 3);
+	n = editor_path_complete_entries(scratch, "foob", entries, 8, lcp, sizeof(lcp));
+	CHECK(n == 2);
+	CHECK(strcmp(lcp, "fooba") == 0);
+	n = editor_path_complete_entries(scratch, "foobaz", entries, 8, lcp, sizeof(lcp));
+	CHECK(n == 1);
+	CHECK(strcmp(entries[0].name, "foobaz") == 0);
+
+	n = editor_path_complete_entries(scratch, "fo", entries, 8, lcp, sizeof(lcp));
+	CHECK(n == 3);
+	CHECK(strcmp(entries[0].name, "foe") == 0);
+	CHECK(strcmp(lcp, "fo") == 0);
+
+	/* From no dotfiles to dotfiles. */
+	CHECK(editor_path_complete_entries(scratch, "", entries, 8, lcp, sizeof(lcp)) == 5);
+	CHECK(editor_path_complete_entries(scratch, ".", entries, 8, lcp, sizeof(lcp)) == 2);
+	teardown();
+}
+
+/* The listing is cached, but an entry created or removed since shows. */
+static void test_cache_follows_directory(void)
+{
+	struct path_entry entries[8];
+	char lcp[256], path[512];
+
+	setup();
+	CHECK(editor_path_complete_entries(scratch, "fo", entries, 8, lcp, sizeof(lcp)) == 3);
+	touch("fox");
+	CHECK(editor_path_complete_entries(scratch, "fo", entries, 8, lcp, sizeof(lcp)) == 4);
+	snprintf(path, sizeof(path), "%sfoe", scratch);
+	unlink(path);
+	CHECK(editor_path_complete_entries(scratch, "fo", entries, 8, lcp, sizeof(lcp)) == 3);
+	CHECK(strcmp(entries[0].name, "foobar") == 0);
+	teardown();
+}
+
+static int count_file(const char *path, void *arg)
+{
+	(void)path;
+	(*(int *)arg)++;
+	return 0;
+}
+
+static int stop_at_first(const char *path, void *arg)
+{
+	(void)path;
+	(*(int *)arg)++;
+	return 1;
+}
+
+/* The walk visits regular files in subdirectories, skips dotfiles and
+ * the directories it is told to, and does not follow a link back up to
+ * the top. */
+static void test_path_walk(void)
+{
+	static const char *const skip[] = { "subdir", NULL };
+	char path[512];
+	int n = 0;
+
+	setup();
+	touch("subdir/inner");
+	snprintf(path, sizeof(path), "%sloop", scratch);
+	CHECK(symlink(scratch, path) == 0);
+
+	CHECK(editor_path_walk(scratch, NULL, count_file, &n) == 0);
+	CHECK(n == 5);            /* foobar, foobaz, foe, README, subdir/inner */
+
+	n = 0;
+	CHECK(editor_path_walk(scratch, skip, count_file, &n) == 0);
+	CHECK(n == 4);
+
+	n = 0;
+	CHECK(editor_path_walk(scratch, NULL, stop_at_first, &n) == 1);
+	CHECK(n == 1);
+
+	CHECK(editor_path_walk("/no/such/dir/exists-12345", NULL, count_file, &n) == -1);
+	teardown();
+}
+
 int main(void)
 {
 	RUN(test_multiple_matches_lcp);
@@ -278,8 +385,12 @@ int main(void)
 	RUN(test_opendir_failure);
 	RUN(test_empty_prefix);
 	RUN(test_dot_prefix_shows_hidden);
+	RUN(test_dot_dot);
 	RUN(test_max_clamp);
 	RUN(test_picker_match_rank);
 	RUN(test_substring_matching);
+	RUN(test_narrow_and_widen);
+	RUN(test_cache_follows_directory);
+	RUN(test_path_walk);
 	return test_summary();
 }
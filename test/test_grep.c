@@ -0,0 +1,143 @@
+/* test_grep.c — tests for M-x grep-project in grep.c.
+ *
+ * Answers the two prompts with a regexp and a scratch directory under
+ * /tmp, waits for the search to finish and checks the *grep* buffer it
+ * fills: one "file:line: text" row per matching line, after the header,
+ * and none for the empty line past a file's last newline. */
+
+#define _DEFAULT_SOURCE   /* for mkdtemp under -std=c99 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test.h"
+#include "../src/def.h"
+
+extern const char **stub_lines;
+
+/* Where results go, and what grep.c calls that the shared stubs file
+ * does not provide. */
+void ab_append(struct abuf *ab, const char *s, int len)
+{
+	char *b = realloc(ab->b, ab->len + len);
+
+	if (!b)
+		return;
+	memcpy(b + ab->len, s, len);
+	ab->b = b;
+	ab->len += len;
+}
+
+int query_has_upper(const char *q, int qlen, int regex)
+{
+	(void)q; (void)qlen; (void)regex;
+	return 0;
+}
+
+int buf_visit_file(char *path, int readonly)
+{
+	(void)path; (void)readonly;
+	return 0;
+}
+
+void editor_goto_line_direct(int line, int col) { (void)line; (void)col; }
+
+/* The *grep* buffer is the current one, rows and all. */
+void buf_open_special(const char *name, struct editor_syntax *syntax,
+                      void (*populate)(void), const char *status)
+{
+	(void)name; (void)status;
+	free_all_rows();
+	editor.syntax = syntax;
+	populate();
+}
+
+void editor_prompt_prefill_dir(char *buf, int size)
+{
+	snprintf(buf, size, "./");
+}
+
+static char scratch[256];
+
+static void put(const char *name, const char *text)
+{
+	char path[512];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", scratch, name);
+	fp = fopen(path, "w");
+	if (fp) {
+		fputs(text, fp);
+		fclose(fp);
+	}
+}
+
+static void rm(const char *name)
+{
+	char path[512];
+
+	snprintf(path, sizeof(path), "%s/%s", scratch, name);
+	unlink(path);
+}
+
+/* Grep the scratch directory for re and wait for all the results. */
+static void grep(const char *re)
+{
+	const char *answers[] = { re, scratch, NULL };
+
+	stub_lines = answers;
+	editor_grep_project(0);
+	while (grep_running()) {
+		pool_wait(10);
+		grep_poll();
+	}
+	stub_lines = NULL;
+}
+
+/* Only lines that match are listed, numbered from 1. */
+static void test_match_lines(void)
+{
+	put("a.txt", "one\ntwo\nthree\n");
+	grep("t");
+	CHECK(editor.numrows == 3);
+	CHECK(!strcmp(editor.row[1].chars, "a.txt:2: two"));
+	CHECK(!strcmp(editor.row[2].chars, "a.txt:3: three"));
+	rm("a.txt");
+}
+
+/* A pattern matching the empty string lists every line, but not one
+ * past the final newline; without a final newline the last line is
+ * still listed. */
+static void test_empty_match(void)
+{
+	put("a.txt", "one\ntwo\n");
+	grep("^");
+	CHECK(editor.numrows == 3);
+	CHECK(!strcmp(editor.row[2].chars, "a.txt:2: two"));
+
+	grep("^$");
+	CHECK(editor.numrows == 1);
+
+	put("a.txt", "one\ntwo");
+	grep("x*");
+	CHECK(editor.numrows == 3);
+	CHECK(!strcmp(editor.row[2].chars, "a.txt:2: two"));
+	rm("a.txt");
+}
+
+int main(void)
+{
+	char tmpl[] = "/tmp/kg-grep-XXXXXX";
+
+	if (!mkdtemp(tmpl)) {
+		CHECK(0);
+		return test_summary();
+	}
+	snprintf(scratch, sizeof(scratch), "%s", tmpl);
+	RUN(test_match_lines);
+	RUN(test_empty_match);
+	rmdir(scratch);
+	free_all_rows();
+	return test_summary();
+}
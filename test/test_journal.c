@@ -0,0 +1,258 @@
+/* test_journal.c — tests for the crash-recovery journal in journal.c.
+ *
+ * Edits a buffer through the row primitives, takes the records the
+ * journal collected for them, and replays those onto the buffer as it
+ * was: the result must be the edited buffer.  Also checks that typing
+ * on one line keeps to one record, that an unmodified buffer drops its
+ * journal, how a journal cut short or not fitting replays, and that a
+ * journal left behind by a crash survives new edits until recovered. */
+
+#define _DEFAULT_SOURCE   /* for mkdtemp under -std=c99 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test.h"
+#include "../src/def.h"
+
+/* The writer thread and the file side of journal.c are not exercised
+ * here; remember what was queued instead. */
+static enum journal_op last_op;
+
+int save_journal(int slot, const char *path, char *buf, int len,
+                 enum journal_op op)
+{
+	(void)slot; (void)path; (void)len;
+	free(buf);
+	last_op = op;
+	return 0;
+}
+
+void save_wait(void) {}
+
+int file_text_read(const char *path, struct file_text *ft)
+{
+	FILE *fp = fopen(path, "r");
+
+	memset(ft, 0, sizeof(*ft));
+	if (!fp) {
+		ft->err = errno;
+		return -1;
+	}
+	ft->buf = malloc(4096);
+	ft->len = fread(ft->buf, 1, 4096, fp);
+	fclose(fp);
+	return 0;
+}
+
+void file_text_free(struct file_text *ft) { free(ft->buf); }
+
+extern int stub_key;
+
+static const char *orig[] = { "one", "two", "three", "four", "five" };
+#define NORIG (int)(sizeof(orig) / sizeof(orig[0]))
+
+static void load(void)
+{
+	int i;
+
+	free_all_rows();
+	for (i = 0; i < NORIG; i++)
+		editor_insert_row(i, orig[i], strlen(orig[i]));
+	editor.dirty = 0;
+}
+
+void buf_reload_from_disk(void) { load(); }
+
+static void setup(void)
+{
+	journal_free(editor.journal);
+	editor.journal = NULL;
+	editor.filename = "/nonexistent/kg-journal-test.txt";
+	last_op = JOURNAL_NONE;
+	load();
+	journal_sync();         /* the buffer gets its journal */
+}
+
+static void teardown(void)
+{
+	journal_free(editor.journal);
+	editor.journal = NULL;
+	free_all_rows();
+}
+
+/* The records waiting, as a string. */
+static char *records(void)
+{
+	struct journal *j = editor.journal;
+	char *s = malloc(j->len + 1);
+
+	memcpy(s, j->pend, j->len);
+	s[j->len] = '\0';
+	return s;
+}
+
+static int count_records(const char *s)
+{
+	int n = 0;
+
+	for (; (s = strchr(s, '@')); s++)
+		n++;
+	return n;
+}
+
+/* Rows as one string, to compare buffers by. */
+static char *snapshot(void)
+{
+	int len;
+
+	return editor_rows_to_string(editor.row, editor.numrows, &len);
+}
+
+/* Edits here and there, each its own command, replay to the same rows. */
+static void test_replay(void)
+{
+	char *want, *got, *text;
+
+	setup();
+	editor_row_insert_char(&editor.row[1], 0, 'X');
+	journal_sync();
+	editor_insert_row(3, "new", 3);
+	editor_del_row(0);
+	journal_sync();
+	editor_row_append_string(&editor.row[editor.numrows - 1], "!", 1);
+	journal_sync();
+	editor_del_row(1);
+	editor_del_row(1);
+	journal_sync();
+
+	want = snapshot();
+	text = records();
+	CHECK(!strncmp(text, "kg journal\n", 11));
+	CHECK(count_records(text) >= 3);
+
+	load();
+	CHECK(journal_replay(text, strlen(text)) == 0);
+	got = snapshot();
+	CHECK(!strcmp(got, want));
+	free(want);
+	free(got);
+	free(text);
+	teardown();
+}
+
+/* Typing along a line rewrites its record instead of adding one. */
+static void test_merge(void)
+{
+	const char *word = "hello";
+	char *text;
+	int i;
+
+	setup();
+	for (i = 0; word[i]; i++) {
+		editor_row_insert_char(&editor.row[2], i, word[i]);
+		journal_sync();
+	}
+	text = records();
+	CHECK(count_records(text) == 1);
+	CHECK(strstr(text, "@2 1 1\nhellothree\n") != NULL);
+	free(text);
+	teardown();
+}
+
+/* An edit undone back to what's on disk drops the journal. */
+static void test_unmodified(void)
+{
+	setup();
+	editor_row_insert_char(&editor.row[0], 0, 'X');
+	journal_sync();
+	CHECK(editor.journal->len > 0 && editor.journal->created);
+
+	editor.dirty = 0;
+	journal_sync();
+	CHECK(editor.journal->len == 0 && !editor.journal->created);
+	CHECK(last_op == JOURNAL_REMOVE);
+	teardown();
+}
+
+/* A journal cut short replays up to the last whole record; one that
+ * doesn't fit the file doesn't replay at all. */
+static void test_damaged(void)
+{
+	const char *cut = "kg journal\n@0 1 1\nONE\n@1 1 2\nTWO\n";
+	const char *misfit = "kg journal\n@9 1 1\nnine\n";
+	char *got;
+
+	setup();
+	CHECK(journal_replay(cut, strlen(cut)) == 1);
+	CHECK(editor.numrows == NORIG);
+	got = snapshot();
+	CHECK(!strncmp(got, "ONE\ntwo\n", 8));
+	free(got);
+
+	load();
+	CHECK(journal_replay(misfit, strlen(misfit)) == -1);
+	CHECK(journal_replay("junk\n", 5) == -1);
+	CHECK(editor.numrows == NORIG);
+	teardown();
+}
+
+/* A journal newer than the file, found when visiting it, is a crashed
+ * session's: new edits stay in memory, not on top of it, and recovering
+ * replays it rather than them. */
+static void test_held(void)
+{
+	char dir[] = "/tmp/kg-journal-XXXXXX";
+	char file[64], crash[64];
+	const char *text = "kg journal\n@0 1 1\nCRASH\n";
+	FILE *fp;
+
+	CHECK(mkdtemp(dir) != NULL);
+	snprintf(file, sizeof(file), "%s/t.txt", dir);
+	snprintf(crash, sizeof(crash), "%s/#t.txt#", dir);
+	fp = fopen(file, "w");
+	fclose(fp);
+	fp = fopen(crash, "w");
+	fputs(text, fp);
+	fclose(fp);
+
+	journal_free(editor.journal);
+	editor.journal = NULL;
+	editor.filename = file;
+	last_op = JOURNAL_NONE;
+	buf_slots = 1;
+	load();
+	CHECK(journal_sync() == 1);
+	CHECK(editor.journal->held);
+
+	editor_row_insert_char(&editor.row[1], 0, 'X');
+	editor.dirty++;
+	journal_sync();
+	CHECK(!journal_pending());
+	journal_flush();
+	CHECK(last_op == JOURNAL_NONE);
+
+	stub_key = 'y';
+	editor_recover_file(0);
+	stub_key = 0;
+	CHECK(!strcmp(editor.row[0].chars, "CRASH"));
+	CHECK(!strcmp(editor.row[1].chars, "two"));
+	CHECK(!editor.journal->held);
+
+	buf_slots = 0;
+	unlink(crash);
+	unlink(file);
+	rmdir(dir);
+	teardown();
+}
+
+int main(void)
+{
+	RUN(test_replay);
+	RUN(test_merge);
+	RUN(test_unmodified);
+	RUN(test_damaged);
+	RUN(test_held);
+	return test_summary();
+}
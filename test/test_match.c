@@ -0,0 +1,116 @@
+/* test_match.c — tests for the substring search engine in match.c.
+ *
+ * Checks forward and backward scans with and without case folding, the
+ * memchr() prefilter and its fallback to Horspool when the prefilter
+ * byte turns out to be common, and the edge cases around empty and
+ * oversized needles. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../src/def.h"
+
+static int find(const char *hay, const char *pat, int fold)
+{
+	struct needle n;
+	int pos;
+
+	needle_init(&n, pat, strlen(pat), fold);
+	pos = needle_find(&n, hay, strlen(hay));
+	needle_free(&n);
+	return pos;
+}
+
+static int rfind(const char *hay, int hlen, const char *pat, int fold)
+{
+	struct needle n;
+	int pos;
+
+	needle_init(&n, pat, strlen(pat), fold);
+	pos = needle_rfind(&n, hay, hlen);
+	needle_free(&n);
+	return pos;
+}
+
+static void test_find_basic(void)
+{
+	CHECK(find("hello world", "world", 0) == 6);
+	CHECK(find("hello world", "o", 0) == 4);
+	CHECK(find("hello world", "hello world", 0) == 0);
+	CHECK(find("hello world", "worlds", 0) == -1);
+	CHECK(find("hello world", "xyz", 0) == -1);
+	CHECK(find("abc", "abcd", 0) == -1);
+	CHECK(find("aaab", "aab", 0) == 1);
+}
+
+static void test_find_fold(void)
+{
+	CHECK(find("Hello World", "world", 1) == 6);
+	CHECK(find("Hello World", "world", 0) == -1);
+	CHECK(find("HELLO", "ello", 1) == 1);
+	CHECK(find("a-B-c", "-b-", 1) == 1);
+	/* The pattern is folded at init time; a mixed-case query matches
+	 * either case when folding. */
+	CHECK(find("foo BAR", "Bar", 1) == 4);
+}
+
+/* Rightmost match must lie wholly inside the limit. */
+static void test_rfind(void)
+{
+	const char *s = "foo bar foo baz";
+
+	CHECK(rfind(s, 15, "foo", 0) == 8);
+	CHECK(rfind(s, 10, "foo", 0) == 0);    /* "fo" at 8 straddles 10 */
+	CHECK(rfind(s, 11, "foo", 0) == 8);
+	CHECK(rfind(s, 2, "foo", 0) == -1);
+	CHECK(rfind(s, 15, "FOO", 1) == 8);
+	CHECK(rfind(s, 15, "qux", 0) == -1);
+	CHECK(rfind("aaaa", 4, "aa", 0) == 2);
+}
+
+/* The empty needle matches at the start going forward, at the limit
+ * going back. */
+static void test_empty_needle(void)
+{
+	CHECK(find("abc", "", 0) == 0);
+	CHECK(rfind("abc", 3, "", 0) == 3);
+}
+
+/* A prefilter byte that is everywhere in the text must not make the
+ * search slow or wrong: after enough misses the scan switches over. */
+static void test_prefilter_fallback(void)
+{
+	char hay[4096];
+
+	memset(hay, 'q', sizeof(hay) - 1);
+	hay[sizeof(hay) - 1] = '\0';
+	memcpy(hay + 4000, "qqqz", 4);
+
+	CHECK(find(hay, "qqqz", 0) == 4000);
+	CHECK(find(hay, "qqqz", 1) == 4000);
+	CHECK(find(hay, "qqqy", 0) == -1);
+	CHECK(rfind(hay, sizeof(hay) - 1, "qqqz", 0) == 4000);
+}
+
+/* Long needles exercise the Horspool shifts over a longer window. */
+static void test_long_needle(void)
+{
+	const char *hay = "the quick brown fox jumps over the lazy dog, "
+	                  "the quick brown fox jumps over the lazy cat";
+
+	CHECK(find(hay, "jumps over the lazy cat", 0) == 65);
+	CHECK(find(hay, "JUMPS OVER THE LAZY DOG", 1) == 20);
+	CHECK(rfind(hay, strlen(hay), "the quick brown fox", 0) == 45);
+	CHECK(rfind(hay, 60, "the quick brown fox", 0) == 0);
+}
+
+int main(void)
+{
+	RUN(test_find_basic);
+	RUN(test_find_fold);
+	RUN(test_rfind);
+	RUN(test_empty_needle);
+	RUN(test_prefilter_fallback);
+	RUN(test_long_needle);
+	return test_summary();
+}
@@ -0,0 +1,105 @@
+/* test_pool.c — tests for the worker pool in pool.c.
+ *
+ * Checks that every task of a batch runs exactly once with a worker
+ * index in range, that pool_wait() times out while a batch is still
+ * running and then reports it done, and that batches can follow one
+ * another. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "test.h"
+#include "../src/def.h"
+
+#define NTASKS 1000
+
+struct batch {
+	pthread_mutex_t lock;
+	int runs[NTASKS];
+	int bad_worker;
+	volatile int release;       /* gate for the slow batch */
+};
+
+static void count_task(void *arg, int task, int worker)
+{
+	struct batch *b = arg;
+
+	pthread_mutex_lock(&b->lock);
+	b->runs[task]++;
+	if (worker < 0 || worker >= pool_size())
+		b->bad_worker = 1;
+	pthread_mutex_unlock(&b->lock);
+}
+
+static void gated_task(void *arg, int task, int worker)
+{
+	struct batch *b = arg;
+	int open = 0;
+
+	(void)task; (void)worker;
+	while (!open) {
+		pthread_mutex_lock(&b->lock);
+		open = b->release;
+		pthread_mutex_unlock(&b->lock);
+	}
+}
+
+static void test_every_task_once(void)
+{
+	static struct batch b;
+	int i, once = 1;
+
+	CHECK(pool_size() > 0);
+	pthread_mutex_init(&b.lock, NULL);
+	CHECK(pool_start(count_task, &b, NTASKS) == 0);
+	while (!pool_wait(100))
+		;
+	for (i = 0; i < NTASKS; i++)
+		if (b.runs[i] != 1)
+			once = 0;
+	CHECK(once);
+	CHECK(!b.bad_worker);
+	pthread_mutex_destroy(&b.lock);
+}
+
+static void test_wait_timeout(void)
+{
+	static struct batch b;
+
+	pthread_mutex_init(&b.lock, NULL);
+	CHECK(pool_start(gated_task, &b, 4) == 0);
+	CHECK(pool_wait(20) == 0);
+	pthread_mutex_lock(&b.lock);
+	b.release = 1;
+	pthread_mutex_unlock(&b.lock);
+	while (!pool_wait(100))
+		;
+	pthread_mutex_destroy(&b.lock);
+}
+
+static void test_batches_in_a_row(void)
+{
+	static struct batch b;
+	int round, i, ok = 1;
+
+	pthread_mutex_init(&b.lock, NULL);
+	for (round = 1; round <= 20; round++) {
+		CHECK(pool_start(count_task, &b, round * 7) == 0);
+		while (!pool_wait(100))
+			;
+	}
+	/* Task i ran in every round with more than i tasks. */
+	for (i = 0; i < 140; i++)
+		if (b.runs[i] != 20 - i / 7)
+			ok = 0;
+	CHECK(ok);
+	pthread_mutex_destroy(&b.lock);
+}
+
+int main(void)
+{
+	RUN(test_every_task_once);
+	RUN(test_wait_timeout);
+	RUN(test_batches_in_a_row);
+	return test_summary();
+}
@@ -0,0 +1,199 @@
+/* test_project.c — tests for the project file index in project.c.
+ *
+ * Builds a small project tree under /tmp, with a .git and the kind of
+ * build output directories the crawl should skip, indexes it and checks
+ * the fuzzy ranking: which files match, which comes first, smart case,
+ * and that narrowing a query step by step ranks the same as typing it
+ * all at once. */
+
+#define _DEFAULT_SOURCE   /* for mkdtemp under -std=c99 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "test.h"
+#include "../src/def.h"
+
+/* The picker side of project.c is not exercised here; stub what it calls
+ * that the shared stubs file does not provide. */
+void editor_picker_render(char *msg, int msg_size, int *off,
+                          const char *const *names, int n, int n_total, int sel)
+{
+	(void)msg; (void)msg_size; (void)off;
+	(void)names; (void)n; (void)n_total; (void)sel;
+}
+
+void editor_msg_appendf(char *msg, int size, int *off, const char *fmt, ...)
+{
+	(void)msg; (void)size; (void)off; (void)fmt;
+}
+
+int buf_visit_file(char *path, int readonly)
+{
+	(void)path; (void)readonly;
+	return 0;
+}
+
+int macro_is_replaying(void) { return 0; }
+void editor_process_pending_resize(void) {}
+
+static char scratch[256];
+
+static void put(const char *name)
+{
+	char path[512], *p;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", scratch, name);
+	for (p = path + strlen(scratch) + 1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		mkdir(path, 0700);
+		*p = '/';
+	}
+	fp = fopen(path, "w");
+	if (fp) fclose(fp);
+}
+
+static void rmtree(const char *path)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *dp = opendir(path);
+	char child[512];
+
+	if (!dp) return;
+	while ((de = readdir(dp)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+		snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+		if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode))
+			rmtree(child);
+		else
+			unlink(child);
+	}
+	closedir(dp);
+	rmdir(path);
+}
+
+/* Index the scratch tree and wait for the crawl to finish. */
+static struct project_index *index_tree(void)
+{
+	struct project_index *ix = project_index_new(scratch);
+	int done = 0, i;
+
+	CHECK(ix != NULL);
+	for (i = 0; ix && !done && i < 500; i++) {
+		project_index_count(ix, &done);
+		if (!done)
+			usleep(10000);
+	}
+	CHECK(done);
+	return ix;
+}
+
+/* Best match for q, or "" when nothing matches. */
+static const char *best(struct project_index *ix, const char *q)
+{
+	int out[PICKER_MAX_ENTRIES];
+
+	if (project_rank(ix, q, (int)strlen(q), out, PICKER_MAX_ENTRIES) < 1)
+		return "";
+	return project_index_path(ix, out[0]);
+}
+
+static void setup(void)
+{
+	char tmpl[] = "/tmp/kg-project-XXXXXX";
+	const char *p = mkdtemp(tmpl);
+
+	CHECK(p != NULL);
+	snprintf(scratch, sizeof(scratch), "%s", p);
+	put("src/main.c");
+	put("src/bufmgr.c");
+	put("doc/kg.1");
+	put("README");
+	put("Makefile");
+	put(".git/config");
+	put("build/main.o");
+	put("node_modules/mod/index.js");
+}
+
+/* Everything but .git and the build output, paths relative to the root. */
+static void test_crawl(void)
+{
+	struct project_index *ix = index_tree();
+	int i, n = project_index_count(ix, NULL);
+
+	CHECK(n == 5);
+	for (i = 0; i < n; i++) {
+		const char *path = project_index_path(ix, i);
+
+		CHECK(path[0] != '/');
+		CHECK(strncmp(path, ".git", 4) && strncmp(path, "build", 5) &&
+		      strncmp(path, "node_modules", 12));
+	}
+	project_index_free(ix);
+}
+
+/* Letters may be spread out, but word starts and file names rank first. */
+static void test_rank(void)
+{
+	struct project_index *ix = index_tree();
+	int out[PICKER_MAX_ENTRIES];
+
+	CHECK(!strcmp(best(ix, "bm"), "src/bufmgr.c"));
+	CHECK(!strcmp(best(ix, "mc"), "src/main.c"));
+	CHECK(!strcmp(best(ix, "sm"), "src/main.c"));
+	CHECK(!strcmp(best(ix, "kg1"), "doc/kg.1"));
+	CHECK(!strcmp(best(ix, "readme"), "README"));
+	CHECK(project_rank(ix, "zzq", 3, out, PICKER_MAX_ENTRIES) == 0);
+	CHECK(project_rank(ix, "", 0, out, PICKER_MAX_ENTRIES) == 5);
+	project_index_free(ix);
+}
+
+/* An upper-case letter in the query makes it case sensitive. */
+static void test_smart_case(void)
+{
+	struct project_index *ix = index_tree();
+	int out[PICKER_MAX_ENTRIES];
+
+	CHECK(project_rank(ix, "ma", 2, out, PICKER_MAX_ENTRIES) == 2);
+	CHECK(project_rank(ix, "Ma", 2, out, PICKER_MAX_ENTRIES) == 1);
+	CHECK(!strcmp(project_index_path(ix, out[0]), "Makefile"));
+	project_index_free(ix);
+}
+
+/* Typing a query a key at a time, with a backspace on the way, ranks the
+ * same as a fresh index given the whole query. */
+static void test_incremental(void)
+{
+	struct project_index *ix = index_tree(), *fresh = index_tree();
+	int a[PICKER_MAX_ENTRIES], b[PICKER_MAX_ENTRIES];
+	int i, na, nb;
+
+	project_rank(ix, "s", 1, a, PICKER_MAX_ENTRIES);
+	project_rank(ix, "sr", 2, a, PICKER_MAX_ENTRIES);
+	project_rank(ix, "srx", 3, a, PICKER_MAX_ENTRIES);
+	project_rank(ix, "sr", 2, a, PICKER_MAX_ENTRIES);
+	na = project_rank(ix, "src", 3, a, PICKER_MAX_ENTRIES);
+	nb = project_rank(fresh, "src", 3, b, PICKER_MAX_ENTRIES);
+	CHECK(na == 2 && na == nb);
+	for (i = 0; i < na && i < nb; i++)
+		CHECK(!strcmp(project_index_path(ix, a[i]),
+		              project_index_path(fresh, b[i])));
+	project_index_free(ix);
+	project_index_free(fresh);
+}
+
+int main(void)
+{
+	setup();
+	RUN(test_crawl);
+	RUN(test_rank);
+	RUN(test_smart_case);
+	RUN(test_incremental);
+	rmtree(scratch);
+	return test_summary();
+}
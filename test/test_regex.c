@@ -0,0 +1,247 @@
+/* test_regex.c — tests for the regular expression engine in regex.c.
+ *
+ * Checks the egrep syntax the parser accepts, leftmost-first match
+ * selection (what a backtracking matcher would return), backward
+ * searches bounded by a limit, line anchors around embedded newlines,
+ * UTF-8 aware classes, the literal prefilter, and that pathological
+ * patterns run in linear time. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../src/def.h"
+
+/* Leftmost match of pat in s from offset from: start in *b, end in *e,
+ * returns 0 when there is none, -1 on a syntax error. */
+static int search(const char *pat, int fold, const char *s, int from, int *b, int *e)
+{
+	const char *err = NULL;
+	struct regex *re = regex_compile(pat, strlen(pat), fold, &err);
+	int found;
+
+	if (!re)
+		return -1;
+	found = regex_search(re, s, strlen(s), from, b, e);
+	regex_free(re);
+	return found;
+}
+
+static int rsearch(const char *pat, const char *s, int limit, int *b, int *e)
+{
+	const char *err = NULL;
+	struct regex *re = regex_compile(pat, strlen(pat), 0, &err);
+	int found;
+
+	if (!re)
+		return -1;
+	found = regex_rsearch(re, s, strlen(s), limit, b, e);
+	regex_free(re);
+	return found;
+}
+
+/* Match span of pat in s as "b-e", or "none" / "error". */
+static const char *span(const char *pat, const char *s)
+{
+	static char buf[32];
+	int b, e, r = search(pat, 0, s, 0, &b, &e);
+
+	if (r < 0) return "error";
+	if (r == 0) return "none";
+	snprintf(buf, sizeof(buf), "%d-%d", b, e);
+	return buf;
+}
+
+#define SPAN(pat, s, want) CHECK(strcmp(span(pat, s), want) == 0)
+
+static void test_literals_and_classes(void)
+{
+	SPAN("world", "hello world", "6-11");
+	SPAN("w.rld", "hello world", "6-11");
+	SPAN("[a-c]+", "xxbcaz", "2-5");
+	SPAN("[^a-z ]", "abc dEf", "5-6");
+	SPAN("\\d+", "abc 1234 x", "4-8");
+	SPAN("\\w+", "  foo_bar1 ", "2-10");
+	SPAN("\\s", "ab\tc", "2-3");
+	SPAN("[[:digit:]]{2}", "a1b23", "3-5");
+	SPAN("a\\.b", "axb a.b", "4-7");
+	SPAN("[]x]", "ab]", "2-3");
+	SPAN("xyz", "hello", "none");
+}
+
+static void test_repeats(void)
+{
+	SPAN("ab*c", "ac abbbc", "0-2");
+	SPAN("ab+c", "ac abbbc", "3-8");
+	SPAN("colou?r", "color colour", "0-5");
+	SPAN("a{3}", "aa aaaa", "3-6");
+	SPAN("a{2,3}", "aaaa", "0-3");
+	SPAN("a{2,}", "a aaaaa", "2-7");
+	SPAN("x{,2}", "xx{,2}", "1-6");        /* not a bound: literal */
+	SPAN("a{", "a{", "0-2");
+	SPAN("<.*>", "<a> <b>", "0-7");
+	SPAN("<.*?>", "<a> <b>", "0-3");
+	SPAN("a+?", "aaa", "0-1");
+}
+
+/* The leftmost match wins; among matches starting there, the first
+ * alternative a backtracking matcher would try. */
+static void test_leftmost_first(void)
+{
+	SPAN("a|ab", "ab", "0-1");
+	SPAN("ab|a", "ab", "0-2");
+	SPAN("(a|ab)(c|bcd)", "abcd", "0-4");
+	SPAN("b|abc", "abc", "0-3");
+	SPAN("x*", "aaa", "0-0");
+	SPAN("(?:foo|foobar)baz", "foobarbaz", "0-9");
+}
+
+static void test_anchors(void)
+{
+	const char *s = "one\ntwo\nthree";
+	int b, e;
+
+	SPAN("^two", s, "4-7");
+	SPAN("two$", s, "4-7");
+	SPAN("^t.*$", s, "4-7");
+	SPAN("o$", "foo bar", "none");
+	SPAN("^$", "ab\n\ncd", "3-3");
+	SPAN("a\\nb", "xa\nb", "1-4");
+	SPAN(".", "\n", "none");
+	SPAN("[^x]", "\n", "0-1");
+
+	/* A start offset doesn't make the text before it disappear. */
+	CHECK(search("^o", 0, "foo", 1, &b, &e) == 0);
+	CHECK(search("^w", 0, "two\nwo", 1, &b, &e) == 1 && b == 4);
+}
+
+/* Only patterns that can consume a newline need more than one line. */
+static void test_multiline(void)
+{
+	static const struct {
+		const char *pat;
+		int want;
+	} t[] = {
+		{ "foo",       0 },
+		{ "^a.*b$",    0 },
+		{ "a\\nb",     1 },
+		{ "[^x]+",     1 },
+		{ "\\s",       1 },
+		{ "\\S+",      0 },
+		{ "(?:a|\\n)", 1 },
+	};
+	const char *err;
+	unsigned i;
+
+	for (i = 0; i < sizeof(t) / sizeof(t[0]); i++) {
+		struct regex *re = regex_compile(t[i].pat, strlen(t[i].pat), 0, &err);
+
+		CHECK(re != NULL);
+		if (!re)
+			continue;
+		CHECK(regex_multiline(re) == t[i].want);
+		regex_free(re);
+	}
+}
+
+static void test_fold(void)
+{
+	int b, e;
+
+	CHECK(search("hello", 1, "Say HELLO", 0, &b, &e) == 1 && b == 4 && e == 9);
+	CHECK(search("hello", 0, "Say HELLO", 0, &b, &e) == 0);
+	CHECK(search("[a-c]x", 1, "zzBX", 0, &b, &e) == 1 && b == 2);
+	CHECK(search("[^a]", 1, "aAb", 0, &b, &e) == 1 && b == 2);
+}
+
+static void test_utf8(void)
+{
+	/* "é" is two bytes, "漢" three. */
+	SPAN("caf.!", "caf\xc3\xa9!", "0-6");
+	SPAN("^.{2}$", "\xe6\xbc\xa2\xc3\xa9", "0-5");
+	SPAN("[\xc3\xa9x]+", "a\xc3\xa9x\xc3\xa9", "1-6");
+	SPAN("\\w+", "na\xc3\xafve!", "0-6");
+	SPAN("\xe6\xbc\xa2", "a\xe6\xbc\xa2", "1-4");
+	SPAN("[^\xc3\xa9]", "x", "error");
+}
+
+static void test_rsearch(void)
+{
+	const char *s = "foo1 foo22 foo333";
+	int b, e;
+
+	CHECK(rsearch("foo[0-9]+", s, strlen(s), &b, &e) == 1 && b == 11 && e == 17);
+	/* The match must end at or before the limit. */
+	CHECK(rsearch("foo[0-9]+", s, 16, &b, &e) == 1 && b == 11 && e == 16);
+	CHECK(rsearch("foo[0-9]+", s, 13, &b, &e) == 1 && b == 5 && e == 10);
+	CHECK(rsearch("foo[0-9]+", s, 3, &b, &e) == 0);
+	CHECK(rsearch("^f", "af\nfa", 5, &b, &e) == 1 && b == 3);
+	CHECK(rsearch("a$", "ab", 1, &b, &e) == 0);
+}
+
+static void test_syntax_errors(void)
+{
+	const char *bad[] = { "(ab", "ab)", "[ab", "*a", "a{3,1}", "\\",
+	                      "a\\b", "[[:nope:]]", "[z-a]", "a{300}" };
+	size_t i;
+	int b, e;
+
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+		CHECK(search(bad[i], 0, "", 0, &b, &e) == -1);
+	CHECK(search("a|", 0, "b", 0, &b, &e) == 1 && b == 0 && e == 0);
+}
+
+/* The literal prefix must only skip text, never change the result. */
+static void test_prefilter(void)
+{
+	char hay[8192];
+	int b, e;
+
+	memset(hay, 'x', sizeof(hay) - 1);
+	hay[sizeof(hay) - 1] = '\0';
+	memcpy(hay + 7000, "abc123", 6);
+	memcpy(hay + 500, "abcx", 4);
+
+	CHECK(search("abc[0-9]+", 0, hay, 0, &b, &e) == 1 && b == 7000 && e == 7006);
+	CHECK(search("ABC[0-9]", 1, hay, 0, &b, &e) == 1 && b == 7000);
+	CHECK(search("^abc", 0, "abc\nxabc\nabc", 1, &b, &e) == 1 && b == 9);
+}
+
+/* (a*)*b against a run of a's with no b sends a backtracking matcher
+ * exponential; here it is one pass per direction. */
+static void test_pathological(void)
+{
+	static char hay[100001];
+	unsigned seed = 1;
+	int i, b, e;
+
+	memset(hay, 'a', sizeof(hay) - 1);
+	CHECK(search("(a*)*b", 0, hay, 0, &b, &e) == 0);
+	CHECK(search("(a|aa)+$", 0, hay, 0, &b, &e) == 1 && b == 0 && e == 100000);
+	CHECK(search("(x+x+)+y", 0, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 0, &b, &e) == 0);
+
+	/* Random a/b text drives "an a twelve back" through thousands of
+	 * distinct states, more than the DFA cache holds. */
+	for (i = 0; i < 50000; i++) {
+		seed = seed * 1103515245 + 12345;
+		hay[i] = (seed >> 16) & 1 ? 'a' : 'b';
+	}
+	memcpy(hay + 50000, "abbbbbbbbbbbc", 14);
+	CHECK(search("[ab]*a[ab]{11}c", 0, hay, 0, &b, &e) == 1 && b == 0 && e == 50013);
+	CHECK(search("a[ab]{11}c", 0, hay, 0, &b, &e) == 1 && b == 50000 && e == 50013);
+}
+
+int main(void)
+{
+	RUN(test_literals_and_classes);
+	RUN(test_repeats);
+	RUN(test_leftmost_first);
+	RUN(test_anchors);
+	RUN(test_multiline);
+	RUN(test_fold);
+	RUN(test_utf8);
+	RUN(test_rsearch);
+	RUN(test_syntax_errors);
+	RUN(test_prefilter);
+	RUN(test_pathological);
+	return test_summary();
+}
@@ -3,22 +3,60 @@
  * These exercise shell_run() directly: fork/exec/pipe plumbing and the
  * concurrent non-blocking I/O pump.  The interactive editor wrappers
  * (editor_shell_command / editor_shell_command_on_region) need a PTY
- * and are exercised by hand. */
+ * and are exercised by hand.  The async command is driven through its
+ * idle-loop poll, with the buffer side stubbed to collect the output. */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "test.h"
 #include "../src/def.h"
 
-/* The test exercises shell_run() only; the editor wrappers it calls below
- * are linked in via the full object set, so we stub the one symbol the
- * shared no-yank stubs file does not provide. */
+/* The editor wrappers are linked in via the full object set, so we stub
+ * the symbols the shared no-yank stubs file does not provide.  The prompt
+ * answers with next_cmd, and the async output lands in `output`. */
+static const char *next_cmd;
+static struct abuf output;
+
 int editor_read_line(int fd, const char *prompt, char *buf, int bufsize)
 {
-	(void)fd; (void)prompt; (void)bufsize;
-	buf[0] = '\0';
-	return -1;
+	(void)fd; (void)prompt;
+	if (!next_cmd) {
+		buf[0] = '\0';
+		return -1;
+	}
+	snprintf(buf, bufsize, "%s", next_cmd);
+	return 0;
+}
+
+int  editor_read_key(int fd) { (void)fd; return 'y'; }
+void editor_refresh_screen(void) {}
+
+void ab_append(struct abuf *ab, const char *s, int len)
+{
+	char *p = realloc(ab->b, ab->len + len);
+
+	if (!p) return;
+	memcpy(p + ab->len, s, len);
+	ab->b = p;
+	ab->len += len;
+}
+
+void ab_free(struct abuf *ab) { free(ab->b); }
+
+void buf_open_special(const char *name, struct editor_syntax *syn,
+                      void (*populate)(void), const char *status)
+{
+	(void)name; (void)status;
+	free_all_rows();
+	populate();
+	editor.syntax = syn;
+}
+
+void editor_append_output(const char *s, size_t len)
+{
+	ab_append(&output, s, len);
 }
 
 /* Capture a child's stdout from a simple command with no stdin. */
@@ -100,6 +138,176 @@ static void test_shell_run_command_not_found(void)
 	free(out);
 }
 
+/* ---- Region filter ---- */
+
+static void filter_setup(void)
+{
+	free_all_rows();
+	undo_free();
+	undo_init();
+	editor.syntax = NULL;
+	editor.rowoff = editor.coloff = 0;
+	editor_insert_row(0, "head c", 6);
+	editor_insert_row(1, "b", 1);
+	editor_insert_row(2, "a tail", 6);
+	editor_insert_row(3, "", 0);
+}
+
+static char *filter_rows(void)
+{
+	int len;
+
+	return editor_rows_to_string(editor.row, editor.numrows, &len);
+}
+
+/* The region from "c" to "a" is sorted in place, the text around it on
+ * its first and last rows kept, and one undo brings it all back. */
+static void test_filter_region(void)
+{
+	char *s;
+
+	filter_setup();
+	editor.mark_set = 1;
+	editor.mark_row = 0;
+	editor.mark_col = 5;
+	editor.cy = 2;
+	editor.cx = 1;
+	next_cmd = "sort";
+	editor_shell_command_on_region(0);
+	next_cmd = NULL;
+
+	s = filter_rows();
+	CHECK(!strcmp(s, "head a\nb\nc\n tail\n"));
+	free(s);
+	CHECK(editor.rowoff + editor.cy == 3 && editor.coloff + editor.cx == 0);
+
+	editor_undo();
+	s = filter_rows();
+	CHECK(!strcmp(s, "head c\nb\na tail\n"));
+	free(s);
+	CHECK(undostack.size == 0);
+	free_all_rows();
+}
+
+/* Output well past the first chunks lands in rows intact. */
+static void test_filter_large_output(void)
+{
+	int i, ok = 1;
+
+	filter_setup();
+	editor.mark_set = 1;
+	editor.mark_row = 0;
+	editor.mark_col = 0;
+	editor.cy = 3;
+	editor.cx = 0;
+	next_cmd = "seq 1 200000";
+	editor_shell_command_on_region(0);
+	next_cmd = NULL;
+
+	CHECK(editor.numrows == 200001);
+	for (i = 0; i < 200000 && ok; i++)
+		ok = atoi(editor.row[i].chars) == i + 1 &&
+		     editor.row[i].idx == i;
+	CHECK(ok);
+	CHECK(editor.row[200000].size == 0);
+	free_all_rows();
+}
+
+/* A failing command leaves the region alone. */
+static void test_filter_failure(void)
+{
+	char *s;
+
+	filter_setup();
+	editor.mark_set = 1;
+	editor.mark_row = 0;
+	editor.mark_col = 0;
+	editor.cy = 2;
+	editor.cx = 6;
+	next_cmd = "cat >/dev/null; echo junk; exit 3";
+	editor_shell_command_on_region(0);
+	next_cmd = NULL;
+
+	s = filter_rows();
+	CHECK(!strcmp(s, "head c\nb\na tail\n"));
+	free(s);
+	CHECK(undostack.size == 0);
+	free_all_rows();
+}
+
+/* ---- Async shell command ---- */
+
+static void async_start(const char *cmd)
+{
+	ab_free(&output);
+	output.b   = NULL;
+	output.len = 0;
+	next_cmd = cmd;
+	editor_async_shell_command(0);
+	next_cmd = NULL;
+}
+
+/* Poll as the idle loop would until the command is reaped and its
+ * output is in, or until the output starts with `until` when that is
+ * given.  Returns
+ * the seconds it took, 99 on timeout. */
+static int async_run(const char *until)
+{
+	time_t start = time(NULL);
+	struct timespec ts = { 0, 10 * 1000 * 1000 };
+
+	while (time(NULL) - start < 10) {
+		shell_async_poll();
+		if (until ? output.len >= (int)strlen(until) &&
+		            !memcmp(output.b, until, strlen(until))
+		          : !shell_async_running() && shell_async_fd() < 0)
+			return time(NULL) - start;
+		nanosleep(&ts, NULL);
+	}
+	return 99;
+}
+
+/* Output, stderr included, arrives in order and the child is reaped. */
+static void test_async_output(void)
+{
+	async_start("printf 'one\\ntwo'; echo err >&2");
+	CHECK(shell_async_running() || shell_async_fd() >= 0);
+	CHECK(async_run(NULL) < 10);
+	shell_async_poll();
+	CHECK(output.len == 11);
+	CHECK(output.b && !memcmp(output.b, "one\ntwoerr\n", 11));
+	CHECK(!shell_async_running());
+	shell_async_stop();
+	free_all_rows();
+}
+
+/* C-g takes down the whole process group: the sleep too, which holds
+ * the output pipe open and would otherwise keep us waiting. */
+static void test_async_interrupt(void)
+{
+	async_start("echo start; sleep 30; echo end");
+	CHECK(async_run("start") < 10);
+	CHECK(shell_async_interrupt() == 1);
+	CHECK(async_run(NULL) < 5);
+	CHECK(!shell_async_running());
+	CHECK(output.len == 6);
+	CHECK(shell_async_interrupt() == 0);
+	shell_async_stop();
+	free_all_rows();
+}
+
+/* Killing the output buffer kills the command. */
+static void test_async_buffer_killed(void)
+{
+	async_start("sleep 30");
+	CHECK(shell_async_running());
+	editor.syntax = NULL;       /* another buffer; no slot holds ours */
+	shell_async_poll();
+	CHECK(!shell_async_running());
+	CHECK(shell_async_fd() < 0);
+	free_all_rows();
+}
+
 /* ---- Main ---- */
 
 int main(void)
@@ -109,5 +317,11 @@ int main(void)
 	RUN(test_shell_run_large_output);
 	RUN(test_shell_run_pump_no_deadlock);
 	RUN(test_shell_run_command_not_found);
+	RUN(test_filter_region);
+	RUN(test_filter_large_output);
+	RUN(test_filter_failure);
+	RUN(test_async_output);
+	RUN(test_async_interrupt);
+	RUN(test_async_buffer_killed);
 	return test_summary();
 }
@@ -0,0 +1,144 @@
+/* test_trigram.c — tests for the block trigram index in trigram.c.
+ *
+ * Checks that a built index never skips the block holding a match, with
+ * or without case differences, that it does skip most blocks for a query
+ * found in only one of them, that it is ignored until complete, and that
+ * editing the buffer drops it. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../src/def.h"
+
+#define NROWS  20000
+#define TARGET 15000
+
+static void fill_rows(void)
+{
+	char line[64];
+	int i, len;
+
+	for (i = 0; i < NROWS; i++) {
+		len = snprintf(line, sizeof(line), "%s row %d of the filler text",
+		               i == TARGET ? "the Needle in" : "plain", i);
+		editor_insert_row(editor.numrows, line, len);
+	}
+}
+
+static struct trigram_index *build(void)
+{
+	struct trigram_index *ix = trigram_new(editor.row, editor.numrows);
+
+	while (ix && !trigram_build_step(ix, editor.row, 0))
+		;
+	return ix;
+}
+
+/* Rows a forward scan from row 0 actually looks at, and whether row
+ * TARGET is among them. */
+static int visited(const struct trigram_index *ix, const char *query, int *hit)
+{
+	struct trigram_query q;
+	int r = 0, n = 0;
+
+	trigram_query_init(&q, query, strlen(query));
+	*hit = 0;
+	while (r < editor.numrows) {
+		int skip = trigram_skip(ix, &q, r, 1);
+
+		if (skip) {
+			r += skip;
+			continue;
+		}
+		if (r == TARGET)
+			*hit = 1;
+		n++;
+		r++;
+	}
+	return n;
+}
+
+static void test_skips_blocks(void)
+{
+	struct trigram_index *ix;
+	int hit, n;
+
+	fill_rows();
+	ix = build();
+	CHECK(ix != NULL);
+
+	n = visited(ix, "Needle", &hit);
+	CHECK(hit);
+	CHECK(n < NROWS / 10);
+	n = visited(ix, "NEEDLE", &hit);
+	CHECK(hit);
+
+	/* Absent from the text, so every block goes. */
+	n = visited(ix, "xyzzy", &hit);
+	CHECK(n == 0);
+
+	/* Too short to have a trigram: nothing is skipped. */
+	n = visited(ix, "ab", &hit);
+	CHECK(n == NROWS);
+
+	trigram_free(ix);
+	free_all_rows();
+	memset(&editor, 0, sizeof(editor));
+}
+
+static void test_backward(void)
+{
+	struct trigram_index *ix;
+	struct trigram_query q;
+	int r = NROWS - 1, hit = 0;
+
+	fill_rows();
+	ix = build();
+	trigram_query_init(&q, "needle", 6);
+	while (r >= 0) {
+		int skip = trigram_skip(ix, &q, r, -1);
+
+		if (skip) {
+			r -= skip;
+			continue;
+		}
+		if (r == TARGET)
+			hit = 1;
+		r--;
+	}
+	CHECK(hit);
+	trigram_free(ix);
+	free_all_rows();
+	memset(&editor, 0, sizeof(editor));
+}
+
+static void test_incomplete_and_dropped(void)
+{
+	struct trigram_index *ix;
+	struct trigram_query q;
+
+	fill_rows();
+	ix = trigram_new(editor.row, editor.numrows);
+	trigram_query_init(&q, "xyzzy", 5);
+	CHECK(trigram_skip(ix, &q, 0, 1) == 0);
+
+	while (!trigram_build_step(ix, editor.row, 0))
+		;
+	CHECK(trigram_skip(ix, &q, 0, 1) > 0);
+
+	/* buffer.c frees the current buffer's index on any change. */
+	editor.index = ix;
+	editor_insert_row(0, "xyzzy", 5);
+	CHECK(editor.index == NULL);
+
+	free_all_rows();
+	memset(&editor, 0, sizeof(editor));
+}
+
+int main(void)
+{
+	RUN(test_skips_blocks);
+	RUN(test_backward);
+	RUN(test_incomplete_and_dropped);
+	return test_summary();
+}
@@ -144,8 +144,8 @@ static void test_join_line(void)
 
 	/* Perform join: "hello" + " " + "world" = "hello world"
 	 * (leading whitespace stripped from row[1], space inserted at join point) */
-	newchars = realloc(editor.row[0].chars, 12);
-	editor.row[0].chars     = newchars;
+	newchars = editor_row_resize(&editor.row[0], 12);
+	CHECK(newchars != NULL);
 	editor.row[0].chars[5]  = ' ';
 	memcpy(editor.row[0].chars + 6, "world", 5);
 	editor.row[0].size      = 11;
@@ -229,6 +229,54 @@ static void test_reflow_para(void)
 	teardown();
 }
 
+/* A row-range record restores each row in place: the rows keep their
+ * slots, rows added after the record are trimmed, and rows outside the
+ * range are left alone. */
+static void test_rect_overwrite_in_place(void)
+{
+	setup();
+	editor_insert_row(0, "keep", 4);
+	editor_insert_row(1, "new one", 7);
+	editor_insert_row(2, "new two", 7);
+
+	/* As replace-all pushes it: rows 1..2, three rows at the time */
+	undo_push(UNDO_RECT_OVERWRITE, 1, 0, 3, "old one\nold two", 15);
+	editor_insert_row(3, "appended", 8);
+
+	editor_undo();
+
+	CHECK(editor.numrows == 3);
+	CHECK(editor.row[0].size == 4 && memcmp(editor.row[0].chars, "keep", 4) == 0);
+	CHECK(editor.row[1].size == 7 && memcmp(editor.row[1].chars, "old one", 7) == 0);
+	CHECK(editor.row[2].size == 7 && memcmp(editor.row[2].chars, "old two", 7) == 0);
+	CHECK(editor.row[2].idx == 2);
+	teardown();
+}
+
+/* A filtered region is undone by swapping the original rows back for the
+ * output rows, empty ones included, leaving the rows around them be. */
+static void test_replace_rows(void)
+{
+	setup();
+	editor_insert_row(0, "keep", 4);
+	editor_insert_row(1, "out", 3);
+	editor_insert_row(2, "tail", 4);
+
+	/* As M-| pushes it: row 1, column 2, one output row */
+	undo_push(UNDO_REPLACE_ROWS, 1, 2, 1, "old one\n\nold three", 18);
+
+	editor_undo();
+
+	CHECK(editor.numrows == 5);
+	CHECK(!strcmp(editor.row[0].chars, "keep"));
+	CHECK(!strcmp(editor.row[1].chars, "old one"));
+	CHECK(editor.row[2].size == 0 && editor.row[2].chars[0] == '\0');
+	CHECK(!strcmp(editor.row[3].chars, "old three"));
+	CHECK(!strcmp(editor.row[4].chars, "tail") && editor.row[4].idx == 4);
+	CHECK(editor.rowoff + editor.cy == 1 && editor.coloff + editor.cx == 2);
+	teardown();
+}
+
 /* Undoing back to the saved state (clean_size) clears the dirty flag. */
 static void test_dirty_tracking(void)
 {
@@ -252,6 +300,26 @@ static void test_dirty_tracking(void)
 	teardown();
 }
 
+/* seq tells edits apart even when the stack is back at the same size,
+ * which is how a finished background save knows it saw the latest text. */
+static void test_seq(void)
+{
+	unsigned long seq;
+
+	setup();
+	editor_insert_row(0, "hi", 2);
+	seq = undostack.seq;
+
+	editor_insert_char('!');
+	CHECK(undostack.seq != seq);
+	seq = undostack.seq;
+	editor_undo();
+	CHECK(undostack.seq != seq);
+	editor_insert_char('!');
+	CHECK(undostack.seq != seq);
+	teardown();
+}
+
 /* Undoing on an empty stack is a safe no-op. */
 static void test_nothing_to_undo(void)
 {
@@ -306,7 +374,10 @@ int main(void)
 	RUN(test_kill_line);
 	RUN(test_yank_text);
 	RUN(test_reflow_para);
+	RUN(test_rect_overwrite_in_place);
+	RUN(test_replace_rows);
 	RUN(test_dirty_tracking);
+	RUN(test_seq);
 	RUN(test_nothing_to_undo);
 	RUN(test_word_case_two_records);
 	return test_summary();
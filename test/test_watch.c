@@ -0,0 +1,172 @@
+/* test_watch.c — tests for the file change watcher in watch.c.
+ *
+ * Watches files in a scratch directory under /tmp from a few buffer
+ * slots, changes them the ways editors and tools do (write in place,
+ * rename a new file over the old one, delete), and checks that exactly
+ * the slots concerned are flagged, also through a symlink to another
+ * directory.  Where the platform has no change
+ * notification, only checks that watch_set() says so. */
+
+#define _DEFAULT_SOURCE   /* for mkdtemp under -std=c99 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include "test.h"
+#include "../src/def.h"
+
+static char scratch[256];
+static char changed[64];
+
+static const char *path(const char *name)
+{
+	static char buf[4][512];
+	static int n;
+
+	n = (n + 1) % 4;
+	snprintf(buf[n], sizeof(buf[n]), "%s/%s", scratch, name);
+	return buf[n];
+}
+
+static void put(const char *name, const char *text)
+{
+	FILE *fp = fopen(path(name), "w");
+
+	if (fp) {
+		fputs(text, fp);
+		fclose(fp);
+	}
+}
+
+/* Wait briefly for notifications to come in, then collect them. */
+static int collect(void)
+{
+	struct pollfd p;
+
+	p.fd      = watch_fd();
+	p.events  = POLLIN;
+	p.revents = 0;
+	poll(&p, 1, 200);
+	return watch_read(changed, (int)sizeof(changed));
+}
+
+static void setup(void)
+{
+	char tmpl[] = "/tmp/kg-watch-XXXXXX";
+	const char *p = mkdtemp(tmpl);
+
+	CHECK(p != NULL);
+	snprintf(scratch, sizeof(scratch), "%s", p);
+	put("a.txt", "a\n");
+	put("b.txt", "b\n");
+	put("other", "x\n");
+}
+
+/* A write in place flags the slot of the file written, not its neighbour. */
+static void test_write_in_place(void)
+{
+	CHECK(watch_set(0, path("a.txt")) == 0);
+	CHECK(watch_set(1, path("b.txt")) == 0);
+	CHECK(collect() == 0);
+
+	put("a.txt", "changed\n");
+	CHECK(collect() == 1);
+	CHECK(changed[0] && !changed[1]);
+}
+
+/* Saving through a temporary file renamed over the original. */
+static void test_rename_over(void)
+{
+	put("b.txt~new", "renamed\n");
+	rename(path("b.txt~new"), path("b.txt"));
+	CHECK(collect() == 1);
+	CHECK(!changed[0] && changed[1]);
+}
+
+/* Other files in the same directory are none of our business. */
+static void test_unrelated_file(void)
+{
+	put("other", "y\n");
+	CHECK(collect() == 0);
+}
+
+/* Setting the same path again is a no-op; clearing one slot keeps the
+ * directory watched for the other. */
+static void test_stop_watching(void)
+{
+	CHECK(watch_set(0, path("a.txt")) == 0);
+	CHECK(watch_set(0, NULL) == 0);
+	put("a.txt", "again\n");
+	put("b.txt", "again\n");
+	CHECK(collect() == 1);
+	CHECK(!changed[0] && changed[1]);
+}
+
+/* The slot table grows to fit whatever slot is asked for. */
+static void test_high_slot(void)
+{
+	CHECK(watch_set(40, path("other")) == 0);
+	put("other", "z\n");
+	CHECK(collect() == 1);
+	CHECK(changed[40] && !changed[1]);
+	CHECK(watch_set(40, NULL) == 0);
+}
+
+/* A symlink is watched where it points: saving the file it names, in
+ * another directory, flags the slot. */
+static void test_symlink(void)
+{
+	mkdir(path("sub"), 0700);
+	put("sub/target", "t\n");
+	CHECK(symlink("sub/target", path("link")) == 0);
+	CHECK(watch_set(2, path("link")) == 0);
+	CHECK(collect() == 0);
+
+	put("sub/target~new", "saved\n");
+	rename(path("sub/target~new"), path("sub/target"));
+	CHECK(collect() == 1);
+	CHECK(changed[2] && !changed[0] && !changed[1]);
+
+	CHECK(watch_set(2, NULL) == 0);
+	unlink(path("link"));
+	unlink(path("sub/target"));
+	rmdir(path("sub"));
+	collect();
+}
+
+/* Deleting the file flags it; deleting the directory flags it too, and
+ * the file can't be watched anymore. */
+static void test_delete(void)
+{
+	unlink(path("b.txt"));
+	CHECK(collect() == 1);
+	CHECK(changed[1]);
+
+	unlink(path("a.txt"));
+	unlink(path("other"));
+	rmdir(scratch);
+	collect();
+	CHECK(changed[1]);
+	CHECK(watch_set(1, path("b.txt")) == -1);
+	CHECK(watch_set(1, NULL) == 0);
+}
+
+int main(void)
+{
+	if (watch_fd() < 0) {
+		CHECK(watch_set(0, "/tmp/x") == -1);
+		return test_summary();
+	}
+	setup();
+	RUN(test_write_in_place);
+	RUN(test_rename_over);
+	RUN(test_unrelated_file);
+	RUN(test_stop_watching);
+	RUN(test_high_slot);
+	RUN(test_symlink);
+	RUN(test_delete);
+	return test_summary();
+}
@@ -13,7 +13,9 @@ struct editor_config editor;
 int running       = 1;
 int suppress_undo = 0;
 
-struct editor_buffer buflist[MAX_BUFFERS];
+static struct editor_buffer slots[4];
+struct editor_buffer *buflist = slots;
+int buf_slots = 4;
 int buf_current = 0;
 int buf_count   = 0;
 
@@ -21,14 +23,14 @@ struct undo_stack undostack;
 
 void editor_set_status_message(const char *fmt, ...) { (void)fmt; }
 void buf_save_current_state(void) {}
-void editor_free_row(erow *row) { (void)row; }   /* for test.c, unused here */
+void editor_free_rows(void) {}   /* for test.c, unused here */
 
 /* ---- Helpers ---- */
 
 static void setup(void)
 {
 	memset(&editor, 0, sizeof(editor));
-	memset(buflist, 0, sizeof(buflist));
+	memset(slots, 0, sizeof(slots));
 	buflist[0].active = 1;
 	win_total_rows = 24;
 	win_total_cols = 80;
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Generate src/width.h, the two-level code point width table.
+
+Usage: utils/mkwidth.py > src/width.h
+
+Widths come from the Unicode database bundled with python3: East Asian
+Wide and Fullwidth characters take two columns, combining marks and
+format characters take none, everything else takes one.  The table is
+split into 256-code-point blocks; identical blocks are shared, so the
+whole of Unicode fits in a few kilobytes.  Each block packs four 2-bit
+widths per byte.
+
+Rerun when moving to a newer Unicode release; the build itself does not
+need python.
+"""
+
+import sys
+import unicodedata
+
+MAXCP = 0x110000
+BLOCK = 256
+
+# Ranges reserved for ideographs are wide even where still unassigned,
+# per the defaults in EastAsianWidth.txt.
+WIDE_DEFAULT = [
+	(0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF),
+	(0x20000, 0x2FFFD), (0x30000, 0x3FFFD),
+]
+
+
+def width(cp):
+	c = chr(cp)
+	cat = unicodedata.category(c)
+
+	if cp == 0x00AD:                        # soft hyphen shows as '-'
+		return 1
+	if cat in ("Mn", "Me", "Cf"):
+		return 0
+	if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+		return 0                        # Hangul medial/final jamo
+	if cp == 0x200B:
+		return 0
+	if unicodedata.east_asian_width(c) in ("W", "F"):
+		return 2
+	for lo, hi in WIDE_DEFAULT:
+		if lo <= cp <= hi:
+			return 2
+	return 1
+
+
+def main():
+	blocks = []
+	index = {}
+	stage1 = []
+
+	for base in range(0, MAXCP, BLOCK):
+		packed = bytearray(BLOCK // 4)
+		for i in range(BLOCK):
+			packed[i >> 2] |= width(base + i) << ((i & 3) * 2)
+		key = bytes(packed)
+		if key not in index:
+			index[key] = len(blocks)
+			blocks.append(key)
+		stage1.append(index[key])
+
+	if len(blocks) > 256:
+		sys.exit("mkwidth: too many distinct blocks for a byte index")
+
+	out = sys.stdout
+	out.write("/* Generated by utils/mkwidth.py from Unicode %s -- do not edit.\n"
+		  " *\n"
+		  " * utf8_width_stage1[cp >> 8] selects a 64-byte block in\n"
+		  " * utf8_width_stage2; the width of cp is the 2-bit field\n"
+		  " * (cp & 3) * 2 of byte (cp & 0xff) >> 2 in that block. */\n\n"
+		  % unicodedata.unidata_version)
+
+	out.write("static const unsigned char utf8_width_stage1[%d] = {\n" % len(stage1))
+	for i in range(0, len(stage1), 16):
+		out.write("\t" + ",".join("%d" % v for v in stage1[i:i + 16]) + ",\n")
+	out.write("};\n\n")
+
+	out.write("static const unsigned char utf8_width_stage2[%d][%d] = {\n"
+		  % (len(blocks), BLOCK // 4))
+	for blk in blocks:
+		out.write("\t{\n")
+		for i in range(0, len(blk), 16):
+			out.write("\t\t" + ",".join("0x%02x" % v for v in blk[i:i + 16]) + ",\n")
+		out.write("\t},\n")
+	out.write("};\n")
+
+
+if __name__ == "__main__":
+	main()
@@ -104,6 +104,9 @@ def token_to_bytes(token: str) -> bytes:
 	if upper == "S-END":
 		return b"\x1b[1;2F"
 
+	if upper.startswith("C-M-") and len(token) == 5:
+		return b"\x1b" + ctrl_byte(token[4])
+
 	if len(token) >= 3 and token[1] == "-":
 		prefix = token[0].upper()
 		payload = token[2:]
@@ -190,6 +193,9 @@ def tmux_key_name(token: str) -> tuple[str, str]:
 	if upper == "S-END":
 		return ("key", "S-End")
 
+	if upper.startswith("C-M-") and len(token) == 5:
+		return ("key", f"C-M-{token[4]}")
+
 	if len(token) >= 3 and token[1] == "-":
 		prefix = token[0].upper()
 		payload = token[2:]